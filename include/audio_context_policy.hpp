@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct AudioContextConfig {
+    // Encoder context sizes short clips are rounded up to, ascending; 1500 is Whisper's full 30s.
+    // Empty = always the full context.
+    std::vector<int> buckets{256, 512, 768};
+    // Audio a bucket must hold beyond the clip itself
+    size_t margin_samples = 16000;
+    // Also decode every Nth reduced-context clip with the full context and compare (0 = never)
+    uint64_t audit_every = 0;
+
+    static AudioContextConfig fromEnvironment();
+};
+
+/**
+ * Picks the encoder context (`audio_ctx`) for a clip. Whisper's encoder costs the
+ * same for any clip of up to 30 seconds unless its context is cut down, so short
+ * clips are encoded with the smallest bucket that holds them with a margin. Few
+ * buckets keep the compute graphs Whisper builds per size few.
+ *
+ * Counts decodes, full-context fallbacks and time per bucket, and optionally how
+ * far the text of sampled clips differs from a full-context decode, to tune the
+ * buckets and margin by.
+ */
+class AudioContextPolicy {
+public:
+    struct BucketMetrics {
+        int audio_ctx = 0;              // 1500 = full context
+        uint64_t decodes = 0;
+        uint64_t fallbacks = 0;         // Decoded again with the full context
+        uint64_t decode_ms = 0;         // Fallbacks included
+        uint64_t audio_ms = 0;
+        uint64_t audits = 0;
+        uint64_t audit_words = 0;       // Words of the full-context transcripts
+        uint64_t audit_word_errors = 0; // Word edits from the reduced-context ones to those
+    };
+
+    // Audio per encoder frame; 1500 frames make Whisper's 30s
+    static constexpr size_t SAMPLES_PER_CTX = 320;
+
+    explicit AudioContextPolicy(const AudioContextConfig& config);
+
+    // @return The context to encode `samples` with, or 0 for the full one
+    int select(size_t samples) const;
+    // @return Whether this reduced-context decode should be audited
+    bool shouldAudit();
+
+    void record(int audio_ctx, size_t samples, std::chrono::milliseconds elapsed, bool fell_back);
+    void recordAudit(int audio_ctx, const std::string& reduced_text, const std::string& full_text);
+
+    std::vector<BucketMetrics> metrics() const;
+
+private:
+    BucketMetrics& bucketLocked(int audio_ctx);
+
+    const AudioContextConfig config;
+    std::atomic<uint64_t> reduced_decodes{0};
+
+    mutable std::mutex mutex;
+    std::vector<BucketMetrics> stats;   // One per bucket, then the full context
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Fixed-size blocks of 16kHz mono int16 samples, shared by all stream sessions.
+ * Released blocks are kept for reuse up to `max_idle_blocks` and handed back to
+ * the allocator beyond that, so memory goes down again after a burst.
+ */
+class AudioBlockPool {
+public:
+    static constexpr size_t BLOCK_SAMPLES = 16000;     // One second
+    static constexpr size_t BLOCK_BYTES = BLOCK_SAMPLES * sizeof(int16_t);
+
+    struct Metrics {
+        uint64_t blocks_in_use = 0;
+        uint64_t blocks_idle = 0;
+        uint64_t allocations = 0;   // Blocks taken from the allocator rather than reused
+    };
+
+    explicit AudioBlockPool(size_t max_idle_blocks);
+    ~AudioBlockPool();
+
+    AudioBlockPool(const AudioBlockPool&) = delete;
+    AudioBlockPool& operator=(const AudioBlockPool&) = delete;
+
+    int16_t* acquire();
+    void release(int16_t* block);
+
+    uint64_t bytesInUse() const { return in_use.load(std::memory_order_relaxed) * BLOCK_BYTES; }
+    Metrics metrics() const;
+
+private:
+    const size_t max_idle;
+    mutable std::mutex mutex;
+    std::vector<int16_t*> idle;
+    std::atomic<uint64_t> in_use{0};
+    uint64_t allocations = 0;
+};
+
+/**
+ * Audio held as a sequence of pooled blocks, each owned by one rope. Appending
+ * never moves what is already stored, dropping from the front returns whole
+ * blocks to the pool, and joining two ropes moves full blocks by pointer. Every
+ * block but the first and the last is full.
+ */
+class AudioRope {
+public:
+    explicit AudioRope(std::shared_ptr<AudioBlockPool> pool);
+    ~AudioRope();
+
+    AudioRope(AudioRope&& other) noexcept;
+    AudioRope& operator=(AudioRope&& other) noexcept;
+    AudioRope(const AudioRope&) = delete;
+    AudioRope& operator=(const AudioRope&) = delete;
+
+    void append(const int16_t* samples, size_t count);
+    // Move all of `other`'s audio to the end of this rope, copying what does not fill whole blocks
+    void append(AudioRope&& other);
+    void dropFront(size_t count);
+    void clear();
+
+    size_t size() const { return total; }
+    bool empty() const { return total == 0; }
+
+    // Copy out as normalized floats, replacing `output`'s contents
+    void copyTo(std::vector<float>& output) const;
+
+private:
+    struct Piece {
+        int16_t* block;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    std::shared_ptr<AudioBlockPool> pool;
+    std::deque<Piece> pieces;
+    size_t total = 0;
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef DIGI_ELLIE_DISABLE_AUDIO_TAP
+#include "lockfree_queue.hpp"
+#endif
+
+namespace audio_utils {
+
+// Capture points along the transcription pipeline
+enum class TapStage {
+    Input,         // Raw request audio, 48kHz stereo 16-bit
+    WhisperInput   // Samples handed to whisper, 16kHz mono float
+};
+
+struct AudioTapConfig {
+    // Capture one in every N requests (0 disables sampling)
+    uint64_t sample_every = 0;
+    // Capture every request whose transcript comes back empty
+    bool on_empty_transcript = false;
+    // Directory the WAV files are written to
+    std::string directory = "audio_tap";
+    // Oldest captures are deleted once the directory exceeds this many bytes
+    uint64_t byte_budget = 256ull * 1024 * 1024;
+    // Captures waiting for the writer; more are dropped
+    size_t queue_capacity = 64;
+
+    bool enabled() const { return sample_every > 0 || on_empty_transcript; }
+
+    static AudioTapConfig fromEnvironment();
+};
+
+#ifndef DIGI_ELLIE_DISABLE_AUDIO_TAP
+
+/**
+ * Debug audio capture.
+ *
+ * A request opens a Capture, registers the buffers at each stage and commits it
+ * with the transcript. Registering only records a view of the caller's buffer;
+ * data is copied on commit, and only when the trigger policy selects the request.
+ * Selected captures are handed to a background writer through a lock-free queue,
+ * so the request thread never touches the disk.
+ */
+class AudioTap {
+    struct Clip {
+        TapStage stage;
+        int sample_rate;
+        int channels;
+        // View of the caller's buffer until commit, then owned copy
+        const uint8_t* pcm_view = nullptr;
+        const float* float_view = nullptr;
+        size_t count = 0;
+        std::vector<uint8_t> pcm;
+        std::vector<float> samples;
+    };
+
+    struct Batch {
+        uint64_t id;
+        const char* reason;
+        std::vector<Clip> clips;
+    };
+
+public:
+    class Capture {
+    public:
+        Capture() = default;
+        Capture(Capture&&) = default;
+        Capture& operator=(Capture&&) = default;
+
+        bool active() const { return tap != nullptr; }
+
+        void add(TapStage stage, const std::vector<uint8_t>& pcm, int sample_rate, int channels) {
+            if (!tap) return;
+            Clip clip;
+            clip.stage = stage;
+            clip.sample_rate = sample_rate;
+            clip.channels = channels;
+            clip.pcm_view = pcm.data();
+            clip.count = pcm.size();
+            clips.push_back(std::move(clip));
+        }
+
+        void add(TapStage stage, const std::vector<float>& samples, int sample_rate) {
+            add(stage, samples.data(), samples.size(), sample_rate);
+        }
+
+        void add(TapStage stage, const float* samples, size_t count, int sample_rate) {
+            if (!tap) return;
+            Clip clip;
+            clip.stage = stage;
+            clip.sample_rate = sample_rate;
+            clip.channels = 1;
+            clip.float_view = samples;
+            clip.count = count;
+            clips.push_back(std::move(clip));
+        }
+
+        /**
+         * Apply the trigger policy and queue the capture for writing.
+         * Registered buffers must still be alive when this is called.
+         */
+        void commit(const std::string& transcript);
+
+    private:
+        friend class AudioTap;
+        AudioTap* tap = nullptr;
+        uint64_t id = 0;
+        bool sampled = false;
+        std::vector<Clip> clips;
+    };
+
+    explicit AudioTap(AudioTapConfig config);
+    ~AudioTap();
+
+    AudioTap(const AudioTap&) = delete;
+    AudioTap& operator=(const AudioTap&) = delete;
+
+    /**
+     * Open a capture for one request. Inactive (and free) when tapping is disabled.
+     */
+    Capture begin();
+
+private:
+    void writerLoop();
+    void writeBatch(const Batch& batch);
+    void enforceBudget();
+    void loadExistingFiles();
+
+    AudioTapConfig config;
+    std::atomic<uint64_t> request_counter{0};
+    std::atomic<uint64_t> dropped{0};
+
+    lockfree::BoundedQueue<Batch*> queue;
+    std::atomic<uint32_t> pending{0};
+    std::atomic<bool> stopping{false};
+    std::thread writer;
+
+    // Writer thread only
+    struct WrittenFile {
+        std::string path;
+        uint64_t size;
+    };
+    std::vector<WrittenFile> written_files;
+    uint64_t written_bytes = 0;
+};
+
+#else
+
+// Audio tap compiled out: every call is an inline no-op
+class AudioTap {
+public:
+    class Capture {
+    public:
+        bool active() const { return false; }
+        void add(TapStage, const std::vector<uint8_t>&, int, int) {}
+        void add(TapStage, const std::vector<float>&, int) {}
+        void add(TapStage, const float*, size_t, int) {}
+        void commit(const std::string&) {}
+    };
+
+    explicit AudioTap(const AudioTapConfig&) {}
+    Capture begin() { return {}; }
+};
+
+#endif
+
+} // namespace audio_utils
@@ -29,12 +29,13 @@ bool savePCMToWav(const std::string& filename, const std::vector<uint8_t>& pcm_d
 bool saveFloatToWav(const std::string& filename, const std::vector<float>& samples, int sample_rate = 16000, int channels = 1);
 
 /**
- * Downsample 16-bit PCM audio from one sample rate to another
+ * Resample 16-bit mono PCM audio from one sample rate to another
+ * using an anti-aliased polyphase filter (see PolyphaseResampler)
  * 
  * @param input_data Input PCM audio data
  * @param input_sample_rate Input sample rate in Hz
  * @param output_sample_rate Output sample rate in Hz
- * @return Downsampled PCM audio data
+ * @return Resampled PCM audio data
  */
 std::vector<uint8_t> downsamplePCM(const std::vector<uint8_t>& input_data, int input_sample_rate, int output_sample_rate);
 
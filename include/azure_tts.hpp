@@ -4,6 +4,8 @@
 #include <vector>
 #include <memory>
 #include <cstdint>
+#include <functional>
+#include "cancellation.hpp"
 
 class AzureTTS {
 public:
@@ -13,6 +15,14 @@ public:
     // Convert text to speech and return raw PCM audio data (24kHz, 16-bit, mono)
     std::vector<uint8_t> textToSpeech(const std::string& text, const std::string& voice);
 
+    // Receives audio as it arrives; chunk boundaries may split a sample
+    using AudioChunkCallback = std::function<void(const uint8_t* data, size_t size)>;
+
+    // Convert text to speech, delivering the audio (24kHz, 16-bit, mono) chunk by chunk.
+    // Cancelling `cancel` aborts the request; audio delivered so far is kept.
+    void textToSpeechStream(const std::string& text, const std::string& voice, const AudioChunkCallback& on_audio,
+                            const CancellationToken& cancel = CancellationToken());
+
 private:
     std::string subscription_key;
     std::string region;
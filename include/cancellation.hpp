@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct CancellationState;
+
+/**
+ * Cancellation flag shared by every stage working on the same request.
+ *
+ * Copies share one state. Long-running work either polls cancelled() or registers
+ * a callback that interrupts it (e.g. stops an HTTP client) for as long as the
+ * returned Registration is alive.
+ */
+class CancellationToken {
+public:
+    class Registration {
+    public:
+        Registration() = default;
+        Registration(Registration&& other) noexcept : state(std::move(other.state)), id(other.id) {}
+        Registration& operator=(Registration&& other) noexcept {
+            reset();
+            state = std::move(other.state);
+            id = other.id;
+            return *this;
+        }
+        ~Registration() { reset(); }
+
+        Registration(const Registration&) = delete;
+        Registration& operator=(const Registration&) = delete;
+
+        /**
+         * Unregister; waits for the callback if it is running right now
+         */
+        void reset();
+
+    private:
+        friend class CancellationToken;
+        Registration(std::shared_ptr<CancellationState> state, uint64_t id) : state(std::move(state)), id(id) {}
+
+        std::shared_ptr<CancellationState> state;
+        uint64_t id = 0;
+    };
+
+    CancellationToken();
+
+    /**
+     * Cancel and run the registered callbacks; later calls do nothing
+     */
+    void cancel() const;
+    bool cancelled() const;
+
+    /**
+     * Run `callback` once the token is cancelled, or right away if it already is
+     */
+    [[nodiscard]] Registration onCancel(std::function<void()> callback) const;
+
+private:
+    std::shared_ptr<CancellationState> state;
+};
+
+struct CancellationState {
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::function<void()>> callbacks;
+    uint64_t next_id = 1;
+};
+
+inline void CancellationToken::Registration::reset() {
+    if (auto current = std::move(state)) {
+        std::lock_guard<std::mutex> lock(current->mutex);
+        current->callbacks.erase(id);
+    }
+}
+
+inline CancellationToken::CancellationToken() : state(std::make_shared<CancellationState>()) {}
+
+inline void CancellationToken::cancel() const {
+    if (state->cancelled.exchange(true)) {
+        return;
+    }
+    // Under the lock, so a Registration being reset waits for its callback
+    std::lock_guard<std::mutex> lock(state->mutex);
+    for (auto& [id, callback] : state->callbacks) {
+        callback();
+    }
+}
+
+inline bool CancellationToken::cancelled() const {
+    return state->cancelled.load(std::memory_order_acquire);
+}
+
+inline CancellationToken::Registration CancellationToken::onCancel(std::function<void()> callback) const {
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->cancelled.load()) {
+            uint64_t id = state->next_id++;
+            state->callbacks.emplace(id, std::move(callback));
+            return Registration(state, id);
+        }
+    }
+    callback();
+    return Registration();
+}
@@ -51,10 +51,107 @@ namespace config {
     const std::string AZURE_SPEECH_REGION = getEnvVar("DIGI_ELLIE_AZURE_SPEECH_REGION", "germanywestcentral");
     const std::string AZURE_SPEECH_VOICE = getEnvVar("DIGI_ELLIE_AZURE_SPEECH_VOICE", "en-US-JennyNeural");
 
+    // Voice activity detection on incoming voice audio
+    // Voiced audio needed before an utterance opens
+    const uint64_t VAD_MIN_VOICED_MS = getEnvVarUInt64("DIGI_ELLIE_VAD_MIN_VOICED_MS", 120);
+    // Unvoiced audio (or no audio at all) needed before an utterance ends
+    const uint64_t VAD_HANGOVER_MS = getEnvVarUInt64("DIGI_ELLIE_VAD_HANGOVER_MS", 500);
+    // Audio kept from before the first voiced frame
+    const uint64_t VAD_PRE_ROLL_MS = getEnvVarUInt64("DIGI_ELLIE_VAD_PRE_ROLL_MS", 200);
+
+    // End-of-turn timeout chosen per utterance from the transcript, the voice's energy and
+    // the speaker's own pauses (0 = always VAD_HANGOVER_MS)
+    const uint64_t ADAPTIVE_ENDPOINTING = getEnvVarUInt64("DIGI_ELLIE_ADAPTIVE_ENDPOINTING", 1);
+    const uint64_t ENDPOINT_MIN_MS = getEnvVarUInt64("DIGI_ELLIE_ENDPOINT_MIN_MS", 150);
+    const uint64_t ENDPOINT_MAX_MS = getEnvVarUInt64("DIGI_ELLIE_ENDPOINT_MAX_MS", 1200);
+
+    // Opus encoding of voice replies
+    const uint64_t OPUS_ENCODER_THREADS = getEnvVarUInt64("DIGI_ELLIE_OPUS_ENCODER_THREADS", 2);
+    const uint64_t OPUS_BITRATE = getEnvVarUInt64("DIGI_ELLIE_OPUS_BITRATE", 64000);
+
+    // Synthesized replies up to this many characters are cached as Opus packets (0 = no cache)
+    const uint64_t TTS_CACHE_MAX_CHARS = getEnvVarUInt64("DIGI_ELLIE_TTS_CACHE_MAX_CHARS", 80);
+    const uint64_t TTS_CACHE_MEMORY_MB = getEnvVarUInt64("DIGI_ELLIE_TTS_CACHE_MEMORY_MB", 16);
+    // Cached replies are kept on disk here across restarts (empty = memory only)
+    const std::string TTS_CACHE_DIR = getEnvVar("DIGI_ELLIE_TTS_CACHE_DIR", "tts_cache");
+    const uint64_t TTS_CACHE_DISK_MB = getEnvVarUInt64("DIGI_ELLIE_TTS_CACHE_DISK_MB", 64);
+
+    // Speakers of a guild finishing close together get one reply: a finished turn waits this
+    // long for others still talking (0 = answer every turn on its own)
+    const uint64_t TURN_COALESCE_MS = getEnvVarUInt64("DIGI_ELLIE_TURN_COALESCE_MS", 400);
+    // ...and this long for turns of others that are already being transcribed
+    const uint64_t TURN_COALESCE_MAX_WAIT_MS = getEnvVarUInt64("DIGI_ELLIE_TURN_COALESCE_MAX_WAIT_MS", 1500);
+    // Voice turns whose partial transcripts are waited for at once; each open wait holds a thread
+    const uint64_t MAX_STREAMING_TURNS = getEnvVarUInt64("DIGI_ELLIE_MAX_STREAMING_TURNS", 16);
+
+    // Voice users not heard from for this long give their receive buffer back to the shared pool
+    const uint64_t VOICE_USER_IDLE_S = getEnvVarUInt64("DIGI_ELLIE_VOICE_USER_IDLE_S", 60);
+
+    // Record every received voice packet to this file for offline replay (empty = off)
+    const std::string VOICE_RECORDING_FILE = getEnvVar("DIGI_ELLIE_VOICE_RECORDING_FILE", "");
+
+    // Speculative replies: start the LLM on the sentences a user has finished while they still talk.
+    // Off by default, since every guess that the final transcript disagrees with is wasted tokens.
+    const uint64_t SPECULATIVE_LLM = getEnvVarUInt64("DIGI_ELLIE_SPECULATIVE_LLM", 0);
+    // Partial transcripts in a row that must be fully committed without adding to it
+    const uint64_t SPECULATIVE_STABLE_PARTIALS = getEnvVarUInt64("DIGI_ELLIE_SPECULATIVE_STABLE_PARTIALS", 2);
+    const uint64_t SPECULATIVE_MIN_CHARS = getEnvVarUInt64("DIGI_ELLIE_SPECULATIVE_MIN_CHARS", 12);
+    const uint64_t SPECULATIVE_MAX_PER_TURN = getEnvVarUInt64("DIGI_ELLIE_SPECULATIVE_MAX_PER_TURN", 2);
+    // Longer speculative replies are thrown away and generated again once the user is done
+    const uint64_t SPECULATIVE_MAX_TOKENS = getEnvVarUInt64("DIGI_ELLIE_SPECULATIVE_MAX_TOKENS", 256);
+
     // Whisper STT Configuration
     const std::string WHISPER_MODEL_NAME = getEnvVar("DIGI_ELLIE_WHISPER_MODEL_NAME", "ggml-large-v3-turbo-q8_0.bin");
     
     // Whisper Service Configuration
     const std::string WHISPER_SERVICE_HOST = getEnvVar("DIGI_ELLIE_WHISPER_SERVICE_HOST", "0.0.0.0");
     const uint64_t WHISPER_SERVICE_PORT = getEnvVarUInt64("DIGI_ELLIE_WHISPER_SERVICE_PORT", 8000);
-} 
\ No newline at end of file
+    // Threads serving HTTP requests; waiting transcriptions and long-polls each hold one
+    const uint64_t WHISPER_HTTP_THREADS = getEnvVarUInt64("DIGI_ELLIE_WHISPER_HTTP_THREADS", 32);
+
+    // Concurrent transcription: decoding states share the loaded model
+    const uint64_t WHISPER_MAX_STATES = getEnvVarUInt64("DIGI_ELLIE_WHISPER_MAX_STATES", 4);
+    // No more states are created once they would exceed this much memory
+    const uint64_t WHISPER_STATE_MEMORY_MB = getEnvVarUInt64("DIGI_ELLIE_WHISPER_STATE_MEMORY_MB", 4096);
+    // Threads per decode (0 = the cores split evenly between the states)
+    const uint64_t WHISPER_THREADS_PER_STATE = getEnvVarUInt64("DIGI_ELLIE_WHISPER_THREADS_PER_STATE", 0);
+    // Pin each decode worker, and the threads its decodes start, to cores of its own (Linux only)
+    const uint64_t WHISPER_PIN_WORKERS = getEnvVarUInt64("DIGI_ELLIE_WHISPER_PIN_WORKERS", 0);
+    // Idle states are freed after this long, down to one
+    const uint64_t WHISPER_STATE_IDLE_S = getEnvVarUInt64("DIGI_ELLIE_WHISPER_STATE_IDLE_S", 120);
+    // Under load, short clips wait up to this long to share an encoder run (0 = never)
+    const uint64_t WHISPER_BATCH_WAIT_MS = getEnvVarUInt64("DIGI_ELLIE_WHISPER_BATCH_WAIT_MS", 40);
+    // Longer clips are always transcribed on their own
+    const uint64_t WHISPER_BATCH_MAX_CLIP_MS = getEnvVarUInt64("DIGI_ELLIE_WHISPER_BATCH_MAX_CLIP_MS", 8000);
+    // Short clips are encoded with the smallest of these encoder contexts that holds them (1500 = 30s)
+    const std::string WHISPER_AUDIO_CTX_BUCKETS = getEnvVar("DIGI_ELLIE_WHISPER_AUDIO_CTX_BUCKETS", "256,512,768");
+    // Audio a reduced context must hold beyond the clip
+    const uint64_t WHISPER_AUDIO_CTX_MARGIN_MS = getEnvVarUInt64("DIGI_ELLIE_WHISPER_AUDIO_CTX_MARGIN_MS", 1000);
+    // Every Nth reduced-context decode is repeated with the full context for comparison (0 = never)
+    const uint64_t WHISPER_AUDIO_CTX_AUDIT_EVERY = getEnvVarUInt64("DIGI_ELLIE_WHISPER_AUDIO_CTX_AUDIT_EVERY", 0);
+    // Silence around the speech in /transcribe clips is cut off, and clips without speech are not decoded
+    const uint64_t WHISPER_TRIM_SILENCE = getEnvVarUInt64("DIGI_ELLIE_WHISPER_TRIM_SILENCE", 1);
+    // Audio kept after the last voiced frame
+    const uint64_t WHISPER_TRIM_PAD_MS = getEnvVarUInt64("DIGI_ELLIE_WHISPER_TRIM_PAD_MS", 200);
+
+    // Streaming sessions: uncommitted audio needed before a partial is decoded
+    const uint64_t STREAM_MIN_WINDOW_MS = getEnvVarUInt64("DIGI_ELLIE_STREAM_MIN_WINDOW_MS", 1000);
+    // Audio not agreed on after this long is committed anyway
+    const uint64_t STREAM_MAX_WINDOW_MS = getEnvVarUInt64("DIGI_ELLIE_STREAM_MAX_WINDOW_MS", 20000);
+    // Committed text Whisper is prompted with when decoding the rest
+    const uint64_t STREAM_PROMPT_CHARS = getEnvVarUInt64("DIGI_ELLIE_STREAM_PROMPT_CHARS", 200);
+    // New streaming sessions are refused while the sessions' audio takes more than this
+    const uint64_t STREAM_MEMORY_MB = getEnvVarUInt64("DIGI_ELLIE_STREAM_MEMORY_MB", 256);
+    // Audio one streaming session may take; longer streams get their later chunks refused
+    const uint64_t STREAM_MAX_SESSION_S = getEnvVarUInt64("DIGI_ELLIE_STREAM_MAX_SESSION_S", 150);
+    // Sessions without a request for this long are dropped
+    const uint64_t STREAM_SESSION_TTL_S = getEnvVarUInt64("DIGI_ELLIE_STREAM_SESSION_TTL_S", 60);
+
+    // Debug audio capture in the Whisper service (off unless one of the triggers is set)
+    // Capture one in every N transcription requests (0 = never)
+    const uint64_t AUDIO_TAP_SAMPLE_EVERY = getEnvVarUInt64("DIGI_ELLIE_AUDIO_TAP_SAMPLE_EVERY", 0);
+    // Capture requests that produce an empty transcript (0 = off, 1 = on)
+    const uint64_t AUDIO_TAP_ON_EMPTY = getEnvVarUInt64("DIGI_ELLIE_AUDIO_TAP_ON_EMPTY", 0);
+    const std::string AUDIO_TAP_DIR = getEnvVar("DIGI_ELLIE_AUDIO_TAP_DIR", "audio_tap");
+    const uint64_t AUDIO_TAP_BUDGET_MB = getEnvVarUInt64("DIGI_ELLIE_AUDIO_TAP_BUDGET_MB", 256);
+}
\ No newline at end of file
@@ -1,8 +1,21 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 
 void initializeConversation();
 std::string buildPrompt(const std::string& userInput, const std::string& userName);
+// One user message holding several speakers' lines, as {name, text} pairs in order
+std::string buildPrompt(const std::vector<std::pair<std::string, std::string>>& speakerLines);
+// The prompt buildPrompt would return, without adding the message to the history.
+// `version` identifies the history it was forked from.
+std::string forkPrompt(const std::string& userInput, const std::string& userName, uint64_t& version);
+// Record a message and the reply to its forked prompt; false if the history changed since the fork
+bool commitExchange(const std::string& userInput, const std::string& userName, const std::string& response, uint64_t version);
 void addEllieResponse(const std::string& response);
+// Take back the message buildPrompt added, when its reply was cancelled before it came
+void retractPrompt(const std::string& userInput, const std::string& userName);
+void retractPrompt(const std::vector<std::pair<std::string, std::string>>& speakerLines);
 void clearHistory();
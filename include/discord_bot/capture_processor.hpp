@@ -0,0 +1,155 @@
+#pragma once
+
+#include "guild_voice.hpp"
+#include "turn_pipeline.hpp"
+#include "timer_wheel.hpp"
+#include "lockfree_queue.hpp"
+#include "vad.hpp"
+#include "endpointer.hpp"
+#include "ingest.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace discord {
+
+    /**
+     * Receive side of voice, from packets to turns: per-user rings, speech detection,
+     * end-of-speech deadlines and the hand-off of utterances to the turn pipeline.
+     *
+     * Nothing here talks to Discord, and time only comes in through the arguments, so
+     * the same code runs behind the live gateway and behind a replayed recording on a
+     * simulated clock. receive(), requeue() and retire() may be called from any
+     * thread; poll() and nextWakeup() belong to a single processing thread.
+     */
+    class CaptureProcessor {
+    public:
+        struct Config {
+            audio_utils::VadConfig vad;
+            audio_utils::EndpointerConfig endpointer;
+            size_t max_users = 256;              // Receive rings across all guilds
+            // Users not heard from for this long give their ring back for others to speak with
+            std::chrono::milliseconds user_idle_timeout{60000};
+            size_t max_utterance_chunks = 512;   // Seconds of utterance audio held across all users
+            size_t min_stream_frames = 51;       // New audio that triggers a streamed upload
+            // Packet gaps shorter than this are network jitter, not missing audio
+            std::chrono::milliseconds packet_gap_tolerance{60};
+        };
+
+        struct Metrics {
+            uint64_t packets = 0;
+            uint64_t rejected_packets = 0;    // Dropped with every ring or user slot taken
+            uint64_t released_rings = 0;
+            uint64_t frames = 0;
+            uint64_t utterances = 0;
+            uint64_t barge_ins = 0;
+            uint64_t endpoint_ms_total = 0;   // Silence waited out before utterances ended
+            uint64_t endpoint_ms_max = 0;
+        };
+
+        CaptureProcessor(TurnPipeline& pipeline, const Config& config, uint64_t now_ms);
+        ~CaptureProcessor();
+
+        CaptureProcessor(const CaptureProcessor&) = delete;
+        CaptureProcessor& operator=(const CaptureProcessor&) = delete;
+
+        /**
+         * Ring storage for the sessions' users; sessions must be created with it
+         */
+        SlabPool& ringPool() { return ring_pool; }
+        size_t maxUsers() const { return config.max_users; }
+
+        /**
+         * Voice thread: hand over a packet of 48kHz stereo PCM
+         * @return true if the processing thread has to be woken to see it
+         */
+        bool receive(std::shared_ptr<GuildVoiceSession> session, uint64_t user_id,
+                     const uint8_t* audio, size_t size, uint64_t arrival_ms);
+
+        /**
+         * Have the processing thread look at a user again, e.g. to re-arm their endpoint
+         * @return true if the processing thread has to be woken
+         */
+        bool requeue(std::shared_ptr<GuildVoiceSession> session, uint64_t user_id);
+
+        /**
+         * A session that left voice; released by the next poll() once no timer points into it
+         */
+        void retire(std::shared_ptr<GuildVoiceSession> session);
+
+        /**
+         * Processing thread: fire endpoints due by `now_ms` and process queued audio
+         */
+        void poll(uint64_t now_ms);
+
+        /**
+         * Processing thread: the next endpoint deadline, if anyone is speaking
+         */
+        std::optional<uint64_t> nextWakeup() const { return endpoints.nextWakeup(); }
+
+        /**
+         * Processing thread, at shutdown: drop the endpoints of every user of `sessions`
+         */
+        void cancelEndpoints(const std::vector<std::shared_ptr<GuildVoiceSession>>& sessions);
+
+        Metrics metrics() const;
+
+    private:
+        struct ReadyUser {
+            std::shared_ptr<GuildVoiceSession> session;
+            VoiceUser* user = nullptr;
+        };
+
+        bool enqueue(std::shared_ptr<GuildVoiceSession> session, VoiceUser* user);
+        void releaseClosedSessions();
+        void reject(const GuildVoiceSession& session, uint64_t user_id, uint64_t arrival_ms);
+        void releaseIdleRings();
+        void drainUserAudio(VoiceUser& user);
+        void checkForSilenceAndTranscribe(VoiceUser& user);
+        void applyHangover(UserAudioState& state);
+        void armEndpoint(UserAudioState& state);
+        void processAudioFrame(VoiceUser& user, const uint8_t* frame);
+        void beginSpeech(VoiceUser& user);
+        void appendSpeech(uint64_t user_id, UserAudioState& state, const uint8_t* frame);
+        void endSpeech(UserAudioState& state);
+
+        TurnPipeline& pipeline;
+        const Config config;
+
+        // Ring storage and utterance chunks come from slab pools shared by all guilds,
+        // users from each session's flat table, so the voice thread never allocates per packet
+        SlabPool ring_pool;
+        SlabPool utterance_pool;
+
+        // Sessions that left voice, released once the processing thread holds no timers into them
+        std::mutex closed_sessions_mutex;
+        std::vector<std::shared_ptr<GuildVoiceSession>> closed_sessions;
+
+        // Users holding a ring, swept for idle ones; the session may be gone by then
+        struct RingHolder {
+            std::weak_ptr<GuildVoiceSession> session;
+            VoiceUser* user = nullptr;
+        };
+        std::vector<RingHolder> ring_holders;
+        uint64_t next_ring_sweep_ms = 0;
+
+        // Users the voice thread flagged as having audio. Queued entries keep their session alive.
+        lockfree::BoundedQueue<ReadyUser> ready_users;
+        TimerWheel endpoints;
+        uint64_t current_ms;
+
+        audio_utils::PcmToFloatKernel vad_downmix;
+        std::vector<float> vad_frame;  // Scratch for the processing thread
+
+        mutable std::mutex metrics_mutex;
+        Metrics stats;
+        std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> rejected_packets{0};
+        std::atomic<uint64_t> last_reject_log_ms{0};
+    };
+
+} // namespace discord
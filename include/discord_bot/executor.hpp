@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace discord {
+
+    /**
+     * Bounded worker pool where every task carries a key.
+     *
+     * Tasks with the same key run one at a time in submission order (a strand), so
+     * per-user or per-guild work stays ordered while different keys run in parallel.
+     * Submission never blocks: when `capacity` tasks are already waiting the task is
+     * rejected and the caller decides what to drop.
+     */
+    class KeyedExecutor {
+    public:
+        using Task = std::function<void()>;
+
+        KeyedExecutor(std::string name, size_t threads, size_t capacity);
+        ~KeyedExecutor();
+
+        KeyedExecutor(const KeyedExecutor&) = delete;
+        KeyedExecutor& operator=(const KeyedExecutor&) = delete;
+
+        /**
+         * Queue a task behind earlier tasks with the same key
+         * @return false if the queue is full or the executor is shutting down
+         */
+        bool trySubmit(uint64_t key, Task task);
+
+        /**
+         * Stop accepting tasks, let running tasks finish and discard queued ones
+         */
+        void shutdown();
+
+        size_t pending() const;
+        uint64_t rejected() const;
+        const std::string& name() const { return executor_name; }
+
+    private:
+        struct Strand {
+            std::deque<Task> tasks;
+        };
+
+        void workerLoop();
+
+        const std::string executor_name;
+        const size_t capacity;
+
+        mutable std::mutex mutex;
+        std::condition_variable cv;
+        // Keys with queued tasks and no task currently running
+        std::deque<uint64_t> ready;
+        std::unordered_map<uint64_t, Strand> strands;
+        size_t queued = 0;
+        uint64_t rejected_tasks = 0;
+        bool stopping = false;
+
+        std::vector<std::thread> workers;
+    };
+
+} // namespace discord
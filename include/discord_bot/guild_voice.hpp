@@ -0,0 +1,199 @@
+#pragma once
+
+#include "voice_ingest.hpp"
+#include "turn_pipeline.hpp"
+#include "timer_wheel.hpp"
+#include "playback.hpp"
+#include "vad.hpp"
+#include "endpointer.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace discord {
+
+    class GuildVoiceSession;
+
+    // Per-user processing state, touched only by the processing thread
+    struct UserAudioState {
+        std::shared_ptr<FrameStore> utterance;   // Audio of the current utterance, stored once
+        bool is_speaking = false;
+        bool speech_ended = false;               // VAD reported the end, waiting to be transcribed
+
+        // Voice activity detection on 20ms frames
+        std::unique_ptr<audio_utils::VoiceActivityDetector> vad;
+        std::unique_ptr<audio_utils::Endpointer> endpointer;  // Learns the user's pauses across utterances
+        uint64_t vad_time_ms = 0;                // Audio accounted for by the VAD up to here
+        std::vector<uint8_t> lookback;           // Circular buffer of recent unvoiced frames for pre-roll
+        size_t lookback_next = 0;
+        size_t lookback_count = 0;
+
+        // Turn in flight in the pipeline; its uploader reads the utterance through views
+        std::shared_ptr<VoiceTurn> turn;
+        size_t announced_frames = 0;
+
+        // Fires when the silence after the last packet would end the utterance.
+        // Its key is the owning VoiceUser's address.
+        TimerWheel::Timer endpoint_timer;
+
+        uint64_t reported_drops = 0;
+        bool holds_ring = false;                 // Listed for the idle ring sweep
+    };
+
+    // One user's entry in a guild session's user table
+    struct VoiceUser {
+        // Whoever moves the ring to PUSHING or RELEASING owns its storage until moving it on
+        enum RingState : uint8_t {
+            RING_DETACHED,                       // No storage; the next packet takes some from the pool
+            RING_ATTACHED,
+            RING_PUSHING,                        // The voice thread is writing into it
+            RING_RELEASING                       // The processing thread is taking its storage
+        };
+
+        VoiceUser(GuildVoiceSession& session, uint64_t user_id) : session(session), user_id(user_id) {}
+
+        GuildVoiceSession& session;
+        const uint64_t user_id;
+        FrameRing ring;                          // Voice thread -> processing thread
+        std::atomic<uint8_t> ring_state{RING_DETACHED};
+        std::atomic<bool> queued{false};         // Listed in the ready queue, awaiting a drain
+        UserAudioState state;
+    };
+
+    /**
+     * Voice state of one guild: its connection's shard, its users and their audio,
+     * and the playback engine its replies are spoken through.
+     *
+     * Sessions are created by a join and closed by a leave or a disconnect, each
+     * independently of the others. Speech of a guild's users is transcribed on their
+     * own strands and replies play on the guild's strand of the TTS executor, so one
+     * busy guild cannot hold up another.
+     */
+    class GuildVoiceSession {
+    public:
+        enum class State {
+            Connecting,
+            Connected,
+            Closing
+        };
+
+        // `ring_pool` must hand out FrameRing::STORAGE_BYTES blocks and outlive the session
+        GuildVoiceSession(uint64_t guild_id, uint32_t shard_id, SlabPool& ring_pool, size_t max_users,
+                          std::shared_ptr<PlaybackEngine> playback);
+        ~GuildVoiceSession();
+
+        GuildVoiceSession(const GuildVoiceSession&) = delete;
+        GuildVoiceSession& operator=(const GuildVoiceSession&) = delete;
+
+        uint64_t guildId() const { return guild_id; }
+        uint32_t shardId() const { return shard_id; }
+
+        PlaybackEngine& playback() const { return *playback_engine; }
+        const std::shared_ptr<PlaybackEngine>& playbackPtr() const { return playback_engine; }
+
+        State state() const { return session_state.load(std::memory_order_acquire); }
+        void setState(State state) { session_state.store(state, std::memory_order_release); }
+        bool closing() const { return state() == State::Closing; }
+
+        // Capture all audio of the guild, not only detected speech
+        bool recording() const { return is_recording.load(std::memory_order_relaxed); }
+        void setRecording(bool recording) { is_recording.store(recording, std::memory_order_relaxed); }
+
+        /**
+         * Lock-free lookup, safe from the voice thread
+         */
+        VoiceUser* findUser(uint64_t user_id) const { return users.find(user_id); }
+
+        /**
+         * @return The user's entry, or nullptr if the table is full
+         */
+        VoiceUser* findOrAddUser(uint64_t user_id);
+
+        /**
+         * Voice thread: append audio to the user's ring, giving it storage from the
+         * ring pool first if it has none
+         * @return false if the pool is exhausted and the audio was dropped
+         */
+        bool pushAudio(VoiceUser& user, const uint8_t* audio, size_t size, uint64_t arrival_ms);
+
+        /**
+         * Processing thread, after draining the user: return their ring's storage to the
+         * pool. Users are kept, so they only need storage again when they next speak.
+         * @return false if audio arrived since the drain and the ring was kept
+         */
+        bool releaseRing(VoiceUser& user);
+
+        template <typename Visitor>
+        void forEachUser(Visitor&& visit) {
+            users.forEach([&visit](uint64_t, VoiceUser& user) { visit(user); });
+        }
+
+        size_t userCount() const { return users.count(); }
+
+    private:
+        const uint64_t guild_id;
+        const uint32_t shard_id;
+        SlabPool& ring_pool;
+        const std::shared_ptr<PlaybackEngine> playback_engine;
+
+        std::atomic<State> session_state{State::Connecting};
+        std::atomic<bool> is_recording{false};
+        UserTable<VoiceUser> users;
+    };
+
+    /**
+     * Guild id -> session, safe for concurrent use.
+     * Split into buckets with their own reader/writer lock, so lookups from the voice
+     * thread only contend with joins and leaves of guilds in the same bucket.
+     */
+    class GuildSessionMap {
+    public:
+        using SessionPtr = std::shared_ptr<GuildVoiceSession>;
+
+        SessionPtr find(uint64_t guild_id) const;
+
+        /**
+         * @param make Called under the bucket lock when the guild has no session
+         */
+        template <typename Factory>
+        SessionPtr findOrCreate(uint64_t guild_id, Factory&& make) {
+            Bucket& bucket = bucketFor(guild_id);
+            std::unique_lock<std::shared_mutex> lock(bucket.mutex);
+            auto& session = bucket.sessions[guild_id];
+            if (!session) {
+                session = make();
+                count.fetch_add(1, std::memory_order_relaxed);
+            }
+            return session;
+        }
+
+        /**
+         * @return The removed session, or nullptr if the guild had none
+         */
+        SessionPtr remove(uint64_t guild_id);
+
+        std::vector<SessionPtr> snapshot() const;
+        size_t size() const { return count.load(std::memory_order_relaxed); }
+
+    private:
+        static constexpr size_t BUCKETS = 16;
+
+        struct Bucket {
+            mutable std::shared_mutex mutex;
+            std::unordered_map<uint64_t, SessionPtr> sessions;
+        };
+
+        Bucket& bucketFor(uint64_t guild_id) { return buckets[bucketIndex(guild_id)]; }
+        const Bucket& bucketFor(uint64_t guild_id) const { return buckets[bucketIndex(guild_id)]; }
+        static size_t bucketIndex(uint64_t guild_id);
+
+        std::array<Bucket, BUCKETS> buckets;
+        std::atomic<size_t> count{0};
+    };
+
+} // namespace discord
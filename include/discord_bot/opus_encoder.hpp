@@ -0,0 +1,142 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct OpusEncoder;
+
+namespace discord {
+
+    // Encoded reply: 20ms Opus packets at 48kHz stereo. Immutable once built,
+    // so it can be cached and replayed to any voice connection.
+    struct OpusClip {
+        std::vector<std::vector<uint8_t>> packets;
+        size_t suppressed_frames = 0;
+
+        uint64_t durationMs() const { return packets.size() * FRAME_MS; }
+        size_t bytes() const {
+            size_t total = 0;
+            for (const auto& packet : packets) total += packet.size();
+            return total;
+        }
+
+        static constexpr uint64_t FRAME_MS = 20;
+    };
+    using OpusClipPtr = std::shared_ptr<const OpusClip>;
+
+    /**
+     * Worker pool that turns 20ms PCM frames into Opus packets off the voice thread.
+     *
+     * Each reply is an encode job pinned to one worker, so its frames are encoded
+     * in order by a single encoder. Packets are handed to the job's callback as they
+     * are produced (for immediate sending) and collected into an OpusClip.
+     *
+     * Frame buffers go back to their worker once encoded and are reused by the next
+     * pushFrame, so a steady stream of frames does not allocate PCM buffers.
+     */
+    class OpusEncoderPool {
+    public:
+        // Called on a worker thread for each encoded packet
+        using PacketCallback = std::function<void(uint8_t* packet, size_t size)>;
+
+        class Job : public std::enable_shared_from_this<Job> {
+        public:
+            ~Job();
+
+            /**
+             * Queue one 20ms frame of 48kHz interleaved stereo PCM (3840 bytes)
+             */
+            void pushFrame(const int16_t* frame, size_t bytes);
+
+            /**
+             * Mark the end of the audio. Trailing silent frames are dropped.
+             * @return Future resolved with the finished clip once every frame is encoded
+             */
+            std::future<OpusClipPtr> finish();
+
+            /**
+             * Frames pushed but not yet encoded (or dropped as silence)
+             */
+            size_t pendingFrames() const { return pending_frames.load(std::memory_order_acquire); }
+
+        private:
+            friend class OpusEncoderPool;
+            Job(OpusEncoderPool& pool, size_t worker, PacketCallback on_packet);
+
+            void encode(const int16_t* frame);
+            void complete();
+            void emit(std::vector<uint8_t> packet);
+
+            OpusEncoderPool& pool;
+            size_t worker;
+            PacketCallback on_packet;
+            OpusEncoder* encoder;
+
+            // Worker thread only
+            std::shared_ptr<OpusClip> clip;
+            std::vector<std::vector<uint8_t>> held_silence;
+            std::array<uint8_t, 1276 * 3> packet_buffer;   // Largest packet libopus makes for a frame
+            bool started;
+            bool completed;
+            std::atomic<bool> finishing;
+            std::atomic<size_t> pending_frames{0};
+            std::promise<OpusClipPtr> done;
+        };
+
+        explicit OpusEncoderPool(size_t workers, int bitrate = 64000);
+        ~OpusEncoderPool();
+
+        OpusEncoderPool(const OpusEncoderPool&) = delete;
+        OpusEncoderPool& operator=(const OpusEncoderPool&) = delete;
+
+        /**
+         * Start encoding a new reply on the least loaded worker
+         */
+        std::shared_ptr<Job> begin(PacketCallback on_packet);
+
+        int bitrate() const { return target_bitrate; }
+
+        static constexpr int SAMPLE_RATE = 48000;
+        static constexpr int CHANNELS = 2;
+        static constexpr int FRAME_SAMPLES = 960;
+        static constexpr size_t FRAME_BYTES = FRAME_SAMPLES * CHANNELS * sizeof(int16_t);
+        // Encoded frame buffers a worker keeps for reuse, ~1s of audio
+        static constexpr size_t MAX_SPARE_FRAMES = 64;
+
+        // Peak amplitude at or below which a frame counts as silence
+        static constexpr int16_t SILENCE_PEAK = 48;
+
+    private:
+        struct Task {
+            std::shared_ptr<Job> job;
+            std::vector<int16_t> frame;  // Empty marks the end of the job
+        };
+
+        struct Worker {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<Task> tasks;
+            std::vector<std::vector<int16_t>> spare_frames;
+            std::atomic<size_t> active_jobs{0};
+            std::thread thread;
+        };
+
+        void submit(size_t worker, Task task);
+        std::vector<int16_t> takeFrame(size_t worker);
+        void workerLoop(Worker& worker);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool> stopping;
+        int target_bitrate;
+    };
+
+} // namespace discord
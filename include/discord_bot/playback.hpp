@@ -0,0 +1,185 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace discord {
+
+    enum class PlaybackPriority : int {
+        Filler = 0,   // Acknowledgements and other audio that may be cut at any time
+        Reply = 1,
+        Urgent = 2
+    };
+
+    // Where a guild's paced Opus packets go (the D++ voice client)
+    struct PlaybackOutput {
+        // Hand over one 20ms packet; false if there is no connection to play it on
+        std::function<bool(uint8_t* packet, size_t size)> send;
+        // Audio handed over but not played yet
+        std::function<uint32_t()> buffered_ms;
+        // Drop everything handed over but not played yet
+        std::function<void()> clear;
+    };
+
+    /**
+     * Per-guild voice output: a priority queue of reply streams, each a bounded queue
+     * of 20ms Opus frames, paced out to the voice connection in real time.
+     *
+     * Producers write frames while earlier frames are already playing and wait when
+     * their stream is full. Only a short lead is handed to the connection ahead of
+     * time, so a flush or a higher-priority stream takes over within a few frames.
+     */
+    class PlaybackEngine : public std::enable_shared_from_this<PlaybackEngine> {
+    public:
+        static constexpr size_t STREAM_FRAMES = 50;  // 1s buffered per stream
+        static constexpr uint32_t LEAD_MS = 60;      // Handed to the connection ahead of playback
+        static constexpr uint32_t FRAME_MS = 20;
+
+        struct Metrics {
+            uint64_t frames_played = 0;
+            uint64_t frames_dropped = 0;   // No connection to play them on
+            uint64_t underruns = 0;        // Ticks where a started stream had nothing ready
+            uint64_t preemptions = 0;      // Streams cut by a flush or a higher priority
+            size_t queued_streams = 0;
+            size_t queued_frames = 0;
+            size_t max_queued_frames = 0;
+        };
+
+        /**
+         * One reply's audio. Written by a single producer, read by the pacer.
+         */
+        class Stream {
+        public:
+            /**
+             * Append an encoded frame. Never blocks, so encoder threads can call it.
+             * @return false if the stream was cancelled
+             */
+            bool push(const uint8_t* packet, size_t size);
+
+            /**
+             * Producer back-pressure: wait until the stream has room for another frame
+             * @param in_flight Returns the frames handed to the encoder but not pushed yet
+             * @return false if the stream was cancelled
+             */
+            template <typename InFlight>
+            bool waitForSpace(InFlight&& in_flight) {
+                std::unique_lock<std::mutex> lock(engine->mutex);
+                // Encoder progress is not signalled, so re-check at frame rate
+                while (!cancelled() && frames.size() + in_flight() >= STREAM_FRAMES) {
+                    engine->space.wait_for(lock, std::chrono::milliseconds(FRAME_MS));
+                }
+                return !cancelled();
+            }
+
+            /**
+             * No more frames will be pushed; the stream ends once played out
+             */
+            void finish();
+
+            /**
+             * Drop the stream's remaining audio
+             */
+            void cancel();
+
+            bool cancelled() const { return is_cancelled.load(std::memory_order_acquire); }
+
+        private:
+            friend class PlaybackEngine;
+            Stream(std::shared_ptr<PlaybackEngine> engine, PlaybackPriority priority)
+                : engine(std::move(engine)), priority(priority) {}
+
+            const std::shared_ptr<PlaybackEngine> engine;
+            const PlaybackPriority priority;
+
+            // Guarded by the engine's mutex
+            std::deque<std::vector<uint8_t>> frames;
+            bool finished = false;
+            bool started = false;
+            std::atomic<bool> is_cancelled{false};
+        };
+        using StreamPtr = std::shared_ptr<Stream>;
+
+        PlaybackEngine(uint64_t guild_id, PlaybackOutput output);
+
+        PlaybackEngine(const PlaybackEngine&) = delete;
+        PlaybackEngine& operator=(const PlaybackEngine&) = delete;
+
+        /**
+         * Queue a new stream behind streams of the same or higher priority
+         * @param preempt Cancel every queued or playing stream of lower priority
+         */
+        StreamPtr open(PlaybackPriority priority, bool preempt = false);
+
+        /**
+         * Cancel every stream and drop audio already handed to the connection
+         */
+        void flush();
+
+        /**
+         * Pacer: top the connection up to LEAD_MS from the first stream in line
+         * @return false once there is nothing left to play
+         */
+        bool tick();
+
+        bool active() const;
+        Metrics metrics() const;
+        uint64_t guildId() const { return guild_id; }
+
+        // Set by the pacer so a new stream can wake it
+        void setWake(std::function<void()> wake) { on_open = std::move(wake); }
+
+    private:
+        friend class Stream;
+
+        void cancelLocked(Stream& stream);
+        void pruneLocked();
+
+        const uint64_t guild_id;
+        PlaybackOutput output;
+        std::function<void()> on_open;
+
+        mutable std::mutex mutex;
+        std::condition_variable space;
+        std::vector<StreamPtr> queue;  // Ordered by priority, then by opening order
+        Metrics stats;
+
+        std::vector<uint8_t> scratch;  // Pacer only
+    };
+
+    /**
+     * Clock shared by all guilds' playback engines: ticks every 20ms while any engine
+     * has audio to play and sleeps otherwise.
+     */
+    class PlaybackPacer {
+    public:
+        PlaybackPacer();
+        ~PlaybackPacer();
+
+        PlaybackPacer(const PlaybackPacer&) = delete;
+        PlaybackPacer& operator=(const PlaybackPacer&) = delete;
+
+        void add(const std::shared_ptr<PlaybackEngine>& engine);
+        void remove(const std::shared_ptr<PlaybackEngine>& engine);
+        void stop();
+
+    private:
+        void wake();
+        void run();
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<std::shared_ptr<PlaybackEngine>> engines;
+        bool pending = false;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+} // namespace discord
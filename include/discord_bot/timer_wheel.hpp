@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+namespace discord {
+
+    /**
+     * Hierarchical timing wheel with 1ms resolution.
+     *
+     * Timers are intrusive list nodes owned by the caller, so arming, re-arming and
+     * cancelling are O(1) and never allocate, whatever the number of timers. Four
+     * levels of 64 slots cover about 4.6 hours; later deadlines are parked in the top
+     * level and re-placed as time moves on. Not thread-safe: one thread owns the wheel.
+     */
+    class TimerWheel {
+    public:
+        struct Timer {
+            uint64_t key = 0;          // Handed back when the timer fires
+            uint64_t deadline_ms = 0;
+
+            bool armed() const { return prev != nullptr; }
+
+        private:
+            friend class TimerWheel;
+            Timer* prev = nullptr;
+            Timer* next = nullptr;
+        };
+
+        explicit TimerWheel(uint64_t now_ms);
+        ~TimerWheel();
+
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+        /**
+         * Arm the timer, or move it if it is already armed. Deadlines in the past
+         * fire on the next advance().
+         */
+        void arm(Timer& timer, uint64_t deadline_ms);
+        void cancel(Timer& timer);
+
+        /**
+         * Fire every timer due at or before `now_ms`, in deadline order. A fired timer
+         * is disarmed before `fire(timer)` runs, which may arm it again.
+         * @return Number of timers fired
+         */
+        template <typename Fire>
+        size_t advance(uint64_t now_ms, Fire&& fire) {
+            size_t fired = 0;
+            if (armed_count == 0) {
+                current = std::max(current, now_ms + 1);
+                return 0;
+            }
+            while (current <= now_ms) {
+                cascade();
+                Slot& slot = levels[0][current & SLOT_MASK];
+                while (slot.next != &slot) {
+                    Timer* timer = slot.next;
+                    unlink(*timer);
+                    if (timer->deadline_ms > current) {
+                        // Parked beyond the wheel's range; not due yet
+                        place(*timer);
+                        continue;
+                    }
+                    fire(*timer);
+                    fired++;
+                }
+                current++;
+                if (armed_count == 0) {
+                    current = std::max(current, now_ms + 1);
+                    break;
+                }
+            }
+            return fired;
+        }
+
+        /**
+         * Earliest time advance() can have work to do. Timers in the upper levels
+         * report when their slot cascades, so this is a lower bound on the next
+         * deadline and never later than it.
+         * @return Nothing if no timer is armed
+         */
+        std::optional<uint64_t> nextWakeup() const;
+
+        size_t size() const { return armed_count; }
+
+    private:
+        static constexpr unsigned SLOT_BITS = 6;
+        static constexpr uint64_t SLOTS = 1u << SLOT_BITS;
+        static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+        static constexpr unsigned LEVELS = 4;
+
+        // Sentinel of a circular list; an empty slot points at itself
+        struct Slot : Timer {
+            Slot();
+        };
+
+        void place(Timer& timer);
+        void unlink(Timer& timer);
+        void cascade();
+
+        std::array<std::array<Slot, SLOTS>, LEVELS> levels;
+        uint64_t current;  // Next millisecond tick to process
+        size_t armed_count = 0;
+    };
+
+    /**
+     * Sleep/wake hand-off between producers that must not block (the voice thread)
+     * and one consumer that sleeps until work arrives or a deadline passes.
+     * notify() only takes the lock when the consumer is actually asleep.
+     */
+    class WakeSignal {
+    public:
+        void notify() {
+            pending.store(true);
+            if (sleeping.load()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                cv.notify_one();
+            }
+        }
+
+        /**
+         * Sleep until notified or until `deadline` (forever if none)
+         * @return true if woken by notify()
+         */
+        bool wait(std::optional<std::chrono::steady_clock::time_point> deadline) {
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping.store(true);
+            auto ready = [this] { return pending.load(); };
+            if (deadline) {
+                cv.wait_until(lock, *deadline, ready);
+            } else {
+                cv.wait(lock, ready);
+            }
+            sleeping.store(false);
+            return pending.exchange(false);
+        }
+
+    private:
+        // Sequentially consistent: either notify() sees the consumer asleep or the
+        // consumer sees `pending` before it sleeps
+        std::atomic<bool> pending{false};
+        std::atomic<bool> sleeping{false};
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+} // namespace discord
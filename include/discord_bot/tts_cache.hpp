@@ -0,0 +1,128 @@
+#pragma once
+
+#include "opus_encoder.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace discord {
+
+    /**
+     * Content-addressed cache of synthesized replies, stored as the Opus packets
+     * they are played from, so a repeated line skips Azure and the encoder entirely.
+     *
+     * Entries are keyed by a hash of the normalized text, the voice and the output
+     * format. Recently used clips stay in memory up to a byte budget; every clip is
+     * also appended to segment files on disk, memory-mapped for reading, so the cache
+     * survives restarts. Once the segments exceed their budget the oldest one is
+     * deleted. Safe to use from several threads.
+     */
+    class TtsCache {
+    public:
+        struct Config {
+            uint64_t memory_bytes = 16ull * 1024 * 1024;
+            std::string directory;                          // Empty = memory only
+            uint64_t disk_bytes = 64ull * 1024 * 1024;
+            uint64_t segment_bytes = 8ull * 1024 * 1024;    // Size at which a new segment is started
+            size_t max_chars = 80;                          // Longer replies are rarely repeated
+        };
+
+        struct Metrics {
+            uint64_t memory_hits = 0;
+            uint64_t disk_hits = 0;
+            uint64_t misses = 0;
+            uint64_t inserts = 0;
+            uint64_t memory_bytes = 0;
+            uint64_t disk_bytes = 0;
+        };
+
+        explicit TtsCache(const Config& config);
+        ~TtsCache();
+
+        TtsCache(const TtsCache&) = delete;
+        TtsCache& operator=(const TtsCache&) = delete;
+
+        /**
+         * Identity of a reply: whitespace-normalized text, voice and output format
+         */
+        static std::string key(const std::string& text, const std::string& voice, const std::string& format);
+
+        /**
+         * Whether a reply is short enough to be worth caching
+         */
+        bool cacheable(const std::string& text) const { return !text.empty() && text.size() <= config.max_chars; }
+
+        /**
+         * @return The cached clip, or nullptr on a miss
+         */
+        OpusClipPtr find(const std::string& key);
+
+        void insert(const std::string& key, OpusClipPtr clip);
+
+        Metrics metrics() const;
+
+    private:
+        struct MemoryEntry {
+            uint64_t hash;
+            std::string key;
+            OpusClipPtr clip;
+            size_t bytes;
+        };
+
+        struct Segment {
+            uint64_t id = 0;
+            std::string path;
+            size_t size = 0;                 // Bytes of complete records
+            const uint8_t* data = nullptr;   // Mapping of the first `mapped` bytes
+            size_t mapped = 0;
+            std::vector<uint8_t> fallback;   // File contents, where there is no mmap
+        };
+
+        struct DiskEntry {
+            uint64_t segment;
+            size_t offset;
+            size_t bytes;
+        };
+
+        static uint64_t hashKey(const std::string& key);
+
+        void openDirectory();
+        void loadSegment(std::unique_ptr<Segment> segment);
+        bool mapSegment(Segment& segment);
+        void unmapSegment(Segment& segment);
+        void startSegment();
+        void dropOldestSegment();
+        bool appendToDisk(uint64_t hash, const std::string& key, const OpusClip& clip);
+        // Start of the record stored for `key`, mapped; nullptr if there is none
+        const uint8_t* diskRecord(uint64_t hash, const std::string& key);
+        bool diskHas(uint64_t hash, const std::string& key) { return diskRecord(hash, key) != nullptr; }
+        OpusClipPtr readFromDisk(uint64_t hash, const std::string& key);
+        void insertMemory(uint64_t hash, const std::string& key, OpusClipPtr clip);
+
+        const Config config;
+
+        mutable std::mutex mutex;
+
+        // Most recently used first
+        std::list<MemoryEntry> lru;
+        std::unordered_map<uint64_t, std::list<MemoryEntry>::iterator> memory_index;
+        size_t memory_used = 0;
+
+        // Segments by id, oldest first; the last one is appended to
+        std::map<uint64_t, std::unique_ptr<Segment>> segments;
+        std::unordered_map<uint64_t, DiskEntry> disk_index;
+        std::FILE* active = nullptr;
+        uint64_t disk_used = 0;
+        bool disk_failed = false;
+
+        Metrics stats;
+    };
+
+} // namespace discord
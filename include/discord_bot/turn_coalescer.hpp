@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace discord {
+
+    struct VoiceTurn;
+
+    /**
+     * Per-guild aggregator for transcribed voice turns.
+     *
+     * A finished turn is answered right away when nobody else in the guild is
+     * talking or being transcribed. Otherwise it waits for the others: up to `window`
+     * for speakers who are still talking, and up to `max_wait` for turns already
+     * being transcribed, so people answering each other get one reply instead of
+     * one each.
+     */
+    class TurnCoalescer {
+    public:
+        using Turns = std::vector<std::shared_ptr<VoiceTurn>>;
+        // Called without the coalescer's lock, on the thread that completed the batch or on its own
+        using Flush = std::function<void(Turns)>;
+
+        TurnCoalescer(std::chrono::milliseconds window, std::chrono::milliseconds max_wait, Flush flush);
+        ~TurnCoalescer();
+
+        TurnCoalescer(const TurnCoalescer&) = delete;
+        TurnCoalescer& operator=(const TurnCoalescer&) = delete;
+
+        /**
+         * A turn started; until it settles, finished turns of its guild may wait for it
+         */
+        void track(const std::shared_ptr<VoiceTurn>& turn);
+
+        /**
+         * The turn was transcribed and has something to answer
+         */
+        void add(const std::shared_ptr<VoiceTurn>& turn);
+
+        /**
+         * A tracked turn was marked settled without anything to answer
+         */
+        void settled();
+
+        /**
+         * Stop the timer; turns still waiting are dropped
+         */
+        void shutdown();
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Guild {
+            std::vector<std::weak_ptr<VoiceTurn>> live;  // Tracked turns not settled yet
+            Turns ready;
+            Clock::time_point first_ready;
+        };
+
+        // Under the lock: whether the guild's ready turns should go now, or when to look again
+        bool due(Guild& guild, Clock::time_point now, Clock::time_point& recheck);
+        void collectDue(std::vector<Turns>& batches, Clock::time_point& next);
+        void run();
+
+        const std::chrono::milliseconds window;
+        const std::chrono::milliseconds max_wait;
+        const Flush flush;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::unordered_map<uint64_t, Guild> guilds;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+} // namespace discord
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "executor.hpp"
+#include "turn_coalescer.hpp"
+#include "voice_ingest.hpp"
+#include "cancellation.hpp"
+#include "endpointer.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace discord {
+
+    // Running transcript of a streamed turn, as the speech-to-text service reports it
+    struct PartialTranscript {
+        uint64_t version = 0;       // Increases with every partial; 0 = none
+        uint64_t audio_bytes = 0;   // Uploaded audio it covers
+        std::string committed;      // Settled; later partials only add to it
+        std::string pending;        // Guess at the audio after it, may still change
+
+        bool empty() const { return committed.empty() && pending.empty(); }
+    };
+
+    struct StreamSessionState {
+        std::string committed_text;
+        std::string pending_fragment;
+    };
+
+    // What one speaker said, as part of a possibly merged turn
+    struct Utterance {
+        uint64_t user_id = 0;
+        std::string text;
+    };
+
+    // Reply generated against a fork of the conversation while the user was still talking
+    struct SpeculativeReply {
+        std::string reply;
+        uint64_t history_version = 0;   // Conversation the prompt was forked from
+        bool usable = false;            // Complete, and not cut off by the speculation token limit
+    };
+
+    struct Speculation {
+        std::string transcript;         // Committed text it answers
+        CancellationToken cancel;
+        CancellationToken::Registration linked;  // Cancelled along with its turn
+        SpeculativeReply result;        // Written by its LLM task
+    };
+
+    /**
+     * One user's utterance on its way through the pipeline.
+     * The capture thread only appends to `utterance`; everything else belongs to
+     * whichever stage currently holds the turn.
+     */
+    struct VoiceTurn {
+        uint64_t user_id = 0;
+        uint64_t guild_id = 0;
+        std::shared_ptr<FrameStore> utterance;
+
+        // Speech-to-text stage
+        std::string session_id;
+        size_t uploaded_frames = 0;
+        StreamSessionState stream;
+        uint64_t partial_version = 0;
+        bool finishing = false;                     // Partials arriving after this are stale
+        std::atomic<bool> upload_queued{false};
+        std::atomic<bool> partial_polling{false};   // A wait for the next partial is out
+        // How the latest partial ends, for the capture thread's end-of-turn timeout
+        std::atomic<audio_utils::TranscriptCue> transcript_cue{audio_utils::TranscriptCue::Unknown};
+
+        // Speculative reply to the committed text, owned by the speech-to-text strand
+        // until the turn is handed to the LLM
+        std::shared_ptr<Speculation> speculation;
+        size_t speculations = 0;
+        size_t stable_partials = 0;
+        size_t stable_committed_size = 0;
+
+        std::string transcript;
+        std::vector<Utterance> utterances;   // Every speaker answered by this turn, in order
+        std::string reply;
+
+        // Speech ended / nothing left to transcribe; read by the coalescer
+        std::atomic<bool> ended{false};
+        std::atomic<bool> settled{false};
+
+        // Cancelled on barge-in; aborts the LLM request, synthesis and playback
+        CancellationToken cancel;
+
+        ~VoiceTurn() {
+            if (speculation) {
+                speculation->cancel.cancel();
+            }
+        }
+    };
+
+    /**
+     * Network-facing steps of a turn. VoiceModule binds them to the Whisper service,
+     * the LLM and Azure TTS; other implementations can stand in for them.
+     */
+    class TurnBackend {
+    public:
+        virtual ~TurnBackend() = default;
+
+        virtual std::string startStream() = 0;
+        // Upload more audio; returns once the service has it, not when it is transcribed
+        virtual bool appendStream(const std::string& session_id, const FrameView& audio) = 0;
+        // Wait up to `wait` for a partial transcript newer than `after_version`; version 0 if none
+        virtual PartialTranscript waitPartial(const std::string& session_id, uint64_t after_version,
+                                              std::chrono::milliseconds wait) = 0;
+        // The whole transcript of the stream
+        virtual std::string finishStream(const std::string& session_id) = 0;
+        // Drop the stream, e.g. when the utterance is too short to transcribe
+        virtual void abortStream(const std::string& session_id) = 0;
+        // Transcribe in one go; the guild's clips may share a Whisper run, no one else's
+        virtual std::string transcribe(uint64_t guild_id, const FrameView& audio) = 0;
+        // A partial transcript changed the turn's transcript cue
+        virtual void transcriptCueChanged(const VoiceTurn& turn) = 0;
+        virtual std::string respond(const std::vector<Utterance>& utterances, const CancellationToken& cancel) = 0;
+        // Answer against a fork of the conversation, leaving the history untouched
+        virtual SpeculativeReply speculate(uint64_t user_id, const std::string& transcript, const CancellationToken& cancel) = 0;
+        // Record a speculative reply as the answer to `transcript`; false if the conversation moved on since its fork
+        virtual bool adoptSpeculation(uint64_t user_id, const std::string& transcript, const SpeculativeReply& reply) = 0;
+        virtual void speak(uint64_t guild_id, const std::string& reply, const CancellationToken& cancel) = 0;
+    };
+
+    /**
+     * Staged processing of voice turns: capture -> upload -> finalize -> LLM -> TTS/playback.
+     *
+     * Capture happens on the caller's thread, which only calls the non-blocking methods
+     * below. Upload and finalize share a per-user strand on the speech-to-text executor,
+     * so a user's chunks, finish and transcript stay ordered; the LLM runs per user and
+     * speech per guild. Every hand-off goes through a bounded queue.
+     *
+     * Uploads do not wait for transcription. Partial transcripts are long-polled on an
+     * executor of their own, with a thread for every turn that may be streaming at once,
+     * and applied on the user's strand as they arrive.
+     *
+     * Transcribed turns of a guild pass through a TurnCoalescer, so speakers finishing
+     * close together are answered with one LLM call and one reply.
+     */
+    class TurnPipeline {
+    public:
+        struct Config {
+            size_t stt_threads = 4;
+            size_t partial_poll_threads = 16;   // Turns with a partial long poll open at once
+            size_t llm_threads = 1;
+            size_t tts_threads = 2;
+            size_t queue_capacity = 256;
+            size_t min_upload_frames = 51;   // ~1s per streamed chunk
+            std::chrono::milliseconds partial_wait{2000};   // Longest one poll for a partial is held open
+            size_t min_utterance_bytes = 20000;
+
+            // Wait for other speakers of the guild before answering (0 = answer each turn alone)
+            std::chrono::milliseconds coalesce_window{0};
+            std::chrono::milliseconds coalesce_max_wait{0};   // For turns already being transcribed
+
+            // Start answering the committed part of a transcript while the user still talks
+            bool speculate = false;
+            size_t speculation_stable_partials = 2;  // Partials in a row with nothing pending and nothing new committed
+            size_t speculation_min_chars = 12;
+            size_t speculation_max_per_turn = 2;     // Each later one replaces a stale one
+        };
+
+        struct SpeculationMetrics {
+            uint64_t started = 0;
+            uint64_t used = 0;
+            uint64_t discarded = 0;
+        };
+
+        TurnPipeline(TurnBackend& backend, const Config& config);
+        ~TurnPipeline();
+
+        TurnPipeline(const TurnPipeline&) = delete;
+        TurnPipeline& operator=(const TurnPipeline&) = delete;
+
+        /**
+         * Speech started: open a turn and its streaming session
+         */
+        std::shared_ptr<VoiceTurn> begin(uint64_t user_id, uint64_t guild_id, std::shared_ptr<FrameStore> utterance);
+
+        /**
+         * More audio was appended to the turn's utterance
+         */
+        void audioAvailable(const std::shared_ptr<VoiceTurn>& turn);
+
+        /**
+         * Speech ended: transcribe the turn and answer it
+         */
+        void end(const std::shared_ptr<VoiceTurn>& turn);
+
+        /**
+         * Answer text that did not come from voice, e.g. a typed message
+         */
+        void respondTo(uint64_t user_id, uint64_t guild_id, const std::string& text);
+
+        /**
+         * Someone in the guild started talking: cancel every reply still being
+         * generated or synthesized there
+         * @return Number of replies cancelled
+         */
+        size_t bargeIn(uint64_t guild_id);
+
+        SpeculationMetrics speculationMetrics() const;
+
+        /**
+         * Stop all stages; queued work is discarded
+         */
+        void shutdown();
+
+    private:
+        void upload(const std::shared_ptr<VoiceTurn>& turn, bool flush);
+        void pollPartial(const std::shared_ptr<VoiceTurn>& turn);
+        void applyPartial(const std::shared_ptr<VoiceTurn>& turn, PartialTranscript partial);
+        void finalize(const std::shared_ptr<VoiceTurn>& turn);
+        void speculate(VoiceTurn& turn);
+        void discardSpeculation(VoiceTurn& turn);
+        void settle(VoiceTurn& turn);
+        void respondToBatch(TurnCoalescer::Turns turns);
+        void submitResponse(const std::shared_ptr<VoiceTurn>& turn);
+        void submitSpeech(const std::shared_ptr<VoiceTurn>& turn);
+        void trackReply(const std::shared_ptr<VoiceTurn>& turn);
+
+        static std::string normalizeTranscript(const std::string& text);
+
+        TurnBackend& backend;
+        Config config;
+
+        KeyedExecutor stt;
+        KeyedExecutor partials;
+        KeyedExecutor llm;
+        KeyedExecutor tts;
+        TurnCoalescer coalescer;
+
+        // Replies past speech-to-text, per guild; expired entries are finished turns
+        std::mutex replies_mutex;
+        std::unordered_map<uint64_t, std::vector<std::weak_ptr<VoiceTurn>>> replies;
+
+        std::atomic<uint64_t> speculations_started{0};
+        std::atomic<uint64_t> speculations_used{0};
+        std::atomic<uint64_t> speculations_discarded{0};
+    };
+
+} // namespace discord
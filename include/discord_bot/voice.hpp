@@ -4,9 +4,17 @@
 #include "commands.hpp"
 #include "whisper_client.hpp"
 #include "azure_tts.hpp"
+#include "opus_encoder.hpp"
+#include "tts_cache.hpp"
+#include "vad.hpp"
+#include "ingest.hpp"
+#include "voice_ingest.hpp"
+#include "guild_voice.hpp"
+#include "capture_processor.hpp"
+#include "voice_recording.hpp"
 #include <dpp/dpp.h>
 #include <vector>
-#include <map>
+#include <memory>
 #include <cstdint>
 #include <chrono>
 #include <functional>
@@ -17,67 +25,70 @@
 
 namespace discord {
 
-	struct UserAudioState {
-		std::vector<uint8_t> current_buffer;
-		std::chrono::steady_clock::time_point last_audio_time;
-		bool is_speaking;
-		dpp::snowflake guild_id;
-	};
-
-	class VoiceModule {
+	class VoiceModule : public TurnBackend {
 	public:
 		explicit VoiceModule(std::shared_ptr<CoreBot> core, std::shared_ptr<CommandsModule> commands);
 		~VoiceModule();
 		
 		void handleJoinVoiceCommand(const dpp::slashcommand_t& event);
 		
-		bool isVoiceConnected() const { return voice_connected; }
-		bool isRecording() const { return is_recording; }
+		void handleLeaveVoiceCommand(const dpp::slashcommand_t& event);
+		
+		bool isVoiceConnected() const { return sessions.size() > 0; }
+		bool isVoiceConnected(dpp::snowflake guild_id) const { return sessions.find(guild_id) != nullptr; }
 		
-		static std::vector<uint16_t> convertTTSAudioFormat(const std::vector<uint8_t>& mono_24khz);
 		void sendVoiceMessage(dpp::snowflake user_id, const std::string& text, dpp::snowflake guild_id);
 
+		// TurnBackend: the network-facing steps run by the turn pipeline
+		std::string startStream() override;
+		bool appendStream(const std::string& session_id, const FrameView& audio) override;
+		PartialTranscript waitPartial(const std::string& session_id, uint64_t after_version,
+		                              std::chrono::milliseconds wait) override;
+		std::string finishStream(const std::string& session_id) override;
+		void abortStream(const std::string& session_id) override;
+		std::string transcribe(uint64_t guild_id, const FrameView& audio) override;
+		void transcriptCueChanged(const VoiceTurn& turn) override;
+		std::string respond(const std::vector<Utterance>& utterances, const CancellationToken& cancel) override;
+		SpeculativeReply speculate(uint64_t user_id, const std::string& transcript, const CancellationToken& cancel) override;
+		bool adoptSpeculation(uint64_t user_id, const std::string& transcript, const SpeculativeReply& reply) override;
+		void speak(uint64_t guild_id, const std::string& reply, const CancellationToken& cancel) override;
+
 	private:
 		void registerCommands();
 		std::vector<uint8_t> convertToWav(const std::vector<uint8_t>& raw_audio);
-		void checkForSilenceAndTranscribe(dpp::snowflake user_id);
-		void processAudioChunk(dpp::snowflake user_id, const uint8_t* audio, size_t audio_size);
-		void speakText(const std::string& text, dpp::snowflake guild_id);
+		void closeSession(dpp::snowflake guild_id);
+		void speakText(const std::string& text, dpp::snowflake guild_id, const CancellationToken& cancel = CancellationToken());
+		PlaybackOutput makePlaybackOutput(dpp::snowflake guild_id, uint32_t shard_id);
 		void startSilenceDetectionTimer();
 		void stopSilenceDetectionTimer();
 		void silenceDetectionLoop();
 
-		struct StreamSessionState {
-			std::vector<uint8_t> accumulator;
-			std::string committed_text;
-			std::string pending_fragment;
-			std::string last_partial;
-		};
-
-		void mergePartialTranscript(StreamSessionState& state, const std::string& partial_text);
-
-		// Streaming state per user
-		std::unordered_map<dpp::snowflake, std::string> user_stream_session_ids;
-		std::unordered_map<dpp::snowflake, StreamSessionState> stream_states;
-
 		std::shared_ptr<CoreBot> core;
 		std::shared_ptr<CommandsModule> commands;
 		std::unique_ptr<WhisperClient> stt;
 		std::unique_ptr<AzureTTS> tts;
-		bool voice_connected;
-		bool is_recording;
-		std::map<dpp::snowflake, UserAudioState> user_audio_states;
+		std::unique_ptr<OpusEncoderPool> opus_encoder;
+		std::unique_ptr<TtsCache> tts_cache;  // Short replies, already encoded
+		std::unique_ptr<TurnPipeline> pipeline;
+		PlaybackPacer playback_pacer;
+
+		// Receive path: packets go straight from the voice thread into the capture
+		// processor, which the processing thread drives. Sessions hold rings from its
+		// pool, so it is declared first and outlives them.
+		std::unique_ptr<CaptureProcessor> capture;
+		std::unique_ptr<VoiceRecordingWriter> recording;
+		GuildSessionMap sessions;
+		WakeSignal processing_wake;
 		
 		std::thread silence_detection_thread;
 		std::atomic<bool> should_stop_silence_detection;
-		std::mutex audio_states_mutex;
 		
-		static constexpr std::chrono::milliseconds SILENCE_THRESHOLD{500};
-		static constexpr std::chrono::milliseconds SILENCE_CHECK_INTERVAL{100};
 		static constexpr size_t MIN_AUDIO_SIZE{20000}; // Minimum audio size to process (about 0.1s at 48kHz stereo)
+		static constexpr size_t MAX_VOICE_USERS{256};      // Recent speakers across all guilds
+		static constexpr size_t MAX_UTTERANCE_CHUNKS{512}; // Seconds of utterance audio held across all users
 
 		// Streaming helpers (1s min chunk for robust partials at 48k stereo 16-bit)
-		static constexpr size_t MIN_STREAM_SEND_BYTES{194000};
+		static constexpr size_t MIN_STREAM_SEND_FRAMES{51};
 		static constexpr size_t OVERLAP_CHARS{16};
 	};
 
@@ -0,0 +1,360 @@
+#pragma once
+
+#include "lockfree_queue.hpp"
+#include "whisper_client.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace discord {
+
+    // Decoded Discord voice audio: 20ms of 48kHz interleaved stereo 16-bit PCM
+    constexpr size_t VOICE_FRAME_BYTES = 3840;
+    constexpr uint32_t VOICE_FRAME_MS = 20;
+
+    /**
+     * Fixed-size blocks carved out of large slabs.
+     * Released blocks are recycled through a lock-free free list, so acquiring a
+     * recycled block never blocks; only growing the pool by a new slab takes a lock.
+     */
+    class SlabPool {
+    public:
+        SlabPool(size_t block_bytes, size_t blocks_per_slab, size_t max_blocks);
+
+        SlabPool(const SlabPool&) = delete;
+        SlabPool& operator=(const SlabPool&) = delete;
+
+        /**
+         * @return A block of blockBytes() bytes, or nullptr once max_blocks are in use
+         */
+        uint8_t* acquire();
+        void release(uint8_t* block);
+
+        size_t blockBytes() const { return block_bytes; }
+        size_t blocksInUse() const { return in_use.load(std::memory_order_relaxed); }
+
+    private:
+        const size_t block_bytes;
+        const size_t blocks_per_slab;
+        const size_t max_blocks;
+
+        lockfree::BoundedQueue<uint8_t*> free_blocks;
+        std::atomic<size_t> in_use{0};
+
+        std::mutex grow_mutex;
+        std::vector<std::unique_ptr<uint8_t[]>> slabs;
+        size_t carved = 0;
+    };
+
+    /**
+     * Single-producer single-consumer ring of voice frames with their arrival times.
+     *
+     * The producer (the D++ voice thread) only copies into a free slot and publishes
+     * it, which is wait-free; when the consumer falls behind, new frames are dropped
+     * and counted rather than blocking the receive path. Packets that are not a whole
+     * frame are assembled on the producer side.
+     *
+     * The frames live in storage attached from outside, so an idle ring can hand it
+     * back and take other storage later; see GuildVoiceSession.
+     */
+    class FrameRing {
+    public:
+        static constexpr size_t CAPACITY = 128;  // 2.56s of audio
+        static constexpr size_t STORAGE_BYTES = CAPACITY * VOICE_FRAME_BYTES;
+
+        FrameRing() = default;
+
+        // `storage` must hold STORAGE_BYTES and stay attached until detach()
+        explicit FrameRing(uint8_t* storage) : storage(storage) {}
+
+        FrameRing(const FrameRing&) = delete;
+        FrameRing& operator=(const FrameRing&) = delete;
+
+        /**
+         * Producer: append raw PCM received at `arrival_ms`
+         * @return false if any complete frame had to be dropped
+         */
+        bool push(const uint8_t* audio, size_t size, uint64_t arrival_ms) {
+            bool all_stored = true;
+            if (pending_size > 0) {
+                size_t take = std::min(size, VOICE_FRAME_BYTES - pending_size);
+                std::memcpy(pending.data() + pending_size, audio, take);
+                pending_size += take;
+                audio += take;
+                size -= take;
+                if (pending_size < VOICE_FRAME_BYTES) {
+                    return true;
+                }
+                all_stored &= pushFrame(pending.data(), arrival_ms);
+                pending_size = 0;
+            }
+            while (size >= VOICE_FRAME_BYTES) {
+                all_stored &= pushFrame(audio, arrival_ms);
+                audio += VOICE_FRAME_BYTES;
+                size -= VOICE_FRAME_BYTES;
+            }
+            if (size > 0) {
+                std::memcpy(pending.data(), audio, size);
+                pending_size = size;
+            }
+            return all_stored;
+        }
+
+        /**
+         * Consumer: oldest unread frame, or nullptr if the ring is empty
+         */
+        const uint8_t* front(uint64_t& arrival_ms) const {
+            size_t tail = read_index.load(std::memory_order_relaxed);
+            if (tail == write_index.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            arrival_ms = arrivals[tail % CAPACITY];
+            return storage + (tail % CAPACITY) * VOICE_FRAME_BYTES;
+        }
+
+        /**
+         * Consumer: release the frame returned by front()
+         */
+        void pop() {
+            read_index.store(read_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        uint64_t dropped() const { return dropped_frames.load(std::memory_order_relaxed); }
+
+        /**
+         * Producer, only while no storage is attached: the next frames go to `block`
+         */
+        void attach(uint8_t* block) { storage = block; }
+
+        /**
+         * Consumer, only while the producer is kept out and the ring is empty
+         * @return The storage, which the ring no longer touches
+         */
+        uint8_t* detach() {
+            uint8_t* block = storage;
+            storage = nullptr;
+            return block;
+        }
+
+        bool attached() const { return storage != nullptr; }
+
+    private:
+        bool pushFrame(const uint8_t* frame, uint64_t arrival_ms) {
+            size_t head = write_index.load(std::memory_order_relaxed);
+            if (head - read_index.load(std::memory_order_acquire) >= CAPACITY) {
+                dropped_frames.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            std::memcpy(storage + (head % CAPACITY) * VOICE_FRAME_BYTES, frame, VOICE_FRAME_BYTES);
+            arrivals[head % CAPACITY] = arrival_ms;
+            write_index.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Handed between the threads by the owner's release/acquire, not by the ring
+        uint8_t* storage = nullptr;
+        std::array<uint64_t, CAPACITY> arrivals{};
+
+        // Producer only
+        std::array<uint8_t, VOICE_FRAME_BYTES> pending{};
+        size_t pending_size = 0;
+
+        alignas(lockfree::CACHE_LINE) std::atomic<size_t> write_index{0};
+        alignas(lockfree::CACHE_LINE) std::atomic<size_t> read_index{0};
+        alignas(lockfree::CACHE_LINE) std::atomic<uint64_t> dropped_frames{0};
+    };
+
+    /**
+     * Fixed-capacity open-addressed table from user id to per-user state.
+     *
+     * Entries are inserted once and never removed, so lookups are a short linear
+     * probe with no locks and pointers to values stay valid for the table's lifetime.
+     * Insertion claims a slot with a CAS and is safe from several threads.
+     */
+    template <typename Value>
+    class UserTable {
+    public:
+        explicit UserTable(size_t requested_capacity)
+            : capacity(roundUp(requested_capacity)), mask(capacity - 1),
+              slots(std::make_unique<Slot[]>(capacity)) {}
+
+        ~UserTable() {
+            for (size_t i = 0; i < capacity; i++) {
+                delete slots[i].value.load(std::memory_order_acquire);
+            }
+        }
+
+        UserTable(const UserTable&) = delete;
+        UserTable& operator=(const UserTable&) = delete;
+
+        /**
+         * @return The user's value, or nullptr if the user was never inserted
+         */
+        Value* find(uint64_t key) const {
+            for (size_t probe = 0, i = hash(key) & mask; probe < capacity; probe++, i = (i + 1) & mask) {
+                uint64_t current = slots[i].key.load(std::memory_order_acquire);
+                if (current == key) return waitForValue(slots[i]);
+                if (current == EMPTY) return nullptr;
+            }
+            return nullptr;
+        }
+
+        /**
+         * @param make Called once to create the value when the user is new
+         * @return The user's value, or nullptr if the table is full
+         */
+        template <typename Factory>
+        Value* findOrInsert(uint64_t key, Factory&& make) {
+            for (size_t probe = 0, i = hash(key) & mask; probe < capacity; probe++, i = (i + 1) & mask) {
+                uint64_t current = slots[i].key.load(std::memory_order_acquire);
+                if (current == EMPTY &&
+                    slots[i].key.compare_exchange_strong(current, key, std::memory_order_acq_rel)) {
+                    Value* value = make();
+                    slots[i].value.store(value, std::memory_order_release);
+                    size.fetch_add(1, std::memory_order_relaxed);
+                    return value;
+                }
+                if (current == key) return waitForValue(slots[i]);
+            }
+            return nullptr;
+        }
+
+        /**
+         * Visit every inserted user
+         */
+        template <typename Visitor>
+        void forEach(Visitor&& visit) const {
+            for (size_t i = 0; i < capacity; i++) {
+                uint64_t key = slots[i].key.load(std::memory_order_acquire);
+                if (key == EMPTY) continue;
+                if (Value* value = slots[i].value.load(std::memory_order_acquire)) {
+                    visit(key, *value);
+                }
+            }
+        }
+
+        size_t count() const { return size.load(std::memory_order_relaxed); }
+
+    private:
+        static constexpr uint64_t EMPTY = 0;
+
+        struct Slot {
+            std::atomic<uint64_t> key{EMPTY};
+            std::atomic<Value*> value{nullptr};
+        };
+
+        static size_t roundUp(size_t value) {
+            size_t result = 16;
+            while (result < value) result <<= 1;
+            return result;
+        }
+
+        static size_t hash(uint64_t key) {
+            // splitmix64 finalizer; snowflakes share their low timestamp bits
+            key ^= key >> 30;
+            key *= 0xbf58476d1ce4e5b9ull;
+            key ^= key >> 27;
+            key *= 0x94d049bb133111ebull;
+            key ^= key >> 31;
+            return static_cast<size_t>(key);
+        }
+
+        // The inserting thread publishes the value right after claiming the key
+        static Value* waitForValue(const Slot& slot) {
+            Value* value;
+            while ((value = slot.value.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+            return value;
+        }
+
+        const size_t capacity;
+        const size_t mask;
+        std::unique_ptr<Slot[]> slots;
+        std::atomic<size_t> size{0};
+    };
+
+    class FrameView;
+
+    /**
+     * Append-only audio of one utterance, stored once as frames in pooled chunks.
+     *
+     * A single writer appends; readers take FrameViews over already published frames
+     * and read them concurrently without copying. Chunks never move, and they return
+     * to the pool when the store and every view of it are gone.
+     */
+    class FrameStore : public std::enable_shared_from_this<FrameStore> {
+    public:
+        static constexpr size_t CHUNK_FRAMES = 50;  // 1s per chunk
+        static constexpr size_t CHUNK_BYTES = CHUNK_FRAMES * VOICE_FRAME_BYTES;
+        static constexpr size_t MAX_CHUNKS = 120;   // Utterances are capped at 2 minutes
+
+        // `chunk_pool` must hand out CHUNK_BYTES blocks and outlive the store
+        static std::shared_ptr<FrameStore> create(SlabPool& chunk_pool);
+        ~FrameStore();
+
+        FrameStore(const FrameStore&) = delete;
+        FrameStore& operator=(const FrameStore&) = delete;
+
+        /**
+         * Writer: append one frame of VOICE_FRAME_BYTES
+         * @return false if the utterance is at its cap or the pool is exhausted
+         */
+        bool append(const uint8_t* frame);
+
+        size_t frames() const { return frame_count.load(std::memory_order_acquire); }
+        size_t bytes() const { return frames() * VOICE_FRAME_BYTES; }
+
+        /**
+         * View of frames [first, last), clamped to what has been published
+         */
+        FrameView view(size_t first, size_t last) const;
+        FrameView all() const;
+
+    private:
+        friend class FrameView;
+        explicit FrameStore(SlabPool& chunk_pool) : pool(chunk_pool) {}
+
+        SlabPool& pool;
+        std::array<uint8_t*, MAX_CHUNKS> chunks{};
+        std::atomic<size_t> frame_count{0};
+    };
+
+    /**
+     * Read-only range of frames in a FrameStore. Keeps the store alive.
+     */
+    class FrameView {
+    public:
+        FrameView() = default;
+
+        size_t frames() const { return last - first; }
+        size_t bytes() const { return frames() * VOICE_FRAME_BYTES; }
+        bool empty() const { return first == last; }
+
+        /**
+         * Contiguous pieces of the view, in order (one per chunk touched)
+         */
+        std::vector<WhisperClient::AudioSpan> spans() const;
+
+        /**
+         * Copy the audio out, for consumers that need one contiguous buffer
+         */
+        std::vector<uint8_t> copy() const;
+
+    private:
+        friend class FrameStore;
+        FrameView(std::shared_ptr<const FrameStore> store, size_t first, size_t last)
+            : store(std::move(store)), first(first), last(last) {}
+
+        std::shared_ptr<const FrameStore> store;
+        size_t first = 0;
+        size_t last = 0;
+    };
+
+} // namespace discord
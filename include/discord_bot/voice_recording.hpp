@@ -0,0 +1,156 @@
+#pragma once
+
+#include "lockfree_queue.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace discord {
+
+    /**
+     * On-disk format of recorded voice traffic: every voice_receive packet of every
+     * user, with its arrival time, as handed to the capture path.
+     *
+     *   file   := FileHeader record*
+     *   record := RecordHeader payload[size]
+     *
+     * Records are written in arrival order. A user's packets refer to a stream index
+     * that a Stream record (payload: guild id, user id) declares before its first use.
+     * Packet payloads are 48kHz stereo s16 PCM exactly as D++ delivered them. All
+     * integers are little-endian.
+     */
+    namespace voice_recording {
+        constexpr char MAGIC[4] = {'E', 'V', 'R', 'C'};
+        constexpr uint16_t VERSION = 1;
+
+        struct FileHeader {
+            char magic[4];
+            uint16_t version;
+            uint16_t channels;
+            uint32_t sample_rate;
+            uint32_t reserved;
+        };
+
+        enum class RecordKind : uint16_t {
+            Packet = 0,
+            Stream = 1
+        };
+
+        struct RecordHeader {
+            uint32_t time_ms;     // Since the recording started
+            uint16_t stream;
+            uint16_t kind;        // RecordKind
+            uint32_t size;        // Payload bytes that follow
+        };
+
+        static_assert(sizeof(FileHeader) == 16 && sizeof(RecordHeader) == 12, "Recording headers must be packed");
+    }
+
+    /**
+     * Appends received packets to a recording. Safe to call from several voice threads.
+     *
+     * append() copies the packet into a preallocated slot and hands it to a writer
+     * thread through a lock-free queue, so the voice threads never wait for the disk.
+     * When the writer falls behind and every slot is taken, packets are dropped and
+     * counted; the writer logs drops and failed writes.
+     */
+    class VoiceRecordingWriter {
+    public:
+        static constexpr size_t DEFAULT_SLOTS = 1024;  // 20s of one speaker
+
+        explicit VoiceRecordingWriter(const std::string& path, size_t slots = DEFAULT_SLOTS);
+        ~VoiceRecordingWriter();
+
+        VoiceRecordingWriter(const VoiceRecordingWriter&) = delete;
+        VoiceRecordingWriter& operator=(const VoiceRecordingWriter&) = delete;
+
+        void append(uint64_t guild_id, uint64_t user_id, uint64_t arrival_ms, const uint8_t* audio, size_t size);
+
+        uint64_t dropped() const { return dropped_packets.load(std::memory_order_relaxed); }
+        uint64_t writeFailures() const { return write_failures.load(std::memory_order_relaxed); }
+
+    private:
+        struct Slot {
+            uint64_t guild_id = 0;
+            uint64_t user_id = 0;
+            uint64_t arrival_ms = 0;
+            std::vector<uint8_t> audio;   // Keeps its capacity across packets
+        };
+
+        void writerLoop();
+        void writePacket(const Slot& slot);
+        void writeRecord(const voice_recording::RecordHeader& header, const void* payload);
+        void reportProblems();
+
+        std::vector<std::unique_ptr<Slot>> slots;
+        lockfree::BoundedQueue<Slot*> free_slots;
+        lockfree::BoundedQueue<Slot*> queue;
+        std::atomic<uint32_t> pending{0};
+        std::atomic<bool> stopping{false};
+        std::atomic<uint64_t> dropped_packets{0};
+        std::atomic<uint64_t> write_failures{0};
+
+        // Writer thread only
+        std::FILE* file = nullptr;
+        std::vector<char> buffer;
+        std::map<std::pair<uint64_t, uint64_t>, uint16_t> streams;
+        uint64_t start_ms = 0;
+        bool started = false;
+        uint64_t reported_drops = 0;
+        uint64_t reported_failures = 0;
+
+        std::thread writer;
+    };
+
+    /**
+     * Read-only view of a recording, memory-mapped where the platform allows
+     */
+    class VoiceRecordingReader {
+    public:
+        struct Packet {
+            uint32_t time_ms = 0;
+            uint64_t guild_id = 0;
+            uint64_t user_id = 0;
+            const uint8_t* audio = nullptr;   // Points into the mapping
+            size_t size = 0;
+        };
+
+        /**
+         * @throws std::runtime_error if the file cannot be read or is not a recording
+         */
+        explicit VoiceRecordingReader(const std::string& path);
+        ~VoiceRecordingReader();
+
+        VoiceRecordingReader(const VoiceRecordingReader&) = delete;
+        VoiceRecordingReader& operator=(const VoiceRecordingReader&) = delete;
+
+        /**
+         * Next packet in arrival order
+         * @return false at the end of the recording (or at a truncated last record)
+         */
+        bool next(Packet& packet);
+
+        void rewind() { offset = sizeof(voice_recording::FileHeader); }
+
+        /**
+         * Arrival time of the last packet
+         */
+        uint32_t durationMs();
+
+    private:
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+        size_t offset = 0;
+        std::vector<std::pair<uint64_t, uint64_t>> streams;
+        std::vector<uint8_t> fallback;   // Whole file, where there is no mmap
+        bool mapped = false;
+    };
+
+} // namespace discord
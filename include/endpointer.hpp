@@ -0,0 +1,104 @@
+#pragma once
+
+#include "vad.hpp"
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace audio_utils {
+
+// What the latest partial transcript says about the end of a turn
+enum class TranscriptCue : uint8_t {
+    Unknown,
+    Complete,    // Ends a sentence or reads as a whole question
+    Incomplete   // Stops on a conjunction, an article, a filler or a comma
+};
+
+struct EndpointerConfig {
+    // Silence that ends an utterance while nothing is known about the speaker
+    uint32_t default_hangover_ms = 500;
+    uint32_t min_hangover_ms = 150;
+    uint32_t max_hangover_ms = 1200;
+    bool adaptive = true;
+
+    // Multipliers on the speaker's base timeout
+    float complete_scale = 0.5f;
+    float incomplete_scale = 1.6f;
+    float falling_scale = 0.7f;
+    // Drop of the last voiced frames below the utterance's level that counts as falling energy
+    float falling_db = 6.0f;
+
+    static EndpointerConfig fromEnvironment();
+};
+
+/**
+ * End-of-turn timeout for one speaker, chosen per utterance.
+ *
+ * The base timeout comes from the speaker's own pauses: the gaps inside their
+ * utterances (and gaps that split an utterance the speaker then went on with) are
+ * learned online, and the timeout sits just above their 90th percentile. It shrinks
+ * when the transcript reads as finished or the voice trailed off, and grows when the
+ * speaker stopped mid-clause.
+ */
+class Endpointer {
+public:
+    explicit Endpointer(const EndpointerConfig& config);
+
+    /**
+     * Speech started at `time_ms` (stream time, as used for the VAD)
+     */
+    void beginUtterance(uint64_t time_ms);
+
+    /**
+     * Speech ended at `time_ms`, after `hangover_ms` of silence
+     */
+    void endUtterance(uint64_t time_ms, uint32_t hangover_ms);
+
+    /**
+     * One analyzed frame while speaking
+     */
+    void observeFrame(const VadFrameStats& stats);
+
+    /**
+     * Time without any audio while speaking
+     */
+    void observeGap(uint32_t ms);
+
+    /**
+     * Unvoiced or missing audio that should end the current utterance
+     */
+    uint32_t hangoverMs(TranscriptCue cue) const;
+
+    /**
+     * The speaker's learned base timeout, or the default until enough pauses were seen
+     */
+    uint32_t baseHangoverMs() const;
+
+    bool energyFalling() const;
+
+    static TranscriptCue classifyTranscript(const std::string& text);
+
+private:
+    static constexpr uint32_t BIN_MS = 20;
+    static constexpr size_t BINS = 100;            // Pauses up to 2s
+    static constexpr uint32_t MIN_PAUSE_MS = 100;  // Shorter gaps are within words
+    static constexpr float MIN_PAUSE_WEIGHT = 8.0f;
+
+    void recordPause(uint32_t ms);
+
+    EndpointerConfig config;
+
+    // Decaying histogram of the speaker's pauses
+    std::array<float, BINS> pauses{};
+    float pause_weight = 0.0f;
+
+    // Current utterance
+    uint32_t unvoiced_ms = 0;
+    float level_db = 0.0f;       // Slow average of voiced frame energy
+    float tail_db = 0.0f;        // Fast average, i.e. the last few voiced frames
+    uint32_t voiced_frames = 0;
+    uint64_t last_end_ms = 0;
+    uint32_t last_hangover_ms = 0;
+};
+
+} // namespace audio_utils
@@ -1,7 +1,22 @@
 #pragma once
+#include <cstdint>
 #include <string>
 #include "config.hpp"
+#include "cancellation.hpp"
 
 bool initializeModel();
-std::string runInference(const std::string& conversationJson);
+
+struct ChatCompletion {
+    std::string text;                // Reply, or an "[Error: ...]" message
+    bool ok = false;                 // The server produced a reply
+    bool truncated = false;          // Cut off by the token limit
+    uint64_t completion_tokens = 0;  // As reported by the server, if it does
+};
+
+// One chat completion over `conversationJson`; leaves the conversation history alone.
+// Returns an empty, not-ok completion if `cancel` fired before the reply arrived
+ChatCompletion runChatCompletion(const std::string& conversationJson, int maxTokens, const CancellationToken& cancel = CancellationToken());
+
+// Returns an empty string if `cancel` fired before the reply arrived
+std::string runInference(const std::string& conversationJson, const CancellationToken& cancel = CancellationToken());
 void shutdownModel();
\ No newline at end of file
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "resampler.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+namespace audio_utils {
+
+/**
+ * Convert interleaved 16-bit frames to normalized mono floats, averaging the channels.
+ * `frames` is the number of sample frames, not bytes.
+ */
+using PcmToFloatKernel = void (*)(const int16_t* input, size_t frames, float* output);
+
+/**
+ * @param channels Number of interleaved input channels (1 or 2)
+ * @return Conversion kernel for the instruction set selected at runtime
+ */
+PcmToFloatKernel pcmToFloatKernel(int channels);
+
+/**
+ * Single-pass conversion from raw 16-bit PCM bytes to resampled mono samples.
+ *
+ * Downmixing, sample format conversion and polyphase low-pass resampling are fused:
+ * the input is read once in cache-sized blocks and every output sample is written
+ * exactly once into the caller's buffer, with no intermediate vectors.
+ *
+ * @tparam Channels Interleaved channels in the input (1 or 2)
+ * @tparam InputRate Input sample rate in Hz
+ * @tparam OutputRate Output sample rate in Hz
+ * @tparam OutputSample float (normalized to [-1, 1)) or int16_t
+ */
+template <int Channels, int InputRate, int OutputRate, typename OutputSample>
+class IngestPipeline {
+    static_assert(Channels == 1 || Channels == 2, "Only mono and stereo input is supported");
+    static_assert(InputRate > 0 && OutputRate > 0, "Sample rates must be positive");
+    static_assert(std::is_same_v<OutputSample, float> || std::is_same_v<OutputSample, int16_t>,
+                  "Output samples must be float or int16_t");
+
+    static constexpr int DIVISOR = std::gcd(InputRate, OutputRate);
+    static constexpr bool PASSTHROUGH = InputRate == OutputRate;
+
+public:
+    static constexpr int UP = OutputRate / DIVISOR;
+    static constexpr int DOWN = InputRate / DIVISOR;
+    static constexpr size_t TAPS = tapsPerPhase(UP, DOWN);
+    static constexpr size_t BYTES_PER_FRAME = Channels * sizeof(int16_t);
+
+    IngestPipeline()
+        : bank(PASSTHROUGH ? nullptr : getFilterBank(InputRate, OutputRate)),
+          dot(dotKernel()),
+          convert(pcmToFloatKernel(Channels)) {}
+
+    /**
+     * @param input_bytes Size of the raw PCM input in bytes
+     * @return Number of output samples produced for that input
+     */
+    static constexpr size_t outputCount(size_t input_bytes) {
+        size_t frames = input_bytes / BYTES_PER_FRAME;
+        return (frames * UP + DOWN - 1) / DOWN;
+    }
+
+    /**
+     * Convert raw PCM bytes into `output`.
+     * Trailing bytes that do not form a whole frame are ignored.
+     *
+     * @param pcm Raw interleaved 16-bit little-endian PCM
+     * @param bytes Size of `pcm` in bytes
+     * @param output Destination with room for outputCount(bytes) samples
+     * @return Number of samples written
+     */
+    size_t run(const uint8_t* pcm, size_t bytes, OutputSample* output) const {
+        const int16_t* input = reinterpret_cast<const int16_t*>(pcm);
+        const size_t frames = bytes / BYTES_PER_FRAME;
+        const size_t total = outputCount(bytes);
+
+        if constexpr (PASSTHROUGH) {
+            return convertBlocks(input, frames, output);
+        } else {
+            return resample(input, frames, total, output);
+        }
+    }
+
+    /**
+     * Convert raw PCM bytes into a reusable buffer.
+     * The buffer is resized to the exact output size; its capacity is kept between calls.
+     *
+     * @return Number of samples written
+     */
+    size_t run(const std::vector<uint8_t>& pcm, std::vector<OutputSample>& output) const {
+        output.resize(outputCount(pcm.size()));
+        size_t written = run(pcm.data(), pcm.size(), output.data());
+        output.resize(written);
+        return written;
+    }
+
+private:
+    // Frames converted per block; the working window stays resident in L1
+    static constexpr size_t BLOCK_FRAMES = 1024;
+
+    static OutputSample store(float value) {
+        if constexpr (std::is_same_v<OutputSample, float>) {
+            return value;
+        } else {
+            float scaled = std::nearbyint(value * 32768.0f);
+            if (scaled > 32767.0f) scaled = 32767.0f;
+            if (scaled < -32768.0f) scaled = -32768.0f;
+            return static_cast<OutputSample>(scaled);
+        }
+    }
+
+    size_t convertBlocks(const int16_t* input, size_t frames, OutputSample* output) const {
+        if constexpr (std::is_same_v<OutputSample, float>) {
+            convert(input, frames, output);
+        } else {
+            std::array<float, BLOCK_FRAMES> block;
+            for (size_t offset = 0; offset < frames; offset += BLOCK_FRAMES) {
+                size_t count = std::min(BLOCK_FRAMES, frames - offset);
+                convert(input + offset * Channels, count, block.data());
+                for (size_t i = 0; i < count; i++) {
+                    output[offset + i] = store(block[i]);
+                }
+            }
+        }
+        return frames;
+    }
+
+    size_t resample(const int16_t* input, size_t frames, size_t total, OutputSample* output) const {
+        // Sliding window of mono input x[window_start, window_start + window_size)
+        std::array<float, BLOCK_FRAMES + TAPS> window;
+        constexpr int64_t taps = static_cast<int64_t>(TAPS);
+        constexpr uint64_t delay = TAPS * UP / 2;
+
+        // Zeros before the first sample fill the left half of the filter
+        int64_t window_start = -taps;
+        size_t window_size = TAPS;
+        std::fill(window.begin(), window.begin() + TAPS, 0.0f);
+        size_t next_frame = 0;
+
+        for (size_t n = 0; n < total; n++) {
+            uint64_t position = static_cast<uint64_t>(n) * DOWN + delay;
+            int64_t base = static_cast<int64_t>(position / UP);
+            int phase = static_cast<int>(position % UP);
+
+            while (base >= window_start + static_cast<int64_t>(window_size)) {
+                // Slide: keep the taps the current output still needs, then convert the next block
+                int64_t keep_from = base - taps + 1;
+                size_t drop = static_cast<size_t>(keep_from - window_start);
+                if (drop > 0) {
+                    std::memmove(window.data(), window.data() + drop, (window_size - drop) * sizeof(float));
+                    window_size -= drop;
+                    window_start = keep_from;
+                }
+
+                size_t count = std::min(BLOCK_FRAMES, window.size() - window_size);
+                size_t available = next_frame < frames ? std::min(count, frames - next_frame) : 0;
+                if (available > 0) {
+                    convert(input + next_frame * Channels, available, window.data() + window_size);
+                    next_frame += available;
+                }
+                // Zeros after the last sample fill the right half of the filter
+                std::fill(window.data() + window_size + available, window.data() + window_size + count, 0.0f);
+                window_size += count;
+            }
+
+            const float* taps_start = window.data() + (base - taps + 1 - window_start);
+            output[n] = store(dot(bank->phase(phase), taps_start, TAPS));
+        }
+        return total;
+    }
+
+    std::shared_ptr<const FilterBank> bank;
+    DotKernel dot;
+    PcmToFloatKernel convert;
+};
+
+// Discord voice (48kHz stereo) to Whisper input (16kHz mono float)
+using DiscordToWhisper = IngestPipeline<2, 48000, 16000, float>;
+
+/**
+ * IngestPipeline over input arriving in pieces, with the same output as one run
+ * over all of it.
+ *
+ * Each piece is converted together with the input the filter still needs from
+ * before it. Samples whose filter reaches past the input received so far are held
+ * back until more arrives, or until flush() pads the end with zeros like a single
+ * run does. Only that short history is kept between pieces.
+ */
+template <int Channels, int InputRate, int OutputRate, typename OutputSample>
+class StreamingIngest {
+    using Pipeline = IngestPipeline<Channels, InputRate, OutputRate, OutputSample>;
+    static constexpr uint64_t UP = Pipeline::UP;
+    static constexpr uint64_t DOWN = Pipeline::DOWN;
+    static constexpr uint64_t TAPS = Pipeline::TAPS;
+    static constexpr uint64_t DELAY = UP == DOWN ? 0 : TAPS * UP / 2;
+
+public:
+    /**
+     * Convert more input, appending the samples now complete to `output`
+     * @return Number of samples appended
+     */
+    size_t push(const uint8_t* pcm, size_t bytes, std::vector<OutputSample>& output) {
+        history.insert(history.end(), pcm, pcm + bytes);
+        input_frames = history_frame + history.size() / Pipeline::BYTES_PER_FRAME;
+
+        // Sample n reads input up to frame (n * DOWN + DELAY) / UP
+        const uint64_t reach = input_frames * UP;
+        const uint64_t ready = reach > DELAY ? (reach - DELAY + DOWN - 1) / DOWN : 0;
+        size_t appended = emit(std::min(ready, Pipeline::outputCount(input_frames * Pipeline::BYTES_PER_FRAME)), output);
+
+        // Keep the input from the first frame the next sample reads, aligned so the
+        // history converts to whole output samples
+        const uint64_t base = (emitted * DOWN + DELAY) / UP;
+        const uint64_t first = base + 1 > TAPS ? base + 1 - TAPS : 0;
+        const uint64_t keep_from = std::max(history_frame, first / DOWN * DOWN);
+        const size_t drop = static_cast<size_t>((keep_from - history_frame) * Pipeline::BYTES_PER_FRAME);
+        history.erase(history.begin(), history.begin() + static_cast<std::ptrdiff_t>(drop));
+        history_frame = keep_from;
+        return appended;
+    }
+
+    /**
+     * End of input: append the held-back samples
+     * @return Number of samples appended
+     */
+    size_t flush(std::vector<OutputSample>& output) {
+        size_t appended = emit(Pipeline::outputCount(input_frames * Pipeline::BYTES_PER_FRAME), output);
+        history.clear();
+        history_frame = input_frames;
+        return appended;
+    }
+
+    uint64_t samples() const { return emitted; }
+
+private:
+    size_t emit(uint64_t ready, std::vector<OutputSample>& output) {
+        if (ready <= emitted) {
+            return 0;
+        }
+        // Output sample j of the history is sample first + j of the stream
+        const uint64_t first = history_frame * UP / DOWN;
+        pipeline.run(history, scratch);
+        const size_t from = static_cast<size_t>(emitted - first);
+        const size_t to = std::min(static_cast<size_t>(ready - first), scratch.size());
+        output.insert(output.end(), scratch.begin() + static_cast<std::ptrdiff_t>(from),
+                      scratch.begin() + static_cast<std::ptrdiff_t>(to));
+        emitted = first + to;
+        return to - from;
+    }
+
+    Pipeline pipeline;
+    std::vector<uint8_t> history;   // Input from frame `history_frame` on
+    uint64_t history_frame = 0;     // Always a multiple of DOWN
+    uint64_t input_frames = 0;
+    uint64_t emitted = 0;
+    std::vector<OutputSample> scratch;
+};
+
+// Discord voice to stored stream audio (16kHz mono int16), a piece at a time
+using DiscordToStream = StreamingIngest<2, 48000, 16000, int16_t>;
+
+} // namespace audio_utils
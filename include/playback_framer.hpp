@@ -0,0 +1,67 @@
+#pragma once
+
+#include "resampler.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace audio_utils {
+
+/**
+ * Streaming converter from mono 16-bit PCM (e.g. Azure TTS at 24kHz) to Discord
+ * playback frames: 20ms of 48kHz interleaved stereo, 3840 bytes each.
+ *
+ * Input may arrive in chunks of any size, including chunks that split a sample.
+ * Every completed frame is handed to the callback as soon as it is filled, so
+ * playback can start while the rest of the audio is still being received.
+ */
+class PlaybackFramer {
+public:
+    static constexpr int OUTPUT_RATE = 48000;
+    static constexpr int OUTPUT_CHANNELS = 2;
+    static constexpr size_t FRAME_SAMPLES = OUTPUT_RATE / 50;                 // Per channel
+    static constexpr size_t FRAME_BYTES = FRAME_SAMPLES * OUTPUT_CHANNELS * sizeof(int16_t);
+
+    // Receives one complete frame; the buffer is reused after the call returns
+    using FrameCallback = std::function<void(int16_t* frame, size_t bytes)>;
+
+    PlaybackFramer(int input_rate, FrameCallback on_frame);
+
+    /**
+     * Feed raw mono 16-bit little-endian PCM
+     */
+    void push(const uint8_t* pcm, size_t bytes);
+
+    /**
+     * Flush the resampler and emit the final frame, padded with silence.
+     * The framer can be reused for a new stream afterwards.
+     */
+    void finish();
+
+    size_t framesEmitted() const { return frames_emitted; }
+
+private:
+    void pushSamples(const int16_t* samples, size_t count);
+    void appendMono(const int16_t* mono, size_t count);
+
+    PolyphaseResampler resampler;
+    FrameCallback on_frame;
+
+    // Mono to interleaved stereo copy, selected at runtime
+    void (*duplicate)(const int16_t* mono, size_t count, int16_t* stereo);
+
+    // Input samples copied out of the byte stream
+    std::array<int16_t, 1024> input;
+    // Resampled mono output waiting to be framed
+    std::array<int16_t, 2048> resampled;
+    std::array<int16_t, FRAME_SAMPLES * OUTPUT_CHANNELS> frame;
+    size_t frame_fill;        // Stereo sample frames already in `frame`
+    size_t frames_emitted;
+
+    // Odd trailing byte of the previous chunk
+    uint8_t carry_byte;
+    bool has_carry;
+};
+
+} // namespace audio_utils
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace audio_utils {
+
+/**
+ * Polyphase decomposition of a windowed-sinc low-pass filter for a rational
+ * resampling ratio up/down.
+ *
+ * Coefficients are stored phase-major. Within a phase the taps are reversed and
+ * scaled by the interpolation factor, so an output sample is a plain dot product
+ * against `taps` consecutive input samples.
+ */
+struct FilterBank {
+    int input_rate;
+    int output_rate;
+    int up;        // Interpolation factor (L)
+    int down;      // Decimation factor (M)
+    size_t taps;   // Taps per phase, always a multiple of 8
+    std::vector<float> coefficients;
+
+    const float* phase(int p) const { return coefficients.data() + static_cast<size_t>(p) * taps; }
+};
+
+/**
+ * Number of taps per polyphase branch for a ratio up/down: about 16 zero crossings
+ * per side of the narrowest band, rounded up to a multiple of 8 for the SIMD kernels.
+ */
+constexpr size_t tapsPerPhase(int up, int down) {
+    int widest = up > down ? up : down;
+    size_t taps = static_cast<size_t>((16 * widest + up - 1) / up);
+    taps = (taps + 7) & ~static_cast<size_t>(7);
+    return taps < 8 ? 8 : taps;
+}
+
+/**
+ * Get the filter bank for a sample rate conversion.
+ * Banks are designed once per ratio and shared; the 48kHz->16kHz (Discord -> Whisper)
+ * and 24kHz->48kHz (Azure TTS -> Discord) banks are built up front.
+ *
+ * @param input_rate Input sample rate in Hz
+ * @param output_rate Output sample rate in Hz
+ * @return Shared, immutable filter bank
+ */
+std::shared_ptr<const FilterBank> getFilterBank(int input_rate, int output_rate);
+
+/**
+ * Dot product of two float arrays. `n` must be a multiple of 8.
+ */
+using DotKernel = float (*)(const float* a, const float* b, size_t n);
+
+/**
+ * @return Dot product kernel for the instruction set selected at runtime
+ */
+DotKernel dotKernel();
+
+/**
+ * Streaming polyphase FIR resampler.
+ *
+ * Filter history is carried between calls, so feeding a signal in arbitrary chunks
+ * produces exactly the same samples as a single call with the whole signal.
+ * The filter delay is compensated: after flush() the output is aligned with the
+ * input and contains ceil(input_count * output_rate / input_rate) samples.
+ */
+class PolyphaseResampler {
+public:
+    PolyphaseResampler(int input_rate, int output_rate);
+
+    /**
+     * Upper bound of samples produced by process() on `input_count` samples followed by flush()
+     */
+    size_t maxOutputCount(size_t input_count) const;
+
+    /**
+     * Resample a chunk of 16-bit samples
+     *
+     * @param input Input samples
+     * @param count Number of input samples
+     * @param output Destination with room for at least maxOutputCount(count) samples
+     * @return Number of samples written
+     */
+    size_t process(const int16_t* input, size_t count, int16_t* output);
+    size_t process(const float* input, size_t count, float* output);
+
+    /**
+     * Resample a chunk and append the result to `output`
+     *
+     * @return Number of samples appended
+     */
+    size_t process(const int16_t* input, size_t count, std::vector<int16_t>& output);
+    size_t process(const float* input, size_t count, std::vector<float>& output);
+
+    /**
+     * Emit the remaining samples held back by the filter delay and reset the stream
+     *
+     * @param output Destination with room for at least maxOutputCount(0) samples
+     * @return Number of samples written
+     */
+    size_t flush(int16_t* output);
+    size_t flush(float* output);
+
+    /**
+     * Drop all filter history and start a new stream
+     */
+    void reset();
+
+    int inputRate() const { return bank->input_rate; }
+    int outputRate() const { return bank->output_rate; }
+
+private:
+    template <typename Sample>
+    size_t processBlocks(const Sample* input, size_t count, Sample* output);
+
+    template <typename Sample>
+    size_t finish(Sample* output);
+
+    template <typename Sample>
+    size_t drain(Sample* output, uint64_t output_limit);
+
+    int64_t inputIndexFor(uint64_t output_index) const;
+
+    std::shared_ptr<const FilterBank> bank;
+    DotKernel dot;
+
+    // Input samples x[history_start, input_count) as normalized floats
+    std::vector<float> history;
+    int64_t history_start;
+    uint64_t input_count;
+    uint64_t output_count;
+    uint64_t delay;  // Filter delay in upsampled samples
+
+    static constexpr size_t BLOCK_SIZE = 4096;
+};
+
+} // namespace audio_utils
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+// Target attributes for kernels that are compiled for a specific instruction set
+// and selected at runtime. MSVC accepts intrinsics without per-function targets.
+#if (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define AUDIO_SIMD_X86 1
+#if defined(__GNUC__) || defined(__clang__)
+#define AUDIO_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define AUDIO_TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+#define AUDIO_TARGET_AVX2
+#define AUDIO_TARGET_SSE41
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || (defined(__ARM_NEON) && defined(__arm__))
+#define AUDIO_SIMD_NEON 1
+#endif
+
+namespace audio_utils {
+namespace simd {
+
+enum class Level {
+    Scalar,
+    SSE41,
+    AVX2,
+    NEON
+};
+
+/**
+ * Detect the best instruction set supported by the running CPU.
+ * The result is computed once and cached.
+ *
+ * Setting DIGI_ELLIE_SIMD to "scalar", "sse41", "avx2" or "neon" caps the
+ * detected level, which is useful when comparing kernels.
+ *
+ * @return Highest usable SIMD level
+ */
+Level activeLevel();
+
+/**
+ * @return Human readable name of a SIMD level
+ */
+const char* levelName(Level level);
+
+} // namespace simd
+} // namespace audio_utils
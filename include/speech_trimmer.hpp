@@ -0,0 +1,47 @@
+#pragma once
+
+#include "vad.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace audio_utils {
+
+struct SpeechTrimConfig {
+    bool enabled = true;
+    // Audio kept after the last voiced frame, so trailing consonants survive
+    uint32_t pad_ms = 200;
+
+    static SpeechTrimConfig fromEnvironment();
+};
+
+// Samples [begin, end) of a clip
+struct SpeechSpan {
+    size_t begin = 0;
+    size_t end = 0;
+
+    bool empty() const { return end <= begin; }
+    size_t size() const { return empty() ? 0 : end - begin; }
+};
+
+/**
+ * Finds the speech in a whole clip of 16kHz mono samples, so the silence around it
+ * is not encoded and clips without any speech are not decoded at all.
+ *
+ * The clip is run through the voice activity detector the bot uses: it spans from
+ * the first speech onset, pre-roll included, to the last voiced frame of the last
+ * utterance plus `pad_ms`. A clip the detector never hears speech in is empty.
+ */
+class SpeechTrimmer {
+public:
+    SpeechTrimmer(const SpeechTrimConfig& config, const VadConfig& vad_config);
+
+    // Safe to call from several threads
+    SpeechSpan find(const float* samples, size_t count) const;
+
+private:
+    const SpeechTrimConfig config;
+    const VadConfig vad_config;
+};
+
+} // namespace audio_utils
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "streaming_decoder.hpp"
+#include "audio_rope.hpp"
+#include "ingest.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct StreamSessionStoreConfig {
+    // Independently locked parts of the session map
+    size_t shards = 16;
+    // New sessions are refused while the sessions' audio takes more than this
+    uint64_t memory_budget = 256ull * 1024 * 1024;
+    // Raw audio (48kHz stereo s16) one session may receive; later chunks are refused
+    uint64_t max_session_bytes = 150ull * 192000;
+    // Sessions without a request for this long are dropped
+    std::chrono::seconds idle_ttl{60};
+    // Freed audio blocks kept for reuse
+    size_t max_idle_blocks = 256;
+
+    static StreamSessionStoreConfig fromEnvironment();
+};
+
+/**
+ * One streamed utterance. Chunks are converted to 16kHz mono as they arrive and
+ * only appended by the request; partial transcripts are decoded in the background
+ * and picked up by long-polling.
+ */
+struct StreamSession {
+    StreamSession(std::string id, WhisperSTT& stt, const StreamingDecoderConfig& config,
+                  const std::shared_ptr<AudioBlockPool>& pool)
+        : id(std::move(id)), incoming(pool), decoder(stt, config, pool) {}
+
+    const std::string id;
+
+    std::mutex mutex;
+    std::condition_variable changed;   // A partial was published or the decoder was handed back
+    audio_utils::DiscordToStream ingest;
+    AudioRope incoming;                // Converted chunks not yet handed to the decoder
+    uint64_t received_bytes = 0;       // Raw PCM, as the client counts it
+    bool decoding = false;      // A partial job owns the decoder
+    bool dirty = false;         // Audio arrived while it was decoding
+    bool finishing = false;     // Finished or expired; takes no more chunks
+
+    // Latest partial transcript and the raw audio it covers
+    StreamingTranscript partial;
+    uint64_t partial_version = 0;
+    uint64_t partial_bytes = 0;
+
+    // Owned by the partial job while `decoding`, otherwise by whoever holds `mutex`
+    StreamingDecoder decoder;
+
+    // Last request for the session, in steady clock milliseconds
+    std::atomic<int64_t> last_active{0};
+};
+
+/**
+ * Live stream sessions, sharded by id so requests for different sessions do not
+ * contend on one lock.
+ *
+ * All sessions' audio lives in blocks of one shared pool, which bounds the memory
+ * they hold: past the budget, new sessions are refused until finished ones free
+ * their audio. Each session may also only take so much audio, so one stream cannot
+ * use up the budget of all. Sessions the client never finishes expire after the
+ * idle TTL.
+ */
+class StreamSessionStore {
+public:
+    struct Metrics {
+        size_t sessions = 0;
+        uint64_t audio_bytes = 0;   // In blocks held by sessions
+        uint64_t idle_bytes = 0;    // In blocks pooled for reuse
+        uint64_t created = 0;
+        uint64_t rejected = 0;      // Refused over the memory budget
+        uint64_t expired = 0;
+    };
+
+    // How long a refused client should wait before starting a session again
+    static constexpr std::chrono::seconds RETRY_AFTER{2};
+
+    StreamSessionStore(WhisperSTT& stt, const StreamingDecoderConfig& decoder_config,
+                       const StreamSessionStoreConfig& config);
+    ~StreamSessionStore();
+
+    StreamSessionStore(const StreamSessionStore&) = delete;
+    StreamSessionStore& operator=(const StreamSessionStore&) = delete;
+
+    // @return A new session under a fresh id, or nullptr if over the memory budget
+    std::shared_ptr<StreamSession> create();
+    // @return The session, marked active, or nullptr if there is none
+    std::shared_ptr<StreamSession> find(const std::string& id);
+    // Remove the session and hand it to the caller
+    std::shared_ptr<StreamSession> take(const std::string& id);
+
+    uint64_t maxSessionBytes() const { return config.max_session_bytes; }
+
+    Metrics metrics() const;
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::shared_ptr<StreamSession>> sessions;
+    };
+
+    Shard& shardFor(const std::string& id);
+    static int64_t nowMs();
+    void reaperLoop();
+
+    WhisperSTT& stt;
+    const StreamingDecoderConfig decoder_config;
+    const StreamSessionStoreConfig config;
+    std::shared_ptr<AudioBlockPool> pool;
+    std::vector<std::unique_ptr<Shard>> shards;
+
+    std::atomic<size_t> live{0};
+    std::atomic<uint64_t> created{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> expired{0};
+
+    std::mutex reaper_mutex;
+    bool stopping = false;
+    std::condition_variable reaper_wake;
+    std::thread reaper;
+};
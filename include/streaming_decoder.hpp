@@ -0,0 +1,86 @@
+#pragma once
+
+#include "whisper_stt.hpp"
+#include "audio_rope.hpp"
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct StreamingDecoderConfig {
+    // Uncommitted audio needed before a partial is decoded
+    size_t min_window_samples = 16000;
+    // Audio still not agreed on at this length is committed anyway; must stay below Whisper's 30s window
+    size_t max_window_samples = 20 * 16000;
+    // Tail of the committed text Whisper is prompted with
+    size_t prompt_chars = 200;
+
+    static StreamingDecoderConfig fromEnvironment();
+};
+
+struct StreamingTranscript {
+    std::string committed;  // Agreed on by two passes; never changes again
+    std::string pending;    // Latest guess at the audio after it
+};
+
+/**
+ * Incremental transcription of one streamed utterance.
+ *
+ * Only the audio after the last committed word is kept and decoded, prompted with
+ * the committed text so Whisper carries on from it. A word is committed once two
+ * consecutive passes agree on it and on everything before it (LocalAgreement-2),
+ * and the window then slides past it. Each chunk costs one decode of a bounded
+ * window, and finishing decodes only the tail, so the work per utterance grows
+ * linearly with its length instead of decoding all of it again on every chunk.
+ *
+ * Not thread safe: a session's chunks are processed one at a time.
+ */
+class StreamingDecoder {
+public:
+    struct Metrics {
+        uint64_t decodes = 0;
+        uint64_t received_samples = 0;
+        uint64_t decoded_samples = 0;   // Sum over all passes
+    };
+
+    StreamingDecoder(WhisperSTT& stt, const StreamingDecoderConfig& config, std::shared_ptr<AudioBlockPool> pool);
+
+    // Append 16kHz mono audio, taking over its blocks
+    void append(AudioRope&& audio);
+
+    // Decode the uncommitted audio on `lease` if enough is buffered, and commit what
+    // the last two passes agree on
+    StreamingTranscript update(const WhisperStatePool::Lease& lease);
+
+    // Commit the rest, decoding the tail only if audio arrived since the last pass
+    // @return The whole transcript
+    // @throws DeadlineExceeded if the tail could not be decoded by `deadline`
+    std::string finish(TranscriptionScheduler::Clock::time_point deadline = TranscriptionScheduler::Clock::time_point::max());
+
+    const Metrics& metrics() const { return stats; }
+
+private:
+    size_t windowSamples() const;
+    // Decodes on `lease`, or queues for a state by `deadline` if there is none
+    std::vector<TimedWord> decodeWindow(const WhisperStatePool::Lease* lease,
+                                        TranscriptionScheduler::Clock::time_point deadline);
+    void dropRepeated(std::vector<TimedWord>& words) const;
+    void commit(const std::vector<TimedWord>& words, size_t count);
+    void slide(size_t samples);
+    std::string pendingText() const;
+
+    WhisperSTT& stt;
+    const StreamingDecoderConfig config;
+
+    // Audio after the last committed word
+    AudioRope window;
+    bool window_decoded = false;        // The last pass saw all of `window`
+    std::vector<TimedWord> hypothesis;  // Uncommitted words of the last pass
+
+    std::string committed;
+    std::vector<std::string> committed_tail;    // Last committed words, normalized
+    std::vector<whisper_token> prompt;
+
+    Metrics stats;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "whisper_state_pool.hpp"
+
+class WhisperSTT;
+
+// 16kHz mono samples owned by the caller
+struct AudioClip {
+    const float* samples = nullptr;
+    size_t count = 0;
+};
+
+// How a transcription request may be scheduled
+struct TranscriptionOptions {
+    // Only clips with the same non-empty key share an encoder run, e.g. the speakers of
+    // one guild; clips without a key are always decoded alone
+    std::string batch_key;
+    // Bound on the wait for others to share the run (default: the configured one)
+    std::chrono::milliseconds max_batch_wait = std::chrono::milliseconds::max();
+    // Latest time the decode may start
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+};
+
+// A request's deadline passed before its decode started
+class DeadlineExceeded : public std::runtime_error {
+public:
+    DeadlineExceeded() : std::runtime_error("Deadline exceeded before transcription started") {}
+};
+
+struct TranscriptionSchedulerConfig {
+    // Decodes running at once; one per Whisper state
+    size_t workers = 4;
+    // Cores each worker is pinned to, counted from worker * pin_cores; the threads a decode
+    // starts inherit them (0 = not pinned)
+    size_t pin_cores = 0;
+    // Longest a request waits for others to share its encoder run (0 = never batch).
+    // Only spent while other decodes are running; an idle service starts at once.
+    std::chrono::milliseconds batch_wait{40};
+    // Clips longer than this are decoded alone
+    size_t batch_max_clip_samples = 8 * 16000;
+    // Audio packed into one run, silence between clips included; must fit Whisper's 30s window
+    size_t batch_max_samples = 28 * 16000;
+
+    static TranscriptionSchedulerConfig fromEnvironment(size_t workers, size_t threads_per_worker);
+};
+
+/**
+ * Queue in front of the Whisper states. Transcription requests from the HTTP
+ * handlers are decoded by a fixed set of workers, one per state.
+ *
+ * Whisper's encoder always processes a 30 second window, however short the audio.
+ * When several short clips with the same batch key are waiting, a worker packs them
+ * into one window, separated by silence, and splits the transcript back up by segment
+ * timestamps, so one encoder run serves all of them. Clips are only packed with their
+ * own key's, so what one group says can never turn up in another's transcript. A
+ * request is held back for others at most `batch_wait`, or its own bound if shorter.
+ * Clips whose text cannot be told apart are answered last, decoded again alone.
+ *
+ * Requests someone is waiting on (transcriptions and stream finishes) are queued
+ * apart from partial stream transcripts and always run first, so a burst of
+ * partials cannot delay a final transcript. A request whose deadline passes
+ * while queued is failed with DeadlineExceeded instead of being decoded.
+ */
+class TranscriptionScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Metrics {
+        uint64_t requests = 0;
+        uint64_t partials = 0;          // Of the requests, partial stream transcripts
+        uint64_t decodes = 0;           // Encoder runs
+        uint64_t batched_clips = 0;     // Requests that shared a run
+        uint64_t fallbacks = 0;         // Packed clips decoded again alone
+        uint64_t batch_wait_ms = 0;     // Total time requests were held back for batching
+        uint64_t expired = 0;           // Dropped past their deadline
+    };
+
+    TranscriptionScheduler(WhisperSTT& stt, const TranscriptionSchedulerConfig& config);
+    ~TranscriptionScheduler();
+
+    TranscriptionScheduler(const TranscriptionScheduler&) = delete;
+    TranscriptionScheduler& operator=(const TranscriptionScheduler&) = delete;
+
+    /**
+     * Transcribe a clip, blocking until done. `clip` must stay valid until it returns.
+     * @throws DeadlineExceeded if it could not start by the options' deadline
+     */
+    std::string transcribe(const AudioClip& clip, const TranscriptionOptions& options = {});
+
+    // Run `work` on a state of its own, in queue order with the transcriptions, blocking until done
+    void execute(std::function<void(const WhisperStatePool::Lease&)> work,
+                 Clock::time_point deadline = Clock::time_point::max());
+    // Queue partial-transcript `work` behind all other requests without waiting for it;
+    // it must handle its own errors
+    void post(std::function<void(const WhisperStatePool::Lease&)> work);
+
+    Metrics metrics() const;
+
+private:
+    struct Job {
+        AudioClip clip;
+        std::string batch_key;
+        std::function<void(const WhisperStatePool::Lease&)> work;   // Set for execute() and post(); never batched
+        bool partial = false;               // Queued by post()
+        Clock::time_point enqueued;
+        Clock::time_point batch_deadline;   // Latest time its run should start to batch
+        Clock::time_point deadline = Clock::time_point::max();      // Latest time it may start at all
+        std::promise<std::string> result;
+    };
+    using JobPtr = std::shared_ptr<Job>;
+
+    std::future<std::string> submit(JobPtr job);
+    bool batchable(const Job& job) const;
+    std::vector<JobPtr> collectBatch(std::unique_lock<std::mutex>& lock);
+    // Fail the job if its deadline has passed
+    bool expire(Job& job, Clock::time_point now);
+    void run(std::vector<JobPtr>& batch);
+    void workerLoop();
+    void pinWorker(size_t index);
+
+    WhisperSTT& stt;
+    const TranscriptionSchedulerConfig config;
+
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<JobPtr> finals;      // Someone is waiting on these
+    std::deque<JobPtr> partials;
+    size_t decoding = 0;
+    bool stopping = false;
+    Metrics stats;
+
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include "resampler.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace audio_utils {
+
+struct VadConfig {
+    // Sample rate of the mono frames passed to process()
+    int sample_rate = 48000;
+    // Voiced audio needed before speech is reported as started
+    uint32_t min_voiced_ms = 120;
+    // Unvoiced audio needed before speech is reported as ended
+    uint32_t hangover_ms = 500;
+    // Audio before the first voiced frame that belongs to the utterance
+    uint32_t pre_roll_ms = 200;
+
+    // Frame energy above the noise floor needed to start / continue speech (hysteresis)
+    float start_margin_db = 9.0f;
+    float continue_margin_db = 4.0f;
+    // Frames quieter than this are never voiced
+    float min_energy_dbfs = -50.0f;
+    // Share of frame energy that must fall in the 300-3400Hz speech band to start speech
+    float min_band_ratio = 0.25f;
+    // Zero crossings per second above which a frame cannot start speech (clicks, hiss)
+    float max_zero_crossing_rate = 5000.0f;
+
+    static VadConfig fromEnvironment(int sample_rate);
+};
+
+// Per-frame measurements, exposed for logging and tuning
+struct VadFrameStats {
+    float energy_dbfs = -120.0f;
+    float zero_crossing_rate = 0.0f;  // Per second
+    float band_ratio = 0.0f;
+    float noise_floor_dbfs = -120.0f;
+    bool voiced = false;
+};
+
+enum class VadEvent {
+    None,
+    SpeechStart,
+    SpeechEnd
+};
+
+/**
+ * Frame-level voice activity detector for one speaker.
+ *
+ * Audio is analyzed in 20ms mono frames. Each frame is classified from its energy
+ * against an adaptive noise floor, its zero-crossing rate and the share of energy
+ * in the speech band. Speech starts once `min_voiced_ms` of voiced frames arrive
+ * without a long gap, and ends after `hangover_ms` of unvoiced frames, so short
+ * noises never open an utterance and short pauses never close one.
+ */
+class VoiceActivityDetector {
+public:
+    static constexpr uint32_t FRAME_MS = 20;
+
+    explicit VoiceActivityDetector(const VadConfig& config);
+
+    /**
+     * @return Samples in one frame at the configured rate
+     */
+    size_t frameSamples() const { return frame_samples; }
+
+    /**
+     * Classify one frame of normalized mono samples (frameSamples() long)
+     */
+    VadEvent process(const float* frame);
+
+    /**
+     * Account for time without any input (e.g. the sender stopped transmitting).
+     * Missing audio counts as unvoiced frames.
+     */
+    VadEvent processSilence(uint32_t ms);
+
+    bool speaking() const { return state == State::Speech; }
+
+    /**
+     * Change the unvoiced audio that ends speech, e.g. per utterance; takes effect
+     * from the next frame
+     */
+    void setHangover(uint32_t ms) { config.hangover_ms = std::max(ms, FRAME_MS); }
+    uint32_t hangover() const { return config.hangover_ms; }
+
+    /**
+     * While speaking: unvoiced or missing audio still needed before SpeechEnd
+     */
+    uint32_t msUntilSpeechEnd() const;
+
+    /**
+     * On SpeechStart: how many frames before the current one belong to the
+     * utterance (the onset frames plus the pre-roll)
+     */
+    size_t onsetFrames() const { return onset_frames; }
+
+    /**
+     * Frames a caller must keep to be able to honour onsetFrames()
+     */
+    size_t lookbackFrames() const;
+
+    const VadFrameStats& lastFrame() const { return stats; }
+
+    /**
+     * Forget all state except the learned noise floor
+     */
+    void reset();
+
+private:
+    enum class State {
+        Silence,
+        Onset,
+        Speech
+    };
+
+    VadEvent advance(bool voiced);
+
+    VadConfig config;
+    size_t frame_samples;
+    float silence_remainder_ms;
+
+    // Speech band-pass FIR and the previous frame's tail it runs over
+    std::vector<float> band_filter;
+    std::vector<float> window;
+    size_t band_stride;
+    DotKernel dot;
+
+    VadFrameStats stats;
+    float noise_floor_db;
+    State state;
+    uint32_t voiced_run;      // Voiced frames since the onset began
+    uint32_t onset_length;    // Frames since the onset began
+    uint32_t unvoiced_run;    // Consecutive unvoiced frames
+    size_t onset_frames;
+};
+
+} // namespace audio_utils
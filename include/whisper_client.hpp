@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <chrono>
@@ -8,6 +9,7 @@
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <unordered_map>
 #include "httplib.h"
 
 class WhisperClient {
@@ -15,17 +17,41 @@ public:
     WhisperClient(const std::string& service_url, int retry_delay_ms = 2000);
     ~WhisperClient();
 
-    // Convert audio data to text using the remote service
-    std::string audioToText(const std::vector<uint8_t>& audio_data);
+    // Piece of raw PCM owned by the caller. Requests built from spans stream
+    // the pieces straight into the request body without gathering them first.
+    struct AudioSpan {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    // Convert audio data to text using the remote service. The service may transcribe it
+    // in one run with other clips of the same non-empty `batch_key`, never with others'.
+    std::string audioToText(const std::vector<uint8_t>& audio_data, const std::string& batch_key = "");
+    std::string audioToText(const std::vector<AudioSpan>& audio, const std::string& batch_key = "");
+
+    // Transcript of a stream so far
+    struct StreamPartial {
+        uint64_t version = 0;       // Increases with every partial; 0 = none yet
+        uint64_t audio_bytes = 0;   // Uploaded audio it covers
+        std::string committed;      // Settled; later chunks only add to it
+        std::string pending;        // May still change
+    };
 
     // Streaming API
     // Start a new streaming session, returns session id
     std::string startStream();
     // Append a chunk of raw PCM data to an existing stream session
-    // Returns partial text when available (may be empty)
-    std::string appendStream(const std::string& session_id, const std::vector<uint8_t>& audio_chunk);
-    // Finish the stream and get the transcription
+    // Returns once the service has stored it; transcription happens in the background
+    bool appendStream(const std::string& session_id, const std::vector<uint8_t>& audio_chunk);
+    bool appendStream(const std::string& session_id, const std::vector<AudioSpan>& audio);
+    // Wait up to `wait` for a partial transcript newer than `after_version`.
+    // Returns the latest one either way; version 0 if there is none or the request failed.
+    // Polls of a session reuse one keep-alive connection, so at most one may be out at a time.
+    StreamPartial waitPartial(const std::string& session_id, uint64_t after_version, std::chrono::milliseconds wait);
+    // Finish the stream and get the transcription of all of it
     std::string finishStream(const std::string& session_id);
+    // Drop the stream without transcribing it
+    bool abortStream(const std::string& session_id);
 
     // Check if the service is available
     bool isHealthy();
@@ -37,6 +63,10 @@ public:
     void stopReconnectionTask();
 
 private:
+    // Read timeout of requests, also sent as their deadline so the service drops
+    // work nobody waits for anymore
+    static constexpr int REQUEST_TIMEOUT_S = 30;
+
     std::string service_url;
     std::unique_ptr<httplib::Client> client;
     int retry_delay_ms;
@@ -45,6 +75,11 @@ private:
     std::atomic<bool> should_stop_reconnection;
     std::unique_ptr<std::thread> reconnection_thread;
     std::mutex client_mutex;
+
+    // Long-poll connection of every open stream session, apart from `client` so polls
+    // do not hold up uploads; made by startStream and closed by finishStream
+    std::mutex poll_clients_mutex;
+    std::unordered_map<std::string, std::shared_ptr<httplib::Client>> poll_clients;
     
     void initClient();
     void reconnectionLoop();
@@ -1,12 +1,11 @@
 #pragma once
 
 #include "whisper_stt.hpp"
+#include "stream_session_store.hpp"
 #include "httplib.h"
 #include <string>
 #include <memory>
 #include <vector>
-#include <unordered_map>
-#include <mutex>
 
 class WhisperService {
 public:
@@ -24,12 +23,12 @@ private:
     bool running;
 
     void setupRoutes();
-    std::string handleTranscription(const std::vector<uint8_t>& audio_data);
+    ClipTranscript handleTranscription(const std::vector<uint8_t>& audio_data, const TranscriptionOptions& options);
 
-    // In-memory stream sessions: store accumulated raw bytes per session
-    std::mutex sessions_mutex;
-    std::unordered_map<std::string, std::vector<uint8_t>> sessions;
+    void schedulePartial(const std::shared_ptr<StreamSession>& session);
+    void decodePartial(const std::shared_ptr<StreamSession>& session, const WhisperStatePool::Lease& lease);
 
-    // Serialize whisper usage across requests for safety
-    std::mutex whisper_mutex;
+    // Longest a /stream/partial request is held open
+    static constexpr uint64_t MAX_PARTIAL_WAIT_MS = 10000;
+    std::unique_ptr<StreamSessionStore> sessions;
 }; 
\ No newline at end of file
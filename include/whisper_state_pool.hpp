@@ -0,0 +1,132 @@
+#pragma once
+
+#include "whisper.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WhisperStatePoolConfig {
+    // Most states decoding at once
+    size_t max_states = 4;
+    // States beyond the first are only created while their memory fits in this budget
+    uint64_t memory_budget = 4096ull * 1024 * 1024;
+    // Threads each decode uses (0 = the cores split evenly between the states)
+    int threads_per_state = 0;
+    // States unused for this long are freed, down to one
+    std::chrono::seconds idle_timeout{120};
+
+    static WhisperStatePoolConfig fromEnvironment();
+};
+
+/**
+ * Decoding states sharing one whisper_context, so several requests can be
+ * transcribed at once. The model weights are loaded once; each state only holds
+ * its own KV cache and compute buffers.
+ *
+ * States are created on demand, up to the configured count and memory budget, and
+ * freed again after sitting idle. A request leases a free state for the length of
+ * its decode, together with that state's share of the CPU threads.
+ */
+class WhisperStatePool {
+public:
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease&& other) noexcept : pool(other.pool), state(other.state) {
+            other.pool = nullptr;
+            other.state = nullptr;
+        }
+        Lease& operator=(Lease&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool = other.pool;
+                state = other.state;
+                other.pool = nullptr;
+                other.state = nullptr;
+            }
+            return *this;
+        }
+        ~Lease() { release(); }
+
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        whisper_state* get() const { return state; }
+        int threads() const;
+        explicit operator bool() const { return state != nullptr; }
+
+        void release();
+
+    private:
+        friend class WhisperStatePool;
+        Lease(WhisperStatePool* pool, whisper_state* state) : pool(pool), state(state) {}
+
+        WhisperStatePool* pool = nullptr;
+        whisper_state* state = nullptr;
+    };
+
+    struct Metrics {
+        size_t allocated = 0;
+        size_t busy = 0;
+        size_t capacity = 0;          // States the memory budget allows
+        uint64_t state_bytes = 0;     // Measured size of one state (0 = not measured)
+        uint64_t leases = 0;
+        uint64_t waits = 0;           // Leases that had to wait for a free state
+        uint64_t reclaimed = 0;
+    };
+
+    WhisperStatePool(whisper_context* ctx, const WhisperStatePoolConfig& config);
+    ~WhisperStatePool();
+
+    WhisperStatePool(const WhisperStatePool&) = delete;
+    WhisperStatePool& operator=(const WhisperStatePool&) = delete;
+
+    /**
+     * Lease a free state, creating one if the pool may grow, or wait for one
+     * @throws std::runtime_error if no state can be created at all
+     */
+    Lease acquire();
+
+    /**
+     * @return A free state, or an empty lease if all are busy and the pool is full
+     */
+    Lease tryAcquire();
+
+    Metrics metrics() const;
+    int threadsPerState() const { return threads_per_state; }
+
+private:
+    struct IdleState {
+        whisper_state* state;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    whisper_state* takeLocked(std::unique_lock<std::mutex>& lock);
+    whisper_state* createLocked(std::unique_lock<std::mutex>& lock);
+    void release(whisper_state* state);
+    void reaperLoop();
+
+    whisper_context* const ctx;
+    const WhisperStatePoolConfig config;
+    const int threads_per_state;
+
+    mutable std::mutex mutex;
+    std::condition_variable available;
+    // Most recently used last: reused first while its caches are warm, while the
+    // ones at the front age out
+    std::vector<IdleState> idle;
+    size_t allocated = 0;
+    size_t creating = 0;
+    size_t capacity;
+    uint64_t state_bytes = 0;
+    Metrics stats;
+
+    bool stopping = false;
+    std::condition_variable reaper_wake;
+    std::thread reaper;
+};
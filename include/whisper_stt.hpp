@@ -4,21 +4,96 @@
 #include <vector>
 #include <memory>
 #include <cstdint>
+#include <functional>
+#include <atomic>
 #include "whisper.h"
+#include "ingest.hpp"
+#include "audio_tap.hpp"
+#include "speech_trimmer.hpp"
+#include "whisper_state_pool.hpp"
+#include "transcription_scheduler.hpp"
+#include "audio_context_policy.hpp"
+
+// Transcribed word and where it was heard, in samples from the start of the clip
+struct TimedWord {
+    std::string text;   // As Whisper spells it, with its leading space
+    int64_t start = 0;
+    int64_t end = 0;
+};
+
+// Transcript of a clip and how much of it was cut off as silence before decoding
+struct ClipTranscript {
+    std::string text;
+    uint64_t audio_ms = 0;
+    uint64_t trimmed_ms = 0;    // All of it if no speech was found
+    bool speech = true;         // False: not decoded at all
+};
 
 class WhisperSTT {
 public:
+    struct TrimMetrics {
+        uint64_t clips = 0;
+        uint64_t no_speech = 0;     // Answered without decoding
+        uint64_t audio_ms = 0;
+        uint64_t trimmed_ms = 0;
+    };
+
     WhisperSTT(const std::string& model_path);
     ~WhisperSTT();
 
-    // Convert audio data to text
-    // Input: Raw PCM audio data (16kHz, 16-bit, mono)
-    std::string audioToText(const std::vector<uint8_t>& audio_data);
+    // Convert audio data to text, decoding only the speech in it
+    // Input: Raw PCM audio data (48kHz, 16-bit, stereo) as received from Discord
+    // Safe to call from several threads; requests are queued for the decoding states.
+    // Throws DeadlineExceeded if decoding could not start by the options' deadline.
+    ClipTranscript audioToText(const std::vector<uint8_t>& audio_data, const TranscriptionOptions& options = {});
+
+    // Transcribe word by word, continuing the text `prompt` was tokenized from.
+    // Used by streaming sessions; never batched with other clips.
+    std::vector<TimedWord> transcribeWords(const AudioClip& clip, const std::vector<whisper_token>& prompt,
+                                           TranscriptionScheduler::Clock::time_point deadline = TranscriptionScheduler::Clock::time_point::max());
+    std::vector<whisper_token> tokenize(const std::string& text) const;
+    // Run partial-transcript `work` on a decoding state once no other request is waiting, without waiting for it
+    void schedule(std::function<void(const WhisperStatePool::Lease&)> work) { scheduler->post(std::move(work)); }
+
+    // Decoding on a leased state, for the scheduler
+    std::string decode(const WhisperStatePool::Lease& lease, const AudioClip& clip);
+    // Transcribe several clips in one run. Clips whose text cannot be told apart are
+    // flagged in `ambiguous`, to be decoded again alone.
+    std::vector<std::string> decodePacked(const WhisperStatePool::Lease& lease, const std::vector<AudioClip>& clips,
+                                          std::vector<bool>& ambiguous);
+    std::vector<TimedWord> decodeWords(const WhisperStatePool::Lease& lease, const AudioClip& clip,
+                                       const std::vector<whisper_token>& prompt);
+
+    WhisperStatePool& statePool() { return *states; }
+    WhisperStatePool::Metrics poolMetrics() const { return states->metrics(); }
+    TranscriptionScheduler::Metrics schedulerMetrics() const { return scheduler->metrics(); }
+    std::vector<AudioContextPolicy::BucketMetrics> contextMetrics() const { return context_policy.metrics(); }
+    TrimMetrics trimMetrics() const;
+
+    // Silence between packed clips, enough for Whisper to end a segment there
+    static constexpr size_t PACKED_GAP_SAMPLES = 16000;
 
 private:
+    // whisper_full on `lease` with the encoder context cut down to the clip, decoding
+    // again with the full context if the result looks truncated
+    // @return Whether Whisper succeeded
+    bool run(const WhisperStatePool::Lease& lease, whisper_full_params params, const AudioClip& clip);
+
     struct whisper_context* ctx;
-    struct whisper_state* state;
-    
-    // Convert raw PCM bytes to float samples
-    std::vector<float> convertPCMToFloat(const std::vector<uint8_t>& audio_data);
+    AudioContextPolicy context_policy;
+
+    // Decoding states sharing the context's weights
+    std::unique_ptr<WhisperStatePool> states;
+    std::unique_ptr<TranscriptionScheduler> scheduler;
+
+    // Fused stereo 48kHz int16 -> mono 16kHz float conversion
+    audio_utils::DiscordToWhisper ingest;
+    audio_utils::SpeechTrimmer trimmer;
+    std::atomic<uint64_t> trimmed_clips{0};
+    std::atomic<uint64_t> no_speech_clips{0};
+    std::atomic<uint64_t> trim_audio_ms{0};
+    std::atomic<uint64_t> trimmed_ms{0};
+
+    // Debug capture of request audio, written off the request thread
+    audio_utils::AudioTap tap;
 }; 
\ No newline at end of file
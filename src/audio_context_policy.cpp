@@ -0,0 +1,127 @@
+#include "audio_context_policy.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+namespace {
+
+// Whisper's full encoder context
+constexpr int FULL_AUDIO_CTX = 1500;
+
+// Lowercase words without punctuation, so only what was heard counts
+std::vector<std::string> words(const std::string& text) {
+    std::vector<std::string> result;
+    std::string word;
+    for (unsigned char c : text + " ") {
+        if (std::isspace(c)) {
+            if (!word.empty()) {
+                result.push_back(std::move(word));
+                word.clear();
+            }
+        } else if (std::isalnum(c) || c >= 0x80) {
+            word += static_cast<char>(std::tolower(c));
+        }
+    }
+    return result;
+}
+
+size_t wordEditDistance(const std::vector<std::string>& from, const std::vector<std::string>& to) {
+    std::vector<size_t> row(to.size() + 1);
+    for (size_t j = 0; j <= to.size(); j++) {
+        row[j] = j;
+    }
+    for (size_t i = 1; i <= from.size(); i++) {
+        size_t diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= to.size(); j++) {
+            const size_t above = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, diagonal + (from[i - 1] == to[j - 1] ? 0 : 1)});
+            diagonal = above;
+        }
+    }
+    return row[to.size()];
+}
+
+} // namespace
+
+AudioContextConfig AudioContextConfig::fromEnvironment() {
+    AudioContextConfig config;
+    config.buckets.clear();
+    std::stringstream list(config::WHISPER_AUDIO_CTX_BUCKETS);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        try {
+            const int audio_ctx = std::stoi(item);
+            if (audio_ctx > 0 && audio_ctx < FULL_AUDIO_CTX) {
+                config.buckets.push_back(audio_ctx);
+            }
+        } catch (const std::exception&) {
+            LOG_WARN("Ignoring invalid audio context bucket '{}'", item);
+        }
+    }
+    std::sort(config.buckets.begin(), config.buckets.end());
+    config.buckets.erase(std::unique(config.buckets.begin(), config.buckets.end()), config.buckets.end());
+    config.margin_samples = config::WHISPER_AUDIO_CTX_MARGIN_MS * 16;
+    config.audit_every = config::WHISPER_AUDIO_CTX_AUDIT_EVERY;
+    return config;
+}
+
+AudioContextPolicy::AudioContextPolicy(const AudioContextConfig& config) : config(config) {
+    for (int audio_ctx : config.buckets) {
+        stats.push_back({});
+        stats.back().audio_ctx = audio_ctx;
+    }
+    stats.push_back({});
+    stats.back().audio_ctx = FULL_AUDIO_CTX;
+}
+
+int AudioContextPolicy::select(size_t samples) const {
+    const size_t needed = samples + config.margin_samples;
+    for (int audio_ctx : config.buckets) {
+        if (static_cast<size_t>(audio_ctx) * SAMPLES_PER_CTX >= needed) {
+            return audio_ctx;
+        }
+    }
+    return 0;
+}
+
+bool AudioContextPolicy::shouldAudit() {
+    return config.audit_every > 0 && reduced_decodes.fetch_add(1, std::memory_order_relaxed) % config.audit_every == 0;
+}
+
+void AudioContextPolicy::record(int audio_ctx, size_t samples, std::chrono::milliseconds elapsed, bool fell_back) {
+    std::lock_guard<std::mutex> lock(mutex);
+    BucketMetrics& bucket = bucketLocked(audio_ctx);
+    bucket.decodes++;
+    bucket.fallbacks += fell_back ? 1 : 0;
+    bucket.decode_ms += static_cast<uint64_t>(elapsed.count());
+    bucket.audio_ms += samples / 16;
+}
+
+void AudioContextPolicy::recordAudit(int audio_ctx, const std::string& reduced_text, const std::string& full_text) {
+    const std::vector<std::string> reduced = words(reduced_text);
+    const std::vector<std::string> full = words(full_text);
+    const size_t errors = wordEditDistance(reduced, full);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    BucketMetrics& bucket = bucketLocked(audio_ctx);
+    bucket.audits++;
+    bucket.audit_words += full.size();
+    bucket.audit_word_errors += errors;
+}
+
+std::vector<AudioContextPolicy::BucketMetrics> AudioContextPolicy::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+AudioContextPolicy::BucketMetrics& AudioContextPolicy::bucketLocked(int audio_ctx) {
+    // select() gives 0 for the full context, which is counted last
+    for (auto& bucket : stats) {
+        if (bucket.audio_ctx == audio_ctx) {
+            return bucket;
+        }
+    }
+    return stats.back();
+}
@@ -0,0 +1,138 @@
+#include "audio_rope.hpp"
+#include "ingest.hpp"
+#include <algorithm>
+
+AudioBlockPool::AudioBlockPool(size_t max_idle_blocks) : max_idle(max_idle_blocks) {}
+
+AudioBlockPool::~AudioBlockPool() {
+    for (int16_t* block : idle) {
+        delete[] block;
+    }
+}
+
+int16_t* AudioBlockPool::acquire() {
+    in_use.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty()) {
+            int16_t* block = idle.back();
+            idle.pop_back();
+            return block;
+        }
+        allocations++;
+    }
+    return new int16_t[BLOCK_SAMPLES];
+}
+
+void AudioBlockPool::release(int16_t* block) {
+    in_use.fetch_sub(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < max_idle) {
+            idle.push_back(block);
+            return;
+        }
+    }
+    delete[] block;
+}
+
+AudioBlockPool::Metrics AudioBlockPool::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Metrics metrics;
+    metrics.blocks_in_use = in_use.load(std::memory_order_relaxed);
+    metrics.blocks_idle = idle.size();
+    metrics.allocations = allocations;
+    return metrics;
+}
+
+AudioRope::AudioRope(std::shared_ptr<AudioBlockPool> pool) : pool(std::move(pool)) {}
+
+AudioRope::~AudioRope() {
+    clear();
+}
+
+AudioRope::AudioRope(AudioRope&& other) noexcept
+    : pool(other.pool), pieces(std::move(other.pieces)), total(other.total) {
+    other.pieces.clear();
+    other.total = 0;
+}
+
+AudioRope& AudioRope::operator=(AudioRope&& other) noexcept {
+    if (this != &other) {
+        clear();
+        pool = other.pool;
+        pieces = std::move(other.pieces);
+        total = other.total;
+        other.pieces.clear();
+        other.total = 0;
+    }
+    return *this;
+}
+
+void AudioRope::append(const int16_t* samples, size_t count) {
+    total += count;
+    while (count > 0) {
+        if (pieces.empty() || pieces.back().end == AudioBlockPool::BLOCK_SAMPLES) {
+            pieces.push_back({pool->acquire(), 0, 0});
+        }
+        Piece& tail = pieces.back();
+        const size_t n = std::min<size_t>(count, AudioBlockPool::BLOCK_SAMPLES - tail.end);
+        std::copy_n(samples, n, tail.block + tail.end);
+        tail.end += static_cast<uint32_t>(n);
+        samples += n;
+        count -= n;
+    }
+}
+
+void AudioRope::append(AudioRope&& other) {
+    // Only whole blocks are moved, and only behind a full tail; the rest is copied into
+    // the tail. Splicing partly filled blocks would leave a gap behind every append.
+    for (const Piece& piece : other.pieces) {
+        const bool tail_full = pieces.empty() || pieces.back().end == AudioBlockPool::BLOCK_SAMPLES;
+        const bool whole = piece.begin == 0 && piece.end == AudioBlockPool::BLOCK_SAMPLES;
+        if (whole && tail_full && other.pool == pool) {
+            pieces.push_back(piece);
+            total += piece.end;
+            continue;
+        }
+        append(piece.block + piece.begin, piece.end - piece.begin);
+        // Blocks go back to the pool they came from
+        other.pool->release(piece.block);
+    }
+    other.pieces.clear();
+    other.total = 0;
+}
+
+void AudioRope::dropFront(size_t count) {
+    count = std::min(count, total);
+    total -= count;
+    while (count > 0) {
+        Piece& head = pieces.front();
+        const size_t n = head.end - head.begin;
+        if (count < n) {
+            head.begin += static_cast<uint32_t>(count);
+            return;
+        }
+        pool->release(head.block);
+        pieces.pop_front();
+        count -= n;
+    }
+}
+
+void AudioRope::clear() {
+    for (const Piece& piece : pieces) {
+        pool->release(piece.block);
+    }
+    pieces.clear();
+    total = 0;
+}
+
+void AudioRope::copyTo(std::vector<float>& output) const {
+    static const audio_utils::PcmToFloatKernel convert = audio_utils::pcmToFloatKernel(1);
+    output.resize(total);
+    float* out = output.data();
+    for (const Piece& piece : pieces) {
+        convert(piece.block + piece.begin, piece.end - piece.begin, out);
+        out += piece.end - piece.begin;
+    }
+}
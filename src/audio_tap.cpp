@@ -0,0 +1,221 @@
+#include "audio_tap.hpp"
+#include "audio_utils.hpp"
+#include "config.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <system_error>
+
+namespace audio_utils {
+
+AudioTapConfig AudioTapConfig::fromEnvironment() {
+    AudioTapConfig config;
+    config.sample_every = config::AUDIO_TAP_SAMPLE_EVERY;
+    config.on_empty_transcript = config::AUDIO_TAP_ON_EMPTY != 0;
+    config.directory = config::AUDIO_TAP_DIR;
+    config.byte_budget = config::AUDIO_TAP_BUDGET_MB * 1024 * 1024;
+    return config;
+}
+
+#ifndef DIGI_ELLIE_DISABLE_AUDIO_TAP
+
+namespace {
+
+const char* stageName(TapStage stage) {
+    switch (stage) {
+        case TapStage::Input: return "input_48khz_stereo";
+        case TapStage::WhisperInput: return "whisper_16khz_mono";
+        default: return "unknown";
+    }
+}
+
+std::string timestamp() {
+    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    char buffer[32];
+    std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &local);
+    return buffer;
+}
+
+} // namespace
+
+void AudioTap::Capture::commit(const std::string& transcript) {
+    if (!tap) return;
+
+    const char* reason = nullptr;
+    if (sampled) {
+        reason = "sampled";
+    } else if (tap->config.on_empty_transcript && transcript.empty()) {
+        reason = "empty";
+    }
+
+    if (reason != nullptr && !clips.empty()) {
+        // Copy the views now; the caller's buffers may be reused after this returns
+        auto batch = std::make_unique<Batch>();
+        batch->id = id;
+        batch->reason = reason;
+        batch->clips = std::move(clips);
+        for (auto& clip : batch->clips) {
+            if (clip.pcm_view) {
+                clip.pcm.assign(clip.pcm_view, clip.pcm_view + clip.count);
+                clip.pcm_view = nullptr;
+            } else if (clip.float_view) {
+                clip.samples.assign(clip.float_view, clip.float_view + clip.count);
+                clip.float_view = nullptr;
+            }
+        }
+
+        if (tap->queue.tryPush(batch.get())) {
+            batch.release();
+            tap->pending.fetch_add(1, std::memory_order_release);
+            tap->pending.notify_one();
+        } else {
+            uint64_t total = tap->dropped.fetch_add(1, std::memory_order_relaxed) + 1;
+            LOG_WARN("Audio tap queue full, dropped capture {} ({} dropped so far)", id, total);
+        }
+    }
+
+    clips.clear();
+    tap = nullptr;
+}
+
+AudioTap::AudioTap(AudioTapConfig config)
+    : config(std::move(config)), queue(std::max<size_t>(2, this->config.queue_capacity)) {
+    if (!this->config.enabled()) {
+        LOG_INFO("Audio tap disabled");
+        return;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(this->config.directory, ec);
+    if (ec) {
+        LOG_ERROR("Failed to create audio tap directory {}: {}", this->config.directory, ec.message());
+        this->config.sample_every = 0;
+        this->config.on_empty_transcript = false;
+        return;
+    }
+
+    loadExistingFiles();
+    writer = std::thread(&AudioTap::writerLoop, this);
+    LOG_INFO("Audio tap enabled: sample 1 in {}, on empty transcript: {}, directory {}, budget {} bytes",
+             this->config.sample_every, this->config.on_empty_transcript,
+             this->config.directory, this->config.byte_budget);
+}
+
+AudioTap::~AudioTap() {
+    stopping.store(true, std::memory_order_release);
+    pending.fetch_add(1, std::memory_order_release);
+    pending.notify_one();
+    if (writer.joinable()) {
+        writer.join();
+    }
+
+    // Anything still queued after the writer exits is discarded
+    while (auto batch = queue.tryPop()) {
+        delete *batch;
+    }
+}
+
+AudioTap::Capture AudioTap::begin() {
+    Capture capture;
+    if (!config.enabled()) {
+        return capture;
+    }
+
+    uint64_t id = request_counter.fetch_add(1, std::memory_order_relaxed);
+    capture.sampled = config.sample_every > 0 && id % config.sample_every == 0;
+    if (capture.sampled || config.on_empty_transcript) {
+        capture.tap = this;
+        capture.id = id;
+    }
+    return capture;
+}
+
+void AudioTap::writerLoop() {
+    uint32_t seen = 0;
+    while (true) {
+        pending.wait(seen, std::memory_order_acquire);
+        seen = pending.load(std::memory_order_acquire);
+
+        while (auto batch = queue.tryPop()) {
+            std::unique_ptr<Batch> owned(*batch);
+            writeBatch(*owned);
+        }
+
+        if (stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+    }
+}
+
+void AudioTap::writeBatch(const Batch& batch) {
+    std::filesystem::path directory(config.directory);
+    std::string prefix = timestamp() + "_" + std::to_string(batch.id) + "_" + batch.reason + "_";
+
+    for (const auto& clip : batch.clips) {
+        std::string path = (directory / (prefix + stageName(clip.stage) + ".wav")).string();
+        bool saved = false;
+        uint64_t size = 44;
+        if (!clip.pcm.empty()) {
+            saved = savePCMToWav(path, clip.pcm, clip.sample_rate, clip.channels);
+            size += clip.pcm.size();
+        } else if (!clip.samples.empty()) {
+            saved = saveFloatToWav(path, clip.samples, clip.sample_rate, clip.channels);
+            size += clip.samples.size() * sizeof(int16_t);
+        }
+
+        if (saved) {
+            written_files.push_back({path, size});
+            written_bytes += size;
+        }
+    }
+
+    enforceBudget();
+}
+
+void AudioTap::enforceBudget() {
+    size_t removed = 0;
+    while (written_bytes > config.byte_budget && removed < written_files.size()) {
+        const auto& oldest = written_files[removed];
+        std::error_code ec;
+        std::filesystem::remove(oldest.path, ec);
+        if (ec) {
+            LOG_WARN("Failed to rotate audio tap file {}: {}", oldest.path, ec.message());
+        }
+        written_bytes -= std::min(written_bytes, oldest.size);
+        removed++;
+    }
+    if (removed > 0) {
+        written_files.erase(written_files.begin(), written_files.begin() + removed);
+        LOG_DEBUG("Rotated {} audio tap files, {} bytes retained", removed, written_bytes);
+    }
+}
+
+void AudioTap::loadExistingFiles() {
+    // Captures from earlier runs count against the budget, oldest first
+    std::vector<std::pair<std::filesystem::file_time_type, WrittenFile>> existing;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(config.directory, ec)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".wav") continue;
+        existing.push_back({entry.last_write_time(), {entry.path().string(), entry.file_size()}});
+    }
+    std::sort(existing.begin(), existing.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    for (auto& [time, file] : existing) {
+        written_bytes += file.size;
+        written_files.push_back(std::move(file));
+    }
+    enforceBudget();
+}
+
+#endif
+
+} // namespace audio_utils
@@ -1,4 +1,5 @@
 #include "audio_utils.hpp"
+#include "resampler.hpp"
 #include "logging.hpp"
 #include <fstream>
 #include <cstring>
@@ -86,42 +87,20 @@ std::vector<uint8_t> downsamplePCM(const std::vector<uint8_t>& input_data, int i
         return input_data;
     }
     
-    // Calculate the ratio between input and output sample rates
-    double ratio = static_cast<double>(input_sample_rate) / output_sample_rate;
-    
-    // Convert input bytes to int16_t samples
     const int16_t* input_samples = reinterpret_cast<const int16_t*>(input_data.data());
     size_t input_sample_count = input_data.size() / sizeof(int16_t);
     
-    // Calculate output sample count
-    size_t output_sample_count = static_cast<size_t>(std::ceil(input_sample_count / ratio));
-    
-    // Create output buffer for int16_t samples
-    std::vector<int16_t> output_samples(output_sample_count);
-    
-    LOG_INFO("Downsampling from {}Hz to {}Hz (ratio: {})", input_sample_rate, output_sample_rate, ratio);
-    LOG_INFO("Input samples: {}, Output samples: {}", input_sample_count, output_sample_count);
-    
-    // Simple linear interpolation downsampling
-    for (size_t i = 0; i < output_sample_count; i++) {
-        // Calculate the corresponding position in the input
-        double input_pos = i * ratio;
-        size_t input_idx = static_cast<size_t>(input_pos);
-        
-        // Ensure we don't go out of bounds
-        if (input_idx >= input_sample_count) {
-            input_idx = input_sample_count - 1;
-        }
-        
-        // Simple point sampling (take the nearest sample)
-        output_samples[i] = input_samples[input_idx];
-    }
+    // Band-limited polyphase resampling straight into the output bytes
+    PolyphaseResampler resampler(input_sample_rate, output_sample_rate);
+    std::vector<uint8_t> output_data(resampler.maxOutputCount(input_sample_count) * sizeof(int16_t));
+    int16_t* output_samples = reinterpret_cast<int16_t*>(output_data.data());
     
-    // Convert output samples back to bytes
-    std::vector<uint8_t> output_data(output_samples.size() * sizeof(int16_t));
-    std::memcpy(output_data.data(), output_samples.data(), output_data.size());
+    size_t output_sample_count = resampler.process(input_samples, input_sample_count, output_samples);
+    output_sample_count += resampler.flush(output_samples + output_sample_count);
+    output_data.resize(output_sample_count * sizeof(int16_t));
     
-    LOG_INFO("Downsampling complete: {} bytes -> {} bytes", input_data.size(), output_data.size());
+    LOG_INFO("Resampled {}Hz -> {}Hz: {} samples -> {} samples", 
+             input_sample_rate, output_sample_rate, input_sample_count, output_sample_count);
     return output_data;
 }
 
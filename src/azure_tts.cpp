@@ -68,6 +68,21 @@ std::string AzureTTS::getAccessToken() {
 }
 
 std::vector<uint8_t> AzureTTS::textToSpeech(const std::string& text, const std::string& voice) {
+    std::vector<uint8_t> audio;
+    textToSpeechStream(text, voice, [&audio](const uint8_t* data, size_t size) {
+        audio.insert(audio.end(), data, data + size);
+    });
+
+    // Validate audio data size
+    size_t expected_sample_size = 2; // 16-bit = 2 bytes per sample
+    if (audio.size() % expected_sample_size != 0) {
+        throw std::runtime_error("Received malformed audio data: size is not aligned with 16-bit samples");
+    }
+    return audio;
+}
+
+void AzureTTS::textToSpeechStream(const std::string& text, const std::string& voice, const AudioChunkCallback& on_audio,
+                                  const CancellationToken& cancel) {
     // Get access token
     std::string token = getAccessToken();
     
@@ -84,66 +99,76 @@ std::vector<uint8_t> AzureTTS::textToSpeech(const std::string& text, const std::
     std::string host = region + ".tts.speech.microsoft.com";
     LOG_INFO("Connecting to TTS service: {}", host);
 
-    httplib::SSLClient* cli = new httplib::SSLClient(host.c_str());
+    httplib::SSLClient cli(host.c_str());
     LOG_INFO("Using SSL for TTS connection");
 
-    if (!cli) {
-        throw std::runtime_error("Failed to create HTTP client");
-    }
-
-    cli->set_connection_timeout(10);
+    cli.set_connection_timeout(10);
     
-    // Set headers
-    httplib::Headers headers = {
+    // Build the request by hand so the body can be consumed as it arrives
+    httplib::Request req;
+    req.method = "POST";
+    req.path = "/cognitiveservices/v1";
+    req.headers = {
         {"X-Microsoft-OutputFormat", "raw-24khz-16bit-mono-pcm"},
         {"Content-Type", "application/ssml+xml"},
         {"Host", host},
-        {"Content-Length", std::to_string(ssml_text.length())},
         {"Authorization", "Bearer " + token},
         {"User-Agent", config::AZURE_SPEECH_APP_NAME}
     };
+    req.body = ssml_text;
 
     // Print request details for debugging
     LOG_DEBUG("Request Headers:");
-    for (const auto& header : headers) {
+    for (const auto& header : req.headers) {
         if (header.first != "Authorization") { // Don't print the auth token
             LOG_DEBUG("{}: {}", header.first, header.second);
         }
     }
     LOG_DEBUG("Request Body:\n{}", ssml_text);
+
+    int status = 0;
+    size_t received = 0;
+    std::string error_body;
+    req.response_handler = [&status](const httplib::Response& response) {
+        status = response.status;
+        LOG_INFO("Got TTS response with status: {}", status);
+        LOG_DEBUG("Response Headers:");
+        for (const auto& header : response.headers) {
+            LOG_DEBUG("{}: {}", header.first, header.second);
+        }
+        return true;
+    };
+    req.content_receiver = [&](const char* data, size_t length, uint64_t, uint64_t) {
+        if (status != 200) {
+            error_body.append(data, length);
+            return true;
+        }
+        received += length;
+        on_audio(reinterpret_cast<const uint8_t*>(data), length);
+        return !cancel.cancelled();
+    };
     
     LOG_INFO("Sending TTS request...");
-    auto result = cli->Post("/cognitiveservices/v1", headers, ssml_text, "application/ssml+xml");
-    
-    // Clean up the client
-    delete cli;
+    auto stop = cancel.onCancel([&cli] { cli.stop(); });
+    auto result = cli.send(req);
+    stop.reset();
+
+    if (cancel.cancelled()) {
+        LOG_INFO("TTS request cancelled after {} bytes", received);
+        return;
+    }
     
     if (result) {
-        LOG_INFO("Got TTS response with status: {}", result->status);
-        LOG_DEBUG("Response Headers:");
-        for (const auto& header : result->headers) {
-            LOG_DEBUG("{}: {}", header.first, header.second);
-        }
-        
-        if (result->status == 200) {
-            const std::string& body = result->body;
-            LOG_INFO("Received audio data of size: {} bytes", body.size());
-            
-            // Validate audio data size
-            size_t expected_sample_size = 2; // 16-bit = 2 bytes per sample
-            if (body.size() % expected_sample_size != 0) {
-                throw std::runtime_error("Received malformed audio data: size is not aligned with 16-bit samples");
-            }
-            
-            return std::vector<uint8_t>(body.begin(), body.end());
+        if (status == 200) {
+            LOG_INFO("Received audio data of size: {} bytes", received);
         } else {
-            LOG_ERROR("Error Response Body: {}", result->body);
+            LOG_ERROR("Error Response Body: {}", error_body);
             throw std::runtime_error("Failed to convert text to speech: HTTP " + 
-                std::to_string(result->status) + " - " + result->body);
+                std::to_string(status) + " - " + error_body);
         }
     } else {
         auto err = result.error();
         LOG_ERROR("TTS connection error code: {}", static_cast<int>(err));
         throw std::runtime_error("Failed to connect to Azure TTS: Connection error - " + std::string(httplib::to_string(err)));
     }
-} 
\ No newline at end of file
+}
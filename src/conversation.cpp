@@ -1,12 +1,41 @@
 #include "conversation.hpp"
 #include <nlohmann/json.hpp>
+#include <mutex>
 #include <sstream>
 
 using json = nlohmann::json;
 
+// Replies can be generated on several threads at once (speculatively among them)
+static std::mutex historyMutex;
 static json conversationHistory = json::array();
+// Bumped on every change, so a fork can tell whether it is still current
+static uint64_t historyVersion = 0;
+
+static json formatUserMessage(const std::vector<std::pair<std::string, std::string>>& speakerLines) {
+    // Format the user input to include each speaker's name in the content
+    std::ostringstream formattedInput;
+    for (size_t i = 0; i < speakerLines.size(); i++) {
+        if (i > 0) {
+            formattedInput << "\n";
+        }
+        formattedInput << "[" << speakerLines[i].first << "]: " << speakerLines[i].second;
+    }
+
+    // Following Ollama's format
+    return {
+        {"role", "user"},
+        {"content", formattedInput.str()}
+    };
+}
+
+static json formatUserMessage(const std::string& userInput, const std::string& userName) {
+    return formatUserMessage({{userName, userInput}});
+}
 
 void initializeConversation() {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    historyVersion++;
+
     // Add system prompt as initial user message
     conversationHistory.push_back({
         {"role", "system"},
@@ -704,29 +733,77 @@ Stay in character."}
 }
 
 std::string buildPrompt(const std::string& userInput, const std::string& userName) {
-    // Format the user input to include their name in the content
-    std::ostringstream formattedInput;
-    formattedInput << "[" << userName << "]: " << userInput;
-    
-    // Add the message to history following Ollama's format
-    json userMessage = {
-        {"role", "user"},
-        {"content", formattedInput.str()}
-    };
-    conversationHistory.push_back(userMessage);
+    std::lock_guard<std::mutex> lock(historyMutex);
+    conversationHistory.push_back(formatUserMessage(userInput, userName));
+    historyVersion++;
     
     return conversationHistory.dump();
 }
 
+std::string buildPrompt(const std::vector<std::pair<std::string, std::string>>& speakerLines) {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    conversationHistory.push_back(formatUserMessage(speakerLines));
+    historyVersion++;
+
+    return conversationHistory.dump();
+}
+
+std::string forkPrompt(const std::string& userInput, const std::string& userName, uint64_t& version) {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    json fork = conversationHistory;
+    fork.push_back(formatUserMessage(userInput, userName));
+    version = historyVersion;
+    return fork.dump();
+}
+
+bool commitExchange(const std::string& userInput, const std::string& userName, const std::string& response, uint64_t version) {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    if (version != historyVersion) {
+        return false;
+    }
+    conversationHistory.push_back(formatUserMessage(userInput, userName));
+    conversationHistory.push_back({
+        {"role", "assistant"},
+        {"content", response}
+    });
+    historyVersion++;
+    return true;
+}
+
 void addEllieResponse(const std::string& response) {
     json assistantMessage = {
         {"role", "assistant"},
         {"content", response}
     };
+    std::lock_guard<std::mutex> lock(historyMutex);
     conversationHistory.push_back(assistantMessage);
+    historyVersion++;
+}
+
+// The latest copy of `message`; replies to other prompts may have been added after it
+static void retractMessage(const json& message) {
+    std::lock_guard<std::mutex> lock(historyMutex);
+    for (size_t i = conversationHistory.size(); i-- > 0;) {
+        if (conversationHistory[i] == message) {
+            conversationHistory.erase(i);
+            historyVersion++;
+            return;
+        }
+    }
+}
+
+void retractPrompt(const std::string& userInput, const std::string& userName) {
+    retractMessage(formatUserMessage(userInput, userName));
+}
+
+void retractPrompt(const std::vector<std::pair<std::string, std::string>>& speakerLines) {
+    retractMessage(formatUserMessage(speakerLines));
 }
 
 void clearHistory() {
-    conversationHistory.clear();
+    {
+        std::lock_guard<std::mutex> lock(historyMutex);
+        conversationHistory.clear();
+    }
     initializeConversation();  // Reinitialize with system prompt
 }
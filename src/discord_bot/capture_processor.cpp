@@ -0,0 +1,354 @@
+#include "discord_bot/capture_processor.hpp"
+#include "ingest.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace discord {
+
+    CaptureProcessor::CaptureProcessor(TurnPipeline& pipeline, const Config& config, uint64_t now_ms)
+        : pipeline(pipeline), config(config),
+          ring_pool(FrameRing::STORAGE_BYTES, 4, config.max_users),
+          utterance_pool(FrameStore::CHUNK_BYTES, 8, config.max_utterance_chunks),
+          ready_users(config.max_users * 2),
+          endpoints(now_ms), current_ms(now_ms),
+          vad_downmix(audio_utils::pcmToFloatKernel(2)),
+          vad_frame(VOICE_FRAME_BYTES / 4) {}
+
+    CaptureProcessor::~CaptureProcessor() {
+        releaseClosedSessions();
+    }
+
+    bool CaptureProcessor::receive(std::shared_ptr<GuildVoiceSession> session, uint64_t user_id,
+                                   const uint8_t* audio, size_t size, uint64_t arrival_ms) {
+        VoiceUser* user = session->findOrAddUser(user_id);
+        if (user == nullptr || !session->pushAudio(*user, audio, size, arrival_ms)) {
+            reject(*session, user_id, arrival_ms);
+            return false;
+        }
+        packets.fetch_add(1, std::memory_order_relaxed);
+        return enqueue(std::move(session), user);
+    }
+
+    void CaptureProcessor::reject(const GuildVoiceSession& session, uint64_t user_id, uint64_t arrival_ms) {
+        const uint64_t rejected = rejected_packets.fetch_add(1, std::memory_order_relaxed) + 1;
+
+        // Every packet of a new speaker lands here while the cap holds; say so once in a while
+        constexpr uint64_t LOG_INTERVAL_MS = 10000;
+        uint64_t last = last_reject_log_ms.load(std::memory_order_relaxed);
+        if ((last == 0 || arrival_ms >= last + LOG_INTERVAL_MS) &&
+            last_reject_log_ms.compare_exchange_strong(last, arrival_ms, std::memory_order_relaxed)) {
+            LOG_WARN("Voice user cap reached ({} receive rings in use, {} users in guild {}), dropping audio of user {}; {} packets dropped so far",
+                     ring_pool.blocksInUse(), session.userCount(), session.guildId(), user_id, rejected);
+        }
+    }
+
+    bool CaptureProcessor::requeue(std::shared_ptr<GuildVoiceSession> session, uint64_t user_id) {
+        VoiceUser* user = session->findUser(user_id);
+        return user != nullptr && enqueue(std::move(session), user);
+    }
+
+    bool CaptureProcessor::enqueue(std::shared_ptr<GuildVoiceSession> session, VoiceUser* user) {
+        // Only once until drained: the drain sees everything pushed before it starts
+        if (user->queued.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        ready_users.tryPush(ReadyUser{std::move(session), user});
+        return true;
+    }
+
+    void CaptureProcessor::retire(std::shared_ptr<GuildVoiceSession> session) {
+        std::lock_guard<std::mutex> lock(closed_sessions_mutex);
+        closed_sessions.push_back(std::move(session));
+    }
+
+    void CaptureProcessor::poll(uint64_t now_ms) {
+        current_ms = std::max(current_ms, now_ms);
+        releaseClosedSessions();
+        releaseIdleRings();
+
+        // Utterances whose speaker went quiet end exactly at their deadline
+        endpoints.advance(current_ms, [this](TimerWheel::Timer& timer) {
+            checkForSilenceAndTranscribe(*reinterpret_cast<VoiceUser*>(timer.key));
+        });
+
+        while (auto ready = ready_users.tryPop()) {
+            VoiceUser* user = ready->user;
+            // Cleared before draining, so audio pushed from now on queues the user again
+            user->queued.store(false, std::memory_order_release);
+            if (ready->session->closing()) {
+                continue;
+            }
+            drainUserAudio(*user);
+            if (!user->state.holds_ring &&
+                user->ring_state.load(std::memory_order_acquire) != VoiceUser::RING_DETACHED) {
+                user->state.holds_ring = true;
+                ring_holders.push_back(RingHolder{ready->session, user});
+            }
+            if (user->state.speech_ended) {
+                endSpeech(user->state);
+            } else {
+                armEndpoint(user->state);
+            }
+        }
+    }
+
+    void CaptureProcessor::cancelEndpoints(const std::vector<std::shared_ptr<GuildVoiceSession>>& sessions) {
+        releaseClosedSessions();
+        for (const auto& session : sessions) {
+            session->forEachUser([this](VoiceUser& user) { endpoints.cancel(user.state.endpoint_timer); });
+        }
+    }
+
+    CaptureProcessor::Metrics CaptureProcessor::metrics() const {
+        std::lock_guard<std::mutex> lock(metrics_mutex);
+        Metrics metrics = stats;
+        metrics.packets = packets.load(std::memory_order_relaxed);
+        metrics.rejected_packets = rejected_packets.load(std::memory_order_relaxed);
+        return metrics;
+    }
+
+    void CaptureProcessor::releaseClosedSessions() {
+        std::vector<std::shared_ptr<GuildVoiceSession>> closed;
+        {
+            std::lock_guard<std::mutex> lock(closed_sessions_mutex);
+            closed.swap(closed_sessions);
+        }
+        for (const auto& session : closed) {
+            // Utterances in progress are dropped; turns already in the pipeline finish
+            session->forEachUser([this](VoiceUser& user) {
+                endpoints.cancel(user.state.endpoint_timer);
+                user.state.turn.reset();
+                user.state.utterance.reset();
+            });
+        }
+    }
+
+    void CaptureProcessor::releaseIdleRings() {
+        if (current_ms < next_ring_sweep_ms) {
+            return;
+        }
+        const uint64_t idle_ms = static_cast<uint64_t>(config.user_idle_timeout.count());
+        next_ring_sweep_ms = current_ms + std::max<uint64_t>(idle_ms / 4, 1000);
+
+        uint64_t released = 0;
+        for (size_t i = 0; i < ring_holders.size();) {
+            auto session = ring_holders[i].session.lock();
+            // A closed session's rings go back to the pool with it
+            bool drop = !session || session->closing();
+            if (!drop) {
+                VoiceUser& user = *ring_holders[i].user;
+                const auto& state = user.state;
+                const bool idle = !state.is_speaking && !state.speech_ended && !state.turn &&
+                                  current_ms >= state.vad_time_ms + idle_ms;
+                if (idle && session->releaseRing(user)) {
+                    user.state.holds_ring = false;
+                    released++;
+                    drop = true;
+                }
+            }
+            if (drop) {
+                ring_holders[i] = std::move(ring_holders.back());
+                ring_holders.pop_back();
+            } else {
+                i++;
+            }
+        }
+        if (released > 0) {
+            LOG_DEBUG("Released the receive rings of {} idle voice users ({} still held)", released, ring_holders.size());
+            std::lock_guard<std::mutex> lock(metrics_mutex);
+            stats.released_rings += released;
+        }
+    }
+
+    void CaptureProcessor::drainUserAudio(VoiceUser& user) {
+        auto& state = user.state;
+        const uint64_t user_id = user.user_id;
+        if (!state.vad) {
+            state.vad = std::make_unique<audio_utils::VoiceActivityDetector>(config.vad);
+            state.lookback.resize(state.vad->lookbackFrames() * VOICE_FRAME_BYTES);
+            state.endpointer = std::make_unique<audio_utils::Endpointer>(config.endpointer);
+        }
+
+        uint64_t drops = user.ring.dropped();
+        if (drops != state.reported_drops) {
+            LOG_WARN("Dropped {} audio frames from user {}, processing fell behind", drops - state.reported_drops, user_id);
+            state.reported_drops = drops;
+        }
+
+        uint64_t arrival_ms = 0;
+        uint64_t frames = 0;
+        while (const uint8_t* frame = user.ring.front(arrival_ms)) {
+            // A gap in packets is silence the sender didn't transmit
+            if (state.vad_time_ms != 0 && arrival_ms > state.vad_time_ms + config.packet_gap_tolerance.count()) {
+                const uint32_t gap_ms = static_cast<uint32_t>(arrival_ms - state.vad_time_ms);
+                if (state.is_speaking) {
+                    applyHangover(state);
+                    state.endpointer->observeGap(gap_ms);
+                }
+                if (state.vad->processSilence(gap_ms) == audio_utils::VadEvent::SpeechEnd) {
+                    state.speech_ended = true;
+                }
+                state.lookback_count = 0;
+            }
+            state.vad_time_ms = std::max(state.vad_time_ms, arrival_ms);
+
+            // Finalized before the next frame, which may already start the user's next utterance
+            if (state.speech_ended) {
+                endSpeech(state);
+            }
+            processAudioFrame(user, frame);
+            user.ring.pop();
+            frames++;
+        }
+
+        std::lock_guard<std::mutex> lock(metrics_mutex);
+        stats.frames += frames;
+    }
+
+    void CaptureProcessor::processAudioFrame(VoiceUser& user, const uint8_t* frame) {
+        auto& state = user.state;
+        const uint64_t user_id = user.user_id;
+        vad_downmix(reinterpret_cast<const int16_t*>(frame), vad_frame.size(), vad_frame.data());
+        if (state.is_speaking) {
+            applyHangover(state);
+        }
+        auto event = state.vad->process(vad_frame.data());
+
+        const size_t lookback_capacity = state.lookback.size() / VOICE_FRAME_BYTES;
+        if (event == audio_utils::VadEvent::SpeechStart && !state.is_speaking) {
+            beginSpeech(user);
+
+            // Replay the onset and pre-roll that were held back while the VAD decided
+            size_t replay = std::min(state.vad->onsetFrames(), state.lookback_count);
+            for (size_t i = replay; i > 0; i--) {
+                size_t slot = (state.lookback_next + lookback_capacity - i) % lookback_capacity;
+                appendSpeech(user_id, state, state.lookback.data() + slot * VOICE_FRAME_BYTES);
+            }
+            state.lookback_count = 0;
+        }
+        if (state.is_speaking && !state.speech_ended) {
+            state.endpointer->observeFrame(state.vad->lastFrame());
+        }
+
+        if ((user.session.recording() || state.is_speaking) && !state.speech_ended) {
+            appendSpeech(user_id, state, frame);
+            if (event == audio_utils::VadEvent::SpeechEnd) {
+                state.speech_ended = true;
+                LOG_DEBUG("User {} stopped speaking", user_id);
+            }
+        } else if (lookback_capacity > 0) {
+            std::memcpy(state.lookback.data() + state.lookback_next * VOICE_FRAME_BYTES, frame, VOICE_FRAME_BYTES);
+            state.lookback_next = (state.lookback_next + 1) % lookback_capacity;
+            state.lookback_count = std::min(state.lookback_count + 1, lookback_capacity);
+        }
+    }
+
+    void CaptureProcessor::beginSpeech(VoiceUser& user) {
+        auto& state = user.state;
+        const uint64_t user_id = user.user_id;
+        state.is_speaking = true;
+        state.speech_ended = false;
+        state.utterance = FrameStore::create(utterance_pool);
+        state.announced_frames = 0;
+        state.endpointer->beginUtterance(state.vad_time_ms);
+        const auto& frame_stats = state.vad->lastFrame();
+        LOG_DEBUG("User {} started speaking ({:.1f} dBFS, floor {:.1f} dBFS, band ratio {:.2f})",
+                  user_id, frame_stats.energy_dbfs, frame_stats.noise_floor_dbfs, frame_stats.band_ratio);
+
+        // Ellie stops talking and drops any reply still in the works when someone talks over her
+        const uint64_t guild_id = user.session.guildId();
+        size_t cancelled = pipeline.bargeIn(guild_id);
+        PlaybackEngine::Metrics playback = user.session.playback().metrics();
+        if (cancelled > 0 || playback.queued_streams > 0) {
+            user.session.playback().flush();
+            LOG_INFO("Barge-in by user {} in guild {}: cancelled {} replies", user_id, guild_id, cancelled);
+            std::lock_guard<std::mutex> lock(metrics_mutex);
+            stats.barge_ins++;
+        }
+
+        // The streaming session is opened by the pipeline, off this thread
+        state.turn = pipeline.begin(user_id, guild_id, state.utterance);
+    }
+
+    void CaptureProcessor::appendSpeech(uint64_t user_id, UserAudioState& state, const uint8_t* frame) {
+        if (!state.utterance) {
+            state.utterance = FrameStore::create(utterance_pool);
+        }
+        if (!state.utterance->append(frame)) {
+            LOG_WARN("Utterance of user {} is at its size limit, dropping audio", user_id);
+            return;
+        }
+
+        // Let the uploader know once enough new audio is available
+        if (state.turn && state.utterance->frames() - state.announced_frames >= config.min_stream_frames) {
+            state.announced_frames = state.utterance->frames();
+            pipeline.audioAvailable(state.turn);
+        }
+    }
+
+    void CaptureProcessor::applyHangover(UserAudioState& state) {
+        auto cue = state.turn ? state.turn->transcript_cue.load() : audio_utils::TranscriptCue::Unknown;
+        state.vad->setHangover(state.endpointer->hangoverMs(cue));
+    }
+
+    void CaptureProcessor::armEndpoint(UserAudioState& state) {
+        if (!state.is_speaking || !state.vad) {
+            endpoints.cancel(state.endpoint_timer);
+            return;
+        }
+        applyHangover(state);
+
+        // If nothing else arrives, the VAD's hangover runs out this long after the last
+        // frame; packet gaps shorter than the jitter tolerance are never counted
+        uint64_t wait_ms = std::max<uint64_t>(state.vad->msUntilSpeechEnd(), config.packet_gap_tolerance.count() + 1);
+        endpoints.arm(state.endpoint_timer, state.vad_time_ms + wait_ms);
+    }
+
+    void CaptureProcessor::endSpeech(UserAudioState& state) {
+        endpoints.cancel(state.endpoint_timer);
+        state.endpointer->endUtterance(state.vad_time_ms, state.vad->hangover());
+        state.is_speaking = false;
+        state.speech_ended = false;
+        if (state.turn) {
+            pipeline.end(state.turn);
+        }
+        {
+            std::lock_guard<std::mutex> lock(metrics_mutex);
+            stats.utterances++;
+            stats.endpoint_ms_total += state.vad->hangover();
+            stats.endpoint_ms_max = std::max<uint64_t>(stats.endpoint_ms_max, state.vad->hangover());
+        }
+
+        // The next utterance starts from a fresh store and turn
+        state.turn.reset();
+        state.utterance.reset();
+    }
+
+    void CaptureProcessor::checkForSilenceAndTranscribe(VoiceUser& user) {
+        auto& state = user.state;
+        const uint64_t user_id = user.user_id;
+        if (!state.is_speaking) {
+            return;
+        }
+
+        // No packets means the sender stopped transmitting; let the VAD count that time as unvoiced
+        const uint64_t now_ms = current_ms;
+        if (!state.speech_ended && now_ms > state.vad_time_ms + config.packet_gap_tolerance.count()) {
+            applyHangover(state);
+            state.endpointer->observeGap(static_cast<uint32_t>(now_ms - state.vad_time_ms));
+            if (state.vad->processSilence(static_cast<uint32_t>(now_ms - state.vad_time_ms)) == audio_utils::VadEvent::SpeechEnd) {
+                state.speech_ended = true;
+                LOG_DEBUG("User {} stopped transmitting", user_id);
+            }
+            state.vad_time_ms = now_ms;
+        }
+
+        if (state.speech_ended) {
+            endSpeech(state);
+        } else {
+            armEndpoint(state);
+        }
+    }
+
+} // namespace discord
@@ -0,0 +1,114 @@
+#include "discord_bot/executor.hpp"
+#include "logging.hpp"
+#include <algorithm>
+
+namespace discord {
+
+    KeyedExecutor::KeyedExecutor(std::string name, size_t threads, size_t capacity)
+        : executor_name(std::move(name)), capacity(std::max<size_t>(1, capacity)) {
+        threads = std::max<size_t>(1, threads);
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; i++) {
+            workers.emplace_back(&KeyedExecutor::workerLoop, this);
+        }
+        LOG_INFO("Started {} executor with {} threads, queue capacity {}", executor_name, threads, this->capacity);
+    }
+
+    KeyedExecutor::~KeyedExecutor() {
+        shutdown();
+    }
+
+    void KeyedExecutor::shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping && workers.empty()) {
+                return;
+            }
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+        workers.clear();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queued > 0) {
+            LOG_WARN("{} executor discarded {} queued tasks on shutdown", executor_name, queued);
+        }
+        strands.clear();
+        ready.clear();
+        queued = 0;
+    }
+
+    bool KeyedExecutor::trySubmit(uint64_t key, Task task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping || queued >= capacity) {
+                rejected_tasks++;
+                return false;
+            }
+
+            // A key is in `strands` while it has queued or running work; a new strand
+            // becomes ready immediately, an existing one is rescheduled by its worker
+            auto [it, created] = strands.try_emplace(key);
+            it->second.tasks.push_back(std::move(task));
+            queued++;
+            if (!created) {
+                return true;
+            }
+            ready.push_back(key);
+        }
+        cv.notify_one();
+        return true;
+    }
+
+    size_t KeyedExecutor::pending() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queued;
+    }
+
+    uint64_t KeyedExecutor::rejected() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return rejected_tasks;
+    }
+
+    void KeyedExecutor::workerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            cv.wait(lock, [this] { return stopping || !ready.empty(); });
+            if (stopping) {
+                return;
+            }
+
+            uint64_t key = ready.front();
+            ready.pop_front();
+            Task task = std::move(strands[key].tasks.front());
+            strands[key].tasks.pop_front();
+            queued--;
+
+            lock.unlock();
+            try {
+                task();
+            } catch (const std::exception& e) {
+                LOG_ERROR("{} executor task for key {} failed: {}", executor_name, key, e.what());
+            }
+            task = nullptr;
+            lock.lock();
+
+            // Keep the strand's order: its next task only becomes ready now
+            auto it = strands.find(key);
+            if (it != strands.end()) {
+                if (it->second.tasks.empty()) {
+                    strands.erase(it);
+                } else {
+                    ready.push_back(key);
+                    cv.notify_one();
+                }
+            }
+        }
+    }
+
+} // namespace discord
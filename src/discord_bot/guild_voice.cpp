@@ -0,0 +1,114 @@
+#include "discord_bot/guild_voice.hpp"
+#include "logging.hpp"
+#include <thread>
+
+namespace discord {
+
+    GuildVoiceSession::GuildVoiceSession(uint64_t guild_id, uint32_t shard_id, SlabPool& ring_pool, size_t max_users,
+                                         std::shared_ptr<PlaybackEngine> playback)
+        : guild_id(guild_id), shard_id(shard_id), ring_pool(ring_pool), playback_engine(std::move(playback)),
+          users(max_users * 2) {}
+
+    GuildVoiceSession::~GuildVoiceSession() {
+        // Rings go back to the pool for the next session
+        users.forEach([this](uint64_t, VoiceUser& user) {
+            if (user.ring.attached()) {
+                ring_pool.release(user.ring.detach());
+            }
+        });
+        LOG_DEBUG("Closed voice session of guild {}", guild_id);
+    }
+
+    VoiceUser* GuildVoiceSession::findOrAddUser(uint64_t user_id) {
+        if (VoiceUser* user = users.find(user_id)) {
+            return user;
+        }
+        return users.findOrInsert(user_id, [&] {
+            auto* created = new VoiceUser(*this, user_id);
+            created->state.endpoint_timer.key = reinterpret_cast<uintptr_t>(created);
+            return created;
+        });
+    }
+
+    bool GuildVoiceSession::pushAudio(VoiceUser& user, const uint8_t* audio, size_t size, uint64_t arrival_ms) {
+        uint8_t state = user.ring_state.load(std::memory_order_relaxed);
+        while (true) {
+            if (state == VoiceUser::RING_RELEASING) {
+                // Held for a few instructions only
+                std::this_thread::yield();
+                state = user.ring_state.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (user.ring_state.compare_exchange_weak(state, VoiceUser::RING_PUSHING, std::memory_order_acquire)) {
+                break;
+            }
+        }
+        if (state == VoiceUser::RING_DETACHED) {
+            uint8_t* storage = ring_pool.acquire();
+            if (storage == nullptr) {
+                user.ring_state.store(VoiceUser::RING_DETACHED, std::memory_order_release);
+                return false;
+            }
+            user.ring.attach(storage);
+        }
+        user.ring.push(audio, size, arrival_ms);
+        user.ring_state.store(VoiceUser::RING_ATTACHED, std::memory_order_release);
+        return true;
+    }
+
+    bool GuildVoiceSession::releaseRing(VoiceUser& user) {
+        uint8_t expected = VoiceUser::RING_ATTACHED;
+        if (!user.ring_state.compare_exchange_strong(expected, VoiceUser::RING_RELEASING, std::memory_order_acquire)) {
+            return false;
+        }
+        uint64_t arrival_ms = 0;
+        if (user.ring.front(arrival_ms) != nullptr) {
+            user.ring_state.store(VoiceUser::RING_ATTACHED, std::memory_order_release);
+            return false;
+        }
+        uint8_t* storage = user.ring.detach();
+        user.ring_state.store(VoiceUser::RING_DETACHED, std::memory_order_release);
+        ring_pool.release(storage);
+        return true;
+    }
+
+    size_t GuildSessionMap::bucketIndex(uint64_t guild_id) {
+        // Snowflakes are timestamps in the high bits; mix before taking the low ones
+        guild_id ^= guild_id >> 33;
+        guild_id *= 0xff51afd7ed558ccdull;
+        guild_id ^= guild_id >> 33;
+        return static_cast<size_t>(guild_id % BUCKETS);
+    }
+
+    GuildSessionMap::SessionPtr GuildSessionMap::find(uint64_t guild_id) const {
+        const Bucket& bucket = bucketFor(guild_id);
+        std::shared_lock<std::shared_mutex> lock(bucket.mutex);
+        auto it = bucket.sessions.find(guild_id);
+        return it != bucket.sessions.end() ? it->second : nullptr;
+    }
+
+    GuildSessionMap::SessionPtr GuildSessionMap::remove(uint64_t guild_id) {
+        Bucket& bucket = bucketFor(guild_id);
+        std::unique_lock<std::shared_mutex> lock(bucket.mutex);
+        auto it = bucket.sessions.find(guild_id);
+        if (it == bucket.sessions.end()) {
+            return nullptr;
+        }
+        SessionPtr session = std::move(it->second);
+        bucket.sessions.erase(it);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return session;
+    }
+
+    std::vector<GuildSessionMap::SessionPtr> GuildSessionMap::snapshot() const {
+        std::vector<SessionPtr> sessions;
+        for (const Bucket& bucket : buckets) {
+            std::shared_lock<std::shared_mutex> lock(bucket.mutex);
+            for (const auto& [guild_id, session] : bucket.sessions) {
+                sessions.push_back(session);
+            }
+        }
+        return sessions;
+    }
+
+} // namespace discord
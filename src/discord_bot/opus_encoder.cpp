@@ -0,0 +1,211 @@
+#include "discord_bot/opus_encoder.hpp"
+#include "logging.hpp"
+#include <opus/opus.h>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+namespace discord {
+
+    namespace {
+        constexpr size_t FRAME_VALUES = OpusEncoderPool::FRAME_SAMPLES * OpusEncoderPool::CHANNELS;
+
+        bool isSilent(const int16_t* frame) {
+            for (size_t i = 0; i < FRAME_VALUES; i++) {
+                if (std::abs(static_cast<int>(frame[i])) > OpusEncoderPool::SILENCE_PEAK) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    OpusEncoderPool::Job::Job(OpusEncoderPool& pool, size_t worker, PacketCallback on_packet)
+        : pool(pool), worker(worker), on_packet(std::move(on_packet)), encoder(nullptr),
+          clip(std::make_shared<OpusClip>()), started(false), completed(false), finishing(false) {
+        int error = OPUS_OK;
+        encoder = opus_encoder_create(SAMPLE_RATE, CHANNELS, OPUS_APPLICATION_VOIP, &error);
+        if (error != OPUS_OK || encoder == nullptr) {
+            throw std::runtime_error(std::string("Failed to create Opus encoder: ") + opus_strerror(error));
+        }
+
+        opus_encoder_ctl(encoder, OPUS_SET_BITRATE(pool.bitrate()));
+        opus_encoder_ctl(encoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+        // Pauses inside a reply shrink to 1-2 byte packets instead of full frames
+        opus_encoder_ctl(encoder, OPUS_SET_DTX(1));
+    }
+
+    OpusEncoderPool::Job::~Job() {
+        if (!completed) {
+            pool.workers[worker]->active_jobs.fetch_sub(1, std::memory_order_relaxed);
+        }
+        opus_encoder_destroy(encoder);
+    }
+
+    void OpusEncoderPool::Job::pushFrame(const int16_t* frame, size_t bytes) {
+        if (bytes != FRAME_BYTES) {
+            LOG_WARN("Dropping Opus input frame of {} bytes, expected {}", bytes, FRAME_BYTES);
+            return;
+        }
+        std::vector<int16_t> buffer = pool.takeFrame(worker);
+        buffer.assign(frame, frame + FRAME_VALUES);
+        pending_frames.fetch_add(1, std::memory_order_acq_rel);
+        pool.submit(worker, {shared_from_this(), std::move(buffer)});
+    }
+
+    std::future<OpusClipPtr> OpusEncoderPool::Job::finish() {
+        auto future = done.get_future();
+        if (!finishing.exchange(true)) {
+            pool.submit(worker, {shared_from_this(), {}});
+        }
+        return future;
+    }
+
+    void OpusEncoderPool::Job::encode(const int16_t* frame) {
+        bool silent = isSilent(frame);
+
+        // Leading silence is never encoded or sent
+        if (!started && silent) {
+            clip->suppressed_frames++;
+            return;
+        }
+        started = true;
+
+        opus_int32 size = opus_encode(encoder, frame, FRAME_SAMPLES, packet_buffer.data(),
+                                      static_cast<opus_int32>(packet_buffer.size()));
+        if (size < 0) {
+            LOG_ERROR("Opus encoding failed: {}", opus_strerror(size));
+            return;
+        }
+        // Kept by the clip, so it gets exactly the packet's size
+        std::vector<uint8_t> packet(packet_buffer.begin(), packet_buffer.begin() + size);
+
+        // Silence is held back until speech follows it, so trailing silence can be dropped
+        if (silent) {
+            held_silence.push_back(std::move(packet));
+            return;
+        }
+        for (auto& held : held_silence) {
+            emit(std::move(held));
+        }
+        held_silence.clear();
+        emit(std::move(packet));
+    }
+
+    void OpusEncoderPool::Job::emit(std::vector<uint8_t> packet) {
+        if (on_packet) {
+            on_packet(packet.data(), packet.size());
+        }
+        clip->packets.push_back(std::move(packet));
+    }
+
+    void OpusEncoderPool::Job::complete() {
+        clip->suppressed_frames += held_silence.size();
+        held_silence.clear();
+
+        completed = true;
+        pool.workers[worker]->active_jobs.fetch_sub(1, std::memory_order_relaxed);
+        done.set_value(std::move(clip));
+    }
+
+    OpusEncoderPool::OpusEncoderPool(size_t worker_count, int bitrate)
+        : stopping(false), target_bitrate(bitrate) {
+        worker_count = std::max<size_t>(1, worker_count);
+        workers.reserve(worker_count);
+        for (size_t i = 0; i < worker_count; i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for (auto& worker : workers) {
+            worker->thread = std::thread(&OpusEncoderPool::workerLoop, this, std::ref(*worker));
+        }
+        LOG_INFO("Opus encoder pool started with {} workers at {} bps", worker_count, bitrate);
+    }
+
+    OpusEncoderPool::~OpusEncoderPool() {
+        stopping.store(true);
+        for (auto& worker : workers) {
+            {
+                std::lock_guard<std::mutex> lock(worker->mutex);
+            }
+            worker->cv.notify_all();
+        }
+        for (auto& worker : workers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+    }
+
+    std::shared_ptr<OpusEncoderPool::Job> OpusEncoderPool::begin(PacketCallback on_packet) {
+        size_t chosen = 0;
+        size_t least = workers[0]->active_jobs.load(std::memory_order_relaxed);
+        for (size_t i = 1; i < workers.size(); i++) {
+            size_t load = workers[i]->active_jobs.load(std::memory_order_relaxed);
+            if (load < least) {
+                least = load;
+                chosen = i;
+            }
+        }
+
+        std::shared_ptr<Job> job(new Job(*this, chosen, std::move(on_packet)));
+        workers[chosen]->active_jobs.fetch_add(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    void OpusEncoderPool::submit(size_t index, Task task) {
+        Worker& worker = *workers[index];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        }
+        worker.cv.notify_one();
+    }
+
+    std::vector<int16_t> OpusEncoderPool::takeFrame(size_t index) {
+        Worker& worker = *workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.spare_frames.empty()) {
+            std::vector<int16_t> frame;
+            frame.reserve(FRAME_VALUES);
+            return frame;
+        }
+        std::vector<int16_t> frame = std::move(worker.spare_frames.back());
+        worker.spare_frames.pop_back();
+        return frame;
+    }
+
+    void OpusEncoderPool::workerLoop(Worker& worker) {
+        Task task;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(worker.mutex);
+                // The last frame's buffer goes back for the next pushFrame
+                if (task.frame.capacity() >= FRAME_VALUES && worker.spare_frames.size() < MAX_SPARE_FRAMES) {
+                    worker.spare_frames.push_back(std::move(task.frame));
+                }
+                worker.cv.wait(lock, [&] { return stopping.load() || !worker.tasks.empty(); });
+                if (worker.tasks.empty()) {
+                    return;
+                }
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+            }
+
+            try {
+                if (task.frame.empty()) {
+                    task.job->complete();
+                } else {
+                    task.job->encode(task.frame.data());
+                }
+            } catch (const std::exception& e) {
+                LOG_ERROR("Opus encoder worker error: {}", e.what());
+            }
+            if (!task.frame.empty()) {
+                task.job->pending_frames.fetch_sub(1, std::memory_order_acq_rel);
+            }
+            task.job.reset();
+        }
+    }
+
+} // namespace discord
@@ -0,0 +1,238 @@
+#include "discord_bot/playback.hpp"
+#include "logging.hpp"
+#include <algorithm>
+
+namespace discord {
+
+    bool PlaybackEngine::Stream::push(const uint8_t* packet, size_t size) {
+        std::lock_guard<std::mutex> lock(engine->mutex);
+        if (cancelled()) {
+            return false;
+        }
+        frames.emplace_back(packet, packet + size);
+        auto& stats = engine->stats;
+        stats.queued_frames++;
+        stats.max_queued_frames = std::max(stats.max_queued_frames, stats.queued_frames);
+        return true;
+    }
+
+    void PlaybackEngine::Stream::finish() {
+        std::lock_guard<std::mutex> lock(engine->mutex);
+        finished = true;
+    }
+
+    void PlaybackEngine::Stream::cancel() {
+        {
+            std::lock_guard<std::mutex> lock(engine->mutex);
+            engine->cancelLocked(*this);
+        }
+        engine->space.notify_all();
+    }
+
+    PlaybackEngine::PlaybackEngine(uint64_t guild_id, PlaybackOutput output)
+        : guild_id(guild_id), output(std::move(output)) {}
+
+    PlaybackEngine::StreamPtr PlaybackEngine::open(PlaybackPriority priority, bool preempt) {
+        StreamPtr stream(new Stream(shared_from_this(), priority));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (preempt) {
+                for (auto& queued : queue) {
+                    if (queued->priority < priority) {
+                        cancelLocked(*queued);
+                    }
+                }
+                pruneLocked();
+            }
+
+            // Ahead of lower priorities, but never in the middle of a stream already playing
+            auto position = std::find_if(queue.begin(), queue.end(), [&](const StreamPtr& queued) {
+                return queued->priority < priority && !queued->started;
+            });
+            queue.insert(position, stream);
+            stats.queued_streams = queue.size();
+        }
+        space.notify_all();
+        if (on_open) {
+            on_open();
+        }
+        return stream;
+    }
+
+    void PlaybackEngine::flush() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto& queued : queue) {
+                cancelLocked(*queued);
+            }
+            pruneLocked();
+            if (output.clear) {
+                output.clear();
+            }
+        }
+        space.notify_all();
+    }
+
+    void PlaybackEngine::cancelLocked(Stream& stream) {
+        if (stream.is_cancelled.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        stats.queued_frames -= stream.frames.size();
+        stream.frames.clear();
+        if (!stream.finished || stream.started) {
+            stats.preemptions++;
+        }
+
+        // Whatever the connection still buffers belongs to the stream that was playing
+        if (stream.started && output.clear) {
+            output.clear();
+        }
+    }
+
+    void PlaybackEngine::pruneLocked() {
+        auto done = [this](const StreamPtr& stream) {
+            if (stream->cancelled()) {
+                return true;
+            }
+            if (stream->finished && stream->frames.empty()) {
+                LOG_DEBUG("Finished playback in guild {} ({} frames played, {} underruns, max queue depth {})",
+                          guild_id, stats.frames_played, stats.underruns, stats.max_queued_frames);
+                return true;
+            }
+            return false;
+        };
+        queue.erase(std::remove_if(queue.begin(), queue.end(), done), queue.end());
+        stats.queued_streams = queue.size();
+    }
+
+    bool PlaybackEngine::tick() {
+        bool freed = false;
+        bool playing = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (true) {
+                pruneLocked();
+                if (queue.empty()) {
+                    playing = false;
+                    break;
+                }
+                if (output.buffered_ms && output.buffered_ms() >= LEAD_MS) {
+                    break;
+                }
+
+                Stream& stream = *queue.front();
+                if (stream.frames.empty()) {
+                    // A stream that started playing and ran dry is an audible gap
+                    if (stream.started) {
+                        stats.underruns++;
+                    }
+                    break;
+                }
+
+                scratch.swap(stream.frames.front());
+                stream.frames.pop_front();
+                stream.started = true;
+                stats.queued_frames--;
+                freed = true;
+
+                if (output.send && output.send(scratch.data(), scratch.size())) {
+                    stats.frames_played++;
+                } else {
+                    stats.frames_dropped++;
+                }
+            }
+        }
+        if (freed) {
+            space.notify_all();
+        }
+        return playing;
+    }
+
+    bool PlaybackEngine::active() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !queue.empty();
+    }
+
+    PlaybackEngine::Metrics PlaybackEngine::metrics() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    PlaybackPacer::PlaybackPacer() : thread(&PlaybackPacer::run, this) {}
+
+    PlaybackPacer::~PlaybackPacer() {
+        stop();
+    }
+
+    void PlaybackPacer::add(const std::shared_ptr<PlaybackEngine>& engine) {
+        engine->setWake([this] { wake(); });
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            engines.push_back(engine);
+            pending = true;
+        }
+        cv.notify_one();
+    }
+
+    void PlaybackPacer::remove(const std::shared_ptr<PlaybackEngine>& engine) {
+        std::lock_guard<std::mutex> lock(mutex);
+        engines.erase(std::remove(engines.begin(), engines.end(), engine), engines.end());
+    }
+
+    void PlaybackPacer::stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_one();
+        if (thread.joinable()) {
+            thread.join();
+        }
+        engines.clear();
+    }
+
+    void PlaybackPacer::wake() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending = true;
+        }
+        cv.notify_one();
+    }
+
+    void PlaybackPacer::run() {
+        const auto period = std::chrono::milliseconds(PlaybackEngine::FRAME_MS);
+        auto next_tick = std::chrono::steady_clock::now();
+
+        // Ticked without the lock: a tick sends through the voice client, and add() and
+        // remove() must not wait behind that. A wake during the ticks keeps `pending` set.
+        std::vector<std::shared_ptr<PlaybackEngine>> ticking;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            pending = false;
+            ticking = engines;
+            lock.unlock();
+            bool any_playing = false;
+            for (auto& engine : ticking) {
+                any_playing |= engine->tick();
+            }
+            ticking.clear();
+            lock.lock();
+
+            if (!any_playing) {
+                // Nothing to play anywhere: sleep until a stream opens
+                cv.wait(lock, [this] { return stopping || pending; });
+                next_tick = std::chrono::steady_clock::now();
+                continue;
+            }
+
+            // Absolute deadlines so ticks don't drift; after a stall, resume from now
+            next_tick += period;
+            auto now = std::chrono::steady_clock::now();
+            if (next_tick < now - 5 * period) {
+                next_tick = now;
+            }
+            cv.wait_until(lock, next_tick, [this] { return stopping; });
+        }
+    }
+
+} // namespace discord
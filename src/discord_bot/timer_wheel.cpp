@@ -0,0 +1,116 @@
+#include "discord_bot/timer_wheel.hpp"
+#include <algorithm>
+
+namespace discord {
+
+    TimerWheel::Slot::Slot() {
+        prev = this;
+        next = this;
+    }
+
+    TimerWheel::TimerWheel(uint64_t now_ms) : current(now_ms) {}
+
+    TimerWheel::~TimerWheel() {
+        // Leave callers' timers disarmed rather than pointing into a dead wheel
+        for (auto& level : levels) {
+            for (Slot& slot : level) {
+                while (slot.next != &slot) {
+                    unlink(*slot.next);
+                }
+            }
+        }
+    }
+
+    void TimerWheel::arm(Timer& timer, uint64_t deadline_ms) {
+        if (timer.armed()) {
+            unlink(timer);
+        }
+        timer.deadline_ms = deadline_ms;
+        place(timer);
+    }
+
+    void TimerWheel::cancel(Timer& timer) {
+        if (timer.armed()) {
+            unlink(timer);
+        }
+    }
+
+    void TimerWheel::place(Timer& timer) {
+        uint64_t deadline = std::max(timer.deadline_ms, current);
+        uint64_t delta = deadline - current;
+
+        unsigned level = 0;
+        while (level + 1 < LEVELS && delta >= (SLOTS << (SLOT_BITS * level))) {
+            level++;
+        }
+        if (delta >= (SLOTS << (SLOT_BITS * level))) {
+            // Beyond the top level: park in the last slot it can reach and re-place later
+            deadline = current + (SLOTS << (SLOT_BITS * level)) - 1;
+        }
+
+        Slot& slot = levels[level][(deadline >> (SLOT_BITS * level)) & SLOT_MASK];
+        timer.next = &slot;
+        timer.prev = slot.prev;
+        slot.prev->next = &timer;
+        slot.prev = &timer;
+        armed_count++;
+    }
+
+    void TimerWheel::unlink(Timer& timer) {
+        timer.prev->next = timer.next;
+        timer.next->prev = timer.prev;
+        timer.prev = nullptr;
+        timer.next = nullptr;
+        armed_count--;
+    }
+
+    void TimerWheel::cascade() {
+        // When a level's index wraps, the next slot of the level above is due:
+        // spread its timers over the finer levels
+        for (unsigned level = LEVELS - 1; level > 0; level--) {
+            if ((current & ((uint64_t{1} << (SLOT_BITS * level)) - 1)) != 0) {
+                continue;
+            }
+            Slot& slot = levels[level][(current >> (SLOT_BITS * level)) & SLOT_MASK];
+            while (slot.next != &slot) {
+                Timer* timer = slot.next;
+                unlink(*timer);
+                place(*timer);
+            }
+        }
+    }
+
+    std::optional<uint64_t> TimerWheel::nextWakeup() const {
+        if (armed_count == 0) {
+            return std::nullopt;
+        }
+
+        std::optional<uint64_t> earliest;
+        for (uint64_t offset = 0; offset < SLOTS; offset++) {
+            const Slot& slot = levels[0][(current + offset) & SLOT_MASK];
+            if (slot.next != &slot) {
+                earliest = current + offset;
+                break;
+            }
+        }
+
+        for (unsigned level = 1; level < LEVELS; level++) {
+            unsigned shift = SLOT_BITS * level;
+            uint64_t block = current >> shift;
+            // The current block's slot is only due again a full turn later
+            uint64_t first = (current & ((uint64_t{1} << shift) - 1)) == 0 ? 0 : 1;
+            for (uint64_t offset = first; offset <= SLOTS; offset++) {
+                const Slot& slot = levels[level][(block + offset) & SLOT_MASK];
+                if (slot.next != &slot) {
+                    uint64_t due = (block + offset) << shift;
+                    if (!earliest || due < *earliest) {
+                        earliest = due;
+                    }
+                    break;
+                }
+            }
+        }
+        return earliest;
+    }
+
+} // namespace discord
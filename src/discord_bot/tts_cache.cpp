@@ -0,0 +1,462 @@
+#include "discord_bot/tts_cache.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace discord {
+
+    namespace {
+        /**
+         * Segment file layout:
+         *
+         *   segment := SegmentHeader record*
+         *   record  := RecordHeader key[key_bytes] uint16 packet_size[packets] audio[audio_bytes]
+         *
+         * Records are only ever appended. A record cut short by a crash ends the segment.
+         */
+        constexpr char SEGMENT_MAGIC[4] = {'E', 'T', 'T', 'S'};
+        constexpr uint32_t SEGMENT_VERSION = 1;
+
+        struct SegmentHeader {
+            char magic[4];
+            uint32_t version;
+        };
+
+        struct RecordHeader {
+            uint64_t hash;
+            uint32_t key_bytes;
+            uint32_t packets;
+            uint32_t audio_bytes;
+            uint32_t suppressed_frames;
+        };
+
+        static_assert(sizeof(SegmentHeader) == 8 && sizeof(RecordHeader) == 24, "Segment headers must be packed");
+
+        size_t recordBytes(const RecordHeader& header) {
+            return sizeof(RecordHeader) + header.key_bytes + header.packets * sizeof(uint16_t) + header.audio_bytes;
+        }
+
+        // Memory held by a cached clip, roughly
+        size_t clipBytes(const std::string& key, const OpusClip& clip) {
+            return key.size() + clip.bytes() + clip.packets.size() * sizeof(std::vector<uint8_t>) + sizeof(OpusClip);
+        }
+
+        bool parseSegmentName(const std::string& name, uint64_t& id) {
+            static const std::string prefix = "segment-";
+            static const std::string suffix = ".etts";
+            if (name.size() <= prefix.size() + suffix.size() || name.rfind(prefix, 0) != 0 ||
+                name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+                return false;
+            }
+            std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+            if (!std::all_of(digits.begin(), digits.end(), [](unsigned char c) { return std::isdigit(c); })) {
+                return false;
+            }
+            id = std::stoull(digits);
+            return true;
+        }
+    }
+
+    TtsCache::TtsCache(const Config& config) : config(config) {
+        if (!config.directory.empty()) {
+            openDirectory();
+        }
+    }
+
+    TtsCache::~TtsCache() {
+        if (active != nullptr) {
+            std::fclose(active);
+        }
+        for (auto& [id, segment] : segments) {
+            unmapSegment(*segment);
+        }
+    }
+
+    std::string TtsCache::key(const std::string& text, const std::string& voice, const std::string& format) {
+        // Runs of whitespace and surrounding whitespace don't change what is spoken
+        std::string normalized;
+        normalized.reserve(text.size());
+        for (unsigned char c : text) {
+            if (std::isspace(c)) {
+                if (!normalized.empty() && normalized.back() != ' ') {
+                    normalized += ' ';
+                }
+            } else {
+                normalized += static_cast<char>(c);
+            }
+        }
+        if (!normalized.empty() && normalized.back() == ' ') {
+            normalized.pop_back();
+        }
+        return voice + '\n' + format + '\n' + normalized;
+    }
+
+    uint64_t TtsCache::hashKey(const std::string& key) {
+        // FNV-1a; collisions are caught by comparing the stored key
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    OpusClipPtr TtsCache::find(const std::string& key) {
+        const uint64_t hash = hashKey(key);
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = memory_index.find(hash);
+        if (it != memory_index.end() && it->second->key == key) {
+            lru.splice(lru.begin(), lru, it->second);
+            stats.memory_hits++;
+            return it->second->clip;
+        }
+
+        if (OpusClipPtr clip = readFromDisk(hash, key)) {
+            insertMemory(hash, key, clip);
+            stats.disk_hits++;
+            return clip;
+        }
+        stats.misses++;
+        return nullptr;
+    }
+
+    void TtsCache::insert(const std::string& key, OpusClipPtr clip) {
+        if (!clip || clip->packets.empty()) {
+            return;
+        }
+        const uint64_t hash = hashKey(key);
+        std::lock_guard<std::mutex> lock(mutex);
+
+        insertMemory(hash, key, clip);
+        // Keys sharing a hash evict each other: the index holds one record per hash
+        if (!diskHas(hash, key)) {
+            appendToDisk(hash, key, *clip);
+        }
+        stats.inserts++;
+    }
+
+    TtsCache::Metrics TtsCache::metrics() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        Metrics metrics = stats;
+        metrics.memory_bytes = memory_used;
+        metrics.disk_bytes = disk_used;
+        return metrics;
+    }
+
+    void TtsCache::insertMemory(uint64_t hash, const std::string& key, OpusClipPtr clip) {
+        const size_t bytes = clipBytes(key, *clip);
+        if (bytes > config.memory_bytes) {
+            return;
+        }
+
+        auto it = memory_index.find(hash);
+        if (it != memory_index.end()) {
+            memory_used -= it->second->bytes;
+            lru.erase(it->second);
+            memory_index.erase(it);
+        }
+
+        lru.push_front(MemoryEntry{hash, key, std::move(clip), bytes});
+        memory_index[hash] = lru.begin();
+        memory_used += bytes;
+
+        while (memory_used > config.memory_bytes) {
+            const MemoryEntry& oldest = lru.back();
+            memory_used -= oldest.bytes;
+            memory_index.erase(oldest.hash);
+            lru.pop_back();
+        }
+    }
+
+    void TtsCache::openDirectory() {
+        std::error_code ec;
+        std::filesystem::create_directories(config.directory, ec);
+        if (ec) {
+            LOG_ERROR("Cannot create TTS cache directory {}: {}", config.directory, ec.message());
+            disk_failed = true;
+            return;
+        }
+
+        for (const auto& entry : std::filesystem::directory_iterator(config.directory, ec)) {
+            uint64_t id = 0;
+            if (!entry.is_regular_file() || !parseSegmentName(entry.path().filename().string(), id)) {
+                continue;
+            }
+            auto segment = std::make_unique<Segment>();
+            segment->id = id;
+            segment->path = entry.path().string();
+            loadSegment(std::move(segment));
+        }
+
+        // Keep appending to the newest segment if it has room
+        if (!segments.empty() && segments.rbegin()->second->size < config.segment_bytes) {
+            Segment& last = *segments.rbegin()->second;
+            // Cut off a record left incomplete by a crash, so new records follow the last good one
+            std::filesystem::resize_file(last.path, last.size, ec);
+            active = ec ? nullptr : std::fopen(last.path.c_str(), "ab");
+        }
+        if (active == nullptr) {
+            startSegment();
+        }
+        while (disk_used > config.disk_bytes && segments.size() > 1) {
+            dropOldestSegment();
+        }
+
+        LOG_INFO("TTS cache: {} clips in {} segments ({} KB) under {}", disk_index.size(), segments.size(),
+                 disk_used / 1024, config.directory);
+    }
+
+    void TtsCache::loadSegment(std::unique_ptr<Segment> segment) {
+        SegmentHeader header{};
+        if (!mapSegment(*segment) || segment->mapped < sizeof(header)) {
+            LOG_WARN("Ignoring unreadable TTS cache segment {}", segment->path);
+            unmapSegment(*segment);
+            return;
+        }
+        std::memcpy(&header, segment->data, sizeof(header));
+        if (std::memcmp(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 || header.version != SEGMENT_VERSION) {
+            LOG_WARN("Ignoring TTS cache segment {} of an unknown format", segment->path);
+            unmapSegment(*segment);
+            return;
+        }
+
+        size_t offset = sizeof(header);
+        while (offset + sizeof(RecordHeader) <= segment->mapped) {
+            RecordHeader record{};
+            std::memcpy(&record, segment->data + offset, sizeof(record));
+            const size_t bytes = recordBytes(record);
+            if (bytes > segment->mapped - offset) {
+                LOG_WARN("TTS cache segment {} ends in a truncated record", segment->path);
+                break;
+            }
+            // A later record of the same key replaces an earlier one
+            disk_index[record.hash] = DiskEntry{segment->id, offset, bytes};
+            offset += bytes;
+        }
+        segment->size = offset;
+        disk_used += offset;
+        segments[segment->id] = std::move(segment);
+    }
+
+    bool TtsCache::mapSegment(Segment& segment) {
+        unmapSegment(segment);
+#ifndef _WIN32
+        int fd = ::open(segment.path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st{};
+        bool ok = ::fstat(fd, &st) == 0;
+        if (ok && st.st_size > 0) {
+            void* mapping = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+            ok = mapping != MAP_FAILED;
+            if (ok) {
+                segment.data = static_cast<const uint8_t*>(mapping);
+                segment.mapped = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+        return ok;
+#else
+        std::ifstream in(segment.path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+        segment.fallback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        segment.data = segment.fallback.data();
+        segment.mapped = segment.fallback.size();
+        return true;
+#endif
+    }
+
+    void TtsCache::unmapSegment(Segment& segment) {
+#ifndef _WIN32
+        if (segment.data != nullptr) {
+            ::munmap(const_cast<uint8_t*>(segment.data), segment.mapped);
+        }
+#else
+        segment.fallback.clear();
+        segment.fallback.shrink_to_fit();
+#endif
+        segment.data = nullptr;
+        segment.mapped = 0;
+    }
+
+    void TtsCache::startSegment() {
+        if (active != nullptr) {
+            std::fclose(active);
+            active = nullptr;
+        }
+
+        auto segment = std::make_unique<Segment>();
+        segment->id = segments.empty() ? 1 : segments.rbegin()->first + 1;
+        char name[40];
+        std::snprintf(name, sizeof(name), "segment-%06llu.etts", static_cast<unsigned long long>(segment->id));
+        segment->path = (std::filesystem::path(config.directory) / name).string();
+
+        active = std::fopen(segment->path.c_str(), "wb");
+        SegmentHeader header{};
+        std::memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+        header.version = SEGMENT_VERSION;
+        if (active == nullptr || std::fwrite(&header, sizeof(header), 1, active) != 1 || std::fflush(active) != 0) {
+            LOG_ERROR("Cannot write TTS cache segment {}, caching in memory only", segment->path);
+            if (active != nullptr) {
+                std::fclose(active);
+                active = nullptr;
+            }
+            disk_failed = true;
+            return;
+        }
+        segment->size = sizeof(header);
+        disk_used += segment->size;
+        segments[segment->id] = std::move(segment);
+    }
+
+    void TtsCache::dropOldestSegment() {
+        auto oldest = segments.begin();
+        const uint64_t id = oldest->first;
+        for (auto it = disk_index.begin(); it != disk_index.end();) {
+            it = it->second.segment == id ? disk_index.erase(it) : std::next(it);
+        }
+        unmapSegment(*oldest->second);
+        std::error_code ec;
+        std::filesystem::remove(oldest->second->path, ec);
+        disk_used -= oldest->second->size;
+        segments.erase(oldest);
+    }
+
+    bool TtsCache::appendToDisk(uint64_t hash, const std::string& key, const OpusClip& clip) {
+        if (active == nullptr || disk_failed) {
+            return false;
+        }
+
+        RecordHeader header{};
+        header.hash = hash;
+        header.key_bytes = static_cast<uint32_t>(key.size());
+        header.packets = static_cast<uint32_t>(clip.packets.size());
+        header.audio_bytes = static_cast<uint32_t>(clip.bytes());
+        header.suppressed_frames = static_cast<uint32_t>(clip.suppressed_frames);
+        const size_t bytes = recordBytes(header);
+        if (bytes + sizeof(SegmentHeader) > config.disk_bytes) {
+            return false;
+        }
+
+        if (segments.rbegin()->second->size + bytes > config.segment_bytes &&
+            segments.rbegin()->second->size > sizeof(SegmentHeader)) {
+            startSegment();
+            if (active == nullptr) {
+                return false;
+            }
+        }
+        while (disk_used + bytes > config.disk_bytes && segments.size() > 1) {
+            dropOldestSegment();
+        }
+
+        std::vector<uint8_t> record(bytes);
+        uint8_t* out = record.data();
+        std::memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        std::memcpy(out, key.data(), key.size());
+        out += key.size();
+        for (const auto& packet : clip.packets) {
+            const uint16_t size = static_cast<uint16_t>(packet.size());
+            std::memcpy(out, &size, sizeof(size));
+            out += sizeof(size);
+        }
+        for (const auto& packet : clip.packets) {
+            std::memcpy(out, packet.data(), packet.size());
+            out += packet.size();
+        }
+
+        Segment& segment = *segments.rbegin()->second;
+        if (std::fwrite(record.data(), record.size(), 1, active) != 1 || std::fflush(active) != 0) {
+            LOG_ERROR("Failed to append to TTS cache segment {}, caching in memory only", segment.path);
+            std::fclose(active);
+            active = nullptr;
+            disk_failed = true;
+            return false;
+        }
+        disk_index[hash] = DiskEntry{segment.id, segment.size, bytes};
+        segment.size += bytes;
+        disk_used += bytes;
+        return true;
+    }
+
+    const uint8_t* TtsCache::diskRecord(uint64_t hash, const std::string& key) {
+        auto it = disk_index.find(hash);
+        if (it == disk_index.end()) {
+            return nullptr;
+        }
+        const DiskEntry entry = it->second;
+        auto segment_it = segments.find(entry.segment);
+        if (segment_it == segments.end()) {
+            return nullptr;
+        }
+        Segment& segment = *segment_it->second;
+        // Records appended since the segment was mapped need a fresh mapping
+        if (entry.offset + entry.bytes > segment.mapped && !mapSegment(segment)) {
+            return nullptr;
+        }
+        if (entry.offset + entry.bytes > segment.mapped) {
+            return nullptr;
+        }
+
+        const uint8_t* record = segment.data + entry.offset;
+        RecordHeader header{};
+        std::memcpy(&header, record, sizeof(header));
+        if (header.hash != hash || header.key_bytes != key.size() ||
+            std::memcmp(record + sizeof(header), key.data(), key.size()) != 0) {
+            return nullptr;  // Same hash, different reply
+        }
+        return record;
+    }
+
+    OpusClipPtr TtsCache::readFromDisk(uint64_t hash, const std::string& key) {
+        const uint8_t* in = diskRecord(hash, key);
+        if (!in) {
+            return nullptr;
+        }
+        RecordHeader header{};
+        std::memcpy(&header, in, sizeof(header));
+        in += sizeof(header) + key.size();
+
+        size_t audio_bytes = 0;
+        for (uint32_t i = 0; i < header.packets; i++) {
+            uint16_t size = 0;
+            std::memcpy(&size, in + i * sizeof(uint16_t), sizeof(size));
+            audio_bytes += size;
+        }
+        if (audio_bytes != header.audio_bytes) {
+            auto it = disk_index.find(hash);
+            LOG_WARN("Corrupt record in TTS cache segment {}", segments.at(it->second.segment)->path);
+            disk_index.erase(it);
+            return nullptr;
+        }
+
+        auto clip = std::make_shared<OpusClip>();
+        clip->suppressed_frames = header.suppressed_frames;
+        clip->packets.resize(header.packets);
+        const uint8_t* audio = in + header.packets * sizeof(uint16_t);
+        for (auto& packet : clip->packets) {
+            uint16_t size = 0;
+            std::memcpy(&size, in, sizeof(size));
+            in += sizeof(size);
+            packet.assign(audio, audio + size);
+            audio += size;
+        }
+        return clip;
+    }
+
+} // namespace discord
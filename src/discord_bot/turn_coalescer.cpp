@@ -0,0 +1,150 @@
+#include "discord_bot/turn_coalescer.hpp"
+#include "discord_bot/turn_pipeline.hpp"
+#include <algorithm>
+
+namespace discord {
+
+    TurnCoalescer::TurnCoalescer(std::chrono::milliseconds window, std::chrono::milliseconds max_wait, Flush flush)
+        : window(window), max_wait(std::max(window, max_wait)), flush(std::move(flush)) {
+        if (window.count() > 0) {
+            thread = std::thread(&TurnCoalescer::run, this);
+        }
+    }
+
+    TurnCoalescer::~TurnCoalescer() {
+        shutdown();
+    }
+
+    void TurnCoalescer::shutdown() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            guilds.clear();
+        }
+        cv.notify_one();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    void TurnCoalescer::track(const std::shared_ptr<VoiceTurn>& turn) {
+        if (window.count() == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& live = guilds[turn->guild_id].live;
+        live.erase(std::remove_if(live.begin(), live.end(), [](const auto& tracked) { return tracked.expired(); }),
+                   live.end());
+        live.push_back(turn);
+    }
+
+    void TurnCoalescer::add(const std::shared_ptr<VoiceTurn>& turn) {
+        if (window.count() == 0) {
+            flush(Turns{turn});
+            return;
+        }
+
+        std::vector<Turns> batches;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+            Guild& guild = guilds[turn->guild_id];
+            if (guild.ready.empty()) {
+                guild.first_ready = Clock::now();
+            }
+            guild.ready.push_back(turn);
+            Clock::time_point next;
+            collectDue(batches, next);
+        }
+        cv.notify_one();
+        for (auto& batch : batches) {
+            flush(std::move(batch));
+        }
+    }
+
+    void TurnCoalescer::settled() {
+        if (window.count() == 0) {
+            return;
+        }
+        // The turn is marked settled by the pipeline; a batch that only waited for it may go now
+        std::vector<Turns> batches;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Clock::time_point next;
+            collectDue(batches, next);
+        }
+        cv.notify_one();
+        for (auto& batch : batches) {
+            flush(std::move(batch));
+        }
+    }
+
+    bool TurnCoalescer::due(Guild& guild, Clock::time_point now, Clock::time_point& recheck) {
+        bool speaking = false;
+        bool transcribing = false;
+        for (const auto& tracked : guild.live) {
+            auto turn = tracked.lock();
+            if (!turn || turn->settled.load(std::memory_order_acquire)) {
+                continue;
+            }
+            (turn->ended.load(std::memory_order_acquire) ? transcribing : speaking) = true;
+        }
+
+        // Nobody to wait for, or waited long enough for whoever is left
+        if (!speaking && !transcribing) {
+            return true;
+        }
+        if (now >= guild.first_ready + max_wait || (!transcribing && now >= guild.first_ready + window)) {
+            return true;
+        }
+        recheck = std::min(recheck, transcribing ? guild.first_ready + max_wait : guild.first_ready + window);
+        return false;
+    }
+
+    void TurnCoalescer::collectDue(std::vector<Turns>& batches, Clock::time_point& next) {
+        const auto now = Clock::now();
+        next = Clock::time_point::max();
+        for (auto it = guilds.begin(); it != guilds.end();) {
+            Guild& guild = it->second;
+            if (!guild.ready.empty() && due(guild, now, next)) {
+                batches.push_back(std::move(guild.ready));
+                guild.ready.clear();
+            }
+
+            guild.live.erase(std::remove_if(guild.live.begin(), guild.live.end(), [](const auto& tracked) {
+                auto turn = tracked.lock();
+                return !turn || turn->settled.load(std::memory_order_acquire);
+            }), guild.live.end());
+            if (guild.ready.empty() && guild.live.empty()) {
+                it = guilds.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void TurnCoalescer::run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            std::vector<Turns> batches;
+            Clock::time_point next;
+            collectDue(batches, next);
+            if (!batches.empty()) {
+                lock.unlock();
+                for (auto& batch : batches) {
+                    flush(std::move(batch));
+                }
+                lock.lock();
+                continue;
+            }
+            if (next == Clock::time_point::max()) {
+                cv.wait(lock);
+            } else {
+                cv.wait_until(lock, next);
+            }
+        }
+    }
+
+} // namespace discord
@@ -0,0 +1,432 @@
+#include "discord_bot/turn_pipeline.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace discord {
+
+    TurnPipeline::TurnPipeline(TurnBackend& backend, const Config& config)
+        : backend(backend), config(config),
+          stt("speech-to-text", config.stt_threads, config.queue_capacity),
+          partials("partials", config.partial_poll_threads, config.queue_capacity),
+          llm("llm", config.llm_threads, config.queue_capacity),
+          tts("text-to-speech", config.tts_threads, config.queue_capacity),
+          coalescer(config.coalesce_window, config.coalesce_max_wait,
+                    [this](TurnCoalescer::Turns turns) { respondToBatch(std::move(turns)); }) {}
+
+    TurnPipeline::~TurnPipeline() {
+        shutdown();
+    }
+
+    void TurnPipeline::shutdown() {
+        // Upstream first, so nothing is handed to a stage that already stopped
+        partials.shutdown();
+        stt.shutdown();
+        coalescer.shutdown();
+        llm.shutdown();
+        tts.shutdown();
+    }
+
+    std::shared_ptr<VoiceTurn> TurnPipeline::begin(uint64_t user_id, uint64_t guild_id, std::shared_ptr<FrameStore> utterance) {
+        auto turn = std::make_shared<VoiceTurn>();
+        turn->user_id = user_id;
+        turn->guild_id = guild_id;
+        turn->utterance = std::move(utterance);
+        coalescer.track(turn);
+
+        bool queued = stt.trySubmit(user_id, [this, turn] {
+            try {
+                turn->session_id = backend.startStream();
+                if (!turn->session_id.empty()) {
+                    LOG_DEBUG("Started stream session {} for user {}", turn->session_id, turn->user_id);
+                }
+            } catch (const std::exception& e) {
+                LOG_ERROR("Failed to start stream for user {}: {}", turn->user_id, e.what());
+            }
+        });
+        if (!queued) {
+            // The turn falls back to a single transcription at the end
+            LOG_WARN("Speech-to-text queue full, not streaming turn of user {}", user_id);
+        }
+        return turn;
+    }
+
+    void TurnPipeline::audioAvailable(const std::shared_ptr<VoiceTurn>& turn) {
+        // One upload in the queue is enough; it sends everything published by the time it runs
+        if (turn->upload_queued.exchange(true)) {
+            return;
+        }
+        bool queued = stt.trySubmit(turn->user_id, [this, turn] {
+            turn->upload_queued.store(false);
+            upload(turn, false);
+        });
+        if (!queued) {
+            turn->upload_queued.store(false);
+        }
+    }
+
+    void TurnPipeline::end(const std::shared_ptr<VoiceTurn>& turn) {
+        turn->ended.store(true, std::memory_order_release);
+        if (turn->utterance->bytes() < config.min_utterance_bytes) {
+            // Too short to be worth a transcription; its stream session is dropped on the
+            // user's strand, behind the task that may still be starting it
+            settle(*turn);
+            bool queued = stt.trySubmit(turn->user_id, [this, turn] {
+                turn->finishing = true;
+                if (turn->session_id.empty()) {
+                    return;
+                }
+                try {
+                    backend.abortStream(turn->session_id);
+                } catch (const std::exception& e) {
+                    LOG_WARN("Failed to abort stream of user {}: {}", turn->user_id, e.what());
+                }
+            });
+            if (!queued) {
+                LOG_WARN("Speech-to-text queue full, stream of user {} is left to expire", turn->user_id);
+            }
+            return;
+        }
+        LOG_INFO("End of speech for user {}, transcribing {} bytes", turn->user_id, turn->utterance->bytes());
+
+        if (!stt.trySubmit(turn->user_id, [this, turn] { finalize(turn); })) {
+            LOG_ERROR("Speech-to-text queue full, dropping turn of user {}", turn->user_id);
+            settle(*turn);
+        }
+    }
+
+    void TurnPipeline::settle(VoiceTurn& turn) {
+        turn.settled.store(true, std::memory_order_release);
+        coalescer.settled();
+    }
+
+    void TurnPipeline::respondTo(uint64_t user_id, uint64_t guild_id, const std::string& text) {
+        auto turn = std::make_shared<VoiceTurn>();
+        turn->user_id = user_id;
+        turn->guild_id = guild_id;
+        turn->transcript = text;
+        turn->utterances.push_back({user_id, text});
+        submitResponse(turn);
+    }
+
+    void TurnPipeline::upload(const std::shared_ptr<VoiceTurn>& turn, bool flush) {
+        if (turn->session_id.empty()) {
+            return;
+        }
+        FrameView pending = turn->utterance->view(turn->uploaded_frames, turn->utterance->frames());
+        if (pending.empty() || (!flush && pending.frames() < config.min_upload_frames)) {
+            return;
+        }
+
+        bool appended = false;
+        try {
+            appended = backend.appendStream(turn->session_id, pending);
+        } catch (const std::exception& e) {
+            LOG_WARN("Failed to stream audio of user {}: {}", turn->user_id, e.what());
+        }
+        if (!appended) {
+            // The stream would miss audio; the turn is transcribed in one go at its end instead
+            LOG_WARN("Stream session {} of user {} did not take a chunk, falling back to one transcription",
+                     turn->session_id, turn->user_id);
+            turn->finishing = true;
+            try {
+                backend.abortStream(turn->session_id);
+            } catch (const std::exception& e) {
+                LOG_WARN("Failed to abort stream of user {}: {}", turn->user_id, e.what());
+            }
+            turn->session_id.clear();
+            return;
+        }
+        turn->uploaded_frames += pending.frames();
+        if (!flush) {
+            pollPartial(turn);
+        }
+    }
+
+    void TurnPipeline::pollPartial(const std::shared_ptr<VoiceTurn>& turn) {
+        // One poll at a time; it returns the newest partial, however many chunks went up meanwhile
+        if (turn->finishing || turn->partial_polling.exchange(true)) {
+            return;
+        }
+        const uint64_t after = turn->partial_version;
+        // The session id is cleared on the user's strand if the stream fails
+        bool queued = partials.trySubmit(turn->user_id, [this, turn, after, session_id = turn->session_id] {
+            PartialTranscript partial;
+            try {
+                partial = backend.waitPartial(session_id, after, config.partial_wait);
+            } catch (const std::exception& e) {
+                LOG_WARN("Failed to get partial transcript for user {}: {}", turn->user_id, e.what());
+            }
+            // Back onto the user's strand, which owns the turn's transcript
+            bool applied = stt.trySubmit(turn->user_id, [this, turn, partial = std::move(partial)]() mutable {
+                applyPartial(turn, std::move(partial));
+            });
+            if (!applied) {
+                turn->partial_polling.store(false);
+            }
+        });
+        if (!queued) {
+            turn->partial_polling.store(false);
+        }
+    }
+
+    void TurnPipeline::applyPartial(const std::shared_ptr<VoiceTurn>& turn, PartialTranscript partial) {
+        turn->partial_polling.store(false);
+        if (turn->finishing) {
+            return;
+        }
+
+        if (partial.version > turn->partial_version) {
+            // The service commits words once its passes agree on them
+            turn->partial_version = partial.version;
+            turn->stream.committed_text = std::move(partial.committed);
+            turn->stream.pending_fragment = std::move(partial.pending);
+            LOG_DEBUG("User {} partial (committed='{}', pending='{}')", turn->user_id, turn->stream.committed_text, turn->stream.pending_fragment);
+
+            // Whatever the user said last decides how long a pause may be
+            const StreamSessionState& stream = turn->stream;
+            auto cue = audio_utils::Endpointer::classifyTranscript(
+                stream.pending_fragment.empty() ? stream.committed_text : stream.pending_fragment);
+            if (turn->transcript_cue.exchange(cue) != cue) {
+                backend.transcriptCueChanged(*turn);
+            }
+            if (config.speculate) {
+                speculate(*turn);
+            }
+        }
+
+        // Keep waiting while uploaded audio is not transcribed yet; the next upload restarts it otherwise
+        if (partial.version != 0 && partial.audio_bytes < turn->uploaded_frames * VOICE_FRAME_BYTES) {
+            pollPartial(turn);
+        }
+    }
+
+    void TurnPipeline::speculate(VoiceTurn& turn) {
+        const StreamSessionState& stream = turn.stream;
+
+        // Stable: the last partials committed everything heard and added nothing new.
+        // Pending words mean the user is still talking or the service is unsure of them.
+        if (!stream.pending_fragment.empty()) {
+            turn.stable_partials = 0;
+            return;
+        }
+        if (stream.committed_text.size() != turn.stable_committed_size) {
+            turn.stable_committed_size = stream.committed_text.size();
+            turn.stable_partials = 0;
+        }
+        turn.stable_partials++;
+
+        if (turn.stable_partials < config.speculation_stable_partials ||
+            stream.committed_text.size() < config.speculation_min_chars ||
+            turn.speculations >= config.speculation_max_per_turn ||
+            (turn.speculation && turn.speculation->transcript == stream.committed_text)) {
+            return;
+        }
+
+        // The user said more since the last speculation; its answer is stale
+        discardSpeculation(turn);
+
+        auto speculation = std::make_shared<Speculation>();
+        speculation->transcript = stream.committed_text;
+        speculation->linked = turn.cancel.onCancel([cancel = speculation->cancel] { cancel.cancel(); });
+
+        // Ahead of the turn's real LLM task on the user's strand, so that task finds it done
+        const uint64_t user_id = turn.user_id;
+        bool queued = llm.trySubmit(user_id, [this, speculation, user_id] {
+            if (!speculation->cancel.cancelled()) {
+                speculation->result = backend.speculate(user_id, speculation->transcript, speculation->cancel);
+            }
+        });
+        if (!queued) {
+            return;
+        }
+        turn.speculation = std::move(speculation);
+        turn.speculations++;
+        speculations_started.fetch_add(1, std::memory_order_relaxed);
+        LOG_DEBUG("Speculating on reply to user {}: '{}'", user_id, turn.speculation->transcript);
+    }
+
+    void TurnPipeline::discardSpeculation(VoiceTurn& turn) {
+        if (auto speculation = std::move(turn.speculation)) {
+            speculation->cancel.cancel();
+            speculations_discarded.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    TurnPipeline::SpeculationMetrics TurnPipeline::speculationMetrics() const {
+        SpeculationMetrics metrics;
+        metrics.started = speculations_started.load(std::memory_order_relaxed);
+        metrics.used = speculations_used.load(std::memory_order_relaxed);
+        metrics.discarded = speculations_discarded.load(std::memory_order_relaxed);
+        return metrics;
+    }
+
+    void TurnPipeline::finalize(const std::shared_ptr<VoiceTurn>& turn) {
+        std::string transcribed_text;
+        bool streamed = false;
+        try {
+            // Upload the tail that hasn't been streamed yet, then finish; a failed upload
+            // drops the session
+            turn->finishing = true;
+            upload(turn, true);
+            streamed = !turn->session_id.empty();
+            if (streamed) {
+                transcribed_text = backend.finishStream(turn->session_id);
+            } else {
+                // Fallback: non-streaming call if no session
+                transcribed_text = backend.transcribe(turn->guild_id, turn->utterance->all());
+            }
+        } catch (const std::exception& e) {
+            LOG_ERROR("Failed to transcribe audio for user {}: {}", turn->user_id, e.what());
+            discardSpeculation(*turn);
+            settle(*turn);
+            return;
+        }
+
+        // The finished stream's transcript covers the whole turn; the last partial
+        // stands in if finishing came back empty
+        std::string final_text = transcribed_text;
+        if (streamed && final_text.empty()) {
+            final_text = turn->stream.committed_text;
+            if (!turn->stream.pending_fragment.empty()) {
+                if (!final_text.empty()) final_text += " ";
+                final_text += turn->stream.pending_fragment;
+            }
+        }
+        LOG_INFO("Transcription for user {}: {}", turn->user_id, final_text);
+
+        // A speculative reply only stands if the user said nothing after what it answers
+        if (turn->speculation && (final_text.empty() ||
+                                  normalizeTranscript(turn->speculation->transcript) != normalizeTranscript(final_text))) {
+            LOG_DEBUG("Final transcript of user {} differs from the speculated one, discarding its reply", turn->user_id);
+            discardSpeculation(*turn);
+        }
+
+        // The audio is no longer needed; return its chunks to the pool
+        turn->utterance.reset();
+        if (final_text.empty()) {
+            settle(*turn);
+            return;
+        }
+        turn->transcript = std::move(final_text);
+        turn->utterances.push_back({turn->user_id, turn->transcript});
+        turn->settled.store(true, std::memory_order_release);
+        coalescer.add(turn);
+    }
+
+    void TurnPipeline::respondToBatch(TurnCoalescer::Turns turns) {
+        if (turns.size() == 1) {
+            submitResponse(turns.front());
+            return;
+        }
+
+        // One user message with every speaker's line; their speculative replies answer only part of it
+        auto merged = std::make_shared<VoiceTurn>();
+        merged->user_id = turns.front()->user_id;
+        merged->guild_id = turns.front()->guild_id;
+        for (auto& turn : turns) {
+            discardSpeculation(*turn);
+            merged->utterances.insert(merged->utterances.end(), turn->utterances.begin(), turn->utterances.end());
+            if (!merged->transcript.empty()) merged->transcript += " / ";
+            merged->transcript += turn->transcript;
+        }
+        LOG_INFO("Answering {} speakers in guild {} with one reply", turns.size(), merged->guild_id);
+        submitResponse(merged);
+    }
+
+    void TurnPipeline::trackReply(const std::shared_ptr<VoiceTurn>& turn) {
+        std::lock_guard<std::mutex> lock(replies_mutex);
+        auto& guild_replies = replies[turn->guild_id];
+        guild_replies.erase(std::remove_if(guild_replies.begin(), guild_replies.end(),
+                                           [](const auto& reply) { return reply.expired(); }),
+                            guild_replies.end());
+        guild_replies.push_back(turn);
+    }
+
+    size_t TurnPipeline::bargeIn(uint64_t guild_id) {
+        std::vector<std::weak_ptr<VoiceTurn>> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(replies_mutex);
+            auto it = replies.find(guild_id);
+            if (it == replies.end()) {
+                return 0;
+            }
+            cancelled.swap(it->second);
+            replies.erase(it);
+        }
+
+        size_t count = 0;
+        for (const auto& reply : cancelled) {
+            if (auto turn = reply.lock()) {
+                turn->cancel.cancel();
+                count++;
+            }
+        }
+        return count;
+    }
+
+    void TurnPipeline::submitResponse(const std::shared_ptr<VoiceTurn>& turn) {
+        trackReply(turn);
+        bool queued = llm.trySubmit(turn->user_id, [this, turn] {
+            if (turn->cancel.cancelled()) {
+                return;
+            }
+            // Its request ran before this task on the user's strand, so its result is in
+            if (auto speculation = std::move(turn->speculation)) {
+                if (speculation->result.usable &&
+                    backend.adoptSpeculation(turn->user_id, turn->transcript, speculation->result)) {
+                    turn->reply = std::move(speculation->result.reply);
+                    speculations_used.fetch_add(1, std::memory_order_relaxed);
+                    LOG_INFO("Using speculative reply to user {}", turn->user_id);
+                } else {
+                    speculations_discarded.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if (turn->reply.empty()) {
+                turn->reply = backend.respond(turn->utterances, turn->cancel);
+            }
+            if (turn->cancel.cancelled()) {
+                LOG_INFO("Reply to user {} cancelled by barge-in", turn->user_id);
+                return;
+            }
+            if (turn->reply.empty()) {
+                LOG_ERROR("Ellie did not respond to the message.");
+                return;
+            }
+            submitSpeech(turn);
+        });
+        if (!queued) {
+            LOG_ERROR("LLM queue full, dropping message from user {}", turn->user_id);
+        }
+    }
+
+    void TurnPipeline::submitSpeech(const std::shared_ptr<VoiceTurn>& turn) {
+        bool queued = tts.trySubmit(turn->guild_id, [this, turn] {
+            if (!turn->cancel.cancelled()) {
+                backend.speak(turn->guild_id, turn->reply, turn->cancel);
+            }
+        });
+        if (!queued) {
+            LOG_ERROR("Text-to-speech queue full, dropping reply in guild {}", turn->guild_id);
+        }
+    }
+
+    std::string TurnPipeline::normalizeTranscript(const std::string& text) {
+        // Whisper may case and punctuate the same words differently between passes
+        std::string normalized;
+        bool space = false;
+        for (unsigned char c : text) {
+            if (std::isalnum(c) || c >= 0x80) {
+                if (space && !normalized.empty()) {
+                    normalized += ' ';
+                }
+                normalized += static_cast<char>(std::tolower(c));
+                space = false;
+            } else if (std::isspace(c)) {
+                space = true;
+            }
+        }
+        return normalized;
+    }
+
+} // namespace discord
@@ -3,13 +3,23 @@
 #include "config.hpp"
 #include "inference.hpp"
 #include "conversation.hpp"
+#include "playback_framer.hpp"
+#include <algorithm>
 #include <thread>
 #include <chrono>
+#include <optional>
 
 namespace discord {
 
+    namespace {
+        uint64_t steadyMillis() {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+    }
+
     VoiceModule::VoiceModule(std::shared_ptr<CoreBot> core, std::shared_ptr<CommandsModule> commands) 
-        : core(core), commands(commands), voice_connected(false), is_recording(false),
+        : core(core), commands(commands),
           should_stop_silence_detection(true) {
         
         // Initialize Whisper client
@@ -34,67 +44,110 @@ namespace discord {
         } else {
             LOG_WARN("TTS module initialized without Azure credentials - TTS functionality will be disabled");
         }
-        
-        // Set up voice receive handler
-        core->getBot()->on_voice_receive([this](const dpp::voice_receive_t& event) {
-            if (voice_connected) {
-                std::lock_guard<std::mutex> lock(audio_states_mutex);
-                processAudioChunk(event.user_id, event.audio, event.audio_size);
-            }
-        });
-
-        registerCommands();
-    }
 
-    VoiceModule::~VoiceModule() {
-        stopSilenceDetectionTimer();
-    }
+        // Replies are encoded to Opus on our own workers instead of D++'s voice thread
+        opus_encoder = std::make_unique<OpusEncoderPool>(config::OPUS_ENCODER_THREADS,
+                                                         static_cast<int>(config::OPUS_BITRATE));
+
+        TtsCache::Config cache_config;
+        cache_config.memory_bytes = config::TTS_CACHE_MEMORY_MB * 1024 * 1024;
+        cache_config.directory = config::TTS_CACHE_DIR;
+        cache_config.disk_bytes = config::TTS_CACHE_DISK_MB * 1024 * 1024;
+        cache_config.segment_bytes = std::max<uint64_t>(cache_config.disk_bytes / 8, 1024 * 1024);
+        cache_config.max_chars = config::TTS_CACHE_MAX_CHARS;
+        if (cache_config.max_chars > 0) {
+            tts_cache = std::make_unique<TtsCache>(cache_config);
+        }
 
-    void VoiceModule::mergePartialTranscript(StreamSessionState& state, const std::string& partial_text) {
-        if (partial_text.empty()) return;
-
-        // If new partial starts with last_partial, skip duplicate prefix
-        std::string new_text = partial_text;
-        if (!state.last_partial.empty()) {
-            // Find the longest common prefix
-            size_t prefix = 0;
-            size_t max_len = std::min(state.last_partial.size(), new_text.size());
-            while (prefix < max_len && state.last_partial[prefix] == new_text[prefix]) {
-                ++prefix;
+        // Speech-to-text, LLM and TTS run on their own executors, never on the capture thread
+        TurnPipeline::Config pipeline_config;
+        pipeline_config.min_upload_frames = MIN_STREAM_SEND_FRAMES;
+        pipeline_config.min_utterance_bytes = MIN_AUDIO_SIZE;
+        pipeline_config.partial_poll_threads = std::max<size_t>(1, config::MAX_STREAMING_TURNS);
+        pipeline_config.coalesce_window = std::chrono::milliseconds(config::TURN_COALESCE_MS);
+        pipeline_config.coalesce_max_wait = std::chrono::milliseconds(config::TURN_COALESCE_MAX_WAIT_MS);
+        pipeline_config.speculate = config::SPECULATIVE_LLM != 0;
+        pipeline_config.speculation_stable_partials = config::SPECULATIVE_STABLE_PARTIALS;
+        pipeline_config.speculation_min_chars = config::SPECULATIVE_MIN_CHARS;
+        pipeline_config.speculation_max_per_turn = config::SPECULATIVE_MAX_PER_TURN;
+        pipeline = std::make_unique<TurnPipeline>(*this, pipeline_config);
+
+        // Speech detection runs on 20ms frames of the 48kHz stereo Discord audio
+        CaptureProcessor::Config capture_config;
+        capture_config.vad = audio_utils::VadConfig::fromEnvironment(48000);
+        capture_config.endpointer = audio_utils::EndpointerConfig::fromEnvironment();
+        capture_config.max_users = MAX_VOICE_USERS;
+        capture_config.user_idle_timeout = std::chrono::seconds(config::VOICE_USER_IDLE_S);
+        capture_config.max_utterance_chunks = MAX_UTTERANCE_CHUNKS;
+        capture_config.min_stream_frames = MIN_STREAM_SEND_FRAMES;
+        capture = std::make_unique<CaptureProcessor>(*pipeline, capture_config, steadyMillis());
+
+        if (!config::VOICE_RECORDING_FILE.empty()) {
+            try {
+                recording = std::make_unique<VoiceRecordingWriter>(config::VOICE_RECORDING_FILE);
+                LOG_INFO("Recording all received voice packets to {}", config::VOICE_RECORDING_FILE);
+            } catch (const std::exception& e) {
+                LOG_ERROR("Failed to open voice recording: {}", e.what());
             }
-            new_text = new_text.substr(prefix);
         }
+        
+        auto bot = core->getBot();
 
-        // If there is a pending fragment and new_text continues it without a leading space, try to glue smartly
-        if (!state.pending_fragment.empty() && !new_text.empty()) {
-            if (state.pending_fragment.back() != ' ' && new_text.front() != ' ') {
-                state.pending_fragment += new_text;
-            } else {
-                state.pending_fragment += new_text;
+        // Set up voice receive handler: a hand-off into the user's ring in the guild's session
+        bot->on_voice_receive([this](const dpp::voice_receive_t& event) {
+            if (event.audio_size == 0 || !event.voice_client) {
+                return;
+            }
+            auto session = sessions.find(event.voice_client->server_id);
+            if (!session || session->closing()) {
+                return;
+            }
+            const uint64_t arrival_ms = steadyMillis();
+            if (recording) {
+                recording->append(session->guildId(), event.user_id, arrival_ms, event.audio, event.audio_size);
             }
-        } else if (!new_text.empty()) {
-            state.pending_fragment += new_text;
-        }
 
-        // If we have sentence-ending punctuation, commit up to last terminator
-        size_t last_term = state.pending_fragment.find_last_of(".!?\n");
-        if (last_term != std::string::npos) {
-            std::string to_commit = state.pending_fragment.substr(0, last_term + 1);
-            if (!to_commit.empty()) {
-                if (!state.committed_text.empty()) state.committed_text += " ";
-                state.committed_text += to_commit;
+            // Wake the processing thread unless this user is already waiting for it
+            if (capture->receive(std::move(session), event.user_id, event.audio, event.audio_size, arrival_ms)) {
+                processing_wake.notify();
             }
-            state.pending_fragment.erase(0, last_term + 1);
-            // Trim leading spaces in pending fragment
-            while (!state.pending_fragment.empty() && state.pending_fragment.front() == ' ') {
-                state.pending_fragment.erase(state.pending_fragment.begin());
+        });
+
+        bot->on_voice_ready([this](const dpp::voice_ready_t& event) {
+            if (!event.voice_client) {
+                return;
             }
-        }
+            if (auto session = sessions.find(event.voice_client->server_id)) {
+                session->setState(GuildVoiceSession::State::Connected);
+                LOG_INFO("Voice connection ready in guild {} on shard {}", session->guildId(), session->shardId());
+            }
+        });
+
+        // The bot being disconnected or moved out of voice ends that guild's session only
+        bot->on_voice_state_update([this](const dpp::voice_state_update_t& event) {
+            if (event.state.user_id == this->core->getBot()->me.id && event.state.channel_id.empty()) {
+                closeSession(event.state.guild_id);
+            }
+        });
 
-        state.last_partial = partial_text;
+        registerCommands();
+    }
+
+    VoiceModule::~VoiceModule() {
+        stopSilenceDetectionTimer();
+        pipeline->shutdown();
+        playback_pacer.stop();
+        auto open_sessions = sessions.snapshot();
+        for (const auto& session : open_sessions) {
+            session->playback().flush();
+        }
+        capture->cancelEndpoints(open_sessions);
     }
 
     void VoiceModule::startSilenceDetectionTimer() {
+        if (silence_detection_thread.joinable()) {
+            return;
+        }
         should_stop_silence_detection = false;
         silence_detection_thread = std::thread(&VoiceModule::silenceDetectionLoop, this);
         LOG_INFO("Started silence detection timer");
@@ -102,6 +155,7 @@ namespace discord {
 
     void VoiceModule::stopSilenceDetectionTimer() {
         should_stop_silence_detection = true;
+        processing_wake.notify();
         if (silence_detection_thread.joinable()) {
             silence_detection_thread.join();
         }
@@ -110,89 +164,92 @@ namespace discord {
 
     void VoiceModule::silenceDetectionLoop() {
         while (!should_stop_silence_detection) {
-            {
-                std::lock_guard<std::mutex> lock(audio_states_mutex);
-                for (const auto& [user_id, _] : user_audio_states) {
-                    checkForSilenceAndTranscribe(user_id);
-                }
+            capture->poll(steadyMillis());
+
+            // Sleep until audio arrives or the next endpoint is due; with nobody
+            // speaking there is no deadline and the thread sleeps until woken
+            std::optional<std::chrono::steady_clock::time_point> wake_at;
+            if (auto next = capture->nextWakeup()) {
+                wake_at = std::chrono::steady_clock::time_point(std::chrono::milliseconds(*next));
             }
-            std::this_thread::sleep_for(SILENCE_CHECK_INTERVAL);
+            processing_wake.wait(wake_at);
         }
     }
 
-    void VoiceModule::processAudioChunk(dpp::snowflake user_id, const uint8_t* audio, size_t audio_size) {
-        auto& state = user_audio_states[user_id];
-        auto now = std::chrono::steady_clock::now();
+    void VoiceModule::closeSession(dpp::snowflake guild_id) {
+        auto session = sessions.remove(guild_id);
+        if (!session) {
+            return;
+        }
+        session->setState(GuildVoiceSession::State::Closing);
+        session->playback().flush();
+        playback_pacer.remove(session->playbackPtr());
+        LOG_INFO("Left voice in guild {} ({} users tracked)", guild_id, session->userCount());
+
+        // Its users' timers belong to the processing thread, which releases the session
+        capture->retire(std::move(session));
+        processing_wake.notify();
+    }
+
+    void VoiceModule::sendVoiceMessage(dpp::snowflake user_id, const std::string& message, dpp::snowflake guild_id) {
+        pipeline->respondTo(user_id, guild_id, message);
+    }
+
+    std::string VoiceModule::startStream() {
+        return stt ? stt->startStream() : "";
+    }
 
-        // If we haven't received audio for this user before, initialize their state
-        if (state.current_buffer.empty()) {
-            state.last_audio_time = now;
-            state.is_speaking = false;
+    bool VoiceModule::appendStream(const std::string& session_id, const FrameView& audio) {
+        return stt && stt->appendStream(session_id, audio.spans());
+    }
+
+    PartialTranscript VoiceModule::waitPartial(const std::string& session_id, uint64_t after_version,
+                                               std::chrono::milliseconds wait) {
+        if (!stt) {
+            return {};
         }
+        WhisperClient::StreamPartial partial = stt->waitPartial(session_id, after_version, wait);
+        return {partial.version, partial.audio_bytes, std::move(partial.committed), std::move(partial.pending)};
+    }
 
-        // Check if this is a new speech segment
-        if (!state.is_speaking && audio_size > 0) {
-            state.is_speaking = true;
-            state.current_buffer.clear();
-            LOG_DEBUG("User {} started speaking", user_id);
+    std::string VoiceModule::finishStream(const std::string& session_id) {
+        return stt ? stt->finishStream(session_id) : "";
+    }
 
-            // Start streaming session for this user
-            try {
-                if (stt) {
-                    std::string sid = stt->startStream();
-                    if (!sid.empty()) {
-                        user_stream_session_ids[user_id] = sid;
-                        LOG_DEBUG("Started stream session {} for user {}", sid, user_id);
-                        // Reset stream accumulator
-                        auto& sstate = stream_states[user_id];
-                        sstate.accumulator.clear();
-                        sstate.committed_text.clear();
-                        sstate.pending_fragment.clear();
-                        sstate.last_partial.clear();
-                    }
-                }
-            } catch (const std::exception& e) {
-                LOG_ERROR("Failed to start stream for user {}: {}", user_id, e.what());
-            }
+    void VoiceModule::abortStream(const std::string& session_id) {
+        if (stt) {
+            stt->abortStream(session_id);
         }
+    }
 
-        // Add audio to buffer if we're recording or the user is speaking
-        if (is_recording || state.is_speaking) {
-            size_t current_size = state.current_buffer.size();
-            state.current_buffer.resize(current_size + audio_size);
-            std::memcpy(state.current_buffer.data() + current_size, audio, audio_size);
-            state.last_audio_time = now;
-            
-            LOG_DEBUG("Recorded {} bytes of audio from user {} (total: {} bytes)", 
-                    audio_size, user_id, state.current_buffer.size());
-
-            // Append chunk to streaming session if available
-            auto it = user_stream_session_ids.find(user_id);
-            if (it != user_stream_session_ids.end() && stt) {
-                auto& sstate = stream_states[user_id];
-                // Accumulate and only send when we have at least ~1s of audio
-                size_t prev_size = sstate.accumulator.size();
-                sstate.accumulator.resize(prev_size + audio_size);
-                std::memcpy(sstate.accumulator.data() + prev_size, audio, audio_size);
-
-                if (sstate.accumulator.size() >= MIN_STREAM_SEND_BYTES) {
-                    std::string partial = stt->appendStream(it->second, sstate.accumulator);
-                    sstate.accumulator.clear();
-                    if (!partial.empty()) {
-                        mergePartialTranscript(sstate, partial);
-                        LOG_DEBUG("User {} partial (committed='{}', pending='{}')", user_id, sstate.committed_text, sstate.pending_fragment);
-                    }
-                }
-            }
+    std::string VoiceModule::transcribe(uint64_t guild_id, const FrameView& audio) {
+        return stt ? stt->audioToText(audio.spans(), std::to_string(guild_id)) : "";
+    }
+
+    void VoiceModule::transcriptCueChanged(const VoiceTurn& turn) {
+        // Have the processing thread re-arm the user's endpoint with the new timeout
+        auto session = sessions.find(turn.guild_id);
+        if (session && !session->closing() && capture->requeue(std::move(session), turn.user_id)) {
+            processing_wake.notify();
         }
     }
 
-    void VoiceModule::sendVoiceMessage(dpp::snowflake user_id, const std::string& message, dpp::snowflake guild_id) {
-        dpp::guild* g = dpp::find_guild(guild_id);
+    static std::string displayName(uint64_t user_id) {
         dpp::user* u = dpp::find_user(user_id);
-        std::string username = u->username;
+        return u ? u->username : std::to_string(user_id);
+    }
 
-        std::string prompt = buildPrompt(message, username);
+    std::string VoiceModule::respond(const std::vector<Utterance>& utterances, const CancellationToken& cancel) {
+        std::string prompt;
+        std::vector<std::pair<std::string, std::string>> lines;
+        if (utterances.size() == 1) {
+            prompt = buildPrompt(utterances.front().text, displayName(utterances.front().user_id));
+        } else {
+            for (const auto& utterance : utterances) {
+                lines.emplace_back(displayName(utterance.user_id), utterance.text);
+            }
+            prompt = buildPrompt(lines);
+        }
         
         // Debug output for prompt
         LOG_DEBUG("=== Generated Prompt ===");
@@ -200,116 +257,158 @@ namespace discord {
         LOG_DEBUG("=====================");
 
         // Get Ellie's response
-        std::string ellieResponse = runInference(prompt);
+        std::string ellieResponse = runInference(prompt, cancel);
+        if (cancel.cancelled()) {
+            // Unanswered, so the next prompt does not carry it; a barge-in usually repeats it anyway.
+            // A reply that arrived before the cancel is already in the history and keeps it.
+            if (ellieResponse.empty()) {
+                if (utterances.size() == 1) {
+                    retractPrompt(utterances.front().text, displayName(utterances.front().user_id));
+                } else {
+                    retractPrompt(lines);
+                }
+            }
+            return "";
+        }
 
         // Debug output for response
         LOG_INFO("=== Ellie's Response ===");
         LOG_INFO("{}", ellieResponse);
         LOG_INFO("==================");
 
-        // Check if the response is not empty
-        if (!ellieResponse.empty()) {
-            speakText(ellieResponse, guild_id);
-        } else {
-            LOG_ERROR("Ellie did not respond to the message.");
+        return ellieResponse;
+    }
+
+    SpeculativeReply VoiceModule::speculate(uint64_t user_id, const std::string& transcript, const CancellationToken& cancel) {
+        SpeculativeReply speculative;
+        std::string prompt = forkPrompt(transcript, displayName(user_id), speculative.history_version);
+
+        // The token limit bounds what a wrong guess costs; a reply it cut short is not used
+        ChatCompletion completion = runChatCompletion(prompt, static_cast<int>(config::SPECULATIVE_MAX_TOKENS), cancel);
+        speculative.usable = completion.ok && !completion.truncated && !completion.text.empty();
+        speculative.reply = std::move(completion.text);
+        if (completion.ok && !speculative.usable) {
+            LOG_DEBUG("Speculative reply to user {} hit the token limit ({} tokens)", user_id, completion.completion_tokens);
         }
+        return speculative;
     }
 
-    void VoiceModule::checkForSilenceAndTranscribe(dpp::snowflake user_id) {
-        auto& state = user_audio_states[user_id];
-        auto now = std::chrono::steady_clock::now();
-        auto silence_duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-            now - state.last_audio_time
-        );
-
-        // If we've detected silence and have enough audio data
-        if (state.is_speaking && 
-            silence_duration > SILENCE_THRESHOLD && 
-            state.current_buffer.size() >= MIN_AUDIO_SIZE) {
-            
-            state.is_speaking = false;
-            LOG_INFO("Detected silence for user {}, transcribing {} bytes", 
-                    user_id, state.current_buffer.size());
+    bool VoiceModule::adoptSpeculation(uint64_t user_id, const std::string& transcript, const SpeculativeReply& reply) {
+        if (!commitExchange(transcript, displayName(user_id), reply.reply, reply.history_version)) {
+            LOG_DEBUG("Conversation changed since the speculative reply to user {} was forked", user_id);
+            return false;
+        }
+        LOG_INFO("=== Ellie's Response (speculative) ===");
+        LOG_INFO("{}", reply.reply);
+        LOG_INFO("==================");
+        return true;
+    }
 
-            try {
-                if (stt) {
-                    // Finish streaming session and transcribe
-                    std::string sid;
-                    auto it = user_stream_session_ids.find(user_id);
-                    if (it != user_stream_session_ids.end()) {
-                        sid = it->second;
-                        user_stream_session_ids.erase(it);
-                    }
-
-                    std::string transcribed_text;
-                    if (!sid.empty()) {
-                        // Flush any remaining accumulator before finish to improve finalization
-                        auto sstate_it = stream_states.find(user_id);
-                        if (sstate_it != stream_states.end() && !sstate_it->second.accumulator.empty()) {
-                            std::string partial = stt->appendStream(sid, sstate_it->second.accumulator);
-                            sstate_it->second.accumulator.clear();
-                            if (!partial.empty()) {
-                                mergePartialTranscript(sstate_it->second, partial);
-                            }
-                        }
-                        transcribed_text = stt->finishStream(sid);
-                    } else {
-                        // Fallback: non-streaming call if no session
-                        transcribed_text = stt->audioToText(state.current_buffer);
-                    }
-
-                    // Build final message from committed + pending + final tail
-                    auto sstate_it = stream_states.find(user_id);
-                    std::string final_text = transcribed_text;
-                    if (sstate_it != stream_states.end()) {
-                        final_text = sstate_it->second.committed_text;
-                        if (!sstate_it->second.pending_fragment.empty()) {
-                            if (!final_text.empty()) final_text += " ";
-                            final_text += sstate_it->second.pending_fragment;
-                        }
-                        if (!transcribed_text.empty()) {
-                            if (!final_text.empty()) final_text += " ";
-                            final_text += transcribed_text;
-                        }
-                        // Clear state for next session
-                        stream_states.erase(sstate_it);
-                    }
-
-                    if (!final_text.empty()) {
-                        sendVoiceMessage(user_id, final_text, state.guild_id);
-                    }
-                    LOG_INFO("Transcription for user {}: {}", user_id, final_text);
+    void VoiceModule::speak(uint64_t guild_id, const std::string& reply, const CancellationToken& cancel) {
+        speakText(reply, guild_id, cancel);
+    }
+
+    void VoiceModule::speakText(const std::string& text, dpp::snowflake guild_id, const CancellationToken& cancel) {
+        auto session = sessions.find(guild_id);
+        if (!session) {
+            LOG_WARN("No voice session for guild {}, dropping TTS reply", guild_id);
+            return;
+        }
+
+        // Repeated short lines play straight from the cache, without Azure or the encoder
+        std::string cache_key;
+        if (tts_cache && tts_cache->cacheable(text)) {
+            cache_key = TtsCache::key(text, config::AZURE_SPEECH_VOICE, "opus/48000/2/" + std::to_string(opus_encoder->bitrate()));
+            if (OpusClipPtr clip = tts_cache->find(cache_key)) {
+                auto stream = session->playback().open(PlaybackPriority::Reply);
+                for (const auto& packet : clip->packets) {
+                    stream->push(packet.data(), packet.size());
                 }
-            } catch (const std::exception& e) {
-                LOG_ERROR("Failed to transcribe audio for user {}: {}", user_id, e.what());
+                stream->finish();
+                LOG_DEBUG("Queued {} cached Opus packets for guild {}", clip->packets.size(), guild_id);
+                return;
             }
-
-            // Clear the buffer after transcription
-            state.current_buffer.clear();
         }
-    }
-    
-    void VoiceModule::speakText(const std::string& text, dpp::snowflake guild_id) {
+
         if (!tts) {
             LOG_WARN("TTS not initialized - missing Azure key");
             return;
         }
 
+        auto stream = session->playback().open(PlaybackPriority::Reply);
+        auto stop_playback = cancel.onCancel([stream] { stream->cancel(); });
         try {
-            // Convert text to speech
-            std::vector<uint8_t> audio_data = tts->textToSpeech(text, config::AZURE_SPEECH_VOICE);
-            
-            // Get voice connection for the guild
-            if (auto vconn = core->getBot()->get_shard(0)->get_voice(guild_id)) {
-                // Convert audio format and send
-                std::vector<uint16_t> stereo_data = VoiceModule::convertTTSAudioFormat(audio_data);
-                vconn->voiceclient->send_audio_raw(stereo_data.data(), stereo_data.size() * sizeof(uint16_t));
+            // Upsample to 48kHz stereo, encode each 20ms frame on the Opus pool and queue
+            // the packets for the guild's playback engine, which starts playing while TTS
+            // is still streaming. A full stream holds back synthesis.
+            auto job = opus_encoder->begin([stream](uint8_t* packet, size_t size) {
+                stream->push(packet, size);
+            });
+            // A stream flushed from elsewhere (barge-in, leaving the channel) drops later frames
+            // without cancelling the reply; such a clip is cut short and must not be cached
+            bool every_frame = true;
+            audio_utils::PlaybackFramer framer(24000, [&job, &stream, &every_frame](int16_t* frame, size_t bytes) {
+                if (stream->waitForSpace([&job] { return job->pendingFrames(); })) {
+                    job->pushFrame(frame, bytes);
+                } else {
+                    every_frame = false;
+                }
+            });
+            tts->textToSpeechStream(text, config::AZURE_SPEECH_VOICE, [&framer](const uint8_t* data, size_t size) {
+                framer.push(data, size);
+            }, cancel);
+            if (!cancel.cancelled()) {
+                framer.finish();
+            }
+
+            OpusClipPtr clip = job->finish().get();
+            stream->finish();
+            if (cancel.cancelled() || stream->cancelled() || !every_frame) {
+                LOG_INFO("Dropped reply in guild {} after {} packets, interrupted", guild_id, clip->packets.size());
+                return;
+            }
+            LOG_DEBUG("Queued {} Opus packets ({} bytes, {} silent frames suppressed) for guild {}",
+                      clip->packets.size(), clip->bytes(), clip->suppressed_frames, guild_id);
+            if (!cache_key.empty()) {
+                tts_cache->insert(cache_key, clip);
             }
         } catch (const std::exception& e) {
+            stream->cancel();
             LOG_ERROR("Error in TTS: {}", e.what());
         }
     }
 
+    PlaybackOutput VoiceModule::makePlaybackOutput(dpp::snowflake guild_id, uint32_t shard_id) {
+        // Resolved per call, since the connection can be replaced. The output runs on the
+        // pacer thread, so it must not look the guild up in the session map: the map is
+        // locked while sessions are created, and creating one registers with the pacer.
+        auto voice_client = [bot = core->getBot(), guild_id, shard_id]() -> dpp::discord_voice_client* {
+            dpp::discord_client* shard = bot->get_shard(shard_id);
+            dpp::voiceconn* vconn = shard ? shard->get_voice(guild_id) : nullptr;
+            return vconn && vconn->voiceclient && vconn->voiceclient->is_ready() ? vconn->voiceclient.get() : nullptr;
+        };
+
+        PlaybackOutput output;
+        output.send = [voice_client](uint8_t* packet, size_t size) {
+            dpp::discord_voice_client* client = voice_client();
+            if (!client) {
+                return false;
+            }
+            client->send_audio_opus(packet, size, PlaybackEngine::FRAME_MS);
+            return true;
+        };
+        output.buffered_ms = [voice_client]() -> uint32_t {
+            dpp::discord_voice_client* client = voice_client();
+            return client ? static_cast<uint32_t>(client->get_secs_remaining() * 1000.0f) : 0;
+        };
+        output.clear = [voice_client] {
+            if (dpp::discord_voice_client* client = voice_client()) {
+                client->stop_audio();
+            }
+        };
+        return output;
+    }
+
     void VoiceModule::registerCommands() {
         auto bot = core->getBot();
 
@@ -318,6 +417,12 @@ namespace discord {
         joinVoiceCommand.default_member_permissions = 0;
         commands->addCommand(std::move(joinVoiceCommand));
         commands->addCommandHandler("joinvoice", [this](const auto& event) { handleJoinVoiceCommand(event); });
+
+        // Create the leave voice command
+        dpp::slashcommand leaveVoiceCommand("leavevoice", "Leave the voice channel in this server", bot->me.id);
+        leaveVoiceCommand.default_member_permissions = 0;
+        commands->addCommand(std::move(leaveVoiceCommand));
+        commands->addCommandHandler("leavevoice", [this](const auto& event) { handleLeaveVoiceCommand(event); });
     }
 
     void VoiceModule::handleJoinVoiceCommand(const dpp::slashcommand_t& event) {
@@ -334,26 +439,48 @@ namespace discord {
             return;
         }
 
-        voice_connected = true;
-        
-        // Initialize states for all users in the voice channel
-        {
-            std::lock_guard<std::mutex> lock(audio_states_mutex);
-            user_audio_states.clear();
-            for (const auto& [user_id, state] : g->voice_members) {
-                UserAudioState audio_state;
-                audio_state.current_buffer.reserve(1024 * 1024); // Reserve 1MB initially
-                audio_state.is_speaking = false;
-                audio_state.last_audio_time = std::chrono::steady_clock::now();
-                audio_state.guild_id = guild_id;
-                user_audio_states[user_id] = std::move(audio_state);
+        // A rejoin keeps the guild's existing session; other guilds are untouched
+        bool created = false;
+        auto session = sessions.findOrCreate(guild_id, [&] {
+            created = true;
+            auto playback = std::make_shared<PlaybackEngine>(guild_id, makePlaybackOutput(guild_id, g->shard_id));
+            return std::make_shared<GuildVoiceSession>(guild_id, g->shard_id, capture->ringPool(), MAX_VOICE_USERS,
+                                                       std::move(playback));
+        });
+        // Outside the map's lock, which the pacer must never wait on
+        if (created) {
+            playback_pacer.add(session->playbackPtr());
+            // A leave that raced the join has already tried to remove it
+            if (session->closing()) {
+                playback_pacer.remove(session->playbackPtr());
             }
         }
         
+        // Register everyone already in the channel; rings are only taken once they speak
+        for (const auto& [user_id, state] : g->voice_members) {
+            session->findOrAddUser(user_id);
+        }
+        LOG_INFO("Joining voice in guild {} on shard {} ({} active voice sessions)", guild_id, g->shard_id, sessions.size());
+        
         startSilenceDetectionTimer();
         event.reply("Joined your voice channel! I will now transcribe speech automatically when there are pauses in conversation.");
     }
 
+    void VoiceModule::handleLeaveVoiceCommand(const dpp::slashcommand_t& event) {
+        auto guild_id = event.command.guild_id;
+        auto session = sessions.find(guild_id);
+        if (!session) {
+            event.reply("I'm not in a voice channel in this server!");
+            return;
+        }
+
+        if (dpp::discord_client* shard = core->getBot()->get_shard(session->shardId())) {
+            shard->disconnect_voice(guild_id);
+        }
+        closeSession(guild_id);
+        event.reply("Left the voice channel.");
+    }
+
     std::vector<uint8_t> VoiceModule::convertToWav(const std::vector<uint8_t>& raw_audio) {
         // WAV header for 48kHz 16-bit stereo PCM
         const uint8_t wav_header[] = {
@@ -400,31 +527,4 @@ namespace discord {
         return wav_data;
     }
 
-    std::vector<uint16_t> VoiceModule::convertTTSAudioFormat(const std::vector<uint8_t>& mono_24khz) {
-        std::vector<uint16_t> stereo_data;
-        const int16_t* mono_samples = reinterpret_cast<const int16_t*>(mono_24khz.data());
-        size_t num_samples = mono_24khz.size() / sizeof(int16_t);
-        
-        stereo_data.reserve(num_samples * 4);
-        
-        for (size_t i = 0; i < num_samples - 1; i++) {
-            int16_t current = mono_samples[i];
-            int16_t next = mono_samples[i + 1];
-            
-            stereo_data.push_back(static_cast<uint16_t>(current));
-            stereo_data.push_back(static_cast<uint16_t>(current));
-            
-            int16_t interpolated = (current + next) / 2;
-            stereo_data.push_back(static_cast<uint16_t>(interpolated));
-            stereo_data.push_back(static_cast<uint16_t>(interpolated));
-        }
-        
-        stereo_data.push_back(static_cast<uint16_t>(mono_samples[num_samples - 1]));
-        stereo_data.push_back(static_cast<uint16_t>(mono_samples[num_samples - 1]));
-        
-        LOG_DEBUG("Converted {} mono samples to stereo", num_samples);
-        
-        return stereo_data;
-    }
-
 } // namespace discord 
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include "discord_bot/voice_ingest.hpp"
+#include "logging.hpp"
+
+namespace discord {
+
+    SlabPool::SlabPool(size_t block_bytes, size_t blocks_per_slab, size_t max_blocks)
+        : block_bytes(block_bytes), blocks_per_slab(std::max<size_t>(1, blocks_per_slab)),
+          max_blocks(std::max<size_t>(1, max_blocks)), free_blocks(this->max_blocks) {}
+
+    uint8_t* SlabPool::acquire() {
+        if (auto block = free_blocks.tryPop()) {
+            in_use.fetch_add(1, std::memory_order_relaxed);
+            return *block;
+        }
+
+        std::lock_guard<std::mutex> lock(grow_mutex);
+        // Another thread may have released a block while we waited
+        if (auto block = free_blocks.tryPop()) {
+            in_use.fetch_add(1, std::memory_order_relaxed);
+            return *block;
+        }
+        if (carved >= max_blocks) {
+            return nullptr;
+        }
+
+        size_t count = std::min(blocks_per_slab, max_blocks - carved);
+        slabs.push_back(std::make_unique<uint8_t[]>(count * block_bytes));
+        uint8_t* slab = slabs.back().get();
+        carved += count;
+        for (size_t i = 1; i < count; i++) {
+            free_blocks.tryPush(slab + i * block_bytes);
+        }
+        LOG_DEBUG("Slab pool grew to {} blocks of {} bytes", carved, block_bytes);
+
+        in_use.fetch_add(1, std::memory_order_relaxed);
+        return slab;
+    }
+
+    void SlabPool::release(uint8_t* block) {
+        if (block == nullptr) return;
+        // The free list holds max_blocks entries, so this cannot fail
+        free_blocks.tryPush(block);
+        in_use.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<FrameStore> FrameStore::create(SlabPool& chunk_pool) {
+        return std::shared_ptr<FrameStore>(new FrameStore(chunk_pool));
+    }
+
+    FrameStore::~FrameStore() {
+        for (uint8_t* chunk : chunks) {
+            pool.release(chunk);
+        }
+    }
+
+    bool FrameStore::append(const uint8_t* frame) {
+        size_t count = frame_count.load(std::memory_order_relaxed);
+        size_t chunk = count / CHUNK_FRAMES;
+        if (chunk >= MAX_CHUNKS) {
+            return false;
+        }
+        if (chunks[chunk] == nullptr) {
+            chunks[chunk] = pool.acquire();
+            if (chunks[chunk] == nullptr) {
+                return false;
+            }
+        }
+
+        std::memcpy(chunks[chunk] + (count % CHUNK_FRAMES) * VOICE_FRAME_BYTES, frame, VOICE_FRAME_BYTES);
+        frame_count.store(count + 1, std::memory_order_release);
+        return true;
+    }
+
+    FrameView FrameStore::view(size_t first, size_t last) const {
+        size_t published = frames();
+        last = std::min(last, published);
+        first = std::min(first, last);
+        return FrameView(shared_from_this(), first, last);
+    }
+
+    FrameView FrameStore::all() const {
+        return view(0, frames());
+    }
+
+    std::vector<WhisperClient::AudioSpan> FrameView::spans() const {
+        std::vector<WhisperClient::AudioSpan> result;
+        size_t frame = first;
+        while (frame < last) {
+            size_t chunk = frame / FrameStore::CHUNK_FRAMES;
+            size_t offset = frame % FrameStore::CHUNK_FRAMES;
+            size_t count = std::min(FrameStore::CHUNK_FRAMES - offset, last - frame);
+            result.push_back({store->chunks[chunk] + offset * VOICE_FRAME_BYTES, count * VOICE_FRAME_BYTES});
+            frame += count;
+        }
+        return result;
+    }
+
+    std::vector<uint8_t> FrameView::copy() const {
+        std::vector<uint8_t> result;
+        result.reserve(bytes());
+        for (const auto& span : spans()) {
+            result.insert(result.end(), span.data, span.data + span.size);
+        }
+        return result;
+    }
+
+} // namespace discord
@@ -0,0 +1,243 @@
+#include "discord_bot/voice_recording.hpp"
+#include "logging.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace discord {
+
+    using namespace voice_recording;
+
+    VoiceRecordingWriter::VoiceRecordingWriter(const std::string& path, size_t slot_count)
+        : free_slots(slot_count), queue(slot_count), buffer(1 << 20) {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("Cannot open " + path + " for writing");
+        }
+        // Packets arrive every 20ms per user; let stdio batch them into large writes
+        std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+
+        FileHeader header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.channels = 2;
+        header.sample_rate = 48000;
+        if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+            std::fclose(file);
+            throw std::runtime_error("Cannot write to " + path);
+        }
+
+        // Slots sized for a 20ms stereo frame, which is what D++ delivers
+        for (size_t i = 0; i < slot_count; i++) {
+            auto slot = std::make_unique<Slot>();
+            slot->audio.reserve(3840);
+            free_slots.tryPush(slot.get());
+            slots.push_back(std::move(slot));
+        }
+        writer = std::thread(&VoiceRecordingWriter::writerLoop, this);
+    }
+
+    VoiceRecordingWriter::~VoiceRecordingWriter() {
+        stopping.store(true, std::memory_order_release);
+        pending.fetch_add(1, std::memory_order_release);
+        pending.notify_one();
+        if (writer.joinable()) {
+            writer.join();
+        }
+        if (std::fclose(file) != 0) {
+            write_failures.fetch_add(1, std::memory_order_relaxed);
+        }
+        reportProblems();
+    }
+
+    void VoiceRecordingWriter::append(uint64_t guild_id, uint64_t user_id, uint64_t arrival_ms, const uint8_t* audio, size_t size) {
+        auto slot = free_slots.tryPop();
+        if (!slot) {
+            dropped_packets.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Slot& record = **slot;
+        record.guild_id = guild_id;
+        record.user_id = user_id;
+        record.arrival_ms = arrival_ms;
+        record.audio.assign(audio, audio + size);
+
+        // Never full: there are no more slots than it holds
+        queue.tryPush(&record);
+        pending.fetch_add(1, std::memory_order_release);
+        pending.notify_one();
+    }
+
+    void VoiceRecordingWriter::writerLoop() {
+        uint32_t seen = 0;
+        while (true) {
+            pending.wait(seen, std::memory_order_acquire);
+            seen = pending.load(std::memory_order_acquire);
+
+            while (auto slot = queue.tryPop()) {
+                writePacket(**slot);
+                free_slots.tryPush(*slot);
+            }
+            reportProblems();
+
+            if (stopping.load(std::memory_order_acquire)) {
+                // Packets queued before the stop are written by the drain above
+                std::fflush(file);
+                return;
+            }
+        }
+    }
+
+    void VoiceRecordingWriter::writePacket(const Slot& slot) {
+        if (!started) {
+            start_ms = slot.arrival_ms;
+            started = true;
+        }
+        // Voice threads hand packets over in about, not exactly, arrival order
+        const uint32_t time_ms = static_cast<uint32_t>(slot.arrival_ms > start_ms ? slot.arrival_ms - start_ms : 0);
+
+        auto key = std::make_pair(slot.guild_id, slot.user_id);
+        auto it = streams.find(key);
+        if (it == streams.end()) {
+            if (streams.size() > UINT16_MAX) {
+                return;
+            }
+            it = streams.emplace(key, static_cast<uint16_t>(streams.size())).first;
+            uint64_t ids[2] = {slot.guild_id, slot.user_id};
+            writeRecord({time_ms, it->second, static_cast<uint16_t>(RecordKind::Stream), sizeof(ids)}, ids);
+        }
+        writeRecord({time_ms, it->second, static_cast<uint16_t>(RecordKind::Packet), static_cast<uint32_t>(slot.audio.size())},
+                    slot.audio.data());
+    }
+
+    void VoiceRecordingWriter::writeRecord(const RecordHeader& header, const void* payload) {
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        if (written && header.size > 0) {
+            written = std::fwrite(payload, header.size, 1, file) == 1;
+        }
+        if (!written) {
+            write_failures.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void VoiceRecordingWriter::reportProblems() {
+        const uint64_t drops = dropped_packets.load(std::memory_order_relaxed);
+        if (drops != reported_drops) {
+            LOG_WARN("Voice recording fell behind, dropped {} packets ({} so far)", drops - reported_drops, drops);
+            reported_drops = drops;
+        }
+        const uint64_t failures = write_failures.load(std::memory_order_relaxed);
+        if (failures != reported_failures) {
+            LOG_ERROR("Failed to write {} voice recording records ({} so far): {}", failures - reported_failures, failures,
+                      std::strerror(errno));
+            reported_failures = failures;
+        }
+    }
+
+    VoiceRecordingReader::VoiceRecordingReader(const std::string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open " + path);
+        }
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* mapping = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                data = static_cast<const uint8_t*>(mapping);
+                size = static_cast<size_t>(st.st_size);
+                mapped = true;
+                // Replay reads front to back
+                ::madvise(mapping, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+#endif
+        if (!mapped) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in) {
+                throw std::runtime_error("Cannot open " + path);
+            }
+            fallback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            data = fallback.data();
+            size = fallback.size();
+        }
+
+        FileHeader header{};
+        if (size < sizeof(header)) {
+            throw std::runtime_error(path + " is not a voice recording");
+        }
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+            throw std::runtime_error(path + " is not a voice recording (or of an unknown version)");
+        }
+        if (header.channels != 2 || header.sample_rate != 48000) {
+            throw std::runtime_error(path + " is not 48kHz stereo");
+        }
+        offset = sizeof(header);
+    }
+
+    VoiceRecordingReader::~VoiceRecordingReader() {
+#ifndef _WIN32
+        if (mapped) {
+            ::munmap(const_cast<uint8_t*>(data), size);
+        }
+#endif
+    }
+
+    bool VoiceRecordingReader::next(Packet& packet) {
+        while (offset + sizeof(RecordHeader) <= size) {
+            RecordHeader header{};
+            std::memcpy(&header, data + offset, sizeof(header));
+            const uint8_t* payload = data + offset + sizeof(header);
+            if (header.size > size - offset - sizeof(header)) {
+                LOG_WARN("Voice recording ends in a truncated record");
+                offset = size;
+                return false;
+            }
+            offset += sizeof(header) + header.size;
+
+            if (header.kind == static_cast<uint16_t>(RecordKind::Stream) && header.size >= 2 * sizeof(uint64_t)) {
+                if (streams.size() <= header.stream) {
+                    streams.resize(header.stream + 1u);
+                }
+                std::memcpy(&streams[header.stream].first, payload, sizeof(uint64_t));
+                std::memcpy(&streams[header.stream].second, payload + sizeof(uint64_t), sizeof(uint64_t));
+                continue;
+            }
+            if (header.kind != static_cast<uint16_t>(RecordKind::Packet) || header.stream >= streams.size()) {
+                continue;  // Unknown record kinds are skipped
+            }
+
+            packet.time_ms = header.time_ms;
+            packet.guild_id = streams[header.stream].first;
+            packet.user_id = streams[header.stream].second;
+            packet.audio = payload;
+            packet.size = header.size;
+            return true;
+        }
+        return false;
+    }
+
+    uint32_t VoiceRecordingReader::durationMs() {
+        const size_t saved = offset;
+        rewind();
+        uint32_t last = 0;
+        Packet packet;
+        while (next(packet)) {
+            last = packet.time_ms;
+        }
+        offset = saved;
+        return last;
+    }
+
+} // namespace discord
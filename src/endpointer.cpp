@@ -0,0 +1,212 @@
+#include "endpointer.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace audio_utils {
+
+namespace {
+
+// Each recorded pause weighs a little less than the one after it, so the
+// histogram follows the speaker over a few dozen pauses
+constexpr float PAUSE_DECAY = 0.97f;
+constexpr float PAUSE_QUANTILE = 0.9f;
+constexpr float PAUSE_MARGIN = 1.25f;
+
+// Voiced energy averages: the utterance's level and its most recent frames
+constexpr float LEVEL_ALPHA = 0.05f;
+constexpr float TAIL_ALPHA = 0.3f;
+constexpr uint32_t MIN_VOICED_FOR_TREND = 10;
+
+// Words a sentence does not end on
+const char* const CONNECTIVES[] = {
+    "and", "but", "or", "so", "because", "cause", "if", "then", "which", "while",
+    "the", "a", "an", "my", "your", "to", "of", "for", "with", "from", "into",
+    "um", "uh", "erm"
+};
+
+// A question opens with one of these followed by an auxiliary ("what is", "how do"),
+// with a contracted one ("what's"), or with an auxiliary followed by its subject ("can you").
+// Either word alone also starts plenty of statements ("when I was", "do it").
+const char* const QUESTION_WORDS[] = {
+    "what", "why", "how", "when", "where", "who", "which", "whose"
+};
+const char* const CONTRACTED_QUESTIONS[] = {
+    "what's", "why's", "how's", "when's", "where's", "who's"
+};
+const char* const AUXILIARIES[] = {
+    "is", "are", "was", "were", "am", "do", "does", "did", "can", "could", "would", "will",
+    "should", "shall", "may", "might", "must", "have", "has", "had"
+};
+const char* const SUBJECTS[] = {
+    "i", "you", "he", "she", "it", "we", "they", "there", "this", "that"
+};
+// Objects of an imperative "do" ("do it now") that could also be the subject of a question
+const char* const DO_OBJECTS[] = {
+    "it", "this", "that"
+};
+
+template <size_t N>
+bool contains(const char* const (&words)[N], const std::string& word) {
+    return std::any_of(std::begin(words), std::end(words), [&](const char* w) { return word == w; });
+}
+
+std::string lowerWord(const std::string& text, size_t begin, size_t end) {
+    std::string word;
+    for (size_t i = begin; i < end; i++) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (std::isalpha(c) || c == '\'') {
+            word += static_cast<char>(std::tolower(c));
+        }
+    }
+    return word;
+}
+
+} // namespace
+
+EndpointerConfig EndpointerConfig::fromEnvironment() {
+    EndpointerConfig config;
+    config.default_hangover_ms = static_cast<uint32_t>(config::VAD_HANGOVER_MS);
+    config.min_hangover_ms = static_cast<uint32_t>(config::ENDPOINT_MIN_MS);
+    config.max_hangover_ms = std::max(static_cast<uint32_t>(config::ENDPOINT_MAX_MS), config.min_hangover_ms);
+    config.adaptive = config::ADAPTIVE_ENDPOINTING != 0;
+    return config;
+}
+
+Endpointer::Endpointer(const EndpointerConfig& config) : config(config) {}
+
+void Endpointer::beginUtterance(uint64_t time_ms) {
+    // Speaking again right after an endpoint: that silence was a pause, not the end
+    // of the turn, and the timeout should learn to sit it out
+    if (last_end_ms != 0 && time_ms > last_end_ms && time_ms - last_end_ms <= config.max_hangover_ms) {
+        recordPause(static_cast<uint32_t>(time_ms - last_end_ms) + last_hangover_ms);
+    }
+    unvoiced_ms = 0;
+    level_db = 0.0f;
+    tail_db = 0.0f;
+    voiced_frames = 0;
+}
+
+void Endpointer::endUtterance(uint64_t time_ms, uint32_t hangover_ms) {
+    last_end_ms = time_ms;
+    last_hangover_ms = hangover_ms;
+}
+
+void Endpointer::observeFrame(const VadFrameStats& stats) {
+    if (!stats.voiced) {
+        unvoiced_ms += VoiceActivityDetector::FRAME_MS;
+        return;
+    }
+
+    if (unvoiced_ms >= MIN_PAUSE_MS) {
+        recordPause(unvoiced_ms);
+    }
+    unvoiced_ms = 0;
+
+    if (voiced_frames++ == 0) {
+        level_db = stats.energy_dbfs;
+        tail_db = stats.energy_dbfs;
+    } else {
+        level_db += LEVEL_ALPHA * (stats.energy_dbfs - level_db);
+        tail_db += TAIL_ALPHA * (stats.energy_dbfs - tail_db);
+    }
+}
+
+void Endpointer::observeGap(uint32_t ms) {
+    unvoiced_ms += ms;
+}
+
+void Endpointer::recordPause(uint32_t ms) {
+    for (float& bin : pauses) {
+        bin *= PAUSE_DECAY;
+    }
+    pauses[std::min<size_t>(ms / BIN_MS, BINS - 1)] += 1.0f;
+    pause_weight = pause_weight * PAUSE_DECAY + 1.0f;
+}
+
+uint32_t Endpointer::baseHangoverMs() const {
+    if (!config.adaptive || pause_weight < MIN_PAUSE_WEIGHT) {
+        return config.default_hangover_ms;
+    }
+
+    float needed = pause_weight * PAUSE_QUANTILE;
+    float seen = 0.0f;
+    size_t bin = 0;
+    for (; bin < BINS - 1; bin++) {
+        seen += pauses[bin];
+        if (seen >= needed) {
+            break;
+        }
+    }
+    float quantile_ms = static_cast<float>((bin + 1) * BIN_MS);
+    return std::clamp(static_cast<uint32_t>(quantile_ms * PAUSE_MARGIN), config.min_hangover_ms, config.max_hangover_ms);
+}
+
+bool Endpointer::energyFalling() const {
+    return voiced_frames >= MIN_VOICED_FOR_TREND && level_db - tail_db >= config.falling_db;
+}
+
+uint32_t Endpointer::hangoverMs(TranscriptCue cue) const {
+    if (!config.adaptive) {
+        return config.default_hangover_ms;
+    }
+
+    float hangover = static_cast<float>(baseHangoverMs());
+    if (cue == TranscriptCue::Complete) {
+        hangover *= config.complete_scale;
+    } else if (cue == TranscriptCue::Incomplete) {
+        hangover *= config.incomplete_scale;
+    }
+    // A voice trailing off ends a turn, but not one stopped mid-clause
+    if (cue != TranscriptCue::Incomplete && energyFalling()) {
+        hangover *= config.falling_scale;
+    }
+    return std::clamp(static_cast<uint32_t>(hangover), config.min_hangover_ms, config.max_hangover_ms);
+}
+
+TranscriptCue Endpointer::classifyTranscript(const std::string& text) {
+    size_t end = text.find_last_not_of(" \t\r\n");
+    if (end == std::string::npos) {
+        return TranscriptCue::Unknown;
+    }
+
+    // Whisper writes an ellipsis when the speaker trails off mid-thought
+    if (end >= 2 && text.compare(end - 2, 3, "...") == 0) {
+        return TranscriptCue::Incomplete;
+    }
+    char last = text[end];
+    if (last == '.' || last == '!' || last == '?') {
+        return TranscriptCue::Complete;
+    }
+    if (last == ',' || last == ';' || last == ':' || last == '-') {
+        return TranscriptCue::Incomplete;
+    }
+
+    size_t last_word_begin = text.find_last_of(" \t\r\n", end);
+    last_word_begin = last_word_begin == std::string::npos ? 0 : last_word_begin + 1;
+    if (contains(CONNECTIVES, lowerWord(text, last_word_begin, end + 1))) {
+        return TranscriptCue::Incomplete;
+    }
+
+    // Partials often leave out the question mark of a question that is already whole
+    std::string opening[2];
+    size_t words = 0;
+    for (size_t begin = text.find_first_not_of(" \t\r\n"); begin <= end;) {
+        size_t word_end = std::min(text.find_first_of(" \t\r\n", begin), end + 1);
+        if (words < 2) {
+            opening[words] = lowerWord(text, begin, word_end);
+        }
+        words++;
+        begin = text.find_first_not_of(" \t\r\n", word_end);
+    }
+    if (words < 3) {
+        return TranscriptCue::Unknown;
+    }
+    bool question = contains(CONTRACTED_QUESTIONS, opening[0]) ||
+                    (contains(QUESTION_WORDS, opening[0]) && contains(AUXILIARIES, opening[1])) ||
+                    (contains(AUXILIARIES, opening[0]) && contains(SUBJECTS, opening[1]) &&
+                     !(opening[0] == "do" && contains(DO_OBJECTS, opening[1])));
+    return question ? TranscriptCue::Complete : TranscriptCue::Unknown;
+}
+
+} // namespace audio_utils
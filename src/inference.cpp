@@ -3,24 +3,33 @@
 #include "httplib.h"
 #include "logging.hpp"
 
+#include <atomic>
 #include <string>
 #include <memory>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
-static bool g_initialized = false;
-static std::unique_ptr<httplib::Client> g_client;
+static std::atomic<bool> g_initialized{false};
 
 static const int LLM_PORT = 8000;
 
+// One keep-alive connection per thread, so requests after the first skip the connect
+// and a cancelled request (which stops its client) only interrupts its own thread's
+static httplib::Client& threadClient() {
+    thread_local std::unique_ptr<httplib::Client> client;
+    if (!client) {
+        client = std::make_unique<httplib::Client>(config::LLM_HOST, LLM_PORT);
+        client->set_keep_alive(true);
+        client->set_connection_timeout(5, 0);   // 5s
+        client->set_read_timeout(120, 0);       // long enough for cold start
+    }
+    return *client;
+}
+
 bool initializeModel() {
     try {
         LOG_INFO("Initializing model: {}", config::MODEL_NAME);
-        g_client = std::make_unique<httplib::Client>(config::LLM_HOST, LLM_PORT);
-        g_client->set_connection_timeout(5, 0);   // 5s
-        g_client->set_read_timeout(120, 0);       // long enough for cold start
-
         // Probe the server with a tiny chat request (works on any OpenAI-compatible server)
         json probe = {
             {"model",    config::MODEL_NAME},
@@ -29,7 +38,7 @@ bool initializeModel() {
             {"temperature", 0.0}
         };
 
-        auto r = g_client->Post("/v1/chat/completions", probe.dump(), "application/json");
+        auto r = threadClient().Post("/v1/chat/completions", probe.dump(), "application/json");
         if (!r || r->status != 200) {
             LOG_CRITICAL("Failed to reach llama.cpp server at {}:{}, status={}",
                          config::LLM_HOST, LLM_PORT, (r ? r->status : -1));
@@ -51,9 +60,11 @@ bool initializeModel() {
 
 // --- INFERENCE --------------------------------------------------------
 
-std::string runInference(const std::string& conversationJson) {
+ChatCompletion runChatCompletion(const std::string& conversationJson, int maxTokens, const CancellationToken& cancel) {
+    ChatCompletion completion;
     if (!g_initialized) {
-        return "[Error: LLM client not initialized]";
+        completion.text = "[Error: LLM client not initialized]";
+        return completion;
     }
 
     try {
@@ -64,63 +75,94 @@ std::string runInference(const std::string& conversationJson) {
         json request_body = {
             {"model",       config::MODEL_NAME},
             {"messages",    messages},
-            {"max_tokens",  16384},       // tune for latency
+            {"max_tokens",  maxTokens},   // tune for latency
             {"temperature", 0.2},
             {"stream",      false}
             // If you ever need tools:
             // {"tools", tools_json}, {"tool_choice","auto"}
         };
 
-        auto response = g_client->Post("/v1/chat/completions",
-                                       request_body.dump(),
-                                       "application/json");
+        // Cancelling drops this thread's connection, and the server stops generating
+        // when it does; the next request on the thread connects again
+        httplib::Client& client = threadClient();
+        auto stop = cancel.onCancel([&client] { client.stop(); });
+        if (cancel.cancelled()) {
+            return completion;
+        }
+
+        auto response = client.Post("/v1/chat/completions",
+                                    request_body.dump(),
+                                    "application/json");
+        stop.reset();
+
+        if (cancel.cancelled()) {
+            LOG_INFO("LLM request cancelled");
+            return completion;
+        }
 
         if (!response || response->status != 200) {
             LOG_ERROR("LLM error: {}", (response ? response->body : "No response"));
-            return "[Error: Failed to get response from LLM]";
+            completion.text = "[Error: Failed to get response from LLM]";
+            return completion;
         }
 
         json resp = json::parse(response->body);
 
         // Parse OpenAI-style response
-        std::string ellieResponse;
         if (resp.contains("choices") && !resp["choices"].empty()) {
             const auto& choice = resp["choices"][0];
 
             // Primary: chat format
             if (choice.contains("message") && choice["message"].contains("content")) {
-                ellieResponse = choice["message"]["content"].get<std::string>();
+                completion.text = choice["message"]["content"].get<std::string>();
             }
             // Fallback: some servers expose "text"
             else if (choice.contains("text")) {
-                ellieResponse = choice["text"].get<std::string>();
+                completion.text = choice["text"].get<std::string>();
             }
             // Tool-call only (no immediate text)
             else if (choice.contains("message") && choice["message"].contains("tool_calls")) {
-                ellieResponse = ""; // your tool pipeline will handle this turn
+                completion.text = ""; // your tool pipeline will handle this turn
             }
             else {
                 LOG_ERROR("Unexpected choices[0] shape: {}", choice.dump());
-                return "[Error: Unexpected response format]";
+                completion.text = "[Error: Unexpected response format]";
+                return completion;
             }
+
+            completion.truncated = choice.contains("finish_reason") && choice["finish_reason"] == "length";
         } else {
             LOG_ERROR("No choices in response: {}", resp.dump());
-            return "[Error: Unexpected response format]";
+            completion.text = "[Error: Unexpected response format]";
+            return completion;
         }
 
-        // Append assistant turn to your conversation history
-        addEllieResponse(ellieResponse);
-        return ellieResponse.empty() ? "[OK]" : ellieResponse;
+        if (resp.contains("usage") && resp["usage"].contains("completion_tokens")) {
+            completion.completion_tokens = resp["usage"]["completion_tokens"].get<uint64_t>();
+        }
+        completion.ok = true;
+        return completion;
 
     } catch (const std::exception& e) {
-        return std::string("[Error: ") + e.what() + "]";
+        completion.text = std::string("[Error: ") + e.what() + "]";
+        return completion;
     }
 }
 
+std::string runInference(const std::string& conversationJson, const CancellationToken& cancel) {
+    ChatCompletion completion = runChatCompletion(conversationJson, 16384, cancel);
+    if (!completion.ok) {
+        return completion.text;
+    }
+
+    // Append assistant turn to your conversation history
+    addEllieResponse(completion.text);
+    return completion.text.empty() ? "[OK]" : completion.text;
+}
+
 // --- SHUTDOWN ---------------------------------------------------------
 
 void shutdownModel() {
-    g_client.reset();
     g_initialized = false;
     clearHistory();
 }
@@ -0,0 +1,131 @@
+#include "ingest.hpp"
+#include "simd.hpp"
+#include <stdexcept>
+
+#if defined(AUDIO_SIMD_X86)
+#include <immintrin.h>
+#elif defined(AUDIO_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace audio_utils {
+
+namespace {
+
+constexpr float MONO_SCALE = 1.0f / 32768.0f;
+// Sum of both channels, halved and normalized in one multiply
+constexpr float STEREO_SCALE = 1.0f / 65536.0f;
+
+void monoToFloatScalar(const int16_t* input, size_t frames, float* output) {
+    for (size_t i = 0; i < frames; i++) {
+        output[i] = static_cast<float>(input[i]) * MONO_SCALE;
+    }
+}
+
+void stereoToFloatScalar(const int16_t* input, size_t frames, float* output) {
+    for (size_t i = 0; i < frames; i++) {
+        int32_t sum = static_cast<int32_t>(input[2 * i]) + static_cast<int32_t>(input[2 * i + 1]);
+        output[i] = static_cast<float>(sum) * STEREO_SCALE;
+    }
+}
+
+#if defined(AUDIO_SIMD_X86)
+AUDIO_TARGET_SSE41
+void monoToFloatSSE41(const int16_t* input, size_t frames, float* output) {
+    const __m128 scale = _mm_set1_ps(MONO_SCALE);
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128i samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + i));
+        __m128 values = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(samples));
+        _mm_storeu_ps(output + i, _mm_mul_ps(values, scale));
+    }
+    monoToFloatScalar(input + i, frames - i, output + i);
+}
+
+AUDIO_TARGET_SSE41
+void stereoToFloatSSE41(const int16_t* input, size_t frames, float* output) {
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128 scale = _mm_set1_ps(STEREO_SCALE);
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        // Four interleaved L/R pairs; madd adds each pair into one 32-bit lane
+        __m128i pairs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * i));
+        __m128 sums = _mm_cvtepi32_ps(_mm_madd_epi16(pairs, ones));
+        _mm_storeu_ps(output + i, _mm_mul_ps(sums, scale));
+    }
+    stereoToFloatScalar(input + 2 * i, frames - i, output + i);
+}
+
+AUDIO_TARGET_AVX2
+void monoToFloatAVX2(const int16_t* input, size_t frames, float* output) {
+    const __m256 scale = _mm256_set1_ps(MONO_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(samples));
+        _mm256_storeu_ps(output + i, _mm256_mul_ps(values, scale));
+    }
+    monoToFloatScalar(input + i, frames - i, output + i);
+}
+
+AUDIO_TARGET_AVX2
+void stereoToFloatAVX2(const int16_t* input, size_t frames, float* output) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256 scale = _mm256_set1_ps(STEREO_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256i pairs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + 2 * i));
+        __m256 sums = _mm256_cvtepi32_ps(_mm256_madd_epi16(pairs, ones));
+        _mm256_storeu_ps(output + i, _mm256_mul_ps(sums, scale));
+    }
+    stereoToFloatScalar(input + 2 * i, frames - i, output + i);
+}
+#endif
+
+#if defined(AUDIO_SIMD_NEON)
+void monoToFloatNEON(const int16_t* input, size_t frames, float* output) {
+    const float32x4_t scale = vdupq_n_f32(MONO_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8_t samples = vld1q_s16(input + i);
+        vst1q_f32(output + i, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(samples))), scale));
+        vst1q_f32(output + i + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(samples))), scale));
+    }
+    monoToFloatScalar(input + i, frames - i, output + i);
+}
+
+void stereoToFloatNEON(const int16_t* input, size_t frames, float* output) {
+    const float32x4_t scale = vdupq_n_f32(STEREO_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int16x8x2_t channels = vld2q_s16(input + 2 * i);
+        int32x4_t low = vaddl_s16(vget_low_s16(channels.val[0]), vget_low_s16(channels.val[1]));
+        int32x4_t high = vaddl_s16(vget_high_s16(channels.val[0]), vget_high_s16(channels.val[1]));
+        vst1q_f32(output + i, vmulq_f32(vcvtq_f32_s32(low), scale));
+        vst1q_f32(output + i + 4, vmulq_f32(vcvtq_f32_s32(high), scale));
+    }
+    stereoToFloatScalar(input + 2 * i, frames - i, output + i);
+}
+#endif
+
+} // namespace
+
+PcmToFloatKernel pcmToFloatKernel(int channels) {
+    if (channels != 1 && channels != 2) {
+        throw std::invalid_argument("Only mono and stereo input is supported");
+    }
+    const bool stereo = channels == 2;
+
+    switch (simd::activeLevel()) {
+#if defined(AUDIO_SIMD_X86)
+        case simd::Level::AVX2: return stereo ? stereoToFloatAVX2 : monoToFloatAVX2;
+        case simd::Level::SSE41: return stereo ? stereoToFloatSSE41 : monoToFloatSSE41;
+#endif
+#if defined(AUDIO_SIMD_NEON)
+        case simd::Level::NEON: return stereo ? stereoToFloatNEON : monoToFloatNEON;
+#endif
+        default: return stereo ? stereoToFloatScalar : monoToFloatScalar;
+    }
+}
+
+} // namespace audio_utils
@@ -0,0 +1,153 @@
+#include "playback_framer.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(AUDIO_SIMD_X86)
+#include <immintrin.h>
+#elif defined(AUDIO_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace audio_utils {
+
+namespace {
+
+void duplicateScalar(const int16_t* mono, size_t count, int16_t* stereo) {
+    for (size_t i = 0; i < count; i++) {
+        stereo[2 * i] = mono[i];
+        stereo[2 * i + 1] = mono[i];
+    }
+}
+
+#if defined(AUDIO_SIMD_X86)
+AUDIO_TARGET_SSE41
+void duplicateSSE41(const int16_t* mono, size_t count, int16_t* stereo) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mono + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(stereo + 2 * i), _mm_unpacklo_epi16(samples, samples));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(stereo + 2 * i + 8), _mm_unpackhi_epi16(samples, samples));
+    }
+    duplicateScalar(mono + i, count - i, stereo + 2 * i);
+}
+
+AUDIO_TARGET_AVX2
+void duplicateAVX2(const int16_t* mono, size_t count, int16_t* stereo) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i samples = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mono + i));
+        // Unpacks work per 128-bit lane, so restore sample order across lanes afterwards
+        __m256i low = _mm256_unpacklo_epi16(samples, samples);
+        __m256i high = _mm256_unpackhi_epi16(samples, samples);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(stereo + 2 * i), _mm256_permute2x128_si256(low, high, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(stereo + 2 * i + 16), _mm256_permute2x128_si256(low, high, 0x31));
+    }
+    duplicateScalar(mono + i, count - i, stereo + 2 * i);
+}
+#endif
+
+#if defined(AUDIO_SIMD_NEON)
+void duplicateNEON(const int16_t* mono, size_t count, int16_t* stereo) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t samples = vld1q_s16(mono + i);
+        int16x8x2_t pair = {{samples, samples}};
+        vst2q_s16(stereo + 2 * i, pair);
+    }
+    duplicateScalar(mono + i, count - i, stereo + 2 * i);
+}
+#endif
+
+using DuplicateKernel = void (*)(const int16_t*, size_t, int16_t*);
+
+DuplicateKernel duplicateKernel() {
+    switch (simd::activeLevel()) {
+#if defined(AUDIO_SIMD_X86)
+        case simd::Level::AVX2: return duplicateAVX2;
+        case simd::Level::SSE41: return duplicateSSE41;
+#endif
+#if defined(AUDIO_SIMD_NEON)
+        case simd::Level::NEON: return duplicateNEON;
+#endif
+        default: return duplicateScalar;
+    }
+}
+
+} // namespace
+
+PlaybackFramer::PlaybackFramer(int input_rate, FrameCallback on_frame)
+    : resampler(input_rate, OUTPUT_RATE), on_frame(std::move(on_frame)),
+      duplicate(duplicateKernel()), frame_fill(0), frames_emitted(0),
+      carry_byte(0), has_carry(false) {}
+
+void PlaybackFramer::push(const uint8_t* pcm, size_t bytes) {
+    if (bytes == 0) return;
+
+    // Complete a sample split across the previous chunk boundary
+    if (has_carry) {
+        uint8_t joined[2] = {carry_byte, pcm[0]};
+        int16_t sample;
+        std::memcpy(&sample, joined, sizeof(sample));
+        pushSamples(&sample, 1);
+        has_carry = false;
+        pcm++;
+        bytes--;
+    }
+
+    // The bytes may sit at any address, after a carry byte in particular, so they are
+    // copied into aligned samples rather than read through a cast pointer
+    size_t count = bytes / sizeof(int16_t);
+    for (size_t offset = 0; offset < count; offset += input.size()) {
+        size_t n = std::min(input.size(), count - offset);
+        std::memcpy(input.data(), pcm + offset * sizeof(int16_t), n * sizeof(int16_t));
+        pushSamples(input.data(), n);
+    }
+    if (bytes % sizeof(int16_t) != 0) {
+        carry_byte = pcm[bytes - 1];
+        has_carry = true;
+    }
+}
+
+void PlaybackFramer::pushSamples(const int16_t* samples, size_t count) {
+    // Input block whose resampled output always fits the staging buffer
+    const size_t block = std::max<size_t>(1,
+        (resampled.size() - 16) * resampler.inputRate() / resampler.outputRate());
+
+    for (size_t offset = 0; offset < count; offset += block) {
+        size_t n = std::min(block, count - offset);
+        size_t produced = resampler.process(samples + offset, n, resampled.data());
+        appendMono(resampled.data(), produced);
+    }
+}
+
+void PlaybackFramer::appendMono(const int16_t* mono, size_t count) {
+    while (count > 0) {
+        size_t n = std::min(count, FRAME_SAMPLES - frame_fill);
+        duplicate(mono, n, frame.data() + frame_fill * OUTPUT_CHANNELS);
+        frame_fill += n;
+        mono += n;
+        count -= n;
+
+        if (frame_fill == FRAME_SAMPLES) {
+            on_frame(frame.data(), FRAME_BYTES);
+            frames_emitted++;
+            frame_fill = 0;
+        }
+    }
+}
+
+void PlaybackFramer::finish() {
+    size_t produced = resampler.flush(resampled.data());
+    appendMono(resampled.data(), produced);
+
+    if (frame_fill > 0) {
+        std::fill(frame.begin() + frame_fill * OUTPUT_CHANNELS, frame.end(), 0);
+        on_frame(frame.data(), FRAME_BYTES);
+        frames_emitted++;
+        frame_fill = 0;
+    }
+    has_carry = false;
+}
+
+} // namespace audio_utils
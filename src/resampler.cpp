@@ -0,0 +1,337 @@
+#include "resampler.hpp"
+#include "simd.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#if defined(AUDIO_SIMD_X86)
+#include <immintrin.h>
+#elif defined(AUDIO_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace audio_utils {
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+// Kaiser window shape; 8.0 gives roughly 80dB of stopband attenuation
+constexpr double KAISER_BETA = 8.0;
+
+// Fraction of the output Nyquist frequency kept in the passband
+constexpr double CUTOFF_ROLLOFF = 0.9;
+
+// Zeroth order modified Bessel function of the first kind
+double besselI0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    double half = x / 2.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (half / k) * (half / k);
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+std::shared_ptr<const FilterBank> designFilterBank(int input_rate, int output_rate) {
+    int divisor = std::gcd(input_rate, output_rate);
+    auto bank = std::make_shared<FilterBank>();
+    bank->input_rate = input_rate;
+    bank->output_rate = output_rate;
+    bank->up = output_rate / divisor;
+    bank->down = input_rate / divisor;
+
+    const int up = bank->up;
+    const int down = bank->down;
+
+    const size_t taps = tapsPerPhase(up, down);
+    bank->taps = taps;
+
+    // Prototype low-pass filter in the upsampled domain
+    const size_t length = taps * up;
+    const double cutoff = CUTOFF_ROLLOFF * 0.5 / std::max(up, down);
+    const double center = (static_cast<double>(length) - 1.0) / 2.0;
+    const double beta_norm = besselI0(KAISER_BETA);
+
+    std::vector<double> prototype(length);
+    double sum = 0.0;
+    for (size_t j = 0; j < length; j++) {
+        double t = static_cast<double>(j) - center;
+        double x = 2.0 * cutoff * t;
+        double sinc = (std::abs(x) < 1e-12) ? 1.0 : std::sin(PI * x) / (PI * x);
+        double ratio = (length > 1) ? (2.0 * static_cast<double>(j) / (length - 1) - 1.0) : 0.0;
+        double window = besselI0(KAISER_BETA * std::sqrt(std::max(0.0, 1.0 - ratio * ratio))) / beta_norm;
+        prototype[j] = 2.0 * cutoff * sinc * window;
+        sum += prototype[j];
+    }
+
+    // Unity DC gain per phase after zero stuffing
+    const double gain = static_cast<double>(up) / sum;
+
+    bank->coefficients.resize(length);
+    for (int p = 0; p < up; p++) {
+        float* phase = bank->coefficients.data() + static_cast<size_t>(p) * taps;
+        for (size_t i = 0; i < taps; i++) {
+            size_t k = taps - 1 - i;
+            phase[i] = static_cast<float>(prototype[p + k * up] * gain);
+        }
+    }
+
+    LOG_INFO("Designed polyphase filter bank {}Hz -> {}Hz (up {}, down {}, {} taps per phase)",
+             input_rate, output_rate, up, down, taps);
+    return bank;
+}
+
+struct FilterBankRegistry {
+    std::mutex mutex;
+    std::map<std::pair<int, int>, std::shared_ptr<const FilterBank>> banks;
+
+    FilterBankRegistry() {
+        // Ratios used on the hot paths
+        banks[{48000, 16000}] = designFilterBank(48000, 16000);
+        banks[{24000, 48000}] = designFilterBank(24000, 48000);
+    }
+};
+
+FilterBankRegistry& registry() {
+    static FilterBankRegistry instance;
+    return instance;
+}
+
+float dotScalar(const float* a, const float* b, size_t n) {
+    float acc[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (size_t i = 0; i < n; i += 4) {
+        acc[0] += a[i] * b[i];
+        acc[1] += a[i + 1] * b[i + 1];
+        acc[2] += a[i + 2] * b[i + 2];
+        acc[3] += a[i + 3] * b[i + 3];
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+#if defined(AUDIO_SIMD_X86)
+AUDIO_TARGET_SSE41
+float dotSSE41(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+    return _mm_cvtss_f32(acc);
+}
+
+AUDIO_TARGET_AVX2
+float dotAVX2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    if (i < n) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+}
+#endif
+
+#if defined(AUDIO_SIMD_NEON)
+float dotNEON(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (size_t i = 0; i < n; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float32x4_t acc = vaddq_f32(acc0, acc1);
+    float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(pair, pair), 0);
+}
+#endif
+
+inline float toFloat(int16_t sample) { return static_cast<float>(sample) * (1.0f / 32768.0f); }
+inline float toFloat(float sample) { return sample; }
+
+template <typename Sample>
+inline Sample fromFloat(float value);
+
+template <>
+inline float fromFloat<float>(float value) { return value; }
+
+template <>
+inline int16_t fromFloat<int16_t>(float value) {
+    float scaled = std::nearbyint(value * 32768.0f);
+    if (scaled > 32767.0f) scaled = 32767.0f;
+    if (scaled < -32768.0f) scaled = -32768.0f;
+    return static_cast<int16_t>(scaled);
+}
+
+} // namespace
+
+std::shared_ptr<const FilterBank> getFilterBank(int input_rate, int output_rate) {
+    if (input_rate <= 0 || output_rate <= 0) {
+        throw std::invalid_argument("Sample rates must be positive");
+    }
+
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto& bank = reg.banks[{input_rate, output_rate}];
+    if (!bank) {
+        bank = designFilterBank(input_rate, output_rate);
+    }
+    return bank;
+}
+
+DotKernel dotKernel() {
+    switch (simd::activeLevel()) {
+#if defined(AUDIO_SIMD_X86)
+        case simd::Level::AVX2: return dotAVX2;
+        case simd::Level::SSE41: return dotSSE41;
+#endif
+#if defined(AUDIO_SIMD_NEON)
+        case simd::Level::NEON: return dotNEON;
+#endif
+        default: return dotScalar;
+    }
+}
+
+PolyphaseResampler::PolyphaseResampler(int input_rate, int output_rate)
+    : bank(getFilterBank(input_rate, output_rate)), dot(dotKernel()) {
+    // Centre of the prototype filter, so output sample 0 lines up with input sample 0
+    delay = bank->taps * bank->up / 2;
+    history.reserve(BLOCK_SIZE + 2 * bank->taps);
+    reset();
+}
+
+void PolyphaseResampler::reset() {
+    // Zeros before the first sample fill the left half of the filter
+    history.assign(bank->taps, 0.0f);
+    history_start = -static_cast<int64_t>(bank->taps);
+    input_count = 0;
+    output_count = 0;
+}
+
+size_t PolyphaseResampler::maxOutputCount(size_t count) const {
+    uint64_t total_input = input_count + count;
+    uint64_t total_output = (total_input * bank->up + bank->down - 1) / bank->down;
+    return static_cast<size_t>(total_output - output_count);
+}
+
+int64_t PolyphaseResampler::inputIndexFor(uint64_t output_index) const {
+    return static_cast<int64_t>((output_index * bank->down + delay) / bank->up);
+}
+
+template <typename Sample>
+size_t PolyphaseResampler::drain(Sample* output, uint64_t output_limit) {
+    const int64_t taps = static_cast<int64_t>(bank->taps);
+    size_t written = 0;
+
+    while (output_count < output_limit) {
+        uint64_t position = output_count * bank->down + delay;
+        int64_t base = static_cast<int64_t>(position / bank->up);
+        int phase = static_cast<int>(position % bank->up);
+
+        const float* window = history.data() + (base - taps + 1 - history_start);
+        output[written++] = fromFloat<Sample>(dot(bank->phase(phase), window, bank->taps));
+        output_count++;
+    }
+
+    // Keep only the history the next output sample needs
+    int64_t keep_from = inputIndexFor(output_count) - taps + 1;
+    int64_t history_end = history_start + static_cast<int64_t>(history.size());
+    keep_from = std::clamp(keep_from, history_start, history_end);
+    if (keep_from > history_start) {
+        history.erase(history.begin(), history.begin() + (keep_from - history_start));
+        history_start = keep_from;
+    }
+    return written;
+}
+
+template <typename Sample>
+size_t PolyphaseResampler::processBlocks(const Sample* input, size_t count, Sample* output) {
+    size_t written = 0;
+    for (size_t offset = 0; offset < count; offset += BLOCK_SIZE) {
+        size_t block = std::min(BLOCK_SIZE, count - offset);
+        size_t old_size = history.size();
+        history.resize(old_size + block);
+        for (size_t i = 0; i < block; i++) {
+            history[old_size + i] = toFloat(input[offset + i]);
+        }
+        input_count += block;
+
+        // Outputs whose newest input sample has already arrived
+        uint64_t available = input_count * bank->up;
+        uint64_t limit = 0;
+        if (available > delay) {
+            limit = (available - 1 - delay) / bank->down + 1;
+        }
+        written += drain(output + written, limit);
+    }
+    return written;
+}
+
+size_t PolyphaseResampler::process(const int16_t* input, size_t count, int16_t* output) {
+    return processBlocks(input, count, output);
+}
+
+size_t PolyphaseResampler::process(const float* input, size_t count, float* output) {
+    return processBlocks(input, count, output);
+}
+
+size_t PolyphaseResampler::process(const int16_t* input, size_t count, std::vector<int16_t>& output) {
+    size_t old_size = output.size();
+    output.resize(old_size + maxOutputCount(count));
+    size_t written = process(input, count, output.data() + old_size);
+    output.resize(old_size + written);
+    return written;
+}
+
+size_t PolyphaseResampler::process(const float* input, size_t count, std::vector<float>& output) {
+    size_t old_size = output.size();
+    output.resize(old_size + maxOutputCount(count));
+    size_t written = process(input, count, output.data() + old_size);
+    output.resize(old_size + written);
+    return written;
+}
+
+template <typename Sample>
+size_t PolyphaseResampler::finish(Sample* output) {
+    uint64_t limit = (input_count * bank->up + bank->down - 1) / bank->down;
+    if (limit > output_count) {
+        // Zeros after the last sample fill the right half of the filter
+        int64_t needed_end = inputIndexFor(limit - 1) + 1;
+        int64_t history_end = history_start + static_cast<int64_t>(history.size());
+        if (needed_end > history_end) {
+            history.resize(history.size() + static_cast<size_t>(needed_end - history_end), 0.0f);
+        }
+    }
+    size_t written = drain(output, limit);
+    reset();
+    return written;
+}
+
+size_t PolyphaseResampler::flush(int16_t* output) {
+    return finish(output);
+}
+
+size_t PolyphaseResampler::flush(float* output) {
+    return finish(output);
+}
+
+} // namespace audio_utils
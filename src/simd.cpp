@@ -0,0 +1,101 @@
+#include "simd.hpp"
+#include "logging.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(AUDIO_SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace audio_utils {
+namespace simd {
+
+namespace {
+
+Level detectHardwareLevel() {
+#if defined(AUDIO_SIMD_X86)
+#if defined(_MSC_VER)
+    int info[4] = {0, 0, 0, 0};
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+
+    bool avx2 = false;
+    if (max_leaf >= 7 && osxsave && fma) {
+        // Make sure the OS saves the YMM registers
+        unsigned long long xcr0 = _xgetbv(0);
+        if ((xcr0 & 0x6) == 0x6) {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+    }
+
+    if (avx2) return Level::AVX2;
+    if (sse41) return Level::SSE41;
+    return Level::Scalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Level::AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return Level::SSE41;
+    return Level::Scalar;
+#endif
+#elif defined(AUDIO_SIMD_NEON)
+    return Level::NEON;
+#else
+    return Level::Scalar;
+#endif
+}
+
+Level applyOverride(Level detected) {
+    const char* value = std::getenv("DIGI_ELLIE_SIMD");
+    if (value == nullptr) {
+        return detected;
+    }
+
+    Level requested = detected;
+    if (std::strcmp(value, "scalar") == 0) requested = Level::Scalar;
+    else if (std::strcmp(value, "sse41") == 0) requested = Level::SSE41;
+    else if (std::strcmp(value, "avx2") == 0) requested = Level::AVX2;
+    else if (std::strcmp(value, "neon") == 0) requested = Level::NEON;
+    else {
+        LOG_WARN("Unknown DIGI_ELLIE_SIMD value '{}', using {}", value, levelName(detected));
+        return detected;
+    }
+
+    // Only allow capping, never enabling an instruction set the CPU lacks
+    bool supported = requested == Level::Scalar || requested == detected ||
+                     (requested == Level::SSE41 && detected == Level::AVX2);
+    if (!supported) {
+        LOG_WARN("DIGI_ELLIE_SIMD={} is not supported on this CPU, using {}", value, levelName(detected));
+        return detected;
+    }
+    return requested;
+}
+
+} // namespace
+
+Level activeLevel() {
+    static const Level level = [] {
+        Level detected = applyOverride(detectHardwareLevel());
+        LOG_INFO("Audio kernels using {} instruction set", levelName(detected));
+        return detected;
+    }();
+    return level;
+}
+
+const char* levelName(Level level) {
+    switch (level) {
+        case Level::SSE41: return "SSE4.1";
+        case Level::AVX2: return "AVX2";
+        case Level::NEON: return "NEON";
+        case Level::Scalar:
+        default: return "scalar";
+    }
+}
+
+} // namespace simd
+} // namespace audio_utils
@@ -0,0 +1,50 @@
+#include "speech_trimmer.hpp"
+#include "config.hpp"
+#include <algorithm>
+
+namespace audio_utils {
+
+SpeechTrimConfig SpeechTrimConfig::fromEnvironment() {
+    SpeechTrimConfig config;
+    config.enabled = config::WHISPER_TRIM_SILENCE != 0;
+    config.pad_ms = static_cast<uint32_t>(config::WHISPER_TRIM_PAD_MS);
+    return config;
+}
+
+SpeechTrimmer::SpeechTrimmer(const SpeechTrimConfig& config, const VadConfig& vad_config)
+    : config(config), vad_config(vad_config) {}
+
+SpeechSpan SpeechTrimmer::find(const float* samples, size_t count) const {
+    if (!config.enabled) {
+        return {0, count};
+    }
+
+    // A detector per clip: it has to learn each clip's noise floor from its start anyway
+    VoiceActivityDetector vad(vad_config);
+    const size_t frame = vad.frameSamples();
+    if (count < frame) {
+        return {0, count};
+    }
+
+    bool heard = false;
+    size_t begin = 0;
+    size_t end = 0;
+    for (size_t i = 0; (i + 1) * frame <= count; i++) {
+        const VadEvent event = vad.process(samples + i * frame);
+        if (event == VadEvent::SpeechStart && !heard) {
+            heard = true;
+            begin = (i - std::min(i, vad.onsetFrames())) * frame;
+        }
+        if (vad.speaking() && vad.lastFrame().voiced) {
+            end = (i + 1) * frame;
+        }
+    }
+    if (!heard) {
+        return {};
+    }
+
+    const size_t pad = static_cast<size_t>(vad_config.sample_rate) * config.pad_ms / 1000;
+    return {begin, std::min(count, end + pad)};
+}
+
+} // namespace audio_utils
@@ -0,0 +1,149 @@
+#include "stream_session_store.hpp"
+#include "config.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <functional>
+#include <random>
+
+StreamSessionStoreConfig StreamSessionStoreConfig::fromEnvironment() {
+    StreamSessionStoreConfig config;
+    config.memory_budget = config::STREAM_MEMORY_MB * 1024 * 1024;
+    config.max_session_bytes = config::STREAM_MAX_SESSION_S * 192000;
+    config.idle_ttl = std::chrono::seconds(std::max<uint64_t>(1, config::STREAM_SESSION_TTL_S));
+    return config;
+}
+
+StreamSessionStore::StreamSessionStore(WhisperSTT& stt, const StreamingDecoderConfig& decoder_config,
+                                       const StreamSessionStoreConfig& config)
+    : stt(stt), decoder_config(decoder_config), config(config),
+      pool(std::make_shared<AudioBlockPool>(config.max_idle_blocks)) {
+    for (size_t i = 0; i < std::max<size_t>(1, config.shards); i++) {
+        shards.push_back(std::make_unique<Shard>());
+    }
+    reaper = std::thread(&StreamSessionStore::reaperLoop, this);
+}
+
+StreamSessionStore::~StreamSessionStore() {
+    {
+        std::lock_guard<std::mutex> lock(reaper_mutex);
+        stopping = true;
+    }
+    reaper_wake.notify_all();
+    if (reaper.joinable()) {
+        reaper.join();
+    }
+}
+
+std::shared_ptr<StreamSession> StreamSessionStore::create() {
+    if (pool->bytesInUse() >= config.memory_budget) {
+        rejected++;
+        return nullptr;
+    }
+
+    static const char* alphabet = "0123456789abcdef";
+    thread_local std::mt19937 rng(std::random_device{}());
+    std::uniform_int_distribution<int> dist(0, 15);
+    while (true) {
+        std::string id(32, '0');
+        for (char& c : id) c = alphabet[dist(rng)];
+
+        Shard& shard = shardFor(id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto& slot = shard.sessions[id];
+        if (slot) {
+            continue;
+        }
+        slot = std::make_shared<StreamSession>(id, stt, decoder_config, pool);
+        slot->last_active = nowMs();
+        live++;
+        created++;
+        return slot;
+    }
+}
+
+std::shared_ptr<StreamSession> StreamSessionStore::find(const std::string& id) {
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(id);
+    if (it == shard.sessions.end()) {
+        return nullptr;
+    }
+    it->second->last_active = nowMs();
+    return it->second;
+}
+
+std::shared_ptr<StreamSession> StreamSessionStore::take(const std::string& id) {
+    Shard& shard = shardFor(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(id);
+    if (it == shard.sessions.end()) {
+        return nullptr;
+    }
+    std::shared_ptr<StreamSession> session = std::move(it->second);
+    shard.sessions.erase(it);
+    live--;
+    return session;
+}
+
+StreamSessionStore::Metrics StreamSessionStore::metrics() const {
+    const AudioBlockPool::Metrics blocks = pool->metrics();
+    Metrics metrics;
+    metrics.sessions = live;
+    metrics.audio_bytes = blocks.blocks_in_use * AudioBlockPool::BLOCK_BYTES;
+    metrics.idle_bytes = blocks.blocks_idle * AudioBlockPool::BLOCK_BYTES;
+    metrics.created = created;
+    metrics.rejected = rejected;
+    metrics.expired = expired;
+    return metrics;
+}
+
+StreamSessionStore::Shard& StreamSessionStore::shardFor(const std::string& id) {
+    return *shards[std::hash<std::string>{}(id) % shards.size()];
+}
+
+int64_t StreamSessionStore::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StreamSessionStore::reaperLoop() {
+    const auto period = std::max<std::chrono::steady_clock::duration>(config.idle_ttl / 4, std::chrono::seconds(1));
+    std::unique_lock<std::mutex> lock(reaper_mutex);
+    while (!stopping) {
+        reaper_wake.wait_for(lock, period);
+        if (stopping) {
+            break;
+        }
+        lock.unlock();
+
+        const int64_t cutoff = nowMs() - std::chrono::duration_cast<std::chrono::milliseconds>(config.idle_ttl).count();
+        std::vector<std::shared_ptr<StreamSession>> stale;
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> shard_lock(shard->mutex);
+            for (auto it = shard->sessions.begin(); it != shard->sessions.end();) {
+                if (it->second->last_active < cutoff) {
+                    stale.push_back(std::move(it->second));
+                    it = shard->sessions.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        // Wake long-polls; a partial still decoding frees the audio when it is done
+        for (const auto& session : stale) {
+            {
+                std::lock_guard<std::mutex> session_lock(session->mutex);
+                session->finishing = true;
+            }
+            session->changed.notify_all();
+        }
+        if (!stale.empty()) {
+            live -= stale.size();
+            expired += stale.size();
+            LOG_INFO("Expired {} idle stream sessions", stale.size());
+        }
+        stale.clear();
+        lock.lock();
+    }
+}
@@ -0,0 +1,188 @@
+#include "streaming_decoder.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+// Shorter tails are not worth a decode on finish; the last pass stands
+constexpr size_t MIN_TAIL_SAMPLES = 1600;
+
+// Whisper may repeat up to this many committed words at the start of the next window
+constexpr size_t MAX_REPEATED_WORDS = 5;
+constexpr int64_t REPEAT_SAMPLES = 16000;
+
+// Passes agree on a word even if they case or punctuate it differently
+std::string normalize(const std::string& word) {
+    std::string normalized;
+    for (unsigned char c : word) {
+        if (std::isalnum(c) || c >= 0x80) {
+            normalized += static_cast<char>(std::tolower(c));
+        }
+    }
+    return normalized;
+}
+
+std::string trimLeading(const std::string& text) {
+    size_t start = 0;
+    while (start < text.size() && std::isspace(static_cast<unsigned char>(text[start]))) {
+        start++;
+    }
+    return text.substr(start);
+}
+
+} // namespace
+
+StreamingDecoderConfig StreamingDecoderConfig::fromEnvironment() {
+    StreamingDecoderConfig config;
+    config.min_window_samples = std::max<size_t>(config::STREAM_MIN_WINDOW_MS * 16, MIN_TAIL_SAMPLES);
+    config.max_window_samples = std::clamp<size_t>(config::STREAM_MAX_WINDOW_MS * 16,
+                                                   2 * config.min_window_samples, 28 * 16000);
+    config.prompt_chars = config::STREAM_PROMPT_CHARS;
+    return config;
+}
+
+StreamingDecoder::StreamingDecoder(WhisperSTT& stt, const StreamingDecoderConfig& config,
+                                   std::shared_ptr<AudioBlockPool> pool)
+    : stt(stt), config(config), window(std::move(pool)) {}
+
+void StreamingDecoder::append(AudioRope&& audio) {
+    if (audio.empty()) {
+        return;
+    }
+    stats.received_samples += audio.size();
+    window.append(std::move(audio));
+    window_decoded = false;
+}
+
+StreamingTranscript StreamingDecoder::update(const WhisperStatePool::Lease& lease) {
+    if (!window_decoded && windowSamples() >= config.min_window_samples) {
+        std::vector<TimedWord> words = decodeWindow(&lease, TranscriptionScheduler::Clock::time_point::max());
+
+        // Commit the longest prefix this pass and the previous one agree on
+        size_t agreed = 0;
+        while (agreed < words.size() && agreed < hypothesis.size() &&
+               normalize(words[agreed].text) == normalize(hypothesis[agreed].text)) {
+            agreed++;
+        }
+        const int64_t samples = static_cast<int64_t>(windowSamples());
+        if (windowSamples() >= config.max_window_samples) {
+            // No agreement for too long: take this pass's word for everything but the last moments
+            const int64_t settled = samples - static_cast<int64_t>(config.min_window_samples);
+            while (agreed < words.size() && words[agreed].end <= settled) {
+                agreed++;
+            }
+        }
+        commit(words, agreed);
+
+        if (windowSamples() >= config.max_window_samples) {
+            // Whatever was heard in the old audio is committed by now; the rest is noise or silence
+            size_t keep_from = windowSamples() - config.min_window_samples;
+            if (!hypothesis.empty()) {
+                keep_from = std::min(keep_from, static_cast<size_t>(std::max<int64_t>(hypothesis.front().start, 0)));
+            }
+            slide(keep_from);
+        }
+    }
+    return {trimLeading(committed), pendingText()};
+}
+
+std::string StreamingDecoder::finish(TranscriptionScheduler::Clock::time_point deadline) {
+    if (!window_decoded && windowSamples() >= MIN_TAIL_SAMPLES) {
+        hypothesis = decodeWindow(nullptr, deadline);
+    }
+    // Nothing follows to disagree with the last pass
+    std::vector<TimedWord> tail = std::move(hypothesis);
+    commit(tail, tail.size());
+    window.clear();
+    hypothesis.clear();
+    return trimLeading(committed);
+}
+
+size_t StreamingDecoder::windowSamples() const {
+    return window.size();
+}
+
+std::vector<TimedWord> StreamingDecoder::decodeWindow(const WhisperStatePool::Lease* lease,
+                                                      TranscriptionScheduler::Clock::time_point deadline) {
+    thread_local std::vector<float> samples;
+    window.copyTo(samples);
+
+    const AudioClip clip{samples.data(), samples.size()};
+    std::vector<TimedWord> words = lease ? stt.decodeWords(*lease, clip, prompt) : stt.transcribeWords(clip, prompt, deadline);
+    stats.decodes++;
+    stats.decoded_samples += samples.size();
+    window_decoded = true;
+    dropRepeated(words);
+    return words;
+}
+
+void StreamingDecoder::dropRepeated(std::vector<TimedWord>& words) const {
+    // The window starts where the last committed word ended by its timestamps, which
+    // may be early; Whisper then hears that word again
+    const size_t longest = std::min({MAX_REPEATED_WORDS, committed_tail.size(), words.size()});
+    for (size_t n = longest; n > 0; n--) {
+        if (words[n - 1].start >= REPEAT_SAMPLES) {
+            continue;
+        }
+        bool repeated = true;
+        for (size_t i = 0; i < n && repeated; i++) {
+            repeated = normalize(words[i].text) == committed_tail[committed_tail.size() - n + i];
+        }
+        if (repeated) {
+            words.erase(words.begin(), words.begin() + static_cast<std::ptrdiff_t>(n));
+            return;
+        }
+    }
+}
+
+void StreamingDecoder::commit(const std::vector<TimedWord>& words, size_t count) {
+    if (count == 0) {
+        hypothesis = words;
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        committed += words[i].text;
+        committed_tail.push_back(normalize(words[i].text));
+    }
+    if (committed_tail.size() > MAX_REPEATED_WORDS) {
+        committed_tail.erase(committed_tail.begin(), committed_tail.end() - MAX_REPEATED_WORDS);
+    }
+
+    // Slide the window to the end of the last committed word, but not into the next one
+    int64_t cut = words[count - 1].end;
+    if (count < words.size()) {
+        cut = std::min(cut, words[count].start);
+    }
+    cut = std::clamp<int64_t>(cut, 0, static_cast<int64_t>(windowSamples()));
+    hypothesis.assign(words.begin() + static_cast<std::ptrdiff_t>(count), words.end());
+    slide(static_cast<size_t>(cut));
+
+    // Prompt with the committed text's tail, from a word boundary on
+    std::string context = committed;
+    if (context.size() > config.prompt_chars) {
+        size_t start = context.find(' ', context.size() - config.prompt_chars);
+        context = start == std::string::npos ? std::string() : context.substr(start);
+    }
+    prompt = stt.tokenize(context);
+}
+
+void StreamingDecoder::slide(size_t samples) {
+    if (samples == 0) {
+        return;
+    }
+    window.dropFront(samples);
+    for (auto& word : hypothesis) {
+        word.start = std::max<int64_t>(word.start - static_cast<int64_t>(samples), 0);
+        word.end = std::max<int64_t>(word.end - static_cast<int64_t>(samples), 0);
+    }
+}
+
+std::string StreamingDecoder::pendingText() const {
+    std::string text;
+    for (const auto& word : hypothesis) {
+        text += word.text;
+    }
+    return trimLeading(text);
+}
@@ -0,0 +1,272 @@
+#include "transcription_scheduler.hpp"
+#include "whisper_stt.hpp"
+#include "config.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+TranscriptionSchedulerConfig TranscriptionSchedulerConfig::fromEnvironment(size_t workers, size_t threads_per_worker) {
+    TranscriptionSchedulerConfig config;
+    config.workers = std::max<size_t>(1, workers);
+    config.pin_cores = config::WHISPER_PIN_WORKERS != 0 ? std::max<size_t>(1, threads_per_worker) : 0;
+    config.batch_wait = std::chrono::milliseconds(config::WHISPER_BATCH_WAIT_MS);
+    config.batch_max_clip_samples = config::WHISPER_BATCH_MAX_CLIP_MS * 16;
+    return config;
+}
+
+TranscriptionScheduler::TranscriptionScheduler(WhisperSTT& stt, const TranscriptionSchedulerConfig& config)
+    : stt(stt), config(config) {
+    for (size_t i = 0; i < config.workers; i++) {
+        workers.emplace_back(&TranscriptionScheduler::workerLoop, this);
+        if (config.pin_cores > 0) {
+            pinWorker(i);
+        }
+    }
+}
+
+void TranscriptionScheduler::pinWorker(size_t index) {
+#ifdef __linux__
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    const size_t count = std::min(config.pin_cores, cores);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    // Wraps around once the workers need more cores than there are
+    for (size_t i = 0; i < count; i++) {
+        CPU_SET((index * config.pin_cores + i) % cores, &set);
+    }
+    int error = pthread_setaffinity_np(workers[index].native_handle(), sizeof(set), &set);
+    if (error != 0) {
+        LOG_WARN("Failed to pin transcription worker {}: error {}", index, error);
+    } else if (index == 0) {
+        LOG_INFO("Pinning transcription workers to {} cores each", count);
+    }
+#else
+    if (index == 0) {
+        LOG_WARN("Pinning transcription workers is only supported on Linux");
+    }
+#endif
+}
+
+TranscriptionScheduler::~TranscriptionScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    for (auto* queue : {&finals, &partials}) {
+        for (auto& job : *queue) {
+            job->result.set_exception(std::make_exception_ptr(std::runtime_error("Transcription service is shutting down")));
+        }
+    }
+}
+
+std::string TranscriptionScheduler::transcribe(const AudioClip& clip, const TranscriptionOptions& options) {
+    auto job = std::make_shared<Job>();
+    job->clip = clip;
+    job->batch_key = options.batch_key;
+    job->enqueued = Clock::now();
+    job->batch_deadline = std::min(job->enqueued + std::min(options.max_batch_wait, config.batch_wait), options.deadline);
+    job->deadline = options.deadline;
+    return submit(std::move(job)).get();
+}
+
+void TranscriptionScheduler::execute(std::function<void(const WhisperStatePool::Lease&)> work,
+                                     Clock::time_point deadline) {
+    auto job = std::make_shared<Job>();
+    job->work = std::move(work);
+    job->enqueued = Clock::now();
+    job->batch_deadline = job->enqueued;
+    job->deadline = deadline;
+    submit(std::move(job)).get();
+}
+
+void TranscriptionScheduler::post(std::function<void(const WhisperStatePool::Lease&)> work) {
+    auto job = std::make_shared<Job>();
+    job->work = std::move(work);
+    job->partial = true;
+    job->enqueued = Clock::now();
+    job->batch_deadline = job->enqueued;
+    submit(std::move(job));
+}
+
+std::future<std::string> TranscriptionScheduler::submit(JobPtr job) {
+    auto result = job->result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            throw std::runtime_error("Transcription service is shutting down");
+        }
+        stats.requests++;
+        if (job->partial) {
+            stats.partials++;
+            partials.push_back(std::move(job));
+        } else {
+            finals.push_back(std::move(job));
+        }
+    }
+    // Idle workers pick it up, and a worker collecting a batch may take it along
+    wake.notify_all();
+    return result;
+}
+
+TranscriptionScheduler::Metrics TranscriptionScheduler::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+bool TranscriptionScheduler::batchable(const Job& job) const {
+    return !job.work && !job.batch_key.empty() && config.batch_wait.count() > 0 &&
+           job.clip.count <= config.batch_max_clip_samples;
+}
+
+bool TranscriptionScheduler::expire(Job& job, Clock::time_point now) {
+    if (now <= job.deadline) {
+        return false;
+    }
+    job.result.set_exception(std::make_exception_ptr(DeadlineExceeded()));
+    stats.expired++;
+    return true;
+}
+
+std::vector<TranscriptionScheduler::JobPtr> TranscriptionScheduler::collectBatch(std::unique_lock<std::mutex>& lock) {
+    // Partials only run while no final is waiting
+    std::deque<JobPtr>& source = finals.empty() ? partials : finals;
+    std::vector<JobPtr> batch{source.front()};
+    source.pop_front();
+    if (expire(*batch.front(), Clock::now())) {
+        return {};
+    }
+    if (!batchable(*batch.front())) {
+        return batch;
+    }
+
+    constexpr size_t GAP = WhisperSTT::PACKED_GAP_SAMPLES;
+    size_t packed = batch.front()->clip.count;
+    Clock::time_point close_at = batch.front()->batch_deadline;
+    while (true) {
+        const auto now = Clock::now();
+        for (auto it = finals.begin(); it != finals.end();) {
+            Job& job = **it;
+            if (expire(job, now)) {
+                it = finals.erase(it);
+            } else if (batchable(job) && job.batch_key == batch.front()->batch_key &&
+                       packed + GAP + job.clip.count <= config.batch_max_samples) {
+                packed += GAP + job.clip.count;
+                close_at = std::min(close_at, job.batch_deadline);
+                batch.push_back(*it);
+                it = finals.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        // Waiting only pays off under load: with nothing else decoding, start now
+        if (decoding == 0 || stopping || packed + GAP >= config.batch_max_samples || now >= close_at) {
+            break;
+        }
+        wake.wait_until(lock, close_at);
+    }
+
+    const auto now = Clock::now();
+    for (const auto& job : batch) {
+        stats.batch_wait_ms += std::chrono::duration_cast<std::chrono::milliseconds>(now - job->enqueued).count();
+    }
+    return batch;
+}
+
+void TranscriptionScheduler::run(std::vector<JobPtr>& batch) {
+    try {
+        WhisperStatePool::Lease lease = stt.statePool().acquire();
+        {
+            // Waiting for a state may have outlasted a deadline; nothing is encoded for those
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto now = Clock::now();
+            batch.erase(std::remove_if(batch.begin(), batch.end(), [&](const JobPtr& job) { return expire(*job, now); }),
+                        batch.end());
+        }
+        if (batch.empty()) {
+            return;
+        }
+        if (batch.size() == 1) {
+            Job& job = *batch.front();
+            if (job.work) {
+                job.work(lease);
+                job.result.set_value({});
+            } else {
+                job.result.set_value(stt.decode(lease, job.clip));
+            }
+            return;
+        }
+
+        std::vector<AudioClip> clips;
+        for (const auto& job : batch) {
+            clips.push_back(job->clip);
+        }
+        std::vector<bool> ambiguous;
+        std::vector<std::string> texts = stt.decodePacked(lease, clips, ambiguous);
+
+        // Answer the clips the run settled before decoding the rest again, one by one
+        size_t fallbacks = 0;
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (!ambiguous[i]) {
+                batch[i]->result.set_value(std::move(texts[i]));
+            }
+        }
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (ambiguous[i]) {
+                batch[i]->result.set_value(stt.decode(lease, clips[i]));
+                fallbacks++;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.batched_clips += batch.size();
+        stats.fallbacks += fallbacks;
+        stats.decodes += fallbacks;
+    } catch (...) {
+        for (auto& job : batch) {
+            try {
+                job->result.set_exception(std::current_exception());
+            } catch (const std::future_error&) {
+                // Already answered
+            }
+        }
+    }
+}
+
+void TranscriptionScheduler::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || !finals.empty() || !partials.empty(); });
+        if (stopping) {
+            return;
+        }
+
+        std::vector<JobPtr> batch = collectBatch(lock);
+        if (batch.empty()) {
+            continue;
+        }
+        decoding++;
+        stats.decodes++;
+        lock.unlock();
+
+        if (batch.size() > 1) {
+            LOG_DEBUG("Packing {} clips into one Whisper run", batch.size());
+        }
+        run(batch);
+
+        lock.lock();
+        decoding--;
+    }
+}
@@ -0,0 +1,330 @@
+#include "vad.hpp"
+#include "config.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(AUDIO_SIMD_X86)
+#include <immintrin.h>
+#elif defined(AUDIO_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace audio_utils {
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+// Speech band used for the band energy ratio
+constexpr double BAND_LOW_HZ = 300.0;
+constexpr double BAND_HIGH_HZ = 3400.0;
+
+// Unvoiced frames tolerated inside an onset before it is abandoned
+constexpr uint32_t ONSET_MAX_GAP = 2;
+
+// Noise floor tracking per frame: fast fall, slow rise, very slow rise during speech
+constexpr float FLOOR_FALL_DB = 1.0f;
+constexpr float FLOOR_RISE_DB = 0.1f;
+constexpr float FLOOR_SPEECH_RISE_DB = 0.01f;
+constexpr float FLOOR_MIN_DB = -90.0f;
+constexpr float INITIAL_FLOOR_DB = -60.0f;
+
+struct FrameEnergy {
+    float energy;        // Sum of squares
+    uint32_t crossings;  // Sign changes, including the one from x[-1] to x[0]
+};
+
+// x[-1] must be readable
+using FrameEnergyKernel = FrameEnergy (*)(const float* x, size_t n);
+
+inline uint32_t signBit(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits >> 31;
+}
+
+FrameEnergy frameEnergyScalar(const float* x, size_t n) {
+    FrameEnergy result{0.0f, 0};
+    for (size_t i = 0; i < n; i++) {
+        result.energy += x[i] * x[i];
+        result.crossings += signBit(x[i]) ^ signBit(x[i - 1]);
+    }
+    return result;
+}
+
+#if defined(AUDIO_SIMD_X86)
+AUDIO_TARGET_SSE41
+FrameEnergy frameEnergySSE41(const float* x, size_t n) {
+    __m128 acc = _mm_setzero_ps();
+    uint32_t crossings = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 current = _mm_loadu_ps(x + i);
+        __m128 previous = _mm_loadu_ps(x + i - 1);
+        acc = _mm_add_ps(acc, _mm_mul_ps(current, current));
+        // Sign bits differ where the xor is negative
+        crossings += std::popcount(static_cast<unsigned>(_mm_movemask_ps(_mm_xor_ps(current, previous))));
+    }
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+
+    FrameEnergy tail = frameEnergyScalar(x + i, n - i);
+    return {_mm_cvtss_f32(acc) + tail.energy, crossings + tail.crossings};
+}
+
+AUDIO_TARGET_AVX2
+FrameEnergy frameEnergyAVX2(const float* x, size_t n) {
+    __m256 acc = _mm256_setzero_ps();
+    uint32_t crossings = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 current = _mm256_loadu_ps(x + i);
+        __m256 previous = _mm256_loadu_ps(x + i - 1);
+        acc = _mm256_fmadd_ps(current, current, acc);
+        crossings += std::popcount(static_cast<unsigned>(_mm256_movemask_ps(_mm256_xor_ps(current, previous))));
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+
+    FrameEnergy tail = frameEnergyScalar(x + i, n - i);
+    return {_mm_cvtss_f32(sum) + tail.energy, crossings + tail.crossings};
+}
+#endif
+
+#if defined(AUDIO_SIMD_NEON)
+FrameEnergy frameEnergyNEON(const float* x, size_t n) {
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    uint32x4_t crossings = vdupq_n_u32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t current = vld1q_f32(x + i);
+        float32x4_t previous = vld1q_f32(x + i - 1);
+        acc = vmlaq_f32(acc, current, current);
+        uint32x4_t differ = veorq_u32(vreinterpretq_u32_f32(current), vreinterpretq_u32_f32(previous));
+        crossings = vaddq_u32(crossings, vshrq_n_u32(differ, 31));
+    }
+    float32x2_t pair = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    uint32x2_t counts = vadd_u32(vget_low_u32(crossings), vget_high_u32(crossings));
+
+    FrameEnergy tail = frameEnergyScalar(x + i, n - i);
+    return {vget_lane_f32(vpadd_f32(pair, pair), 0) + tail.energy,
+            vget_lane_u32(vpadd_u32(counts, counts), 0) + tail.crossings};
+}
+#endif
+
+FrameEnergyKernel frameEnergyKernel() {
+    switch (simd::activeLevel()) {
+#if defined(AUDIO_SIMD_X86)
+        case simd::Level::AVX2: return frameEnergyAVX2;
+        case simd::Level::SSE41: return frameEnergySSE41;
+#endif
+#if defined(AUDIO_SIMD_NEON)
+        case simd::Level::NEON: return frameEnergyNEON;
+#endif
+        default: return frameEnergyScalar;
+    }
+}
+
+/**
+ * Hann-windowed sinc band-pass for the speech band, about 10ms long.
+ * The length is a multiple of 8 so it can run through the dot product kernel.
+ */
+std::vector<float> designBandFilter(int sample_rate) {
+    size_t taps = static_cast<size_t>(sample_rate / 100);
+    taps = std::max<size_t>(8, (taps + 7) & ~static_cast<size_t>(7));
+
+    const double low = BAND_LOW_HZ / sample_rate;
+    const double high = std::min(BAND_HIGH_HZ, 0.45 * sample_rate) / sample_rate;
+    const double center = (static_cast<double>(taps) - 1.0) / 2.0;
+
+    std::vector<float> filter(taps);
+    for (size_t k = 0; k < taps; k++) {
+        double m = static_cast<double>(k) - center;
+        double ideal = m == 0.0
+            ? 2.0 * (high - low)
+            : (std::sin(2.0 * PI * high * m) - std::sin(2.0 * PI * low * m)) / (PI * m);
+        double window = 0.5 - 0.5 * std::cos(2.0 * PI * (static_cast<double>(k) + 0.5) / static_cast<double>(taps));
+        filter[k] = static_cast<float>(ideal * window);
+    }
+    return filter;
+}
+
+inline float toDb(float mean_square) {
+    return 10.0f * std::log10(mean_square + 1e-12f);
+}
+
+} // namespace
+
+VadConfig VadConfig::fromEnvironment(int sample_rate) {
+    VadConfig config;
+    config.sample_rate = sample_rate;
+    config.min_voiced_ms = static_cast<uint32_t>(config::VAD_MIN_VOICED_MS);
+    config.hangover_ms = static_cast<uint32_t>(config::VAD_HANGOVER_MS);
+    config.pre_roll_ms = static_cast<uint32_t>(config::VAD_PRE_ROLL_MS);
+    return config;
+}
+
+VoiceActivityDetector::VoiceActivityDetector(const VadConfig& config)
+    : config(config), silence_remainder_ms(0.0f), dot(dotKernel()),
+      noise_floor_db(INITIAL_FLOOR_DB), state(State::Silence),
+      voiced_run(0), onset_length(0), unvoiced_run(0), onset_frames(0) {
+    if (config.sample_rate < 8000 || config.sample_rate % 50 != 0) {
+        throw std::invalid_argument("VAD sample rate must be at least 8kHz and a multiple of 50Hz");
+    }
+    frame_samples = static_cast<size_t>(config.sample_rate) * FRAME_MS / 1000;
+    band_filter = designBandFilter(config.sample_rate);
+    window.assign(band_filter.size() - 1 + frame_samples, 0.0f);
+    // Band energy is estimated from every stride-th filter output, about 16k per second
+    band_stride = std::max<size_t>(1, static_cast<size_t>(config.sample_rate / 16000));
+}
+
+size_t VoiceActivityDetector::lookbackFrames() const {
+    size_t needed = (config.min_voiced_ms + FRAME_MS - 1) / FRAME_MS;
+    size_t longest_onset = needed + (needed > 0 ? (needed - 1) * ONSET_MAX_GAP : 0);
+    return longest_onset + (config.pre_roll_ms + FRAME_MS - 1) / FRAME_MS;
+}
+
+void VoiceActivityDetector::reset() {
+    std::fill(window.begin(), window.end(), 0.0f);
+    silence_remainder_ms = 0.0f;
+    state = State::Silence;
+    voiced_run = 0;
+    onset_length = 0;
+    unvoiced_run = 0;
+    onset_frames = 0;
+}
+
+VadEvent VoiceActivityDetector::process(const float* frame) {
+    static const FrameEnergyKernel frame_energy = frameEnergyKernel();
+
+    const size_t history = band_filter.size() - 1;
+    std::memcpy(window.data() + history, frame, frame_samples * sizeof(float));
+    silence_remainder_ms = 0.0f;
+
+    const float* samples = window.data() + history;
+    FrameEnergy measured = frame_energy(samples, frame_samples);
+
+    float band_energy = 0.0f;
+    size_t band_outputs = 0;
+    for (size_t i = 0; i < frame_samples; i += band_stride) {
+        float y = dot(window.data() + i, band_filter.data(), band_filter.size());
+        band_energy += y * y;
+        band_outputs++;
+    }
+
+    const float mean_square = measured.energy / static_cast<float>(frame_samples);
+    stats.energy_dbfs = toDb(mean_square);
+    stats.zero_crossing_rate = static_cast<float>(measured.crossings) * 1000.0f / FRAME_MS;
+    stats.band_ratio = mean_square > 0.0f
+        ? std::min(1.0f, band_energy / static_cast<float>(band_outputs) / mean_square)
+        : 0.0f;
+
+    // Hysteresis: a frame has to clear a higher bar to start speech than to continue it
+    const bool in_speech = state == State::Speech;
+    const float margin = in_speech ? config.continue_margin_db : config.start_margin_db;
+    const float threshold = std::max(noise_floor_db + margin, config.min_energy_dbfs);
+    const float band_needed = in_speech ? config.min_band_ratio * 0.5f : config.min_band_ratio;
+    stats.voiced = stats.energy_dbfs > threshold &&
+                   stats.band_ratio >= band_needed &&
+                   (in_speech || stats.zero_crossing_rate <= config.max_zero_crossing_rate);
+
+    // The noise floor follows unvoiced frames; during speech it only creeps up, so a
+    // steady noise that started an utterance eventually ends it
+    if (in_speech) {
+        if (stats.energy_dbfs > noise_floor_db) {
+            noise_floor_db = std::min(stats.energy_dbfs, noise_floor_db + FLOOR_SPEECH_RISE_DB);
+        }
+    } else if (!stats.voiced) {
+        if (stats.energy_dbfs < noise_floor_db) {
+            noise_floor_db = std::max({stats.energy_dbfs, noise_floor_db - FLOOR_FALL_DB, FLOOR_MIN_DB});
+        } else {
+            noise_floor_db = std::min(stats.energy_dbfs, noise_floor_db + FLOOR_RISE_DB);
+        }
+    }
+    stats.noise_floor_dbfs = noise_floor_db;
+
+    std::memmove(window.data(), window.data() + frame_samples, history * sizeof(float));
+    return advance(stats.voiced);
+}
+
+VadEvent VoiceActivityDetector::processSilence(uint32_t ms) {
+    // The filter history is stale after a gap
+    std::fill(window.begin(), window.end(), 0.0f);
+
+    silence_remainder_ms += static_cast<float>(ms);
+    VadEvent event = VadEvent::None;
+    while (silence_remainder_ms >= FRAME_MS && state != State::Silence) {
+        silence_remainder_ms -= FRAME_MS;
+        VadEvent frame_event = advance(false);
+        if (frame_event != VadEvent::None) {
+            event = frame_event;
+        }
+    }
+    if (state == State::Silence) {
+        silence_remainder_ms = 0.0f;
+    }
+    return event;
+}
+
+uint32_t VoiceActivityDetector::msUntilSpeechEnd() const {
+    if (state != State::Speech) {
+        return 0;
+    }
+    uint32_t frames_needed = (config.hangover_ms + FRAME_MS - 1) / FRAME_MS;
+    if (unvoiced_run >= frames_needed) {
+        return 0;
+    }
+    float remaining = static_cast<float>((frames_needed - unvoiced_run) * FRAME_MS) - silence_remainder_ms;
+    return remaining > 0.0f ? static_cast<uint32_t>(std::ceil(remaining)) : 0;
+}
+
+VadEvent VoiceActivityDetector::advance(bool voiced) {
+    switch (state) {
+        case State::Silence:
+            if (!voiced) {
+                return VadEvent::None;
+            }
+            state = State::Onset;
+            voiced_run = 0;
+            onset_length = 0;
+            unvoiced_run = 0;
+            [[fallthrough]];
+
+        case State::Onset:
+            onset_length++;
+            if (voiced) {
+                voiced_run++;
+                unvoiced_run = 0;
+            } else if (++unvoiced_run > ONSET_MAX_GAP) {
+                state = State::Silence;
+                return VadEvent::None;
+            }
+            if (voiced_run * FRAME_MS >= config.min_voiced_ms) {
+                state = State::Speech;
+                unvoiced_run = 0;
+                onset_frames = onset_length - 1 + (config.pre_roll_ms + FRAME_MS - 1) / FRAME_MS;
+                return VadEvent::SpeechStart;
+            }
+            return VadEvent::None;
+
+        case State::Speech:
+            if (voiced) {
+                unvoiced_run = 0;
+                return VadEvent::None;
+            }
+            if (++unvoiced_run * FRAME_MS >= config.hangover_ms) {
+                state = State::Silence;
+                unvoiced_run = 0;
+                return VadEvent::SpeechEnd;
+            }
+            return VadEvent::None;
+    }
+    return VadEvent::None;
+}
+
+} // namespace audio_utils
@@ -0,0 +1,562 @@
+#include "discord_bot/capture_processor.hpp"
+#include "discord_bot/guild_voice.hpp"
+#include "discord_bot/playback.hpp"
+#include "discord_bot/turn_pipeline.hpp"
+#include "discord_bot/voice_recording.hpp"
+#include "logging.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Replays a recording of received voice packets through the bot's capture path and
+// turn pipeline, with stand-ins for Whisper, the LLM and TTS, and reports latencies.
+
+using namespace discord;
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    // Replayed arrival times start here, since 0 means "no audio yet" to the capture path
+    constexpr uint64_t EPOCH_MS = 1000;
+
+    struct Options {
+        std::string path;
+        double speed = 1.0;            // 0 = as fast as possible
+        uint64_t stt_ms = 150;         // Per speech-to-text request
+        uint64_t stt_ms_per_s = 40;    // ...plus this per second of audio
+        uint64_t llm_ms = 600;
+        uint64_t tts_ms = 250;         // Until the first audio of a reply
+    };
+
+    /**
+     * Recording time. Runs `speed` times faster than the wall clock, or at speed 0
+     * only moves when the driver advances it.
+     */
+    class ReplayClock {
+    public:
+        explicit ReplayClock(double speed) : speed(speed), start(Clock::now()) {}
+
+        uint64_t nowMs() const {
+            if (speed <= 0) {
+                return simulated.load(std::memory_order_acquire);
+            }
+            std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+            return EPOCH_MS + static_cast<uint64_t>(elapsed.count() * speed);
+        }
+
+        void advanceTo(uint64_t ms) {
+            if (ms > simulated.load(std::memory_order_relaxed)) {
+                {
+                    std::lock_guard<std::mutex> lock(advance_mutex);
+                    simulated.store(ms, std::memory_order_release);
+                }
+                advanced.notify_all();
+            }
+        }
+
+        // At speed 0: block until the driver advances the clock to `ms` or `done` holds,
+        // which is checked again on every wake()
+        template <typename Done>
+        void waitUntil(uint64_t ms, Done&& done) const {
+            std::unique_lock<std::mutex> lock(advance_mutex);
+            advanced.wait(lock, [&] { return simulated.load(std::memory_order_acquire) >= ms || done(); });
+        }
+
+        void wake() const {
+            { std::lock_guard<std::mutex> lock(advance_mutex); }
+            advanced.notify_all();
+        }
+
+        Clock::time_point wallTime(uint64_t ms) const {
+            uint64_t offset = ms > EPOCH_MS ? ms - EPOCH_MS : 0;
+            return start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(offset / speed));
+        }
+
+        // Stand-in latency in recording time; nothing to wait for at speed 0
+        void sleep(uint64_t ms, const CancellationToken* cancel = nullptr) const {
+            if (speed <= 0 || ms == 0) {
+                return;
+            }
+            auto until = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(ms / speed));
+            while (Clock::now() < until && !(cancel && cancel->cancelled())) {
+                std::this_thread::sleep_for(std::min<Clock::duration>(until - Clock::now(), std::chrono::milliseconds(5)));
+            }
+        }
+
+        bool realTime() const { return speed > 0; }
+
+    private:
+        const double speed;
+        const Clock::time_point start;
+        std::atomic<uint64_t> simulated{EPOCH_MS};
+        mutable std::mutex advance_mutex;
+        mutable std::condition_variable advanced;
+    };
+
+    class LatencyStats {
+    public:
+        void add(const std::string& stage, uint64_t ms) {
+            std::lock_guard<std::mutex> lock(mutex);
+            samples[stage].push_back(ms);
+        }
+
+        void print() {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::printf("%-24s %8s %8s %8s %8s\n", "stage (ms)", "count", "p50", "p95", "max");
+            for (auto& [stage, values] : samples) {
+                std::sort(values.begin(), values.end());
+                std::printf("%-24s %8zu %8llu %8llu %8llu\n", stage.c_str(), values.size(),
+                            static_cast<unsigned long long>(percentile(values, 50)),
+                            static_cast<unsigned long long>(percentile(values, 95)),
+                            static_cast<unsigned long long>(values.back()));
+            }
+        }
+
+    private:
+        static uint64_t percentile(const std::vector<uint64_t>& sorted, size_t p) {
+            size_t rank = (sorted.size() * p + 99) / 100;
+            return sorted[std::max<size_t>(rank, 1) - 1];
+        }
+
+        std::mutex mutex;
+        std::map<std::string, std::vector<uint64_t>> samples;
+    };
+
+    /**
+     * Stands in for the services behind the pipeline: each call takes its configured
+     * latency, and speech-to-text makes up one word per 300ms of audio.
+     */
+    class ReplayBackend : public TurnBackend {
+    public:
+        ReplayBackend(const Options& options, ReplayClock& clock, LatencyStats& latencies)
+            : options(options), clock(clock), latencies(latencies) {}
+
+        void attach(CaptureProcessor& capture, GuildSessionMap& guild_sessions, WakeSignal& wake) {
+            processor = &capture;
+            sessions = &guild_sessions;
+            processing_wake = &wake;
+        }
+
+        // Driver thread: a packet of `user_id` arrived
+        void heard(uint64_t guild_id, uint64_t user_id, uint64_t arrival_ms) {
+            std::lock_guard<std::mutex> lock(mutex);
+            last_voice[user_id] = arrival_ms;
+            last_guild_voice[guild_id] = arrival_ms;
+        }
+
+        bool idle() const { return in_flight.load() == 0; }
+
+        std::string startStream() override {
+            Call call(*this);
+            std::lock_guard<std::mutex> lock(mutex);
+            std::string session_id = "replay-" + std::to_string(++next_session);
+            streams[session_id] = Stream{};
+            return session_id;
+        }
+
+        bool appendStream(const std::string& session_id, const FrameView& audio) override {
+            Call call(*this);
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = streams.find(session_id);
+            if (it == streams.end()) {
+                return false;
+            }
+            // Acknowledged at once; the service transcribes everything received in one pass
+            Stream& stream = it->second;
+            stream.frames += audio.frames();
+            stream.partial_ready_ms = clock.nowMs() + sttLatency(audio.frames());
+            return true;
+        }
+
+        PartialTranscript waitPartial(const std::string& session_id, uint64_t after_version,
+                                      std::chrono::milliseconds wait) override {
+            Call call(*this);
+            const uint64_t deadline = clock.nowMs() + static_cast<uint64_t>(wait.count());
+            while (true) {
+                uint64_t ready_ms = 0;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    auto it = streams.find(session_id);
+                    if (it == streams.end()) {
+                        return {};
+                    }
+                    Stream& stream = it->second;
+                    if (stream.partial_ready_ms != 0 && stream.partial_ready_ms <= clock.nowMs()) {
+                        publishPartial(stream);
+                    }
+                    if (stream.partial.version > after_version || stream.partial_ready_ms == 0 ||
+                        clock.nowMs() >= deadline) {
+                        return stream.partial;
+                    }
+                    ready_ms = std::min(stream.partial_ready_ms, deadline);
+                }
+                if (clock.realTime()) {
+                    clock.sleep(ready_ms - std::min(ready_ms, clock.nowMs()));
+                } else {
+                    // Recording time only moves with the driver; wait for it instead of spinning
+                    clock.waitUntil(ready_ms, [&] {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        return streams.find(session_id) == streams.end();
+                    });
+                }
+            }
+        }
+
+        std::string finishStream(const std::string& session_id) override {
+            Call call(*this);
+            clock.sleep(options.stt_ms);
+            std::string text;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = streams.find(session_id);
+                if (it == streams.end()) {
+                    return "";
+                }
+                publishPartial(it->second);
+                text = trimLeading(it->second.committed + it->second.pending);
+                streams.erase(it);
+            }
+            // A poll of the stream waiting for the clock returns now
+            clock.wake();
+            return text;
+        }
+
+        void abortStream(const std::string& session_id) override {
+            Call call(*this);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                streams.erase(session_id);
+            }
+            clock.wake();
+        }
+
+        std::string transcribe(uint64_t, const FrameView& audio) override {
+            Call call(*this);
+            clock.sleep(sttLatency(audio.frames()));
+            std::string text;
+            for (size_t i = 0; i < std::max<size_t>(audio.frames() / FRAMES_PER_WORD, 1); i++) {
+                text += makeWord(i);
+            }
+            return text;
+        }
+
+        void transcriptCueChanged(const VoiceTurn& turn) override {
+            auto session = sessions ? sessions->find(turn.guild_id) : nullptr;
+            if (session && processor->requeue(std::move(session), turn.user_id)) {
+                processing_wake->notify();
+            }
+        }
+
+        std::string respond(const std::vector<Utterance>& utterances, const CancellationToken& cancel) override {
+            Call call(*this);
+            const uint64_t spoken_ms = lastVoice(utterances);
+            if (clock.realTime() && spoken_ms != 0) {
+                latencies.add("transcribed", clock.nowMs() - std::min(clock.nowMs(), spoken_ms));
+            }
+            clock.sleep(options.llm_ms, &cancel);
+            if (cancel.cancelled()) {
+                return "";
+            }
+            if (clock.realTime() && spoken_ms != 0) {
+                latencies.add("replied", clock.nowMs() - std::min(clock.nowMs(), spoken_ms));
+            }
+            return "Reply to " + std::to_string(utterances.size()) + " speaker(s).";
+        }
+
+        SpeculativeReply speculate(uint64_t, const std::string& transcript, const CancellationToken& cancel) override {
+            Call call(*this);
+            clock.sleep(options.llm_ms, &cancel);
+            SpeculativeReply result;
+            result.reply = "Reply to \"" + transcript + "\"";
+            result.usable = !cancel.cancelled();
+            return result;
+        }
+
+        bool adoptSpeculation(uint64_t, const std::string&, const SpeculativeReply&) override {
+            return true;
+        }
+
+        void speak(uint64_t guild_id, const std::string&, const CancellationToken& cancel) override {
+            Call call(*this);
+            clock.sleep(options.tts_ms, &cancel);
+            if (cancel.cancelled() || !clock.realTime()) {
+                return;
+            }
+            uint64_t spoken_ms = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                spoken_ms = last_guild_voice[guild_id];
+            }
+            latencies.add("first audio", clock.nowMs() - std::min(clock.nowMs(), spoken_ms));
+        }
+
+    private:
+        static constexpr size_t FRAMES_PER_WORD = 15;
+        static constexpr size_t WORDS_PER_SENTENCE = 6;
+
+        // Keeps the drain check from seeing the pipeline idle mid-call
+        struct Call {
+            explicit Call(ReplayBackend& backend) : backend(backend) { backend.in_flight.fetch_add(1); }
+            ~Call() { backend.in_flight.fetch_sub(1); }
+            ReplayBackend& backend;
+        };
+
+        uint64_t sttLatency(size_t frames) const {
+            return options.stt_ms + options.stt_ms_per_s * frames / 50;
+        }
+
+        struct Stream {
+            size_t frames = 0;   // Uploaded so far
+            size_t words = 0;    // Returned so far
+            std::string committed;
+            std::string pending;
+            uint64_t partial_ready_ms = 0;  // When the pass over the latest chunks is done (0 = none running)
+            PartialTranscript partial;      // Latest published
+        };
+
+        // Words are committed one pass after they were first heard, as the service's passes agree
+        static void publishPartial(Stream& stream) {
+            stream.committed += stream.pending;
+            stream.pending.clear();
+            while (stream.words < stream.frames / FRAMES_PER_WORD) {
+                stream.pending += makeWord(stream.words++);
+            }
+            stream.partial_ready_ms = 0;
+            stream.partial.version++;
+            stream.partial.audio_bytes = stream.frames * VOICE_FRAME_BYTES;
+            stream.partial.committed = trimLeading(stream.committed);
+            stream.partial.pending = trimLeading(stream.pending);
+        }
+
+        static std::string trimLeading(const std::string& text) {
+            return text.empty() || text.front() != ' ' ? text : text.substr(1);
+        }
+
+        static std::string makeWord(size_t index) {
+            std::string word = " word" + std::to_string(index);
+            if ((index + 1) % WORDS_PER_SENTENCE == 0) {
+                word += ".";
+            }
+            return word;
+        }
+
+        uint64_t lastVoice(const std::vector<Utterance>& utterances) {
+            std::lock_guard<std::mutex> lock(mutex);
+            uint64_t latest = 0;
+            for (const auto& utterance : utterances) {
+                auto it = last_voice.find(utterance.user_id);
+                if (it != last_voice.end()) {
+                    latest = std::max(latest, it->second);
+                }
+            }
+            return latest;
+        }
+
+        const Options options;
+        ReplayClock& clock;
+        LatencyStats& latencies;
+        CaptureProcessor* processor = nullptr;
+        GuildSessionMap* sessions = nullptr;
+        WakeSignal* processing_wake = nullptr;
+
+        std::mutex mutex;
+        uint64_t next_session = 0;
+        std::unordered_map<std::string, Stream> streams;
+        std::unordered_map<uint64_t, uint64_t> last_voice;        // User -> last packet
+        std::unordered_map<uint64_t, uint64_t> last_guild_voice;  // Guild -> last packet
+        std::atomic<int> in_flight{0};
+    };
+
+    double threadCpuMs() {
+#ifndef _WIN32
+        timespec ts{};
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+#else
+        return 0.0;
+#endif
+    }
+
+    double processCpuMs() {
+#ifndef _WIN32
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+               (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+#else
+        return 1000.0 * std::clock() / CLOCKS_PER_SEC;
+#endif
+    }
+
+    void usage(const char* program) {
+        std::cerr << "Usage: " << program << " <recording> [--speed N] [--stt-ms MS] [--stt-ms-per-s MS]"
+                  << " [--llm-ms MS] [--tts-ms MS]\n"
+                  << "  --speed N  replay N times faster than real time; 0 runs as fast as possible\n"
+                  << "             with instant stand-ins (capture path only)\n";
+    }
+
+    bool parseOptions(int argc, char* argv[], Options& options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                options.path = arg;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                return false;
+            }
+            const char* value = argv[++i];
+            if (arg == "--speed") options.speed = std::strtod(value, nullptr);
+            else if (arg == "--stt-ms") options.stt_ms = std::strtoull(value, nullptr, 10);
+            else if (arg == "--stt-ms-per-s") options.stt_ms_per_s = std::strtoull(value, nullptr, 10);
+            else if (arg == "--llm-ms") options.llm_ms = std::strtoull(value, nullptr, 10);
+            else if (arg == "--tts-ms") options.tts_ms = std::strtoull(value, nullptr, 10);
+            else return false;
+        }
+        return !options.path.empty() && options.speed >= 0;
+    }
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    logging::init();
+
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    try {
+        VoiceRecordingReader reader(options.path);
+        const uint32_t duration_ms = reader.durationMs();
+        LOG_INFO("Replaying {} ({:.1f}s of voice traffic) at {}", options.path, duration_ms / 1000.0,
+                 options.speed > 0 ? std::to_string(options.speed) + "x" : std::string("full speed"));
+
+        ReplayClock clock(options.speed);
+        LatencyStats latencies;
+        ReplayBackend backend(options, clock, latencies);
+
+        // Same settings as the bot, so thresholds can be tuned against a fixed recording
+        TurnPipeline::Config pipeline_config;
+        pipeline_config.partial_poll_threads = std::max<size_t>(1, config::MAX_STREAMING_TURNS);
+        pipeline_config.coalesce_window = std::chrono::milliseconds(config::TURN_COALESCE_MS);
+        pipeline_config.coalesce_max_wait = std::chrono::milliseconds(config::TURN_COALESCE_MAX_WAIT_MS);
+        pipeline_config.speculate = config::SPECULATIVE_LLM != 0;
+        pipeline_config.speculation_stable_partials = config::SPECULATIVE_STABLE_PARTIALS;
+        pipeline_config.speculation_min_chars = config::SPECULATIVE_MIN_CHARS;
+        pipeline_config.speculation_max_per_turn = config::SPECULATIVE_MAX_PER_TURN;
+        TurnPipeline pipeline(backend, pipeline_config);
+
+        CaptureProcessor::Config capture_config;
+        capture_config.vad = audio_utils::VadConfig::fromEnvironment(48000);
+        capture_config.endpointer = audio_utils::EndpointerConfig::fromEnvironment();
+        capture_config.min_stream_frames = pipeline_config.min_upload_frames;
+        capture_config.user_idle_timeout = std::chrono::seconds(config::VOICE_USER_IDLE_S);
+        CaptureProcessor capture(pipeline, capture_config, EPOCH_MS);
+
+        GuildSessionMap sessions;
+        WakeSignal wake;
+        backend.attach(capture, sessions, wake);
+
+        // The capture path runs on this thread, which stands in for the bot's processing thread
+        const double cpu_start_ms = threadCpuMs();
+        const auto wall_start = Clock::now();
+
+        VoiceRecordingReader::Packet packet;
+        bool have_packet = reader.next(packet);
+        while (have_packet || capture.nextWakeup()) {
+            uint64_t due = have_packet ? EPOCH_MS + packet.time_ms : UINT64_MAX;
+            if (auto wakeup = capture.nextWakeup()) {
+                due = std::min(due, *wakeup);
+            }
+
+            uint64_t now_ms = due;
+            if (clock.realTime()) {
+                wake.wait(clock.wallTime(due));
+                now_ms = clock.nowMs();
+            } else {
+                clock.advanceTo(due);
+            }
+
+            while (have_packet && EPOCH_MS + packet.time_ms <= now_ms) {
+                const uint64_t arrival_ms = EPOCH_MS + packet.time_ms;
+                auto session = sessions.findOrCreate(packet.guild_id, [&] {
+                    auto playback = std::make_shared<PlaybackEngine>(packet.guild_id, PlaybackOutput{});
+                    auto created = std::make_shared<GuildVoiceSession>(packet.guild_id, 0, capture.ringPool(),
+                                                                       capture.maxUsers(), std::move(playback));
+                    created->setState(GuildVoiceSession::State::Connected);
+                    return created;
+                });
+                backend.heard(packet.guild_id, packet.user_id, arrival_ms);
+                capture.receive(std::move(session), packet.user_id, packet.audio, packet.size, arrival_ms);
+                have_packet = reader.next(packet);
+            }
+            capture.poll(now_ms);
+        }
+
+        const double capture_cpu_ms = threadCpuMs() - cpu_start_ms;
+        const double feed_wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - wall_start).count();
+
+        // Let the last turns through the pipeline; the coalescer may still hold some back
+        const auto quiet_for = std::chrono::milliseconds(config::TURN_COALESCE_MAX_WAIT_MS + 500);
+        auto quiet_since = Clock::now();
+        while (Clock::now() - quiet_since < quiet_for) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            if (!backend.idle()) {
+                quiet_since = Clock::now();
+            }
+        }
+        pipeline.shutdown();
+
+        CaptureProcessor::Metrics metrics = capture.metrics();
+        TurnPipeline::SpeculationMetrics speculation = pipeline.speculationMetrics();
+
+        std::printf("\nRecording: %.1fs, replayed in %.1fs\n", duration_ms / 1000.0, feed_wall_ms / 1000.0);
+        std::printf("Capture: %llu packets, %llu frames, %llu utterances, %llu barge-ins\n",
+                    static_cast<unsigned long long>(metrics.packets), static_cast<unsigned long long>(metrics.frames),
+                    static_cast<unsigned long long>(metrics.utterances), static_cast<unsigned long long>(metrics.barge_ins));
+        if (metrics.rejected_packets > 0) {
+            std::printf("Dropped %llu packets over the voice user cap\n", static_cast<unsigned long long>(metrics.rejected_packets));
+        }
+        if (metrics.utterances > 0) {
+            std::printf("Endpoint timeout: mean %llums, max %llums\n",
+                        static_cast<unsigned long long>(metrics.endpoint_ms_total / metrics.utterances),
+                        static_cast<unsigned long long>(metrics.endpoint_ms_max));
+        }
+        std::printf("Speculation: %llu started, %llu used, %llu discarded\n",
+                    static_cast<unsigned long long>(speculation.started), static_cast<unsigned long long>(speculation.used),
+                    static_cast<unsigned long long>(speculation.discarded));
+        std::printf("CPU: capture thread %.1fms (%.3f%% of the recording), process %.1fms\n\n",
+                    capture_cpu_ms, duration_ms > 0 ? 100.0 * capture_cpu_ms / duration_ms : 0.0, processCpuMs());
+        if (clock.realTime()) {
+            // Measured from the speaker's last packet, in recording time
+            latencies.print();
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("Replay failed: {}", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -5,6 +5,27 @@
 
 using json = nlohmann::json;
 
+namespace {
+    size_t totalSize(const std::vector<WhisperClient::AudioSpan>& audio) {
+        size_t total = 0;
+        for (const auto& span : audio) total += span.size;
+        return total;
+    }
+
+    // Serves the request body from the caller's spans
+    httplib::ContentProvider spanProvider(const std::vector<WhisperClient::AudioSpan>& audio) {
+        return [&audio](size_t offset, size_t, httplib::DataSink& sink) {
+            for (const auto& span : audio) {
+                if (offset < span.size) {
+                    return sink.write(reinterpret_cast<const char*>(span.data) + offset, span.size - offset);
+                }
+                offset -= span.size;
+            }
+            return true;
+        };
+    }
+}
+
 WhisperClient::WhisperClient(const std::string& service_url, int retry_delay_ms) 
     : service_url(service_url), retry_delay_ms(retry_delay_ms),
       is_reconnecting(false), should_stop_reconnection(false) {
@@ -26,7 +47,7 @@ void WhisperClient::initClient() {
     std::lock_guard<std::mutex> lock(client_mutex);
     client = std::make_unique<httplib::Client>(service_url);
     client->set_connection_timeout(5);
-    client->set_read_timeout(30);
+    client->set_read_timeout(REQUEST_TIMEOUT_S);
     
     LOG_INFO("Initialized Whisper client with service URL: {}", service_url);
 }
@@ -83,8 +104,13 @@ void WhisperClient::reconnectionLoop() {
     is_reconnecting = false;
 }
 
-std::string WhisperClient::audioToText(const std::vector<uint8_t>& audio_data) {
-    if (audio_data.empty()) {
+std::string WhisperClient::audioToText(const std::vector<uint8_t>& audio_data, const std::string& batch_key) {
+    return audioToText(std::vector<AudioSpan>{{audio_data.data(), audio_data.size()}}, batch_key);
+}
+
+std::string WhisperClient::audioToText(const std::vector<AudioSpan>& audio, const std::string& batch_key) {
+    const size_t audio_size = totalSize(audio);
+    if (audio_size == 0) {
         LOG_WARN("Empty audio data provided to Whisper client");
         return "";
     }
@@ -99,17 +125,20 @@ std::string WhisperClient::audioToText(const std::vector<uint8_t>& audio_data) {
 
     // Set up headers
     httplib::Headers headers = {
-        {"Content-Type", "audio/raw"}
+        {"Content-Type", "audio/raw"},
+        {"X-Deadline-Ms", std::to_string(REQUEST_TIMEOUT_S * 1000)}
     };
+    if (!batch_key.empty()) {
+        headers.emplace("X-Batch-Key", batch_key);
+    }
 
     // Send request
-    LOG_INFO("Sending {} bytes of audio data to Whisper service", audio_data.size());
+    LOG_INFO("Sending {} bytes of audio data to Whisper service", audio_size);
     
     std::string transcribed_text;
     {
         std::lock_guard<std::mutex> lock(client_mutex);
-        auto result = client->Post("/transcribe", headers, 
-            std::string(audio_data.begin(), audio_data.end()), "audio/raw");
+        auto result = client->Post("/transcribe", headers, audio_size, spanProvider(audio), "audio/raw");
 
         if (result) {
             if (result->status == 200) {
@@ -169,12 +198,25 @@ std::string WhisperClient::startStream() {
         throw std::runtime_error("Start stream error: " + response.value("error", std::string("HTTP ") + std::to_string(result->status)));
     }
     auto response = json::parse(result->body);
-    return response.value("session_id", "");
+    std::string session_id = response.value("session_id", "");
+    if (!session_id.empty()) {
+        auto poll_client = std::make_shared<httplib::Client>(service_url);
+        poll_client->set_keep_alive(true);
+        poll_client->set_connection_timeout(5);
+        std::lock_guard<std::mutex> poll_lock(poll_clients_mutex);
+        poll_clients[session_id] = std::move(poll_client);
+    }
+    return session_id;
 }
 
-std::string WhisperClient::appendStream(const std::string& session_id, const std::vector<uint8_t>& audio_chunk) {
-    if (session_id.empty() || audio_chunk.empty()) return "";
-    if (!isHealthy()) return "";
+bool WhisperClient::appendStream(const std::string& session_id, const std::vector<uint8_t>& audio_chunk) {
+    return appendStream(session_id, std::vector<AudioSpan>{{audio_chunk.data(), audio_chunk.size()}});
+}
+
+bool WhisperClient::appendStream(const std::string& session_id, const std::vector<AudioSpan>& audio) {
+    const size_t audio_size = totalSize(audio);
+    if (session_id.empty() || audio_size == 0) return false;
+    if (!isHealthy()) return false;
 
     httplib::Headers headers = {
         {"X-Session-Id", session_id},
@@ -182,22 +224,54 @@ std::string WhisperClient::appendStream(const std::string& session_id, const std
     };
 
     std::lock_guard<std::mutex> lock(client_mutex);
-    auto result = client->Post("/stream/chunk", headers, std::string(audio_chunk.begin(), audio_chunk.end()), "audio/raw");
-    if (!result || result->status != 200) return "";
+    auto result = client->Post("/stream/chunk", headers, audio_size, spanProvider(audio), "audio/raw");
+    return result && result->status == 200;
+}
+
+WhisperClient::StreamPartial WhisperClient::waitPartial(const std::string& session_id, uint64_t after_version,
+                                                        std::chrono::milliseconds wait) {
+    if (session_id.empty()) return {};
+
+    std::shared_ptr<httplib::Client> poll_client;
+    {
+        std::lock_guard<std::mutex> lock(poll_clients_mutex);
+        auto it = poll_clients.find(session_id);
+        if (it == poll_clients.end()) return {};   // Finished already
+        poll_client = it->second;
+    }
+    poll_client->set_read_timeout(std::chrono::duration_cast<std::chrono::seconds>(wait).count() + 5);
+
+    httplib::Headers headers = {
+        {"X-Session-Id", session_id}
+    };
+    std::string path = "/stream/partial?after=" + std::to_string(after_version) + "&wait_ms=" + std::to_string(wait.count());
+    auto result = poll_client->Get(path, headers);
+    if (!result || result->status != 200) return {};
     try {
         auto response = json::parse(result->body);
-        return response.value("partial", "");
+        StreamPartial partial;
+        partial.version = response.value("version", uint64_t{0});
+        partial.audio_bytes = response.value("audio_bytes", uint64_t{0});
+        partial.committed = response.value("committed", "");
+        partial.pending = response.value("pending", "");
+        return partial;
     } catch (...) {
-        return "";
+        return {};
     }
 }
 
 std::string WhisperClient::finishStream(const std::string& session_id) {
     if (session_id.empty()) return "";
+    {
+        // A poll still out keeps its connection until it returns
+        std::lock_guard<std::mutex> lock(poll_clients_mutex);
+        poll_clients.erase(session_id);
+    }
     if (!isHealthy()) return "";
 
     httplib::Headers headers = {
-        {"Content-Type", "application/json"}
+        {"Content-Type", "application/json"},
+        {"X-Deadline-Ms", std::to_string(REQUEST_TIMEOUT_S * 1000)}
     };
     json payload = { {"session_id", session_id} };
 
@@ -208,6 +282,23 @@ std::string WhisperClient::finishStream(const std::string& session_id) {
     return response.value("text", "");
 }
 
+bool WhisperClient::abortStream(const std::string& session_id) {
+    if (session_id.empty()) return false;
+    {
+        std::lock_guard<std::mutex> lock(poll_clients_mutex);
+        poll_clients.erase(session_id);
+    }
+
+    httplib::Headers headers = {
+        {"Content-Type", "application/json"}
+    };
+    json payload = { {"session_id", session_id} };
+
+    std::lock_guard<std::mutex> lock(client_mutex);
+    auto result = client->Post("/stream/abort", headers, payload.dump(), "application/json");
+    return result && result->status == 200;
+}
+
 bool WhisperClient::isHealthy() {
     std::lock_guard<std::mutex> lock(client_mutex);
     auto result = client->Get("/health");
@@ -1,15 +1,52 @@
 #include "whisper_service.hpp"
+#include "config.hpp"
 #include "logging.hpp"
 #include <nlohmann/json.hpp>
-#include <random>
+#include <algorithm>
 
 using json = nlohmann::json;
 
+namespace {
+
+using Clock = TranscriptionScheduler::Clock;
+
+// Time budget the client sent in X-Deadline-Ms, counted from now; no deadline without one
+Clock::time_point requestDeadline(const httplib::Request& req) {
+    if (!req.has_header("X-Deadline-Ms")) {
+        return Clock::time_point::max();
+    }
+    try {
+        const uint64_t budget_ms = std::min<uint64_t>(std::stoull(req.get_header_value("X-Deadline-Ms")), 3600 * 1000);
+        return Clock::now() + std::chrono::milliseconds(budget_ms);
+    } catch (const std::exception&) {
+        return Clock::time_point::max();
+    }
+}
+
+// Scheduling terms of a /transcribe request. Clips are only batched with others of the
+// same X-Batch-Key, and wait for them at most a twentieth of the client's time budget.
+TranscriptionOptions transcriptionOptions(const httplib::Request& req) {
+    TranscriptionOptions options;
+    options.batch_key = req.get_header_value("X-Batch-Key");
+    options.deadline = requestDeadline(req);
+    if (options.deadline != Clock::time_point::max()) {
+        options.max_batch_wait = std::chrono::duration_cast<std::chrono::milliseconds>(options.deadline - Clock::now()) / 20;
+    }
+    return options;
+}
+
+} // namespace
+
 WhisperService::WhisperService(const std::string& model_path, const std::string& host, int port)
     : host(host), port(port), running(false) {
     
     whisper = std::make_unique<WhisperSTT>(model_path);
     server = std::make_unique<httplib::Server>();
+    // Waiting transcriptions and long-polls each hold a thread; /health must still get one
+    const size_t http_threads = std::max<uint64_t>(4, config::WHISPER_HTTP_THREADS);
+    server->new_task_queue = [http_threads] { return new httplib::ThreadPool(http_threads); };
+    sessions = std::make_unique<StreamSessionStore>(*whisper, StreamingDecoderConfig::fromEnvironment(),
+                                                    StreamSessionStoreConfig::fromEnvironment());
     
     setupRoutes();
 }
@@ -24,6 +61,59 @@ void WhisperService::setupRoutes() {
         res.set_content("OK", "text/plain");
     });
 
+    // Counters for monitoring
+    server->Get("/stats", [this](const httplib::Request&, httplib::Response& res) {
+        const auto streams = sessions->metrics();
+        const auto states = whisper->poolMetrics();
+        const auto scheduler = whisper->schedulerMetrics();
+        const auto trim = whisper->trimMetrics();
+        json contexts = json::array();
+        for (const auto& bucket : whisper->contextMetrics()) {
+            contexts.push_back({
+                {"audio_ctx", bucket.audio_ctx},
+                {"decodes", bucket.decodes},
+                {"fallbacks", bucket.fallbacks},
+                {"decode_ms", bucket.decode_ms},
+                {"audio_ms", bucket.audio_ms},
+                {"audits", bucket.audits},
+                {"audit_words", bucket.audit_words},
+                {"audit_word_errors", bucket.audit_word_errors}
+            });
+        }
+        json response = {
+            {"streams", {
+                {"sessions", streams.sessions},
+                {"audio_bytes", streams.audio_bytes},
+                {"idle_bytes", streams.idle_bytes},
+                {"created", streams.created},
+                {"rejected", streams.rejected},
+                {"expired", streams.expired}
+            }},
+            {"states", {
+                {"allocated", states.allocated},
+                {"busy", states.busy},
+                {"capacity", states.capacity},
+                {"leases", states.leases},
+                {"waits", states.waits}
+            }},
+            {"scheduler", {
+                {"requests", scheduler.requests},
+                {"partials", scheduler.partials},
+                {"decodes", scheduler.decodes},
+                {"batched_clips", scheduler.batched_clips},
+                {"expired", scheduler.expired}
+            }},
+            {"audio_ctx", contexts},
+            {"trim", {
+                {"clips", trim.clips},
+                {"no_speech", trim.no_speech},
+                {"audio_ms", trim.audio_ms},
+                {"trimmed_ms", trim.trimmed_ms}
+            }}
+        };
+        res.set_content(response.dump(), "application/json");
+    });
+
     // Transcription endpoint
     server->Post("/transcribe", [this](const httplib::Request& req, httplib::Response& res) {
         if (!req.has_header("Content-Type") || req.get_header_value("Content-Type") != "audio/raw") {
@@ -40,14 +130,22 @@ void WhisperService::setupRoutes() {
             LOG_INFO("Received audio data of size: {}", audio_data.size());
             
             // Process the audio
-            std::string transcription = handleTranscription(audio_data);
+            ClipTranscript transcription = handleTranscription(audio_data, transcriptionOptions(req));
             
             // Return the result
             json response = {
-                {"text", transcription}
+                {"text", transcription.text},
+                {"speech", transcription.speech},
+                {"audio_ms", transcription.audio_ms},
+                {"trimmed_ms", transcription.trimmed_ms}
             };
             res.set_content(response.dump(), "application/json");
 
+        } catch (const DeadlineExceeded& e) {
+            LOG_WARN("Dropped transcription request: {}", e.what());
+            res.status = 504;
+            json error = {{"error", e.what()}};
+            res.set_content(error.dump(), "application/json");
         } catch (const std::exception& e) {
             LOG_ERROR("Error processing transcription request: {}", e.what());
             res.status = 500;
@@ -57,21 +155,22 @@ void WhisperService::setupRoutes() {
     });
 
     // Streaming: start session
-    server->Post("/stream/start", [this](const httplib::Request& req, httplib::Response& res) {
-        // Generate a simple random session id
-        static const char* alphabet = "0123456789abcdef";
-        std::random_device rd;
-        std::mt19937 rng(rd());
-        std::uniform_int_distribution<int> dist(0, 15);
-        std::string sid(32, '0');
-        for (char& c : sid) c = alphabet[dist(rng)];
-
-        {
-            std::lock_guard<std::mutex> lock(sessions_mutex);
-            sessions[sid] = {};
+    server->Post("/stream/start", [this](const httplib::Request&, httplib::Response& res) {
+        std::shared_ptr<StreamSession> session = sessions->create();
+        if (!session) {
+            // Over the memory budget until running sessions finish
+            const auto retry = StreamSessionStore::RETRY_AFTER;
+            res.status = 503;
+            res.set_header("Retry-After", std::to_string(retry.count()));
+            json error = {
+                {"error", "Too much stream audio buffered"},
+                {"retry_after_ms", std::chrono::duration_cast<std::chrono::milliseconds>(retry).count()}
+            };
+            res.set_content(error.dump(), "application/json");
+            return;
         }
 
-        json response = { {"session_id", sid} };
+        json response = { {"session_id", session->id} };
         res.set_content(response.dump(), "application/json");
     });
 
@@ -85,43 +184,140 @@ void WhisperService::setupRoutes() {
             return;
         }
 
-        const std::string& sid = it->second;
-
-        std::lock_guard<std::mutex> lock(sessions_mutex);
-        auto sit = sessions.find(sid);
-        if (sit == sessions.end()) {
+        std::shared_ptr<StreamSession> session = sessions->find(it->second);
+        if (!session) {
             res.status = 404;
             json error = {{"error", "Session not found"}};
             res.set_content(error.dump(), "application/json");
             return;
         }
 
-        auto& buffer = sit->second;
-        buffer.insert(buffer.end(), req.body.begin(), req.body.end());
+        // Acknowledged as soon as it is stored; the partial transcript follows on /stream/partial
+        thread_local std::vector<int16_t> samples;
+        uint64_t received = 0;
+        bool schedule = false;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            if (session->finishing) {
+                res.status = 409;
+                json error = {{"error", "Session is finishing"}};
+                res.set_content(error.dump(), "application/json");
+                return;
+            }
+            if (session->received_bytes + req.body.size() > sessions->maxSessionBytes()) {
+                res.status = 413;
+                json error = {{"error", "Stream is over its audio limit"}, {"received_bytes", session->received_bytes}};
+                res.set_content(error.dump(), "application/json");
+                return;
+            }
+            samples.clear();
+            session->ingest.push(reinterpret_cast<const uint8_t*>(req.body.data()), req.body.size(), samples);
+            session->incoming.append(samples.data(), samples.size());
+            session->received_bytes += req.body.size();
+            received = session->received_bytes;
+            if (session->decoding) {
+                session->dirty = true;
+            } else {
+                session->decoding = true;
+                schedule = true;
+            }
+        }
+        if (schedule) {
+            schedulePartial(session);
+        }
+
+        json response = { {"received_bytes", received} };
+        res.set_content(response.dump(), "application/json");
+    });
+
+    // Streaming: wait up to `wait_ms` for a partial transcript newer than version `after`
+    server->Get("/stream/partial", [this](const httplib::Request& req, httplib::Response& res) {
+        auto it = req.headers.find("X-Session-Id");
+        if (it == req.headers.end()) {
+            res.status = 400;
+            json error = {{"error", "Missing X-Session-Id header"}};
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
 
-        // Optional: provide partial transcription for real-time feedback
-        std::string partial_text;
+        uint64_t after = 0;
+        uint64_t wait_ms = 0;
         try {
-            // To avoid long blocking, only attempt partial if buffer is reasonably sized
-            if (buffer.size() >= 194000) {
-                std::vector<uint8_t> tail;
-                // Take last ~0.5s worth of 48k mono data (~48000 bytes for 16-bit)
-                size_t span = std::min<size_t>(buffer.size(), 194000);
-                tail.insert(tail.end(), buffer.end() - span, buffer.end());
-
-                std::lock_guard<std::mutex> wlock(whisper_mutex);
-                partial_text = handleTranscription(tail);
+            if (req.has_param("after")) {
+                after = std::stoull(req.get_param_value("after"));
             }
-        } catch (const std::exception& e) {
-            LOG_WARN("Partial transcription failed: {}", e.what());
+            if (req.has_param("wait_ms")) {
+                wait_ms = std::min<uint64_t>(std::stoull(req.get_param_value("wait_ms")), MAX_PARTIAL_WAIT_MS);
+            }
+        } catch (const std::exception&) {
+            res.status = 400;
+            json error = {{"error", "Invalid after or wait_ms"}};
+            res.set_content(error.dump(), "application/json");
+            return;
         }
 
-        json response = { {"partial", partial_text} };
+        std::shared_ptr<StreamSession> session = sessions->find(it->second);
+        if (!session) {
+            res.status = 404;
+            json error = {{"error", "Session not found"}};
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(session->mutex);
+        session->changed.wait_for(lock, std::chrono::milliseconds(wait_ms), [&] {
+            return session->partial_version > after || session->finishing;
+        });
+        const StreamingTranscript& transcript = session->partial;
+        std::string partial = transcript.committed;
+        if (!partial.empty() && !transcript.pending.empty()) {
+            partial += " ";
+        }
+        partial += transcript.pending;
+        json response = {
+            {"version", session->partial_version},
+            {"partial", partial},
+            {"committed", transcript.committed},
+            {"pending", transcript.pending},
+            {"audio_bytes", session->partial_bytes}
+        };
+        lock.unlock();
         res.set_content(response.dump(), "application/json");
     });
 
+    // Streaming: drop a session whose audio is not worth transcribing
+    server->Post("/stream/abort", [this](const httplib::Request& req, httplib::Response& res) {
+        std::string sid;
+        try {
+            sid = json::parse(req.body).value("session_id", "");
+        } catch (const std::exception&) {
+        }
+        if (sid.empty()) {
+            res.status = 400;
+            json error = {{"error", "Missing session_id"}};
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
+
+        std::shared_ptr<StreamSession> session = sessions->take(sid);
+        if (!session) {
+            res.status = 404;
+            json error = {{"error", "Session not found"}};
+            res.set_content(error.dump(), "application/json");
+            return;
+        }
+        // Wake long-polls; a partial still decoding frees the audio when it is done
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->finishing = true;
+        }
+        session->changed.notify_all();
+        res.set_content("{}", "application/json");
+    });
+
     // Streaming: finish and transcribe
     server->Post("/stream/finish", [this](const httplib::Request& req, httplib::Response& res) {
+        const Clock::time_point deadline = requestDeadline(req);
         try {
             auto body = json::parse(req.body);
             std::string sid = body.value("session_id", "");
@@ -132,23 +328,39 @@ void WhisperService::setupRoutes() {
                 return;
             }
 
-            std::vector<uint8_t> data;
-            {
-                std::lock_guard<std::mutex> lock(sessions_mutex);
-                auto it = sessions.find(sid);
-                if (it == sessions.end()) {
-                    res.status = 404;
-                    json error = {{"error", "Session not found"}};
-                    res.set_content(error.dump(), "application/json");
-                    return;
-                }
-                data = std::move(it->second);
-                sessions.erase(it);
+            std::shared_ptr<StreamSession> session = sessions->take(sid);
+            if (!session) {
+                res.status = 404;
+                json error = {{"error", "Session not found"}};
+                res.set_content(error.dump(), "application/json");
+                return;
             }
 
-            std::string transcription = handleTranscription(data);
+            // Take the decoder back from a partial still running; no new ones start
+            std::unique_lock<std::mutex> lock(session->mutex);
+            session->finishing = true;
+            session->changed.notify_all();
+            session->changed.wait(lock, [&] { return !session->decoding; });
+            thread_local std::vector<int16_t> samples;
+            samples.clear();
+            session->ingest.flush(samples);
+            session->incoming.append(samples.data(), samples.size());
+            AudioRope tail = std::move(session->incoming);
+            lock.unlock();
+
+            // Only the audio after the committed text is decoded again
+            session->decoder.append(std::move(tail));
+            std::string transcription = session->decoder.finish(deadline);
+            const auto& metrics = session->decoder.metrics();
+            LOG_INFO("Stream finished: {:.1f}s of audio, {:.1f}s decoded in {} passes",
+                     metrics.received_samples / 16000.0, metrics.decoded_samples / 16000.0, metrics.decodes);
             json response = { {"text", transcription} };
             res.set_content(response.dump(), "application/json");
+        } catch (const DeadlineExceeded& e) {
+            LOG_WARN("Dropped stream finish: {}", e.what());
+            res.status = 504;
+            json error = {{"error", e.what()}};
+            res.set_content(error.dump(), "application/json");
         } catch (const std::exception& e) {
             LOG_ERROR("Error finishing stream: {}", e.what());
             res.status = 500;
@@ -158,8 +370,68 @@ void WhisperService::setupRoutes() {
     });
 }
 
-std::string WhisperService::handleTranscription(const std::vector<uint8_t>& audio_data) {
-    return whisper->audioToText(audio_data);
+void WhisperService::schedulePartial(const std::shared_ptr<StreamSession>& session) {
+    try {
+        whisper->schedule([this, session](const WhisperStatePool::Lease& lease) {
+            decodePartial(session, lease);
+        });
+    } catch (const std::exception& e) {
+        LOG_WARN("Failed to schedule partial transcription: {}", e.what());
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->decoding = false;
+        }
+        session->changed.notify_all();
+    }
+}
+
+void WhisperService::decodePartial(const std::shared_ptr<StreamSession>& session, const WhisperStatePool::Lease& lease) {
+    AudioRope audio(nullptr);
+    uint64_t covered = 0;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (!session->finishing) {
+            audio = std::move(session->incoming);
+            covered = session->received_bytes;
+            session->dirty = false;
+        }
+    }
+
+    bool decoded = false;
+    StreamingTranscript transcript;
+    if (covered > 0) {
+        try {
+            session->decoder.append(std::move(audio));
+            transcript = session->decoder.update(lease);
+            decoded = true;
+        } catch (const std::exception& e) {
+            LOG_WARN("Partial transcription failed: {}", e.what());
+        }
+    }
+
+    // Chunks that came in meanwhile get one more pass, queued behind other sessions' work
+    bool again = false;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (decoded) {
+            session->partial = std::move(transcript);
+            session->partial_version++;
+            session->partial_bytes = covered;
+        }
+        again = session->dirty && !session->finishing;
+        if (!again) {
+            session->decoding = false;
+        }
+    }
+    session->changed.notify_all();
+    if (again) {
+        schedulePartial(session);
+    }
+}
+
+ClipTranscript WhisperService::handleTranscription(const std::vector<uint8_t>& audio_data,
+                                                   const TranscriptionOptions& options) {
+    return whisper->audioToText(audio_data, options);
 }
 
 void WhisperService::start() {
@@ -0,0 +1,201 @@
+#include "whisper_state_pool.hpp"
+#include "config.hpp"
+#include "logging.hpp"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Resident memory of the process, where the platform reports it
+uint64_t residentBytes() {
+#ifndef _WIN32
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    if (statm >> size >> resident) {
+        return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+#endif
+    return 0;
+}
+
+} // namespace
+
+WhisperStatePoolConfig WhisperStatePoolConfig::fromEnvironment() {
+    WhisperStatePoolConfig config;
+    config.max_states = std::max<size_t>(1, config::WHISPER_MAX_STATES);
+    config.memory_budget = config::WHISPER_STATE_MEMORY_MB * 1024 * 1024;
+    config.threads_per_state = static_cast<int>(config::WHISPER_THREADS_PER_STATE);
+    config.idle_timeout = std::chrono::seconds(config::WHISPER_STATE_IDLE_S);
+    return config;
+}
+
+int WhisperStatePool::Lease::threads() const {
+    return pool ? pool->threads_per_state : 1;
+}
+
+void WhisperStatePool::Lease::release() {
+    if (pool && state) {
+        pool->release(state);
+    }
+    pool = nullptr;
+    state = nullptr;
+}
+
+WhisperStatePool::WhisperStatePool(whisper_context* ctx, const WhisperStatePoolConfig& config)
+    : ctx(ctx), config(config),
+      threads_per_state(config.threads_per_state > 0
+          ? config.threads_per_state
+          : std::max(1, static_cast<int>(std::thread::hardware_concurrency() / config.max_states))),
+      capacity(config.max_states) {
+    // The first state is created up front, so a model that cannot decode at all fails at startup
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        whisper_state* state = createLocked(lock);
+        if (state == nullptr) {
+            throw std::runtime_error("Failed to initialize Whisper state");
+        }
+        idle.push_back({state, std::chrono::steady_clock::now()});
+    }
+    reaper = std::thread(&WhisperStatePool::reaperLoop, this);
+
+    LOG_INFO("Whisper state pool: up to {} states with {} threads each", capacity, threads_per_state);
+}
+
+WhisperStatePool::~WhisperStatePool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    reaper_wake.notify_all();
+    if (reaper.joinable()) {
+        reaper.join();
+    }
+    // Leases must not outlive the pool, so every state is idle by now
+    for (const auto& entry : idle) {
+        whisper_free_state(entry.state);
+    }
+}
+
+WhisperStatePool::Lease WhisperStatePool::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    stats.leases++;
+    bool waited = false;
+    while (true) {
+        if (whisper_state* state = takeLocked(lock)) {
+            if (waited) {
+                stats.waits++;
+            }
+            return Lease(this, state);
+        }
+        if (allocated + creating == 0) {
+            throw std::runtime_error("No Whisper state can be created");
+        }
+        waited = true;
+        available.wait(lock);
+    }
+}
+
+WhisperStatePool::Lease WhisperStatePool::tryAcquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    whisper_state* state = takeLocked(lock);
+    if (state != nullptr) {
+        stats.leases++;
+    }
+    return state ? Lease(this, state) : Lease();
+}
+
+WhisperStatePool::Metrics WhisperStatePool::metrics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Metrics metrics = stats;
+    metrics.allocated = allocated;
+    metrics.busy = allocated - idle.size();
+    metrics.capacity = capacity;
+    metrics.state_bytes = state_bytes;
+    return metrics;
+}
+
+whisper_state* WhisperStatePool::takeLocked(std::unique_lock<std::mutex>& lock) {
+    if (!idle.empty()) {
+        whisper_state* state = idle.back().state;
+        idle.pop_back();
+        return state;
+    }
+    if (allocated + creating < capacity) {
+        return createLocked(lock);
+    }
+    return nullptr;
+}
+
+whisper_state* WhisperStatePool::createLocked(std::unique_lock<std::mutex>& lock) {
+    // Creating a state allocates hundreds of megabytes; others may lease meanwhile
+    creating++;
+    const bool measure = state_bytes == 0 && creating == 1;
+    lock.unlock();
+    const uint64_t before = measure ? residentBytes() : 0;
+    whisper_state* state = whisper_init_state(ctx);
+    const uint64_t after = measure ? residentBytes() : 0;
+    lock.lock();
+    creating--;
+
+    if (state == nullptr) {
+        // Out of memory most likely; stay at the states we have
+        capacity = std::max<size_t>(allocated, 1);
+        LOG_WARN("Failed to create another Whisper state, keeping the pool at {}", allocated);
+        available.notify_all();
+        return nullptr;
+    }
+    allocated++;
+
+    if (measure && after > before) {
+        state_bytes = after - before;
+        capacity = std::clamp<size_t>(static_cast<size_t>(config.memory_budget / state_bytes), 1, config.max_states);
+        LOG_INFO("Whisper state uses {} MB, the memory budget allows {} states", state_bytes / (1024 * 1024), capacity);
+    }
+    return state;
+}
+
+void WhisperStatePool::release(whisper_state* state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        idle.push_back({state, std::chrono::steady_clock::now()});
+    }
+    available.notify_one();
+}
+
+void WhisperStatePool::reaperLoop() {
+    const auto period = std::max<std::chrono::steady_clock::duration>(config.idle_timeout / 4, std::chrono::seconds(1));
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        reaper_wake.wait_for(lock, period);
+        if (stopping) {
+            break;
+        }
+
+        // Oldest idle states are at the front; one state always stays
+        const auto cutoff = std::chrono::steady_clock::now() - config.idle_timeout;
+        std::vector<whisper_state*> expired;
+        while (!idle.empty() && allocated - expired.size() > 1 && idle.front().since < cutoff) {
+            expired.push_back(idle.front().state);
+            idle.erase(idle.begin());
+        }
+        if (expired.empty()) {
+            continue;
+        }
+        allocated -= expired.size();
+        stats.reclaimed += expired.size();
+
+        lock.unlock();
+        for (whisper_state* state : expired) {
+            whisper_free_state(state);
+        }
+        LOG_INFO("Freed {} idle Whisper states", expired.size());
+        lock.lock();
+        // Room to grow again
+        available.notify_all();
+    }
+}
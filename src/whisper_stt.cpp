@@ -1,12 +1,16 @@
 #include "whisper_stt.hpp"
 #include "logging.hpp"
 #include "audio_utils.hpp"
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <thread>
 #include <chrono>
 
-WhisperSTT::WhisperSTT(const std::string& model_path) {
+WhisperSTT::WhisperSTT(const std::string& model_path)
+    : context_policy(AudioContextConfig::fromEnvironment()),
+      trimmer(audio_utils::SpeechTrimConfig::fromEnvironment(), audio_utils::VadConfig::fromEnvironment(16000)),
+      tap(audio_utils::AudioTapConfig::fromEnvironment()) {
     // Initialize whisper context with default parameters
     struct whisper_context_params params = whisper_context_default_params();
     params.use_gpu = true;  // Enable GPU acceleration if available
@@ -16,90 +20,178 @@ WhisperSTT::WhisperSTT(const std::string& model_path) {
         throw std::runtime_error("Failed to initialize Whisper context from model: " + model_path);
     }
     
-    // Initialize state
-    state = whisper_init_state(ctx);
-    if (!state) {
+    // States are created on demand as requests overlap
+    WhisperStatePoolConfig pool_config = WhisperStatePoolConfig::fromEnvironment();
+    try {
+        states = std::make_unique<WhisperStatePool>(ctx, pool_config);
+    } catch (...) {
         whisper_free(ctx);
-        throw std::runtime_error("Failed to initialize Whisper state");
+        throw;
     }
     
+    // One worker per state the pool may hold
+    scheduler = std::make_unique<TranscriptionScheduler>(*this, TranscriptionSchedulerConfig::fromEnvironment(
+        pool_config.max_states, static_cast<size_t>(states->threadsPerState())));
+    
     LOG_INFO("Initialized Whisper STT with model: {}", model_path);
 }
 
 WhisperSTT::~WhisperSTT() {
-    if (state) {
-        whisper_free_state(state);
-    }
+    // Workers hold leases on the states
+    scheduler.reset();
+    states.reset();
     if (ctx) {
         whisper_free(ctx);
     }
 }
 
-std::vector<float> WhisperSTT::convertPCMToFloat(const std::vector<uint8_t>& audio_data) {
-    // Convert 16-bit PCM to float (assumes mono already)
-    const int16_t* pcm = reinterpret_cast<const int16_t*>(audio_data.data());
-    size_t num_samples = audio_data.size() / sizeof(int16_t);
-    
-    std::vector<float> samples(num_samples);
-    for (size_t i = 0; i < num_samples; i++) {
-        samples[i] = static_cast<float>(pcm[i]) / 32768.0f;
+namespace {
+
+whisper_full_params defaultParams(const WhisperStatePool::Lease& lease) {
+    struct whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    params.print_progress = false;
+    params.print_special = false;
+    params.print_realtime = false;
+    params.print_timestamps = false;
+    params.translate = false;
+    params.language = "en";  // Force English
+    params.n_threads = lease.threads();  // The state's share of the cores
+    return params;
+}
+
+// Whisper timestamps are in 10ms steps
+constexpr int64_t SAMPLES_PER_TIMESTAMP = 160;
+
+// Clips this long hold speech often enough that hearing nothing is suspect
+constexpr size_t MIN_SPEECH_SAMPLES = 16000;
+// Timestamps may overshoot the audio by this much before a decode counts as run off
+constexpr int64_t TIMESTAMP_SLACK_SAMPLES = 16000;
+
+std::string segmentText(whisper_state* state) {
+    std::string text;
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    for (int i = 0; i < n_segments; i++) {
+        if (const char* segment = whisper_full_get_segment_text_from_state(state, i)) {
+            text += segment;
+        }
+    }
+    return text;
+}
+
+// How a decode with too little encoder context goes wrong: it hears nothing, runs
+// past the end of the audio, or loops on a phrase
+bool looksTruncated(whisper_state* state, size_t samples) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    if (n_segments == 0) {
+        return samples >= MIN_SPEECH_SAMPLES;
+    }
+    std::string previous;
+    int repeats = 0;
+    for (int i = 0; i < n_segments; i++) {
+        if (whisper_full_get_segment_t1_from_state(state, i) * SAMPLES_PER_TIMESTAMP >
+            static_cast<int64_t>(samples) + TIMESTAMP_SLACK_SAMPLES) {
+            return true;
+        }
+        const char* text = whisper_full_get_segment_text_from_state(state, i);
+        const std::string current = text ? text : "";
+        repeats = !current.empty() && current == previous ? repeats + 1 : 0;
+        if (repeats >= 2) {
+            return true;
+        }
+        previous = current;
+    }
+    return false;
+}
+
+} // namespace
+
+bool WhisperSTT::run(const WhisperStatePool::Lease& lease, whisper_full_params params, const AudioClip& clip) {
+    whisper_state* state = lease.get();
+    const int audio_ctx = context_policy.select(clip.count);
+    const auto started = std::chrono::steady_clock::now();
+
+    params.audio_ctx = audio_ctx;
+    bool ok = whisper_full_with_state(ctx, state, params, clip.samples, static_cast<int>(clip.count)) == 0;
+    bool fell_back = false;
+    if (audio_ctx > 0 && (!ok || looksTruncated(state, clip.count))) {
+        LOG_DEBUG("Decode of {} samples with audio context {} looks truncated, retrying with the full context",
+                  clip.count, audio_ctx);
+        params.audio_ctx = 0;
+        ok = whisper_full_with_state(ctx, state, params, clip.samples, static_cast<int>(clip.count)) == 0;
+        fell_back = true;
+    }
+    context_policy.record(audio_ctx, clip.count,
+                          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started),
+                          fell_back);
+
+    if (ok && audio_ctx > 0 && !fell_back && context_policy.shouldAudit()) {
+        // The caller gets the full-context result
+        const std::string reduced = segmentText(state);
+        params.audio_ctx = 0;
+        ok = whisper_full_with_state(ctx, state, params, clip.samples, static_cast<int>(clip.count)) == 0;
+        if (ok) {
+            context_policy.recordAudit(audio_ctx, reduced, segmentText(state));
+        }
     }
-    return samples;
+    return ok;
 }
 
-std::string WhisperSTT::audioToText(const std::vector<uint8_t>& audio_data) {
+ClipTranscript WhisperSTT::audioToText(const std::vector<uint8_t>& audio_data, const TranscriptionOptions& options) {
+    ClipTranscript result;
     if (audio_data.empty()) {
         LOG_WARN("Empty audio data provided to Whisper STT");
-        return "";
+        return result;
     }
     
-    // Save the original 48kHz stereo PCM audio data to a WAV file
-    std::string original_file = "original_audio_48khz_stereo.wav";
-    LOG_INFO("Saving original 48kHz stereo PCM audio data to WAV file: {}", original_file);
-    audio_utils::savePCMToWav(original_file, audio_data, 48000, 2);
-    
-    // Convert stereo to mono
-    LOG_INFO("Converting stereo audio to mono");
-    std::vector<uint8_t> mono_audio = audio_utils::stereoToMono(audio_data);
-    
-    // Save the mono 48kHz PCM audio data to a WAV file
-    std::string mono_file = "mono_audio_48khz.wav";
-    LOG_INFO("Saving mono 48kHz PCM audio data to WAV file: {}", mono_file);
-    audio_utils::savePCMToWav(mono_file, mono_audio, 48000, 1);
-    
-    // Downsample from 48kHz to 16kHz
-    LOG_INFO("Downsampling mono audio from 48kHz to 16kHz");
-    std::vector<uint8_t> downsampled_audio = audio_utils::downsamplePCM(mono_audio, 48000, 16000);
-    
-    // Save the downsampled 16kHz mono PCM audio data to a WAV file
-    std::string downsampled_file = "downsampled_audio_16khz_mono.wav";
-    LOG_INFO("Saving downsampled 16kHz mono PCM audio data to WAV file: {}", downsampled_file);
-    audio_utils::savePCMToWav(downsampled_file, downsampled_audio, 16000, 1);
-    
-    // Convert downsampled PCM to float samples
-    std::vector<float> samples = convertPCMToFloat(downsampled_audio);
+    auto capture = tap.begin();
+    capture.add(audio_utils::TapStage::Input, audio_data, 48000, 2);
     
-    // Save the converted float samples to a WAV file
-    std::string converted_file = "converted_audio_16khz_mono.wav";
-    LOG_INFO("Saving converted float samples to WAV file: {}", converted_file);
-    audio_utils::saveFloatToWav(converted_file, samples, 16000, 1);
-    
-    LOG_INFO("Created audio files for comparison: {}, {}, {}, and {}", 
-             original_file, mono_file, downsampled_file, converted_file);
+    // Convert to 16kHz mono float in a single pass, into a buffer each thread reuses
+    thread_local std::vector<float> samples;
+    ingest.run(audio_data, samples);
+
+    // Silence is not worth an encoder run, and Whisper tends to hear words in noise
+    const audio_utils::SpeechSpan speech = trimmer.find(samples.data(), samples.size());
+    result.audio_ms = samples.size() / 16;
+    result.trimmed_ms = (samples.size() - speech.size()) / 16;
+    result.speech = !speech.empty();
+    trimmed_clips++;
+    trim_audio_ms += result.audio_ms;
+    trimmed_ms += result.trimmed_ms;
+    if (!result.speech) {
+        no_speech_clips++;
+        LOG_INFO("No speech in {}ms of audio, not transcribing", result.audio_ms);
+        capture.commit("");
+        return result;
+    }
+    if (result.trimmed_ms > 0) {
+        LOG_DEBUG("Trimmed {}ms of silence from {}ms of audio", result.trimmed_ms, result.audio_ms);
+    }
+
+    const AudioClip clip{samples.data() + speech.begin, speech.size()};
+    capture.add(audio_utils::TapStage::WhisperInput, clip.samples, clip.count, 16000);
     
-    // Set up parameters for full processing
-    struct whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-    params.print_progress = false;
-    params.print_special = false;
-    params.print_realtime = false;
-    params.print_timestamps = false;
-    params.translate = false;
-    params.language = "en";  // Force English
-    params.n_threads = 4;    // Use 4 threads for processing
+    result.text = scheduler->transcribe(clip, options);
+    capture.commit(result.text);
+    return result;
+}
+
+WhisperSTT::TrimMetrics WhisperSTT::trimMetrics() const {
+    TrimMetrics metrics;
+    metrics.clips = trimmed_clips;
+    metrics.no_speech = no_speech_clips;
+    metrics.audio_ms = trim_audio_ms;
+    metrics.trimmed_ms = trimmed_ms;
+    return metrics;
+}
+
+std::string WhisperSTT::decode(const WhisperStatePool::Lease& lease, const AudioClip& clip) {
+    whisper_state* state = lease.get();
+    whisper_full_params params = defaultParams(lease);
     
     // Process the audio
-    LOG_INFO("Processing {} samples with Whisper", samples.size());
-    if (whisper_full_with_state(ctx, state, params, samples.data(), samples.size()) != 0) {
+    LOG_INFO("Processing {} samples with Whisper", clip.count);
+    if (!run(lease, params, clip)) {
         LOG_ERROR("Failed to process audio with Whisper");
         return "";
     }
@@ -125,4 +217,118 @@ std::string WhisperSTT::audioToText(const std::vector<uint8_t>& audio_data) {
     
     LOG_INFO("Whisper transcription complete: {} segments, {} characters", n_segments, result.length());
     return result;
-}
\ No newline at end of file
+}
+
+std::vector<std::string> WhisperSTT::decodePacked(const WhisperStatePool::Lease& lease, const std::vector<AudioClip>& clips,
+                                                  std::vector<bool>& ambiguous) {
+    // Clips back to back, each followed by silence
+    thread_local std::vector<float> packed;
+    std::vector<std::pair<int64_t, int64_t>> spans;
+    packed.clear();
+    for (const auto& clip : clips) {
+        spans.emplace_back(static_cast<int64_t>(packed.size()), static_cast<int64_t>(packed.size() + clip.count));
+        packed.insert(packed.end(), clip.samples, clip.samples + clip.count);
+        packed.insert(packed.end(), PACKED_GAP_SAMPLES, 0.0f);
+    }
+
+    whisper_state* state = lease.get();
+    whisper_full_params params = defaultParams(lease);
+    params.no_context = true;   // One clip's text must not steer the next
+
+    std::vector<std::string> texts(clips.size());
+    ambiguous.assign(clips.size(), false);
+    LOG_INFO("Processing {} clips ({} samples) in one Whisper run", clips.size(), packed.size());
+    if (!run(lease, params, AudioClip{packed.data(), packed.size()})) {
+        LOG_ERROR("Failed to process packed audio with Whisper");
+        ambiguous.assign(clips.size(), true);
+        return texts;
+    }
+
+    // A segment is a clip's only if it lies within the clip's audio, give or take the
+    // timestamps' drift; anything reaching further into the silence could be another's
+    const int64_t drift = static_cast<int64_t>(PACKED_GAP_SAMPLES / 4);
+    const int64_t half_gap = static_cast<int64_t>(PACKED_GAP_SAMPLES / 2);
+    auto owner = [&](int64_t sample) {
+        size_t index = 0;
+        while (index + 1 < spans.size() && sample >= spans[index].second + half_gap) {
+            index++;
+        }
+        return index;
+    };
+
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    for (int i = 0; i < n_segments; i++) {
+        const char* text = whisper_full_get_segment_text_from_state(state, i);
+        if (!text) {
+            continue;
+        }
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i) * SAMPLES_PER_TIMESTAMP;
+        const int64_t t1 = std::max<int64_t>(whisper_full_get_segment_t1_from_state(state, i) * SAMPLES_PER_TIMESTAMP - 1, t0);
+        const size_t first = owner(t0);
+        const size_t last = owner(t1);
+        if (first != last || t0 < spans[first].first - drift || t1 > spans[first].second + drift) {
+            for (size_t clip = first; clip <= last; clip++) {
+                ambiguous[clip] = true;
+            }
+            continue;
+        }
+        if (!texts[first].empty()) {
+            texts[first] += " ";
+        }
+        texts[first] += text;
+    }
+    return texts;
+}
+
+std::vector<TimedWord> WhisperSTT::transcribeWords(const AudioClip& clip, const std::vector<whisper_token>& prompt,
+                                                   TranscriptionScheduler::Clock::time_point deadline) {
+    std::vector<TimedWord> words;
+    scheduler->execute([&](const WhisperStatePool::Lease& lease) {
+        words = decodeWords(lease, clip, prompt);
+    }, deadline);
+    return words;
+}
+
+std::vector<whisper_token> WhisperSTT::tokenize(const std::string& text) const {
+    std::vector<whisper_token> tokens(text.size() + 1);
+    int count = whisper_tokenize(ctx, text.c_str(), tokens.data(), static_cast<int>(tokens.size()));
+    if (count < 0) {
+        // Negative: the number of tokens needed
+        tokens.resize(static_cast<size_t>(-count));
+        count = whisper_tokenize(ctx, text.c_str(), tokens.data(), static_cast<int>(tokens.size()));
+    }
+    tokens.resize(static_cast<size_t>(std::max(count, 0)));
+    return tokens;
+}
+
+std::vector<TimedWord> WhisperSTT::decodeWords(const WhisperStatePool::Lease& lease, const AudioClip& clip,
+                                               const std::vector<whisper_token>& prompt) {
+    whisper_state* state = lease.get();
+    whisper_full_params params = defaultParams(lease);
+    params.prompt_tokens = prompt.empty() ? nullptr : prompt.data();
+    params.prompt_n_tokens = static_cast<int>(prompt.size());
+    // One segment per word, timed from the token timestamps
+    params.token_timestamps = true;
+    params.max_len = 1;
+    params.split_on_word = true;
+
+    std::vector<TimedWord> words;
+    if (!run(lease, params, clip)) {
+        LOG_ERROR("Failed to process streamed audio with Whisper");
+        return words;
+    }
+
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    for (int i = 0; i < n_segments; i++) {
+        const char* text = whisper_full_get_segment_text_from_state(state, i);
+        if (!text || !*text) {
+            continue;
+        }
+        TimedWord word;
+        word.text = text;
+        word.start = whisper_full_get_segment_t0_from_state(state, i) * SAMPLES_PER_TIMESTAMP;
+        word.end = whisper_full_get_segment_t1_from_state(state, i) * SAMPLES_PER_TIMESTAMP;
+        words.push_back(std::move(word));
+    }
+    return words;
+}